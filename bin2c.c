@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #ifdef _WIN32
 #include <fcntl.h>
@@ -17,24 +18,11 @@
 #include "lzwlib.h"
 
 #define BYTES_PER_LINE  16
+#define TENSOR_HEADER   12      // version, checksum and dimensions (see struct tensor_header in skipper.h)
 
-int main (int argc, char **argv)
+static void print_array (const char *name, const unsigned char *buffer, int num_bytes)
 {
-    int num_bytes = 0, alloced_bytes = 0, ch;
-    unsigned char *buffer = NULL;
-
-#ifdef _WIN32
-    setmode (fileno (stdin), O_BINARY);
-#endif
-
-    while ((ch = getchar ()) != EOF) {
-        if (num_bytes == alloced_bytes)
-            buffer = realloc (buffer, alloced_bytes += 65536);
-
-        buffer [num_bytes++] = ch;
-    }
-
-    printf ("static unsigned char %s [%d] = {\n", argc == 2 ? argv [1] : "array", num_bytes);
+    printf ("static unsigned char %s [%d] = {\n", name, num_bytes);
 
     for (int i = 0; i < num_bytes; i += BYTES_PER_LINE) {
         char string [256] = { 0 };
@@ -52,6 +40,105 @@ int main (int argc, char **argv)
     }
 
     printf ("};\n");
+}
+
+static unsigned char *read_all (FILE *file, int *num_bytes)
+{
+    int alloced_bytes = 0, ch;
+    unsigned char *buffer = NULL;
+
+    *num_bytes = 0;
+
+    while ((ch = getc (file)) != EOF) {
+        if (*num_bytes == alloced_bytes)
+            buffer = realloc (buffer, alloced_bytes += 65536);
+
+        buffer [(*num_bytes)++] = ch;
+    }
+
+    return buffer;
+}
+
+static uint32_t read_le32 (const unsigned char *ptr)
+{
+    return ptr [0] | ptr [1] << 8 | ptr [2] << 16 | (uint32_t) ptr [3] << 24;
+}
+
+// With -r, write a registry of compressed tensors to embed in the library, from name=file pairs
+// (see tensors.h and skipper_find_tensor() in skipperlib.c). The name, checksum and format of
+// each are taken from the tensor file at build time, so nothing is decompressed until it's used.
+
+static int write_registry (int num_tensors, char **args)
+{
+    uint32_t *checksums = calloc (num_tensors + 1, sizeof (uint32_t)), *versions = calloc (num_tensors + 1, sizeof (uint32_t));
+
+    printf ("// generated by bin2c -r, do not edit\n\n");
+
+    for (int i = 0; i < num_tensors; ++i) {
+        char *filename = strchr (args [i], '='), array_name [32];
+        unsigned char *buffer;
+        FILE *file;
+        int num_bytes;
+
+        if (!filename || filename == args [i] || filename - args [i] > 31) {
+            fprintf (stderr, "bin2c: registry entries must be name=file (with names up to 31 chars)\n");
+            return 1;
+        }
+
+        *filename++ = 0;
+
+        if (!(file = fopen (filename, "rb"))) {
+            fprintf (stderr, "bin2c: can't open \"%s\" for reading!\n", filename);
+            return 1;
+        }
+
+        buffer = read_all (file, &num_bytes);
+        fclose (file);
+
+        if (num_bytes < TENSOR_HEADER) {
+            fprintf (stderr, "bin2c: \"%s\" is not a tensor!\n", filename);
+            return 1;
+        }
+
+        versions [i] = read_le32 (buffer);
+        checksums [i] = read_le32 (buffer + 4);
+        sprintf (array_name, "registered_tensor_%d", i);
+        print_array (array_name, buffer, num_bytes);
+        printf ("\n");
+        free (buffer);
+    }
+
+    printf ("#define REGISTERED_TENSORS %d\n", num_tensors);
+
+    if (num_tensors) {
+        printf ("\nstatic const struct registered_tensor registered_tensors [] = {\n");
+
+        for (int i = 0; i < num_tensors; ++i)
+            printf ("    { \"%s\", %uU, %u, registered_tensor_%d, sizeof (registered_tensor_%d) },\n",
+                args [i], checksums [i], versions [i], i, i);
+
+        printf ("};\n");
+    }
+
+    free (checksums);
+    free (versions);
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    unsigned char *buffer;
+    int num_bytes;
+
+    if (argc >= 2 && !strcmp (argv [1], "-r"))
+        return write_registry (argc - 2, argv + 2);
+
+#ifdef _WIN32
+    setmode (fileno (stdin), O_BINARY);
+#endif
+
+    buffer = read_all (stdin, &num_bytes);
+    print_array (argc == 2 ? argv [1] : "array", buffer, num_bytes);
     free (buffer);
     return 0;
 }
@@ -0,0 +1,377 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// catalog.c
+
+#define _DEFAULT_SOURCE         // for timegm()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "catalog.h"
+
+// Append a single program record (with its segments) to the catalog, creating the file if needed.
+// The file is locked (where flock() is available) around the header check and the append, so that
+// two runs creating the same catalog don't both write a header, and the record is written with a
+// single fwrite() to an append-mode stream so that concurrent runs writing to the same catalog
+// don't interleave their records. Returns 0 on success.
+
+int catalog_append (const char *filename, const struct catalog_program *program, const struct catalog_segment *segments)
+{
+    size_t record_size = sizeof (*program) + program->num_segments * sizeof (*segments);
+    unsigned char *record = malloc (record_size);
+    FILE *file = fopen (filename, "ab");
+    int result = 1;
+
+    if (!file || !record) {
+        fprintf (stderr, "can't open catalog file %s for append!\n", filename);
+        free (record);
+        if (file) fclose (file);
+        return 1;
+    }
+
+    memcpy (record, program, sizeof (*program));
+    memcpy (record + sizeof (*program), segments, program->num_segments * sizeof (*segments));
+
+#ifndef _WIN32
+    if (flock (fileno (file), LOCK_EX))
+        goto done;
+#endif
+
+    fseek (file, 0, SEEK_END);
+
+    if (ftell (file) == 0) {
+        struct catalog_header header;
+
+        memcpy (header.magic, CATALOG_MAGIC, sizeof (header.magic));
+        header.version = CATALOG_VERSION;
+
+        if (fwrite (&header, sizeof (header), 1, file) != 1)
+            goto done;
+    }
+
+    if (fwrite (record, record_size, 1, file) == 1 && !fflush (file))
+        result = 0;
+
+done:
+    if (result)
+        fprintf (stderr, "can't write to catalog file %s!\n", filename);
+
+    fclose (file);      // also releases the lock
+    free (record);
+    return result;
+}
+
+// Open a catalog for reading, memory mapped if possible, otherwise read into memory. Returns 0 on
+// success (an empty catalog is not an error, but a catalog with a bad header is).
+
+int catalog_open (const char *filename, CatalogView *view)
+{
+    const struct catalog_header *header;
+
+    memset (view, 0, sizeof (*view));
+
+#ifndef _WIN32
+    int fd = open (filename, O_RDONLY);
+    struct stat statbuf;
+
+    if (fd < 0 || fstat (fd, &statbuf)) {
+        fprintf (stderr, "can't open catalog file %s!\n", filename);
+        if (fd >= 0) close (fd);
+        return 1;
+    }
+
+    view->size = statbuf.st_size;
+
+    if (view->size) {
+        void *data = mmap (NULL, view->size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (data == MAP_FAILED) {
+            fprintf (stderr, "can't map catalog file %s!\n", filename);
+            close (fd);
+            return 1;
+        }
+
+        view->data = data;
+        view->mapped = 1;
+    }
+
+    close (fd);
+#else
+    FILE *file = fopen (filename, "rb");
+    unsigned char *data;
+    long size;
+
+    if (!file || fseek (file, 0, SEEK_END) || (size = ftell (file)) < 0) {
+        fprintf (stderr, "can't open catalog file %s!\n", filename);
+        if (file) fclose (file);
+        return 1;
+    }
+
+    rewind (file);
+
+    if (size && (!(data = malloc (size)) || fread (data, 1, size, file) != (size_t) size)) {
+        fprintf (stderr, "can't read catalog file %s!\n", filename);
+        fclose (file);
+        return 1;
+    }
+
+    if (size) {
+        view->data = data;
+        view->size = size;
+    }
+
+    fclose (file);
+#endif
+
+    header = (const struct catalog_header *) view->data;
+
+    if (view->size && (view->size < sizeof (*header) || memcmp (header->magic, CATALOG_MAGIC, sizeof (header->magic)) ||
+        header->version != CATALOG_VERSION)) {
+            fprintf (stderr, "%s is not a valid catalog file!\n", filename);
+            catalog_close (view);
+            return 1;
+    }
+
+    return 0;
+}
+
+void catalog_close (CatalogView *view)
+{
+#ifndef _WIN32
+    if (view->mapped)
+        munmap ((void *) view->data, view->size);
+    else
+#endif
+        free ((void *) view->data);
+
+    memset (view, 0, sizeof (*view));
+}
+
+// Return the program record at the given offset, or NULL if it (or its segment array) would extend
+// past the end of the catalog (which can happen legitimately if another run is appending) or the
+// offset isn't aligned (which can only come from a bad index).
+
+const struct catalog_program *catalog_program_at (const CatalogView *view, uint64_t offset)
+{
+    const struct catalog_program *program;
+
+    if (offset < sizeof (struct catalog_header) || (offset & 7) || offset + sizeof (*program) > view->size)
+        return NULL;
+
+    program = (const struct catalog_program *) (view->data + offset);
+
+    if (offset + sizeof (*program) + (uint64_t) program->num_segments * sizeof (struct catalog_segment) > view->size)
+        return NULL;
+
+    return program;
+}
+
+static int compare_entries (const void *a, const void *b)
+{
+    const struct catalog_index_entry *entry_a = a, *entry_b = b;
+    int result = strncmp (entry_a->station, entry_b->station, CATALOG_STATION_LEN);
+
+    if (!result)
+        result = (entry_a->start_time > entry_b->start_time) - (entry_a->start_time < entry_b->start_time);
+
+    if (!result)
+        result = (entry_a->offset > entry_b->offset) - (entry_a->offset < entry_b->offset);
+
+    return result;
+}
+
+// Load the index for the catalog, sorted by station and then start time. If the index is missing,
+// invalid, or doesn't cover the whole catalog then the missing records are added and the index file
+// is replaced (failure to write it is only a warning because the loaded index is still good).
+// Returns 0 on success.
+
+int catalog_load_index (const char *filename, const CatalogView *view, CatalogIndex *index)
+{
+    char *index_filename = malloc (strlen (filename) + 5);
+    struct catalog_index_header header;
+    uint64_t offset, max_entries = 0;
+    FILE *file;
+
+    memset (index, 0, sizeof (*index));
+
+    if (!index_filename)
+        return 1;
+
+    strcat (strcpy (index_filename, filename), ".idx");
+
+    if ((file = fopen (index_filename, "rb"))) {
+        if (fread (&header, sizeof (header), 1, file) == 1 && !memcmp (header.magic, CATALOG_INDEX_MAGIC, sizeof (header.magic)) &&
+            header.version == CATALOG_VERSION && header.catalog_size <= view->size && header.num_entries <= view->size / sizeof (struct catalog_program) &&
+            (index->entries = malloc ((header.num_entries + 1) * sizeof (*index->entries))) &&
+            fread (index->entries, sizeof (*index->entries), header.num_entries, file) == header.num_entries) {
+                index->num_entries = max_entries = header.num_entries;
+                index->max_duration_ms = header.max_duration_ms;
+                offset = header.catalog_size;
+        }
+        else
+            catalog_free_index (index);
+
+        fclose (file);
+    }
+
+    if (!index->entries)
+        offset = sizeof (struct catalog_header);
+
+    if (offset < view->size) {
+        const struct catalog_program *program;
+
+        while ((program = catalog_program_at (view, offset))) {
+            struct catalog_index_entry *entry;
+
+            if (index->num_entries == max_entries) {
+                struct catalog_index_entry *new_entries;
+
+                max_entries = max_entries ? max_entries * 2 : 256;
+                new_entries = realloc (index->entries, max_entries * sizeof (*new_entries));
+
+                if (!new_entries) {
+                    fprintf (stderr, "out of memory indexing catalog!\n");
+                    catalog_free_index (index);
+                    free (index_filename);
+                    return 1;
+                }
+
+                index->entries = new_entries;
+            }
+
+            entry = index->entries + index->num_entries++;
+            memcpy (entry->station, program->station, CATALOG_STATION_LEN);
+            entry->start_time = program->start_time;
+            entry->offset = offset;
+
+            if (program->duration_ms > index->max_duration_ms)
+                index->max_duration_ms = program->duration_ms;
+
+            offset += sizeof (*program) + program->num_segments * sizeof (struct catalog_segment);
+        }
+
+        qsort (index->entries, index->num_entries, sizeof (*index->entries), compare_entries);
+
+        memset (&header, 0, sizeof (header));
+        memcpy (header.magic, CATALOG_INDEX_MAGIC, sizeof (header.magic));
+        header.version = CATALOG_VERSION;
+        header.catalog_size = offset;
+        header.num_entries = index->num_entries;
+        header.max_duration_ms = index->max_duration_ms;
+
+        // the index is written to a temporary file that's then renamed over the old one, so that a
+        // reader (or a concurrent rewrite) never sees a partially written index
+
+        char *temp_filename = malloc (strlen (index_filename) + 16);
+        int written = 0;
+
+        if (temp_filename) {
+#ifndef _WIN32
+            sprintf (temp_filename, "%s.%d", index_filename, (int) getpid ());
+#else
+            strcat (strcpy (temp_filename, index_filename), ".tmp");
+#endif
+            if ((file = fopen (temp_filename, "wb"))) {
+                written = fwrite (&header, sizeof (header), 1, file) == 1 &&
+                    fwrite (index->entries, sizeof (*index->entries), index->num_entries, file) == index->num_entries;
+
+                if (fclose (file))
+                    written = 0;
+#ifdef _WIN32
+                if (written)
+                    remove (index_filename);    // rename() doesn't replace an existing file on Windows
+#endif
+                if (!written || rename (temp_filename, index_filename)) {
+                    remove (temp_filename);
+                    written = 0;
+                }
+            }
+
+            free (temp_filename);
+        }
+
+        if (!written)
+            fprintf (stderr, "warning: can't write catalog index file %s\n", index_filename);
+    }
+
+    free (index_filename);
+    return 0;
+}
+
+void catalog_free_index (CatalogIndex *index)
+{
+    free (index->entries);
+    memset (index, 0, sizeof (*index));
+}
+
+// Parse a time as either seconds since the UNIX epoch or as YYYY-MM-DD[THH:MM[:SS]] (UTC, and the
+// 'T' may also be a space). Returns 0 on success.
+
+int catalog_parse_time (const char *string, int64_t *time_value)
+{
+    int year, month, day, hour = 0, minute = 0, second = 0, chars = 0;
+    const char *cp = string;
+    struct tm tm;
+
+    while (isdigit ((unsigned char) *cp))
+        cp++;
+
+    if (cp != string && !*cp) {
+        *time_value = strtoll (string, NULL, 10);
+        return 0;
+    }
+
+    if (sscanf (string, "%d-%d-%d%n", &year, &month, &day, &chars) != 3)
+        return 1;
+
+    cp = string + chars;
+
+    if (*cp == 'T' || *cp == 't' || *cp == ' ') {
+        if (sscanf (++cp, "%d:%d%n", &hour, &minute, &chars) != 2)
+            return 1;
+
+        cp += chars;
+
+        if (*cp == ':') {
+            if (sscanf (++cp, "%d%n", &second, &chars) != 1)
+                return 1;
+
+            cp += chars;
+        }
+    }
+
+    if (*cp || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+        return 1;
+
+    memset (&tm, 0, sizeof (tm));
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = second;
+
+#ifdef _WIN32
+    *time_value = _mkgmtime (&tm);
+#else
+    *time_value = timegm (&tm);
+#endif
+    return 0;
+}
@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// catalog.h
+
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#include <stdint.h>
+
+/* The segment catalog is an append-only file shared by any number of runs. It
+ * starts with a catalog_header and then has one variable-length record per
+ * program: a catalog_program followed by its catalog_segment array. All the
+ * structures are fixed-size and a multiple of 8 bytes long (so every record,
+ * and its int64_t start time, stays 8-byte aligned) so the file can be used
+ * directly through a read-only memory mapping.
+ *
+ * Queries by station and time use a separate sorted index file (the catalog
+ * name plus ".idx") which records how much of the catalog it covers and is
+ * brought up to date (incrementally) whenever the catalog has grown.
+ */
+
+#define CATALOG_MAGIC       "SKCT"
+#define CATALOG_INDEX_MAGIC "SKCI"
+#define CATALOG_VERSION     2
+
+#define CATALOG_STATION_LEN 16
+#define CATALOG_PROGRAM_LEN 32
+
+struct catalog_header {
+    char magic [4];
+    uint32_t version;
+};
+
+struct catalog_program {
+    char station [CATALOG_STATION_LEN];     // NUL-padded (and not necessarily terminated)
+    char program [CATALOG_PROGRAM_LEN];
+    int64_t start_time;                     // UNIX time of the start of the program
+    uint32_t duration_ms, num_segments;
+};
+
+struct catalog_segment {
+    uint32_t start_ms, end_ms;              // relative to start of program
+    int16_t mean_score;                     // mean raw tensor value * 100
+    int8_t mode;                            // MODE_MUSIC, MODE_TALK or MODE_NOTHING (undetermined)
+    int8_t reserved [5];                    // pads the segment to 16 bytes (keeping records aligned)
+};
+
+struct catalog_index_header {
+    char magic [4];
+    uint32_t version;
+    uint64_t catalog_size, num_entries;     // bytes of catalog covered by this index
+    uint32_t max_duration_ms, reserved;     // longest program (so time searches can look back)
+};
+
+struct catalog_index_entry {
+    char station [CATALOG_STATION_LEN];
+    int64_t start_time;
+    uint64_t offset;                        // of the catalog_program in the catalog file
+};
+
+// a read-only view of a catalog (memory mapped where possible)
+
+typedef struct {
+    const unsigned char *data;
+    uint64_t size;
+    int mapped;
+} CatalogView;
+
+typedef struct {
+    struct catalog_index_entry *entries;
+    uint64_t num_entries;
+    uint32_t max_duration_ms;
+} CatalogIndex;
+
+int catalog_append (const char *filename, const struct catalog_program *program, const struct catalog_segment *segments);
+int catalog_open (const char *filename, CatalogView *view);
+void catalog_close (CatalogView *view);
+const struct catalog_program *catalog_program_at (const CatalogView *view, uint64_t offset);
+int catalog_load_index (const char *filename, const CatalogView *view, CatalogIndex *index);
+void catalog_free_index (CatalogIndex *index);
+int catalog_parse_time (const char *string, int64_t *time_value);
+
+#endif /* CATALOG_H_ */
@@ -0,0 +1,261 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** CATQUERY ****                          //
+//                    Segment Catalog Query for Skipper                   //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "skipperlib.h"
+#include "catalog.h"
+
+static const char *sign_on = "\n"
+" CATQUERY  Segment Catalog Query for Skipper  Version 0.1\n"
+" Copyright (c) 2024 David Bryant. All Rights Reserved.\n\n";
+
+static const char *usage =
+" Usage:     CATQUERY [-options] catalog.skc\n\n"
+" Operation: list the segments (or per-program totals) recorded in a segment\n"
+"            catalog by SKIPPER --catalog, optionally restricted to a station,\n"
+"            a time range, a segment type and a minimum segment length\n\n"
+" Options:  -f <time>      = from time (UNIX time or YYYY-MM-DD[THH:MM[:SS]] UTC)\n"
+"           -l<n>          = only segments at least <n> seconds long\n"
+"           -m             = only music segments\n"
+"           -p             = per-program music and talk totals instead of segments\n"
+"           -s <station>   = only the specified station\n"
+"           -t             = only talk segments\n"
+"           -u <time>      = until time (same formats as -f)\n\n"
+" Web:      Visit www.github.com/dbry/skipper for latest version and info\n\n";
+
+static const char *mode_name (int mode)
+{
+    return mode == MODE_MUSIC ? "music" : mode == MODE_TALK ? "talk" : "unknown";
+}
+
+static void format_time (int64_t time_value, char *string, size_t size)
+{
+    time_t t = (time_t) time_value;
+    struct tm *tm = gmtime (&t);
+
+    if (!tm || !strftime (string, size, "%Y-%m-%d %H:%M:%S", tm))
+        snprintf (string, size, "%lld", (long long) time_value);
+}
+
+static void format_duration (uint32_t msecs, char *string, size_t size)
+{
+    snprintf (string, size, "%d:%02d:%02d", msecs / 3600000, msecs / 60000 % 60, msecs / 1000 % 60);
+}
+
+// Return the first index entry at or after "index" that belongs to the station and starts at or
+// after the specified time (the entries are sorted by station and then start time).
+
+static uint64_t find_first (const CatalogIndex *index, uint64_t low, const char *station, int64_t start_time)
+{
+    uint64_t high = index->num_entries;
+
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        const struct catalog_index_entry *entry = index->entries + mid;
+        int compare = strncmp (entry->station, station, CATALOG_STATION_LEN);
+
+        if (compare < 0 || (!compare && entry->start_time < start_time))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+int main (int argc, char **argv)
+{
+    int from_time_follows = 0, until_time_follows = 0, station_follows = 0;
+    int mode_filter = MODE_NOTHING, summarize = 0, min_seconds = 0;
+    int64_t from_time = INT64_MIN, until_time = INT64_MAX;
+    int64_t total_programs = 0, total_segments = 0;
+    char *catalog_filename = NULL, *station = NULL;
+    char station_key [CATALOG_STATION_LEN + 1];
+    CatalogIndex index;
+    CatalogView view;
+
+    if (argc == 1) {
+        fprintf (stderr, "%s", sign_on);
+        fprintf (stderr, "%s", usage);
+        return 0;
+    }
+
+    // loop through command-line arguments
+
+    while (--argc) {
+        if ((**++argv == '-') && (*argv)[1])
+            while (*++*argv)
+                switch (**argv) {
+
+                    case 'F': case 'f':
+                        from_time_follows = 1;
+                        break;
+
+                    case 'L': case 'l':
+                        min_seconds = strtol (++*argv, argv, 10);
+
+                        if (min_seconds < 0) {
+                            fprintf (stderr, "\nerror: minimum length must be non-negative\n");
+                            return 1;
+                        }
+
+                        --*argv;
+                        break;
+
+                    case 'M': case 'm':
+                        mode_filter = MODE_MUSIC;
+                        break;
+
+                    case 'P': case 'p':
+                        summarize = 1;
+                        break;
+
+                    case 'S': case 's':
+                        station_follows = 1;
+                        break;
+
+                    case 'T': case 't':
+                        mode_filter = MODE_TALK;
+                        break;
+
+                    case 'U': case 'u':
+                        until_time_follows = 1;
+                        break;
+
+                    default:
+                        fprintf (stderr, "\nillegal option: %c !\n", **argv);
+                        return 1;
+                }
+        else if (from_time_follows) {
+            if (catalog_parse_time (*argv, &from_time)) {
+                fprintf (stderr, "\nerror: invalid time: %s\n", *argv);
+                return 1;
+            }
+
+            from_time_follows = 0;
+        }
+        else if (until_time_follows) {
+            if (catalog_parse_time (*argv, &until_time)) {
+                fprintf (stderr, "\nerror: invalid time: %s\n", *argv);
+                return 1;
+            }
+
+            until_time_follows = 0;
+        }
+        else if (station_follows) {
+            station = *argv;
+            station_follows = 0;
+        }
+        else if (!catalog_filename)
+            catalog_filename = *argv;
+        else {
+            fprintf (stderr, "\nextra unknown argument: %s !\n", *argv);
+            return 1;
+        }
+    }
+
+    if (!catalog_filename) {
+        fprintf (stderr, "\nerror: no catalog file specified!\n");
+        return 1;
+    }
+
+    if (catalog_open (catalog_filename, &view) || catalog_load_index (catalog_filename, &view, &index))
+        return 1;
+
+    if (summarize)
+        printf ("%-15s  %-19s  %-24s  %9s  %9s  %9s\n", "station", "aired (UTC)", "program", "duration", "music", "talk");
+    else
+        printf ("%-15s  %-19s  %-24s  %9s  %9s  %-7s  %6s\n", "station", "aired (UTC)", "program", "offset", "length", "type", "score");
+
+    // Step through the index one station at a time, using a binary search to find the first program
+    // that could overlap the time range (i.e., one that starts up to the longest program duration
+    // before it) and stopping at the first program that starts after the time range.
+
+    for (uint64_t first = 0; first < index.num_entries;) {
+        int64_t look_back = from_time == INT64_MIN ? from_time : from_time - (index.max_duration_ms / 1000 + 1);
+        uint64_t next_station;
+
+        if (station)
+            strncpy (station_key, station, CATALOG_STATION_LEN);
+        else
+            memcpy (station_key, index.entries [first].station, CATALOG_STATION_LEN);
+
+        station_key [CATALOG_STATION_LEN] = 0;
+        next_station = find_first (&index, first, station_key, INT64_MAX);
+
+        for (uint64_t i = find_first (&index, first, station_key, look_back); i < next_station; ++i) {
+            const struct catalog_program *program = catalog_program_at (&view, index.entries [i].offset);
+            const struct catalog_segment *segments;
+            char program_name [CATALOG_PROGRAM_LEN + 1], aired [32], string [3][16];
+            uint32_t music_ms = 0, talk_ms = 0;
+
+            if (!program || program->start_time >= until_time)
+                break;
+
+            segments = (const struct catalog_segment *) (program + 1);
+
+            if (program->start_time + (program->duration_ms + 999) / 1000 <= from_time)
+                continue;
+
+            memcpy (program_name, program->program, CATALOG_PROGRAM_LEN);
+            program_name [CATALOG_PROGRAM_LEN] = 0;
+            format_time (program->start_time, aired, sizeof (aired));
+            total_programs++;
+
+            for (uint32_t j = 0; j < program->num_segments; ++j) {
+                uint32_t length_ms = segments [j].end_ms - segments [j].start_ms;
+                int64_t segment_start = program->start_time + segments [j].start_ms / 1000;
+                int64_t segment_end = program->start_time + (segments [j].end_ms + 999) / 1000;
+
+                if (segment_start >= until_time || segment_end <= from_time)
+                    continue;
+
+                if (segments [j].mode == MODE_MUSIC)
+                    music_ms += length_ms;
+                else if (segments [j].mode == MODE_TALK)
+                    talk_ms += length_ms;
+
+                if (summarize || (mode_filter && segments [j].mode != mode_filter) || length_ms < min_seconds * 1000U)
+                    continue;
+
+                format_duration (segments [j].start_ms, string [0], sizeof (string [0]));
+                format_duration (length_ms, string [1], sizeof (string [1]));
+                printf ("%-15s  %-19s  %-24s  %9s  %9s  %-7s  %6.2f\n", station_key, aired, program_name,
+                    string [0], string [1], mode_name (segments [j].mode), segments [j].mean_score / 100.0);
+                total_segments++;
+            }
+
+            if (summarize) {
+                format_duration (program->duration_ms, string [0], sizeof (string [0]));
+                format_duration (music_ms, string [1], sizeof (string [1]));
+                format_duration (talk_ms, string [2], sizeof (string [2]));
+                printf ("%-15s  %-19s  %-24s  %9s  %9s  %9s\n", station_key, aired, program_name, string [0], string [1], string [2]);
+            }
+        }
+
+        if (station)
+            break;
+
+        first = next_station;
+    }
+
+    if (summarize)
+        fprintf (stderr, "%lld program(s) matched\n", (long long) total_programs);
+    else
+        fprintf (stderr, "%lld segment(s) matched in %lld program(s)\n", (long long) total_segments, (long long) total_programs);
+
+    catalog_free_index (&index);
+    catalog_close (&view);
+    return 0;
+}
@@ -0,0 +1,996 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// flacdec.c
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "flacdec.h"
+#include "trace.h"
+
+/* A FLAC decoder for skipper's input. It decodes a whole file that's in memory (normally mapped)
+ * into interleaved 16-bit frames, which is all that skipper takes. FLAC frames are independent
+ * of each other, so the file is split into segments of SEGMENT_BYTES, each of which decodes the
+ * frames that start inside it, and worker threads decode the segments ahead of the caller (which
+ * also decodes one itself if it gets to it first). The frames aren't indexed, so the first one of
+ * a segment is found by looking for a frame header (sync code, sane fields and a good CRC-8) that
+ * starts a frame that decodes with a good CRC-16, and the rest follow it. A false sync that got
+ * through all of that would overlap the last frame of the previous segment, and in that case the
+ * segment is decoded again starting where that frame ended. Frames that don't decode (corruption,
+ * or junk at the end of the file) are skipped by looking for the next good one, like a player, and
+ * the audio they had is replaced with silence (going by the sample numbers in the frame headers)
+ * so that everything after them stays at the right time (and agrees with flac_seek()).
+ *
+ * Only what skipper can use is supported: 1 or 2 channels of up to 24 bits (converted to 16 bits).
+ * Threading requires ENABLE_THREADS; otherwise the caller decodes every segment when it gets to it.
+ */
+
+#define SEGMENT_BYTES   (1 << 20)   // compressed bytes per segment
+#define MAX_THREADS     16
+#define MIN_FRAME_BYTES 8           // smaller than any FLAC frame (for checking lost frames)
+#define MAX_LOST_FRAMES (1 << 24)   // larger jumps in the frame numbers aren't trusted
+
+#define SEGMENT_QUEUED      0
+#define SEGMENT_DECODING    1
+#define SEGMENT_DONE        2
+
+typedef struct {
+    int64_t index;                      // segment number (the frames starting in its bytes)
+    int64_t first_offset, end_offset;   // bytes decoded (first_offset is -1 if no frames)
+    int64_t first_sample;               // sample number of the first frame (from its header)
+    int64_t lost_blocks, lost_frames;   // FLAC frames that didn't decode (replaced with silence)
+    int16_t *samples;
+    int num_frames, max_frames, state;
+    const char *error;
+} segment;
+
+struct FlacDecoder {
+    const unsigned char *data;
+    size_t size, frames_start;          // the first frame is right after the metadata
+    FlacInfo info;
+    int64_t num_segments, next_segment, expected_offset;
+    int num_slots, read_index;
+    int64_t skip_frames;                // before the next frame returned (after a seek)
+    int64_t next_sample;                // sample number following the segments taken so far
+    int64_t silence_frames;             // lost before the current segment (returned before it)
+    int64_t lost_blocks, lost_frames;
+    segment *slots;                     // segment n is in slots [n % num_slots]
+    segment *current;                   // being read by flac_decode() (NULL between segments)
+    const char *error;
+#ifdef ENABLE_THREADS
+    pthread_mutex_t mutex;
+    pthread_cond_t work_ready, segment_done;
+    pthread_t threads [MAX_THREADS];
+    int num_threads, stopping;
+#endif
+};
+
+typedef struct {
+    int block_size, sample_rate, channel_assignment, bits_per_sample, header_bytes;
+    int64_t first_sample;
+} frame_header;
+
+typedef struct {
+    const unsigned char *ptr, *end;
+    uint64_t cache;                     // the next count bits, left-aligned (the rest are zero)
+    int count, overrun;
+} bit_reader;
+
+static unsigned char crc8_table [256];
+static uint16_t crc16_table [256];
+static int crc_tables_ready;
+
+static void init_crc_tables (void)
+{
+    if (crc_tables_ready++)
+        return;
+
+    for (int i = 0; i < 256; ++i) {
+        unsigned int crc8 = i, crc16 = i << 8;
+
+        for (int bit = 0; bit < 8; ++bit) {
+            crc8 = (crc8 & 0x80) ? (crc8 << 1) ^ 0x07 : crc8 << 1;
+            crc16 = (crc16 & 0x8000) ? (crc16 << 1) ^ 0x8005 : crc16 << 1;
+        }
+
+        crc8_table [i] = crc8;
+        crc16_table [i] = crc16;
+    }
+}
+
+static void bits_init (bit_reader *br, const unsigned char *ptr, const unsigned char *end)
+{
+    br->ptr = ptr;
+    br->end = end;
+    br->cache = 0;
+    br->count = br->overrun = 0;
+}
+
+static inline void bits_refill (bit_reader *br)
+{
+    while (br->count <= 56 && br->ptr < br->end) {
+        br->cache |= (uint64_t) *br->ptr++ << (56 - br->count);
+        br->count += 8;
+    }
+}
+
+// read n (0 - 32) bits as unsigned
+
+static inline uint32_t read_bits (bit_reader *br, int n)
+{
+    uint32_t value;
+
+    if (!n)
+        return 0;
+
+    if (br->count < n) {
+        bits_refill (br);
+
+        if (br->count < n) {
+            br->overrun = 1;
+            return 0;
+        }
+    }
+
+    value = (uint32_t) (br->cache >> (64 - n));
+    br->cache <<= n;
+    br->count -= n;
+    return value;
+}
+
+static inline int32_t read_signed (bit_reader *br, int n)
+{
+    uint32_t value = read_bits (br, n);
+
+    return n ? (int32_t) (value << (32 - n)) >> (32 - n) : 0;
+}
+
+// count the zeros before the next 1 bit (and skip them and the 1)
+
+static inline uint32_t read_unary (bit_reader *br)
+{
+    uint32_t zeros = 0;
+
+    while (1) {
+        if (br->count < 32)
+            bits_refill (br);
+
+        if (!br->count) {
+            br->overrun = 1;
+            return zeros;
+        }
+
+        if (br->cache) {
+            int leading = __builtin_clzll (br->cache);
+
+            zeros += leading;
+            br->cache <<= leading;
+            br->cache <<= 1;
+            br->count -= leading + 1;
+            return zeros;
+        }
+
+        zeros += br->count;
+        br->count = 0;
+    }
+}
+
+// bytes fully consumed so far (rounding up to the byte boundary)
+
+static inline const unsigned char *bits_position (const bit_reader *br)
+{
+    return br->ptr - br->count / 8;
+}
+
+// Read the metadata blocks (skipping a leading ID3v2 tag) and keep the STREAMINFO.
+
+static const char *read_metadata (FlacDecoder *dec)
+{
+    const unsigned char *data = dec->data;
+    size_t size = dec->size, index = 0;
+    int have_info = 0, last = 0;
+
+    if (size >= 10 && !memcmp (data, "ID3", 3))
+        index = 10 + ((data [6] & 0x7f) << 21 | (data [7] & 0x7f) << 14 | (data [8] & 0x7f) << 7 | (data [9] & 0x7f));
+
+    if (index + 4 > size || memcmp (data + index, "fLaC", 4))
+        return "not a FLAC file";
+
+    for (index += 4; !last; ) {
+        int type;
+        size_t length;
+
+        if (index + 4 > size)
+            return "truncated FLAC metadata";
+
+        last = data [index] & 0x80;
+        type = data [index] & 0x7f;
+        length = (size_t) data [index + 1] << 16 | data [index + 2] << 8 | data [index + 3];
+        index += 4;
+
+        if (index + length > size)
+            return "truncated FLAC metadata";
+
+        if (type == 0 && length >= 34) {
+            const unsigned char *p = data + index;
+            FlacInfo *info = &dec->info;
+
+            info->min_block_size = p [0] << 8 | p [1];
+            info->max_block_size = p [2] << 8 | p [3];
+            info->sample_rate = p [10] << 12 | p [11] << 4 | p [12] >> 4;
+            info->channels = ((p [12] >> 1) & 7) + 1;
+            info->bits_per_sample = ((p [12] & 1) << 4 | p [13] >> 4) + 1;
+            info->total_samples = (int64_t) (p [13] & 0xf) << 32 | (uint32_t) (p [14] << 24 | p [15] << 16 | p [16] << 8 | p [17]);
+            have_info = 1;
+        }
+
+        index += length;
+    }
+
+    if (!have_info)
+        return "no FLAC STREAMINFO";
+
+    if (dec->info.channels > 2 || dec->info.bits_per_sample < 4 || dec->info.bits_per_sample > 24 ||
+        !dec->info.sample_rate || dec->info.max_block_size < 16)
+            return "unsupported FLAC format (only 1 or 2 channels of up to 24 bits)";
+
+    dec->frames_start = index;
+    return NULL;
+}
+
+static const int sample_rates [12] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+static const int sample_sizes [8] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+
+// Parse and check the frame header at p, which must match the stream. Returns 1 if it's good.
+
+static int parse_frame_header (const FlacDecoder *dec, const unsigned char *p, const unsigned char *end, frame_header *header)
+{
+    const FlacInfo *info = &dec->info;
+    int block_code, rate_code, size_code, index = 4, extra = 0;
+    unsigned char crc = 0;
+
+    if (end - p < 6 || p [0] != 0xff || (p [1] & 0xfe) != 0xf8)
+        return 0;
+
+    block_code = p [2] >> 4;
+    rate_code = p [2] & 0xf;
+    header->channel_assignment = p [3] >> 4;
+    size_code = (p [3] >> 1) & 7;
+
+    if (!block_code || rate_code == 15 || header->channel_assignment > 10 || size_code == 3 || size_code == 7 || (p [3] & 1))
+        return 0;
+
+    // the frame number (or sample number, with variable block sizes) is UTF-8 coded in 1 to 7 bytes
+
+    if (p [4] & 0x80) {
+        if ((p [4] & 0xc0) == 0x80 || p [4] == 0xff)
+            return 0;
+
+        for (int mask = 0x40; p [4] & mask; mask >>= 1)
+            extra++;
+    }
+
+    if (end - p < index + 1 + extra + 5)     // room for the longest block size, rate and CRC-8
+        return 0;
+
+    header->first_sample = p [4] & (0x7f >> (extra + !!extra));
+
+    for (int i = 0; i < extra; ++i)
+        if ((p [index + 1 + i] & 0xc0) != 0x80)
+            return 0;
+        else
+            header->first_sample = header->first_sample << 6 | (p [index + 1 + i] & 0x3f);
+
+    if (!(p [1] & 1))
+        header->first_sample *= info->max_block_size;
+
+    index += 1 + extra;
+
+    if (block_code == 6)
+        header->block_size = p [index++] + 1;
+    else if (block_code == 7) {
+        header->block_size = (p [index] << 8 | p [index + 1]) + 1;
+        index += 2;
+    }
+    else if (block_code == 1)
+        header->block_size = 192;
+    else if (block_code <= 5)
+        header->block_size = 576 << (block_code - 2);
+    else
+        header->block_size = 256 << (block_code - 8);
+
+    if (rate_code == 12)
+        header->sample_rate = p [index++] * 1000;
+    else if (rate_code == 13 || rate_code == 14) {
+        header->sample_rate = (p [index] << 8 | p [index + 1]) * (rate_code == 14 ? 10 : 1);
+        index += 2;
+    }
+    else
+        header->sample_rate = rate_code ? sample_rates [rate_code] : info->sample_rate;
+
+    header->bits_per_sample = size_code ? sample_sizes [size_code] : info->bits_per_sample;
+
+    for (int i = 0; i < index; ++i)
+        crc = crc8_table [crc ^ p [i]];
+
+    if (crc != p [index])
+        return 0;
+
+    header->header_bytes = index + 1;
+
+    return header->sample_rate == info->sample_rate && header->bits_per_sample == info->bits_per_sample &&
+        (header->channel_assignment < 8 ? header->channel_assignment + 1 : 2) == info->channels &&
+        header->block_size <= info->max_block_size;
+}
+
+// The residual of a subframe, coded with Rice codes in 2^order partitions (each with its own
+// parameter, or raw if escaped), goes after the order warm-up samples.
+
+static int decode_residual (bit_reader *br, int32_t *samples, int block_size, int order)
+{
+    int method = read_bits (br, 2), param_bits, escape, partition_order, partition_samples;
+
+    if (method > 1)
+        return 0;
+
+    param_bits = method ? 5 : 4;
+    escape = (1 << param_bits) - 1;
+    partition_order = read_bits (br, 4);
+    partition_samples = block_size >> partition_order;
+
+    if ((partition_samples << partition_order) != block_size || partition_samples < order)
+        return 0;
+
+    for (int partition = 0, i = order; partition < 1 << partition_order; ++partition) {
+        int param = read_bits (br, param_bits), end = (partition + 1) * partition_samples;
+
+        if (param == escape) {
+            int bits = read_bits (br, 5);
+
+            while (i < end)
+                samples [i++] = read_signed (br, bits);
+        }
+        else
+            while (i < end) {
+                uint32_t value = read_unary (br) << param;
+
+                value |= read_bits (br, param);
+                samples [i++] = (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+            }
+
+        if (br->overrun)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int decode_subframe (bit_reader *br, int32_t *samples, int block_size, int bits)
+{
+    int type, wasted = 0, order;
+
+    if (read_bits (br, 1))
+        return 0;
+
+    type = read_bits (br, 6);
+
+    if (read_bits (br, 1)) {
+        wasted = read_unary (br) + 1;
+
+        if ((bits -= wasted) < 1)
+            return 0;
+    }
+
+    if (type == 0) {
+        int32_t value = read_signed (br, bits);
+
+        for (int i = 0; i < block_size; ++i)
+            samples [i] = value;
+    }
+    else if (type == 1) {
+        for (int i = 0; i < block_size; ++i)
+            samples [i] = read_signed (br, bits);
+    }
+    else if (type >= 8 && type <= 12) {
+        if ((order = type - 8) > block_size)
+            return 0;
+
+        for (int i = 0; i < order; ++i)
+            samples [i] = read_signed (br, bits);
+
+        if (!decode_residual (br, samples, block_size, order))
+            return 0;
+
+        // the frame's CRC isn't checked yet, so a corrupt one can overflow: do it all modulo 2^32
+
+        uint32_t *wrapped = (uint32_t *) samples;
+
+        switch (order) {
+            case 1:
+                for (int i = 1; i < block_size; ++i)
+                    wrapped [i] += wrapped [i - 1];
+
+                break;
+
+            case 2:
+                for (int i = 2; i < block_size; ++i)
+                    wrapped [i] += 2 * wrapped [i - 1] - wrapped [i - 2];
+
+                break;
+
+            case 3:
+                for (int i = 3; i < block_size; ++i)
+                    wrapped [i] += 3 * (wrapped [i - 1] - wrapped [i - 2]) + wrapped [i - 3];
+
+                break;
+
+            case 4:
+                for (int i = 4; i < block_size; ++i)
+                    wrapped [i] += 4 * (wrapped [i - 1] + wrapped [i - 3]) - 6 * wrapped [i - 2] - wrapped [i - 4];
+
+                break;
+        }
+    }
+    else if (type >= 32) {
+        int32_t coefficients [32];
+        int precision, shift;
+
+        if ((order = type - 31) > block_size)
+            return 0;
+
+        for (int i = 0; i < order; ++i)
+            samples [i] = read_signed (br, bits);
+
+        if ((precision = read_bits (br, 4) + 1) == 16 || (shift = read_signed (br, 5)) < 0)
+            return 0;
+
+        for (int i = 0; i < order; ++i)
+            coefficients [i] = read_signed (br, precision);
+
+        if (!decode_residual (br, samples, block_size, order))
+            return 0;
+
+        for (int i = order; i < block_size; ++i) {
+            int64_t sum = 0;
+
+            for (int j = 0; j < order; ++j)
+                sum += (int64_t) coefficients [j] * samples [i - 1 - j];
+
+            // the sum can't overflow (at most 32 products of 15 and 32 bits), but adding it can
+
+            samples [i] = (int32_t) ((uint32_t) samples [i] + (uint32_t) (sum >> shift));
+        }
+    }
+    else
+        return 0;
+
+    if (wasted)
+        for (int i = 0; i < block_size; ++i)
+            samples [i] = (int32_t) ((uint32_t) samples [i] << wasted);
+
+    return !br->overrun;
+}
+
+// Decode the frame at p into the channel buffers (which hold max_block_size samples) and check its
+// CRC-16. Returns the block size (and the end of the frame in *frame_end), or 0 if it's bad.
+
+static int decode_frame (const FlacDecoder *dec, const unsigned char *p, int32_t *channels [2], const unsigned char **frame_end, int64_t *first_sample)
+{
+    const unsigned char *end = dec->data + dec->size;
+    frame_header header;
+    bit_reader br;
+    uint16_t crc = 0;
+
+    if (!parse_frame_header (dec, p, end, &header))
+        return 0;
+
+    bits_init (&br, p + header.header_bytes, end);
+
+    for (int chan = 0; chan < dec->info.channels; ++chan) {
+        int bits = header.bits_per_sample;
+
+        // the side channel has an extra bit
+
+        if ((header.channel_assignment == 8 || header.channel_assignment == 10) ? chan == 1 : header.channel_assignment == 9 && chan == 0)
+            bits++;
+
+        if (!decode_subframe (&br, channels [chan], header.block_size, bits))
+            return 0;
+    }
+
+    read_bits (&br, br.count & 7);      // zero padding to the byte boundary
+    *frame_end = bits_position (&br);
+
+    if (end - *frame_end < 2)
+        return 0;
+
+    for (const unsigned char *q = p; q < *frame_end; ++q)
+        crc = (crc << 8) ^ crc16_table [(crc >> 8) ^ *q];
+
+    if (crc != ((*frame_end) [0] << 8 | (*frame_end) [1]))
+        return 0;
+
+    *frame_end += 2;
+
+    if (first_sample)
+        *first_sample = header.first_sample;
+
+    int32_t *left = channels [0], *right = channels [1];
+
+    switch (header.channel_assignment) {
+        case 8:     // left/side
+            for (int i = 0; i < header.block_size; ++i)
+                right [i] = (int32_t) ((uint32_t) left [i] - (uint32_t) right [i]);
+
+            break;
+
+        case 9:     // side/right
+            for (int i = 0; i < header.block_size; ++i)
+                left [i] = (int32_t) ((uint32_t) left [i] + (uint32_t) right [i]);
+
+            break;
+
+        case 10:    // mid/side
+            for (int i = 0; i < header.block_size; ++i) {
+                int64_t mid = (int32_t) ((uint32_t) left [i] << 1) | (right [i] & 1), side = right [i];
+
+                left [i] = (int32_t) ((mid + side) >> 1);
+                right [i] = (int32_t) ((mid - side) >> 1);
+            }
+
+            break;
+    }
+
+    return header.block_size;
+}
+
+// Return the number of frames of audio lost before a frame numbered first_sample, if the good frame
+// before it ended at expected_sample and there were skipped_bytes in between that didn't decode.
+// A jump in the numbers that's more than those bytes could have held isn't believed (it returns 0).
+
+static int64_t missing_frames (const FlacDecoder *dec, int64_t first_sample, int64_t expected_sample, int64_t skipped_bytes)
+{
+    int64_t gap = first_sample - expected_sample;
+
+    return gap > 0 && gap <= MAX_LOST_FRAMES && gap <= skipped_bytes / MIN_FRAME_BYTES * dec->info.max_block_size ? gap : 0;
+}
+
+// Decode the good frames that start in a segment (at or after start, if it's not negative) into
+// its interleaved 16-bit samples, with silence in place of any that don't decode between them.
+
+static void decode_segment (FlacDecoder *dec, segment *seg, int64_t start)
+{
+    int channels = dec->info.channels, shift = dec->info.bits_per_sample - 16;
+    size_t segment_end = dec->frames_start + (size_t) (seg->index + 1) * SEGMENT_BYTES;
+    const unsigned char *limit = dec->data + (segment_end < dec->size ? segment_end : dec->size);
+    const unsigned char *p = dec->data + (start >= 0 ? (size_t) start : dec->frames_start + (size_t) seg->index * SEGMENT_BYTES);
+    int32_t *buffer = malloc (dec->info.max_block_size * sizeof (int32_t) * 2), *buffers [2];
+    uint64_t trace_start = TRACE_START ();
+    const unsigned char *frame_end;
+    int64_t first_sample;
+
+    seg->num_frames = 0;
+    seg->first_offset = seg->end_offset = -1;
+    seg->first_sample = seg->lost_blocks = seg->lost_frames = 0;
+    seg->error = NULL;
+
+    if (!buffer) {
+        seg->error = "out of memory";
+        return;
+    }
+
+    buffers [0] = buffer;
+    buffers [1] = buffer + dec->info.max_block_size;
+
+    while (p < limit) {
+        int block_size = decode_frame (dec, p, buffers, &frame_end, &first_sample), silence = 0;
+
+        if (!block_size) {
+            p++;
+            continue;
+        }
+
+        if (seg->first_offset < 0) {
+            seg->first_offset = p - dec->data;
+            seg->first_sample = first_sample;
+        }
+        else if ((silence = missing_frames (dec, first_sample, seg->first_sample + seg->num_frames, p - dec->data - seg->end_offset))) {
+            seg->lost_blocks += (silence + dec->info.max_block_size - 1) / dec->info.max_block_size;
+            seg->lost_frames += silence;
+        }
+
+        if (seg->num_frames + silence + block_size > seg->max_frames) {
+            int new_max = seg->max_frames + (seg->max_frames >> 1) + silence + block_size;
+            int16_t *new_samples = realloc (seg->samples, (size_t) new_max * channels * sizeof (int16_t));
+
+            if (!new_samples) {
+                seg->error = "out of memory";
+                break;
+            }
+
+            seg->samples = new_samples;
+            seg->max_frames = new_max;
+        }
+
+        memset (seg->samples + (size_t) seg->num_frames * channels, 0, (size_t) silence * channels * sizeof (int16_t));
+        seg->num_frames += silence;
+
+        int16_t *out = seg->samples + (size_t) seg->num_frames * channels;
+
+        for (int chan = 0; chan < channels; ++chan)
+            if (shift > 0)
+                for (int i = 0; i < block_size; ++i)
+                    out [i * channels + chan] = buffers [chan] [i] >> shift;
+            else
+                for (int i = 0; i < block_size; ++i)
+                    out [i * channels + chan] = (int32_t) ((uint32_t) buffers [chan] [i] << -shift);
+
+        seg->num_frames += block_size;
+        seg->end_offset = frame_end - dec->data;
+        p = frame_end;
+    }
+
+    free (buffer);
+    TRACE_SPAN ("flac decode", trace_start, 0, -1);
+}
+
+#ifdef ENABLE_THREADS
+
+static void *decode_worker (void *ctx)
+{
+    FlacDecoder *dec = ctx;
+
+    trace_thread_name ("flac");
+    pthread_mutex_lock (&dec->mutex);
+
+    while (!dec->stopping) {
+        segment *seg = NULL;
+
+        // the queued segment that's needed soonest
+
+        for (int i = 0; i < dec->num_slots; ++i)
+            if (dec->slots [i].state == SEGMENT_QUEUED && (!seg || dec->slots [i].index < seg->index))
+                seg = dec->slots + i;
+
+        if (!seg) {
+            pthread_cond_wait (&dec->work_ready, &dec->mutex);
+            continue;
+        }
+
+        seg->state = SEGMENT_DECODING;
+        pthread_mutex_unlock (&dec->mutex);
+        decode_segment (dec, seg, -1);
+        pthread_mutex_lock (&dec->mutex);
+        seg->state = SEGMENT_DONE;
+        pthread_cond_broadcast (&dec->segment_done);
+    }
+
+    pthread_mutex_unlock (&dec->mutex);
+    return NULL;
+}
+
+#endif
+
+static void queue_segment (FlacDecoder *dec, int64_t index)
+{
+    segment *seg = dec->slots + index % dec->num_slots;
+
+    seg->index = index;
+    seg->state = SEGMENT_QUEUED;
+#ifdef ENABLE_THREADS
+    pthread_cond_signal (&dec->work_ready);
+#endif
+}
+
+// Wait for the next segment (decoding it here if no worker has started it), and if its first frame
+// overlaps the last one of the previous segment, decode it again from the end of that.
+
+static segment *next_segment (FlacDecoder *dec)
+{
+    segment *seg = dec->slots + dec->next_segment % dec->num_slots;
+    int decode_here;
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_lock (&dec->mutex);
+
+    while (seg->state == SEGMENT_DECODING)
+        pthread_cond_wait (&dec->segment_done, &dec->mutex);
+
+    if ((decode_here = seg->state == SEGMENT_QUEUED))
+        seg->state = SEGMENT_DECODING;
+
+    pthread_mutex_unlock (&dec->mutex);
+#else
+    decode_here = seg->state == SEGMENT_QUEUED;
+#endif
+
+    if (decode_here) {
+        decode_segment (dec, seg, -1);
+        seg->state = SEGMENT_DONE;
+    }
+
+    if (seg->first_offset >= 0 && seg->first_offset < dec->expected_offset)
+        decode_segment (dec, seg, dec->expected_offset);
+
+    // frames lost between this segment and the previous one are returned (as silence) before it
+
+    if (seg->first_offset >= 0) {
+        if ((dec->silence_frames = missing_frames (dec, seg->first_sample, dec->next_sample, seg->first_offset - dec->expected_offset))) {
+            dec->lost_blocks += (dec->silence_frames + dec->info.max_block_size - 1) / dec->info.max_block_size;
+            dec->lost_frames += dec->silence_frames;
+        }
+
+        dec->lost_blocks += seg->lost_blocks;
+        dec->lost_frames += seg->lost_frames;
+        dec->next_sample += dec->silence_frames + seg->num_frames;
+        dec->expected_offset = seg->end_offset;
+    }
+
+    return seg;
+}
+
+/* Open a FLAC file in memory (which must stay valid until flac_close()) and start decoding it
+ * on the specified number of threads (including the caller's). The stream parameters are
+ * returned in *info. Returns NULL on failure, with the reason in *error.
+ */
+
+FlacDecoder *flac_open (const unsigned char *data, size_t size, int threads, FlacInfo *info, const char **error)
+{
+    FlacDecoder *dec = calloc (1, sizeof (FlacDecoder));
+
+    if (!dec) {
+        *error = "out of memory";
+        return NULL;
+    }
+
+    init_crc_tables ();
+    dec->data = data;
+    dec->size = size;
+
+    if ((*error = read_metadata (dec))) {
+        free (dec);
+        return NULL;
+    }
+
+    if (threads < 1)
+        threads = 1;
+    else if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    dec->num_segments = (size - dec->frames_start + SEGMENT_BYTES - 1) / SEGMENT_BYTES;
+    dec->expected_offset = dec->frames_start;
+    dec->num_slots = threads * 2;
+    dec->slots = calloc (dec->num_slots, sizeof (segment));
+
+    if (!dec->slots) {
+        *error = "out of memory";
+        free (dec);
+        return NULL;
+    }
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_init (&dec->mutex, NULL);
+    pthread_cond_init (&dec->work_ready, NULL);
+    pthread_cond_init (&dec->segment_done, NULL);
+    pthread_mutex_lock (&dec->mutex);
+#endif
+
+    for (int64_t i = 0; i < dec->num_slots && i < dec->num_segments; ++i)
+        queue_segment (dec, i);
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_unlock (&dec->mutex);
+
+    while (dec->num_threads < threads - 1 && !pthread_create (dec->threads + dec->num_threads, NULL, decode_worker, dec))
+        dec->num_threads++;
+#endif
+
+    *info = dec->info;
+    return dec;
+}
+
+// Decode up to max_frames interleaved 16-bit frames. Returns the number decoded, which is only
+// less than requested at the end of the file, or -1 on error (see flac_error()).
+
+int flac_decode (FlacDecoder *dec, int16_t *samples, int max_frames)
+{
+    int channels = dec->info.channels, frames = 0;
+
+    while (frames < max_frames && !dec->error) {
+        segment *seg = dec->current;
+        int count;
+
+        if (!seg) {
+            if (dec->next_segment == dec->num_segments)
+                break;
+
+            if ((seg = dec->current = next_segment (dec))->error) {
+                dec->error = seg->error;
+                break;
+            }
+        }
+
+        // first any silence for frames lost before this segment
+
+        if (dec->silence_frames) {
+            if (dec->skip_frames) {
+                count = dec->silence_frames < dec->skip_frames ? dec->silence_frames : dec->skip_frames;
+                dec->silence_frames -= count;
+                dec->skip_frames -= count;
+            }
+
+            count = dec->silence_frames < max_frames - frames ? dec->silence_frames : max_frames - frames;
+            memset (samples + (size_t) frames * channels, 0, (size_t) count * channels * sizeof (int16_t));
+            dec->silence_frames -= count;
+            frames += count;
+
+            if (dec->silence_frames)
+                break;
+        }
+
+        if (dec->skip_frames) {
+            if ((count = seg->num_frames - dec->read_index) > dec->skip_frames)
+                count = dec->skip_frames;
+
+            dec->read_index += count;
+            dec->skip_frames -= count;
+        }
+
+        if ((count = seg->num_frames - dec->read_index) > max_frames - frames)
+            count = max_frames - frames;
+
+        memcpy (samples + (size_t) frames * channels, seg->samples + (size_t) dec->read_index * channels, (size_t) count * channels * sizeof (int16_t));
+        frames += count;
+
+        // when a segment is used up, its slot is reused for the next segment to decode
+
+        if ((dec->read_index += count) == seg->num_frames) {
+            int64_t refill = dec->next_segment++ + dec->num_slots;
+
+            dec->current = NULL;
+            dec->read_index = 0;
+
+            if (refill < dec->num_segments) {
+#ifdef ENABLE_THREADS
+                pthread_mutex_lock (&dec->mutex);
+                queue_segment (dec, refill);
+                pthread_mutex_unlock (&dec->mutex);
+#else
+                queue_segment (dec, refill);
+#endif
+            }
+        }
+    }
+
+    return dec->error ? -1 : frames;
+}
+
+/* Move the decoding position to the specified frame (counting from the start of the file), which
+ * can be done at any time. The segment to start decoding from is found with a binary search on
+ * the first frame numbers of the segments, so only a few frames are decoded to seek anywhere.
+ * Returns zero on success, or -1 if out of memory.
+ */
+
+int flac_seek (FlacDecoder *dec, int64_t frame)
+{
+    int32_t *buffer = malloc (dec->info.max_block_size * sizeof (int32_t) * 2), *buffers [2];
+    int64_t low = 0, high = dec->num_segments - 1, start_segment = 0, start_offset = dec->frames_start, start_frame = 0;
+
+    if (!buffer)
+        return -1;
+
+    buffers [0] = buffer;
+    buffers [1] = buffer + dec->info.max_block_size;
+
+    while (low <= high) {
+        int64_t mid = (low + high) / 2, first_sample = 0;
+        size_t segment_end = dec->frames_start + (size_t) (mid + 1) * SEGMENT_BYTES;
+        const unsigned char *p = dec->data + dec->frames_start + (size_t) mid * SEGMENT_BYTES;
+        const unsigned char *limit = dec->data + (segment_end < dec->size ? segment_end : dec->size), *frame_end;
+
+        while (p < limit && !decode_frame (dec, p, buffers, &frame_end, &first_sample))
+            p++;
+
+        if (p < limit && first_sample <= frame) {
+            start_segment = mid;
+            start_offset = p - dec->data;
+            start_frame = first_sample;
+            low = mid + 1;
+        }
+        else
+            high = mid - 1;
+    }
+
+    free (buffer);
+
+    // the queued segments are dropped first so that no more are started, and the ones being
+    // decoded have to finish before their slots can be reused
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_lock (&dec->mutex);
+#endif
+
+    for (int i = 0; i < dec->num_slots; ++i)
+        if (dec->slots [i].state == SEGMENT_QUEUED)
+            dec->slots [i].state = SEGMENT_DONE;
+
+#ifdef ENABLE_THREADS
+    for (int i = 0; i < dec->num_slots; ++i)
+        while (dec->slots [i].state == SEGMENT_DECODING)
+            pthread_cond_wait (&dec->segment_done, &dec->mutex);
+#endif
+
+    dec->current = NULL;
+    dec->read_index = 0;
+    dec->next_segment = start_segment;
+    dec->expected_offset = start_offset;
+    dec->skip_frames = frame - start_frame;
+    dec->next_sample = start_frame;
+    dec->silence_frames = 0;
+
+    for (int64_t i = start_segment; i < start_segment + dec->num_slots && i < dec->num_segments; ++i)
+        queue_segment (dec, i);
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_unlock (&dec->mutex);
+#endif
+    return 0;
+}
+
+const char *flac_error (const FlacDecoder *dec)
+{
+    return dec->error;
+}
+
+/* Return the audio lost so far: the number of FLAC frames that didn't decode (and were replaced with
+ * silence) and the number of frames of silence that took their place. Once the end has
+ * been reached, the return value is how many frames short of the STREAMINFO total the file was (it
+ * was truncated, or lost frames at its end), otherwise it's zero.
+ */
+
+int64_t flac_losses (const FlacDecoder *dec, int64_t *lost_blocks, int64_t *lost_frames)
+{
+    *lost_blocks = dec->lost_blocks;
+    *lost_frames = dec->lost_frames;
+
+    if (dec->next_segment == dec->num_segments && dec->info.total_samples > dec->next_sample)
+        return dec->info.total_samples - dec->next_sample;
+
+    return 0;
+}
+
+void flac_close (FlacDecoder *dec)
+{
+    if (!dec)
+        return;
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_lock (&dec->mutex);
+    dec->stopping = 1;
+    pthread_cond_broadcast (&dec->work_ready);
+    pthread_mutex_unlock (&dec->mutex);
+
+    while (dec->num_threads--)
+        pthread_join (dec->threads [dec->num_threads], NULL);
+
+    pthread_mutex_destroy (&dec->mutex);
+    pthread_cond_destroy (&dec->work_ready);
+    pthread_cond_destroy (&dec->segment_done);
+#endif
+
+    for (int i = 0; i < dec->num_slots; ++i)
+        free (dec->slots [i].samples);
+
+    free (dec->slots);
+    free (dec);
+}
@@ -0,0 +1,40 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// flacdec.h
+
+#ifndef FLACDEC_H_
+#define FLACDEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    int sample_rate, channels, bits_per_sample;
+    int min_block_size, max_block_size;
+    int64_t total_samples;              // per channel (0 if the encoder didn't know)
+} FlacInfo;
+
+typedef struct FlacDecoder FlacDecoder;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FlacDecoder *flac_open (const unsigned char *data, size_t size, int threads, FlacInfo *info, const char **error);
+int flac_decode (FlacDecoder *dec, int16_t *samples, int max_frames);
+int flac_seek (FlacDecoder *dec, int64_t frame);
+const char *flac_error (const FlacDecoder *dec);
+int64_t flac_losses (const FlacDecoder *dec, int64_t *lost_blocks, int64_t *lost_frames);
+void flac_close (FlacDecoder *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLACDEC_H_ */
@@ -0,0 +1,10 @@
+// forest.h: decision-tree ensemble generated by TENSOR-GEN -f (do not edit)
+// placeholder with no trees; regenerate from training data to enable SKIPPER --forest
+
+#define FOREST_TREES    0
+#define FOREST_DEPTH    3
+
+static int forest_evaluate (const struct analysis_result *result)
+{
+    return 0;
+}
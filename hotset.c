@@ -0,0 +1,305 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// hotset.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hotset.h"
+
+// Fibonacci hashing of the cell index to the first slot to try (the table is never more than
+// half full, so linear probing from there is short).
+
+static inline uint32_t hash_slot (uint32_t cell, int slot_bits)
+{
+    return (cell * 0x9e3779b1U) >> (32 - slot_bits);
+}
+
+static void set_slot_bits (SkipperHotSet *hotset, int num_cells)
+{
+    hotset->num_cells = num_cells;
+
+    for (hotset->slot_bits = 1; (1 << hotset->slot_bits) < num_cells * 2; hotset->slot_bits++);
+}
+
+static void insert_cell (SkipperHotSet *hotset, uint32_t entry)
+{
+    uint32_t mask = (1U << hotset->slot_bits) - 1, slot = hash_slot ((entry >> 8) - 1, hotset->slot_bits);
+
+    while (hotset->slots [slot])
+        slot = (slot + 1) & mask;
+
+    hotset->slots [slot] = entry;
+}
+
+static uint32_t cell_entry (int cell, int value)
+{
+    return (uint32_t) (cell + 1) << 8 | (unsigned char) value;
+}
+
+struct cell_hits {
+    uint32_t hits, cell;
+};
+
+static int compare_hits (const void *a, const void *b)
+{
+    const struct cell_hits *ca = a, *cb = b;
+
+    if (ca->hits != cb->hits)
+        return ca->hits > cb->hits ? -1 : 1;
+
+    return ca->cell < cb->cell ? -1 : ca->cell > cb->cell;
+}
+
+/* Build a hot set from a tensor and the hit counts of its cells (in row-major order), keeping
+ * (up to) the specified number of cells with the most hits (cells never hit are never kept).
+ * Each coarse cell is the mean of the 16 tensor cells it covers that weren't kept, weighted by
+ * their hits plus one (so cells that were hit count more, but the never hit ones still count).
+ * Returns the number of cells kept, or -1 if out of memory.
+ */
+
+int hotset_build (SkipperHotSet *hotset, tensor_array tensor, const uint32_t *hits, int num_cells)
+{
+    struct cell_hits *cells = malloc (TENSOR_CELLS * sizeof (struct cell_hits));
+    unsigned char *kept = calloc (TENSOR_CELLS, 1);
+    int num_hit = 0;
+
+    if (!cells || !kept) {
+        free (cells);
+        free (kept);
+        return -1;
+    }
+
+    for (int cell = 0; cell < TENSOR_CELLS; ++cell)
+        if (hits [cell]) {
+            cells [num_hit].hits = hits [cell];
+            cells [num_hit++].cell = cell;
+        }
+
+    qsort (cells, num_hit, sizeof (struct cell_hits), compare_hits);
+
+    if (num_cells > num_hit)
+        num_cells = num_hit;
+
+    if (num_cells > HOTSET_MAX_CELLS)
+        num_cells = HOTSET_MAX_CELLS;
+
+    memset (hotset, 0, sizeof (*hotset));
+    set_slot_bits (hotset, num_cells);
+
+    for (int n = 0; n < num_cells; ++n) {
+        int cell = cells [n].cell, k = cell % ARRAY_BINS_4, j = cell / ARRAY_BINS_4 % ARRAY_BINS_3;
+        int i = cell / (ARRAY_BINS_4 * ARRAY_BINS_3) % ARRAY_BINS_2, h = cell / (ARRAY_BINS_4 * ARRAY_BINS_3 * ARRAY_BINS_2);
+
+        insert_cell (hotset, cell_entry (cell, TENSOR_CELL (tensor, h, i, j, k)));
+        kept [cell] = 1;
+    }
+
+    for (int h = 0; h < ARRAY_BINS_1; h += 2)
+        for (int i = 0; i < ARRAY_BINS_2; i += 2)
+            for (int j = 0; j < ARRAY_BINS_3; j += 2)
+                for (int k = 0; k < ARRAY_BINS_4; k += 2) {
+                    double values_sum = 0.0, weights_sum = 0.0;
+
+                    for (int dh = 0; dh < 2; ++dh)
+                        for (int di = 0; di < 2; ++di)
+                            for (int dj = 0; dj < 2; ++dj)
+                                for (int dk = 0; dk < 2; ++dk) {
+                                    int cell = (((h + dh) * ARRAY_BINS_2 + i + di) * ARRAY_BINS_3 + j + dj) * ARRAY_BINS_4 + k + dk;
+
+                                    if (!kept [cell]) {
+                                        values_sum += (hits [cell] + 1.0) * TENSOR_CELL (tensor, h + dh, i + di, j + dj, k + dk);
+                                        weights_sum += hits [cell] + 1.0;
+                                    }
+                                }
+
+                    if (weights_sum > 0.0)
+                        hotset->coarse [h >> 1] [i >> 1] [j >> 1] [k >> 1] = (int) floor (values_sum / weights_sum + 0.5);
+                }
+
+    free (cells);
+    free (kept);
+    return num_cells;
+}
+
+// Look up the value for an analysis result, and optionally whether it came from a hot cell (rather
+// than the coarse tensor).
+
+int hotset_lookup (const SkipperHotSet *hotset, const struct analysis_result *result, int *hot)
+{
+    int h, i, j, k;
+
+    analysis_result_to_tensor_index (result, &h, &i, &j, &k);
+
+    uint32_t cell = ((h * ARRAY_BINS_2 + i) * ARRAY_BINS_3 + j) * ARRAY_BINS_4 + k, key = (cell + 1) << 8;
+    uint32_t mask = (1U << hotset->slot_bits) - 1, slot = hash_slot (cell, hotset->slot_bits), entry;
+
+    while ((entry = hotset->slots [slot])) {
+        if ((entry & ~0xffU) == key) {
+            if (hot) *hot = 1;
+            return (signed char) (entry & 0xff);
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    if (hot) *hot = 0;
+    return hotset->coarse [h >> 1] [i >> 1] [j >> 1] [k >> 1];
+}
+
+// Serialize the hot cells (in slot order) and the coarse tensor into a contiguous buffer (so that
+// the checksum can be calculated), returning the size, or zero on failure.
+
+static int hotset_payload (const SkipperHotSet *hotset, unsigned char **payload)
+{
+    int size = hotset->num_cells * sizeof (uint32_t) + sizeof (hotset->coarse);
+    unsigned char *buffer = malloc (size), *bp = buffer;
+
+    if (!buffer)
+        return 0;
+
+    for (int slot = 0; slot < (1 << hotset->slot_bits); ++slot)
+        if (hotset->slots [slot]) {
+            memcpy (bp, hotset->slots + slot, sizeof (uint32_t));
+            bp += sizeof (uint32_t);
+        }
+
+    memcpy (bp, hotset->coarse, sizeof (hotset->coarse));
+
+    *payload = buffer;
+    return size;
+}
+
+int hotset_write (const SkipperHotSet *hotset, FILE *file)
+{
+    struct hotset_header header;
+    unsigned char *payload;
+    int payload_size = hotset_payload (hotset, &payload);
+
+    if (!payload_size)
+        return 0;
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, HOTSET_MAGIC, sizeof (header.magic));
+    header.version = HOTSET_VERSION;
+    header.num_cells = hotset->num_cells;
+    header.dimensions [0] = ARRAY_BINS_1;
+    header.dimensions [1] = ARRAY_BINS_2;
+    header.dimensions [2] = ARRAY_BINS_3;
+    header.dimensions [3] = ARRAY_BINS_4;
+
+    for (int i = 0; i < payload_size; ++i)
+        header.checksum += payload [i];
+
+    if (fwrite (&header, sizeof (header), 1, file) != 1 || fwrite (payload, payload_size, 1, file) != 1) {
+        free (payload);
+        return 0;
+    }
+
+    free (payload);
+    return sizeof (header) + payload_size;
+}
+
+// Load a hot set from a memory image of the file, returning TRUE on success.
+
+int hotset_read (SkipperHotSet *hotset, const unsigned char *data, int data_size)
+{
+    struct hotset_header header;
+    uint32_t checksum = 0;
+
+    if (data_size < (int) sizeof (header)) {
+        fprintf (stderr, "invalid hot set!\n");
+        return 0;
+    }
+
+    memcpy (&header, data, sizeof (header));
+    data += sizeof (header);
+    data_size -= sizeof (header);
+
+    if (memcmp (header.magic, HOTSET_MAGIC, sizeof (header.magic)) || header.version != HOTSET_VERSION ||
+        header.dimensions [0] != ARRAY_BINS_1 || header.dimensions [1] != ARRAY_BINS_2 ||
+        header.dimensions [2] != ARRAY_BINS_3 || header.dimensions [3] != ARRAY_BINS_4 ||
+        header.num_cells > HOTSET_MAX_CELLS) {
+            fprintf (stderr, "invalid hot set!\n");
+            return 0;
+    }
+
+    for (int i = 0; i < data_size; ++i)
+        checksum += data [i];
+
+    if (data_size != (int) (header.num_cells * sizeof (uint32_t) + sizeof (hotset->coarse)) || checksum != header.checksum) {
+        fprintf (stderr, "hot set is corrupt!\n");
+        return 0;
+    }
+
+    memset (hotset, 0, sizeof (*hotset));
+    set_slot_bits (hotset, header.num_cells);
+
+    for (int n = 0; n < (int) header.num_cells; ++n) {
+        uint32_t entry;
+
+        memcpy (&entry, data, sizeof (entry));
+        data += sizeof (entry);
+
+        if (!(entry >> 8) || (entry >> 8) > TENSOR_CELLS) {
+            fprintf (stderr, "hot set is corrupt!\n");
+            return 0;
+        }
+
+        insert_cell (hotset, entry);
+    }
+
+    memcpy (hotset->coarse, data, sizeof (hotset->coarse));
+    return 1;
+}
+
+// Write the hit counts of all the tensor cells (in row-major order) as a profile file, returning
+// the size, or zero on failure.
+
+int hotset_write_profile (const uint32_t *hits, FILE *file)
+{
+    struct profile_header header;
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, PROFILE_MAGIC, sizeof (header.magic));
+    header.version = PROFILE_VERSION;
+    header.dimensions [0] = ARRAY_BINS_1;
+    header.dimensions [1] = ARRAY_BINS_2;
+    header.dimensions [2] = ARRAY_BINS_3;
+    header.dimensions [3] = ARRAY_BINS_4;
+
+    if (fwrite (&header, sizeof (header), 1, file) != 1 || fwrite (hits, sizeof (uint32_t), TENSOR_CELLS, file) != TENSOR_CELLS)
+        return 0;
+
+    return sizeof (header) + TENSOR_CELLS * sizeof (uint32_t);
+}
+
+// Read a profile file into the hit counts of all the tensor cells, returning TRUE on success.
+
+int hotset_read_profile (uint32_t *hits, FILE *file)
+{
+    struct profile_header header;
+
+    if (fread (&header, sizeof (header), 1, file) != 1 ||
+        memcmp (header.magic, PROFILE_MAGIC, sizeof (header.magic)) || header.version != PROFILE_VERSION ||
+        header.dimensions [0] != ARRAY_BINS_1 || header.dimensions [1] != ARRAY_BINS_2 ||
+        header.dimensions [2] != ARRAY_BINS_3 || header.dimensions [3] != ARRAY_BINS_4) {
+            fprintf (stderr, "invalid profile!\n");
+            return 0;
+    }
+
+    if (fread (hits, sizeof (uint32_t), TENSOR_CELLS, file) != TENSOR_CELLS) {
+        fprintf (stderr, "profile is truncated!\n");
+        return 0;
+    }
+
+    return 1;
+}
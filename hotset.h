@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// hotset.h
+
+#ifndef HOTSET_H_
+#define HOTSET_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "skipper.h"
+
+/* A pruned tensor for when only a small part of the full one is ever hit (most
+ * of its cells are just border fill). The cells that a profile shows are hit
+ * most often (SKIPPER --profile counts the hits on every cell) are kept exactly
+ * in a small open-addressed hash table, and every other cell is served from a
+ * coarse tensor with half the bins on each axis, so the whole thing (34 KB
+ * with the default 2048 hot cells) stays in L1/L2 instead of the 288 KB tensor
+ * going through the cache. TENSOR-GEN -s builds one from the tensor it made
+ * and reports the coverage and accuracy it costs.
+ *
+ * The hot-set file is a hotset_header followed by the hot cells (a uint32 each,
+ * the row-major cell index shifted left 8 bits with the value in the low byte)
+ * and then the coarse tensor. The profile file is a profile_header followed by
+ * the hit count (uint32) of every cell in row-major order.
+ */
+
+#define HOTSET_MAGIC        "SKHS"
+#define HOTSET_VERSION      1
+#define PROFILE_MAGIC       "SKCP"
+#define PROFILE_VERSION     1
+
+#define HOTSET_CELLS        2048    // default number of hot cells
+#define HOTSET_MAX_CELLS    16384
+#define HOTSET_MAX_SLOTS    (HOTSET_MAX_CELLS * 2)
+
+#define TENSOR_CELLS        (ARRAY_BINS_1 * ARRAY_BINS_2 * ARRAY_BINS_3 * ARRAY_BINS_4)
+
+#if ARRAY_BINS_1 % 2 || ARRAY_BINS_2 % 2 || ARRAY_BINS_3 % 2 || ARRAY_BINS_4 % 2
+#error the coarse tensor of the hot set requires all tensor dimensions to be even
+#endif
+
+struct hotset_header {
+    char magic [4];
+    uint32_t version, checksum, num_cells;
+    unsigned char dimensions [4];
+};
+
+struct profile_header {
+    char magic [4];
+    uint32_t version;
+    unsigned char dimensions [4];
+};
+
+typedef struct {
+    signed char coarse [ARRAY_BINS_1 / 2] [ARRAY_BINS_2 / 2] [ARRAY_BINS_3 / 2] [ARRAY_BINS_4 / 2];
+    int num_cells, slot_bits;           // only the first (1 << slot_bits) slots are used
+    uint32_t slots [HOTSET_MAX_SLOTS];  // (cell + 1) << 8 | value, or zero if empty
+} SkipperHotSet;
+
+// Return the row-major index of the tensor cell for an analysis result (the same cell that
+// analysis_result_to_tensor_pointer() finds in any layout).
+
+static inline int hotset_cell (const struct analysis_result *result)
+{
+    int h, i, j, k;
+
+    analysis_result_to_tensor_index (result, &h, &i, &j, &k);
+    return ((h * ARRAY_BINS_2 + i) * ARRAY_BINS_3 + j) * ARRAY_BINS_4 + k;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hotset_build (SkipperHotSet *hotset, tensor_array tensor, const uint32_t *hits, int num_cells);
+int hotset_lookup (const SkipperHotSet *hotset, const struct analysis_result *result, int *hot);
+int hotset_write (const SkipperHotSet *hotset, FILE *file);
+int hotset_read (SkipperHotSet *hotset, const unsigned char *data, int data_size);
+int hotset_write_profile (const uint32_t *hits, FILE *file);
+int hotset_read_profile (uint32_t *hits, FILE *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOTSET_H_ */
@@ -0,0 +1,1137 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** LOADGEN ****                           //
+//                   Host Capacity Load Generator for Skipper             //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "skipperlib.h"
+#include "logger.h"
+#include "trace.h"
+
+static const char *sign_on = "\n"
+" LOADGEN  Host Capacity Load Generator for Skipper  Version 0.1\n"
+" Copyright (c) 2024 David Bryant. All Rights Reserved.\n\n";
+
+static const char *usage =
+" Usage:     LOADGEN [-options]\n\n"
+" Operation: synthesize concurrent audio streams and run them through the\n"
+"            Skipper library on a pool of worker threads, paced at real time\n"
+"            (or faster), then report latency, throughput and memory figures\n"
+"            (latencies and deadline misses are only meaningful when paced)\n\n"
+" Options:  -a             = adapt to load: when blocks start late, degrade the\n"
+"                            analysis of the lowest priority streams (and\n"
+"                            restore it when caught up; only when paced)\n"
+"           -b<n>          = block size in milliseconds (default 1000)\n"
+"           -c<n>[,<n>...] = channel counts, cycled over streams (default 2)\n"
+"           -d<n>          = seconds of audio per stream (default 600)\n"
+"           -e             = keep level envelopes as 16-bit log levels (half\n"
+"                            the memory, integer analysis)\n"
+"           -f<n>          = number of distinct feeds, with the streams beyond\n"
+"                            that carrying copies of them (default = streams)\n"
+"           -g             = use the generic pipeline (not the specialized ones)\n"
+"           -j<n>          = worker threads (default = online CPUs)\n"
+"           -k<n>          = number of batch streams (archive re-renders, which\n"
+"                            are unpaced and have no deadlines), from the end\n"
+"           -l<n>[,<n>...] = output slack in milliseconds (how long after a\n"
+"                            block arrives it must be done), cycled over the\n"
+"                            streams (default = block size)\n"
+"           -m<n>          = music percentage of synthesized audio (default 60)\n"
+"           -n<n>          = number of concurrent streams (default 8)\n"
+"           -o<n>          = percentage of time the copies of a feed carry their\n"
+"                            own local content instead (default 0)\n"
+"           -p<n>[,<n>...] = stream priorities for -a, cycled over streams\n"
+"                            (higher are degraded last, default 0)\n"
+"           -q             = schedule blocks in order of arrival (FIFO) instead\n"
+"                            of earliest deadline first\n"
+"           -r<n>          = delay in milliseconds between copies of a feed\n"
+"                            (default 0, shared only if a multiple of 200)\n"
+"           -s<n>[,<n>...] = sample rates, cycled over streams (default 44100)\n"
+"           -t <file>      = write timeline of blocks and processing stages to\n"
+"                            file (Chrome trace JSON, for ui.perfetto.dev)\n"
+"           -u             = don't share analysis between identical streams\n"
+"           -x<n>          = speed as multiple of real time (0 = unpaced, default 1)\n\n"
+" Web:      Visit www.github.com/dbry/skipper for latest version and info\n\n";
+
+#define MAX_CONFIGS     8
+#define LOOP_SECONDS    120     // length of synthesized audio loop (shared by streams of the same format)
+#define TRACE_EVENTS    1048576 // per worker thread, for -t
+
+// Simulcast detection: every stream keeps a few seconds of its input along with "anchors", which
+// are the positions where a rolling hash of the last HASH_FRAMES frames has its top ANCHOR_BITS
+// bits clear (so they depend only on the audio, not on where the blocks fall). A stream with an
+// anchor hash that another stream also has might be carrying the same audio at that offset.
+
+#define HISTORY_SECONDS 12      // input kept for matching (also the maximum delay between copies)
+#define HASH_FRAMES     256
+#define HASH_MULTIPLIER 0x9e3779b1
+#define ANCHOR_BITS     12      // about one anchor per 4096 frames
+#define MAX_ANCHORS     256
+#define PRIME_SECONDS   6       // recent input used to restore the front end of a stream that diverges
+
+// Load governor (-a): the mean lateness of the blocks of live streams as they start (as a fraction
+// of their slack) is checked every GOVERNOR_MSECS. Only blocks that had to wait for a worker
+// count (not ones picked by a worker that was sleeping, which are only late by the wakeup time).
+// If it's over SHED_LATENESS and either not going down or not having been shed for SHED_INTERVALS
+// (a backlog takes a while to drain after a shed), some streams are degraded by one level, and
+// once it has stayed under RESTORE_LATENESS for RESTORE_INTERVALS, one stream is restored by one
+// level.
+
+#define GOVERNOR_MSECS      250
+#define SHED_LATENESS       0.25
+#define SHED_INTERVALS      4
+#define RESTORE_LATENESS    0.05
+#define RESTORE_INTERVALS   8
+
+typedef struct {
+    int sample_rate, channels;
+    int16_t *audio;
+    int num_frames;
+} SynthLoop;
+
+typedef struct {
+    uint32_t hash;
+    int64_t position;           // last frame of the hashed span
+} Anchor;
+
+typedef struct Stream {
+    int index, block_frames, num_blocks, next_block, busy;
+    int64_t frames_written;
+    double start_offset, block_seconds, cpu_seconds;
+    double slack_seconds;       // audio seconds from the arrival of a block to its deadline
+    int batch, misses;          // batch streams are unpaced and have no deadlines
+    double *latencies;
+    SynthLoop *loop;
+    int loop_position, copy;
+    int16_t *block;             // current input block
+    Skipper *sk;
+
+    int16_t *history;           // recent input (ring of history_frames) and its anchors
+    int history_frames;
+    int64_t received, last_anchor;
+    uint32_t rolling_hash;
+    Anchor anchors [MAX_ANCHORS];
+    int num_anchors;
+
+    struct Stream *leader;      // stream whose analysis we share (our blocks are processed in its jobs)
+    struct Stream *followers;   // streams sharing our analysis, linked through next_follower
+    struct Stream *next_follower;
+    int64_t leader_offset;      // the leader's input position for the same audio minus ours
+    int shared_blocks;
+
+    int priority, degrade_level, degraded_blocks;   // for the load governor
+} Stream;
+
+static SynthLoop synth_loops [MAX_CONFIGS * MAX_CONFIGS];
+static int num_synth_loops;
+
+static Stream *streams;
+static int num_streams = 8, num_workers, generic_pipeline, log_envelope, block_msecs = 1000, duration_secs = 600, music_percent = 60;
+static int num_feeds, copy_delay_msecs, local_percent, no_sharing, num_joins, num_divergences, num_unaligned;
+static int num_batch, fifo_schedule, slack_msecs [MAX_CONFIGS], num_slacks = 1;
+static int adaptive, priorities [MAX_CONFIGS], num_priorities = 1, num_sheds, num_restores, calm_intervals, shed_intervals;
+static double governor_time, total_lateness, last_lateness;
+static int num_lateness;
+static uint32_t hash_power;     // HASH_MULTIPLIER ^ HASH_FRAMES, for removing frames from the rolling hash
+static int sample_rates [MAX_CONFIGS] = { SAMPLE_RATE }, num_sample_rates = 1;
+static int channel_counts [MAX_CONFIGS] = { CHANNELS }, num_channel_counts = 1;
+static double speed = 1.0, start_time;
+static tensor_array *tensor;
+
+static pthread_mutex_t schedule_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double wall_clock (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double thread_cpu_clock (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int parse_list (char **argp, int *values, int max_values)
+{
+    int count = 0;
+
+    do
+        if (count < max_values)
+            values [count++] = strtol (*argp + (**argp == ','), argp, 10);
+        else
+            return 0;
+    while (**argp == ',');
+
+    return count;
+}
+
+// Synthesize a loop of audio with the requested music/talk mix. Music is a slowly changing chord
+// with a gentle tremolo and talk is noise shaped with a syllabic envelope and pauses, which is
+// close enough to real program material to exercise every part of the decision logic.
+
+static SynthLoop *get_synth_loop (int sample_rate, int channels)
+{
+    double phases [6] = { 0 }, freqs [6] = { 220, 277, 330, 440, 554, 659 };
+    uint32_t random = 0x12345678;
+    SynthLoop *loop;
+
+    for (int i = 0; i < num_synth_loops; ++i)
+        if (synth_loops [i].sample_rate == sample_rate && synth_loops [i].channels == channels)
+            return synth_loops + i;
+
+    loop = synth_loops + num_synth_loops++;
+    loop->sample_rate = sample_rate;
+    loop->channels = channels;
+    loop->num_frames = LOOP_SECONDS * sample_rate;
+    loop->audio = malloc (loop->num_frames * channels * sizeof (int16_t));
+
+    if (!loop->audio) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        exit (1);
+    }
+
+    for (int n = 0; n < loop->num_frames; ++n) {
+        double t = (double) n / sample_rate, value = 0.0;
+
+        if (t < LOOP_SECONDS * music_percent / 100.0) {
+            for (int k = 0; k < 6; ++k) {
+                phases [k] += 2.0 * M_PI * freqs [k] * (1.0 + 0.1 * ((int)(t / 0.5) % 4)) / sample_rate;
+                value += sin (phases [k]);
+            }
+
+            value *= 2500.0 * (0.8 + 0.2 * sin (2.0 * M_PI * 2.0 * t));
+        }
+        else {
+            double noise, envelope = sin (2.0 * M_PI * (2.1 + 0.6 * sin (t * 0.7)) * t);
+
+            random = random * 1103515245 + 12345;
+            noise = ((random >> 16) & 0x7fff) / 16384.0 - 1.0;
+
+            if (envelope < 0.0 || fmod (t, 3.1) > 2.6)
+                envelope = 0.0;
+
+            value = noise * 9000.0 * (0.06 + envelope * envelope * envelope);
+        }
+
+        for (int c = 0; c < channels; ++c)
+            loop->audio [n * channels + c] = (int16_t) value;
+    }
+
+    return loop;
+}
+
+static void count_output (void *ctx, const int16_t *samples, int num_frames)
+{
+    ((Stream *) ctx)->frames_written += num_frames;
+}
+
+// A block arrives when it would have been completely received by a real-time source (batch streams
+// have all of theirs from the start), and its deadline is the stream's slack after that: how much
+// output a live stream has buffered beyond the block, so that it glitches if the block takes
+// longer. Batch streams (and everything when unpaced) have no deadlines.
+
+static double block_arrival_time (Stream *stream, int block)
+{
+    if (speed <= 0.0 || stream->batch)
+        return start_time;
+
+    return start_time + (stream->start_offset + (block + 1) * stream->block_seconds) / speed;
+}
+
+static double block_deadline (Stream *stream, int block)
+{
+    if (speed <= 0.0 || stream->batch)
+        return HUGE_VAL;
+
+    return block_arrival_time (stream, block) + stream->slack_seconds / speed;
+}
+
+// The number of blocks of the stream that have been received (when paced) but not yet processed,
+// including the specified one (for tracing).
+
+static int stream_backlog (Stream *stream, int block)
+{
+    if (speed <= 0.0 || stream->batch)
+        return stream->num_blocks - block;
+
+    int received = (int) floor (((wall_clock () - start_time) * speed - stream->start_offset) / stream->block_seconds);
+    return received < stream->num_blocks ? received - block : stream->num_blocks - block;
+}
+
+/* Pick the idle stream whose next block has arrived and has the earliest deadline (EDF), and
+ * return how long ago the block arrived as a negative *wait_time. Batch streams have no deadline
+ * so they only get the workers that no live stream needs (although a batch block that's already
+ * running still delays a live one that arrives meanwhile, by up to one block). With -q it's the
+ * earliest arrival instead (FIFO), which is what EDF amounts to when all streams are live with
+ * the same slack, but lets batch streams starve the live ones. Ties (always, when unpaced) go to
+ * the stream that's furthest behind. If no block has arrived, returns NULL with *wait_time set to
+ * how long until the next one does, and *finished is set if there's no work left at all.
+ */
+
+static Stream *pick_stream (double *wait_time, int *finished)
+{
+    double now = wall_clock (), best_key = 0.0, next_arrival = HUGE_VAL;
+    Stream *best = NULL;
+    int remaining = 0;
+
+    for (int i = 0; i < num_streams; ++i) {
+        Stream *stream = streams + i;
+
+        if (stream->next_block < stream->num_blocks)
+            remaining++;
+        else
+            continue;
+
+        if (!stream->busy && !stream->leader) {
+            double arrival = block_arrival_time (stream, stream->next_block);
+            double key = fifo_schedule ? arrival : block_deadline (stream, stream->next_block);
+
+            if (arrival > now) {
+                if (arrival < next_arrival)
+                    next_arrival = arrival;
+            }
+            else if (!best || key < best_key || (key == best_key && stream->next_block < best->next_block)) {
+                best_key = key;
+                best = stream;
+            }
+        }
+    }
+
+    if (best)
+        *wait_time = block_arrival_time (best, best->next_block) - now;
+    else
+        *wait_time = next_arrival < HUGE_VAL ? next_arrival - now : 0.001;
+
+    *finished = !remaining;
+    return best;
+}
+
+// Pick the stream to degrade next: the lowest priority, and within that the least degraded (so
+// streams of the same priority share the degradation). Streams that are following another one
+// don't run their own analysis, so they're not candidates.
+
+static Stream *pick_shed_stream (void)
+{
+    Stream *best = NULL;
+
+    for (int i = 0; i < num_streams; ++i) {
+        Stream *stream = streams + i;
+
+        if (stream->leader || stream->batch || stream->next_block == stream->num_blocks || stream->degrade_level == DEGRADE_LEVELS - 1)
+            continue;
+
+        if (!best || stream->priority < best->priority ||
+            (stream->priority == best->priority && stream->degrade_level < best->degrade_level))
+                best = stream;
+    }
+
+    return best;
+}
+
+// And the reverse for restoring: the highest priority, and within that the most degraded.
+
+static Stream *pick_restore_stream (void)
+{
+    Stream *best = NULL;
+
+    for (int i = 0; i < num_streams; ++i) {
+        Stream *stream = streams + i;
+
+        if (!stream->degrade_level || stream->next_block == stream->num_blocks)
+            continue;
+
+        if (!best || stream->priority > best->priority ||
+            (stream->priority == best->priority && stream->degrade_level > best->degrade_level))
+                best = stream;
+    }
+
+    return best;
+}
+
+// Called by the workers (with the schedule mutex held) to check the lateness once per interval
+// and degrade or restore streams. The new levels are applied by the workers at the start of the
+// streams' next jobs. Sheds are scaled with the number of streams so that a large host reacts
+// about as quickly as a small one.
+
+static void govern (double now)
+{
+    double lateness = num_lateness ? total_lateness / num_lateness : 0.0;
+    Stream *stream;
+
+    if (now - governor_time < GOVERNOR_MSECS / 1000.0)
+        return;
+
+    governor_time = now;
+    total_lateness = num_lateness = 0;
+
+    shed_intervals++;
+
+    if (lateness > SHED_LATENESS && (lateness >= last_lateness || shed_intervals >= SHED_INTERVALS)) {
+        calm_intervals = shed_intervals = 0;
+
+        for (int steps = 1 + num_streams / 16; steps-- && (stream = pick_shed_stream ());) {
+            stream->degrade_level++;
+            num_sheds++;
+            fprintf (stderr, "%8.2f secs: stream %d (priority %d) degraded to %s, blocks starting %.0f%% of deadline late\n",
+                now - start_time, stream->index, stream->priority, skipper_degrade_name (stream->degrade_level), lateness * 100.0);
+        }
+    }
+    else if (lateness < RESTORE_LATENESS && ++calm_intervals >= RESTORE_INTERVALS) {
+        calm_intervals = 0;
+
+        if ((stream = pick_restore_stream ())) {
+            stream->degrade_level--;
+            num_restores++;
+            fprintf (stderr, "%8.2f secs: stream %d (priority %d) restored to %s\n",
+                now - start_time, stream->index, stream->priority, skipper_degrade_name (stream->degrade_level));
+        }
+    }
+    else if (lateness >= RESTORE_LATENESS)
+        calm_intervals = 0;
+
+    last_lateness = lateness;
+}
+
+// Read the next block of a stream's synthesized feed. Copies of a feed (other than the first)
+// carry their own local content (from the other half of the loop) for local_percent of the time,
+// in stretches that are placed differently for each copy.
+
+static void read_block (Stream *stream, int block)
+{
+    SynthLoop *loop = stream->loop;
+    double block_time = block * stream->block_seconds;
+    int frames = stream->block_frames, position = stream->loop_position;
+    int16_t *dst = stream->block;
+
+    if (stream->copy && fmod (block_time + stream->copy * 37.0, 100.0) < local_percent)
+        position = (position + loop->num_frames / 2) % loop->num_frames;
+
+    while (frames) {
+        int chunk = loop->num_frames - position < frames ? loop->num_frames - position : frames;
+
+        memcpy (dst, loop->audio + position * loop->channels, chunk * loop->channels * sizeof (int16_t));
+        dst += chunk * loop->channels;
+        position = (position + chunk) % loop->num_frames;
+        frames -= chunk;
+    }
+
+    stream->loop_position = (stream->loop_position + stream->block_frames) % loop->num_frames;
+}
+
+static inline uint32_t frame_value (const int16_t *frame, int channels)
+{
+    return (uint16_t) frame [0] | (uint32_t) (uint16_t) frame [channels - 1] << 16;
+}
+
+// Append the current block to the stream's input history, updating the rolling hash and anchors.
+
+static void append_history (Stream *stream)
+{
+    int channels = stream->loop->channels;
+
+    for (int i = 0; i < stream->block_frames; ++i) {
+        int64_t position = stream->received++;
+        int16_t *frame = stream->history + (position % stream->history_frames) * channels;
+
+        memcpy (frame, stream->block + i * channels, channels * sizeof (int16_t));
+        stream->rolling_hash = stream->rolling_hash * HASH_MULTIPLIER + frame_value (frame, channels);
+
+        if (position >= HASH_FRAMES)
+            stream->rolling_hash -= hash_power *
+                frame_value (stream->history + ((position - HASH_FRAMES) % stream->history_frames) * channels, channels);
+        else if (position < HASH_FRAMES - 1)
+            continue;
+
+        // don't let silence (or any constant signal that happens to hash to an anchor) flood the table
+
+        if (!(stream->rolling_hash >> (32 - ANCHOR_BITS)) && position - stream->last_anchor >= HASH_FRAMES) {
+            Anchor *anchor = stream->anchors + stream->num_anchors++ % MAX_ANCHORS;
+
+            anchor->hash = stream->rolling_hash;
+            anchor->position = stream->last_anchor = position;
+        }
+    }
+}
+
+// Return non-zero if the stream's history has the specified frames at the specified position.
+
+static int history_matches (Stream *stream, int64_t position, const int16_t *frames, int num_frames)
+{
+    int channels = stream->loop->channels;
+
+    if (position < 0 || position < stream->received - stream->history_frames || position + num_frames > stream->received)
+        return 0;
+
+    while (num_frames) {
+        int index = position % stream->history_frames;
+        int chunk = stream->history_frames - index < num_frames ? stream->history_frames - index : num_frames;
+
+        if (memcmp (stream->history + index * channels, frames, chunk * channels * sizeof (int16_t)))
+            return 0;
+
+        frames += chunk * channels;
+        position += chunk;
+        num_frames -= chunk;
+    }
+
+    return 1;
+}
+
+// Return non-zero if the last num_frames of the stream's history are in the other stream's history
+// at the specified position.
+
+static int histories_match (Stream *stream, Stream *other, int64_t position, int num_frames)
+{
+    int channels = stream->loop->channels;
+
+    for (int64_t start = stream->received - num_frames; num_frames;) {
+        int index = start % stream->history_frames;
+        int chunk = stream->history_frames - index < num_frames ? stream->history_frames - index : num_frames;
+
+        if (!history_matches (other, position, stream->history + index * channels, chunk))
+            return 0;
+
+        position += chunk;
+        start += chunk;
+        num_frames -= chunk;
+    }
+
+    return 1;
+}
+
+// After a stream has processed (and appended) a block on its own, look for another stream that
+// has the same audio, using the anchors of the block and a comparison of the audio. Everything
+// that's still in the level buffer and filters must be the same, so not just the block but all
+// the last PRIME_SECONDS must match (or all the audio, near the start). Only streams
+// that receive their blocks at the same time are candidates, and the leader must be at or before
+// the same block (because it will process ours from now on) and at or ahead in the audio (because
+// it must analyze every window before we use it). Called with the schedule mutex held.
+
+static void find_leader (Stream *stream)
+{
+    int channels = stream->loop->channels, step_frames = stream->sk->step_samples;
+    int64_t block_start = stream->received - stream->block_frames;
+    int match_frames = PRIME_SECONDS * stream->loop->sample_rate;
+
+    if (match_frames > stream->received)
+        match_frames = stream->received;
+
+    if (stream->followers)
+        return;
+
+    for (int a = stream->num_anchors - 1; a >= 0 && a >= stream->num_anchors - MAX_ANCHORS; --a) {
+        Anchor *anchor = stream->anchors + a % MAX_ANCHORS;
+
+        if (anchor->position < block_start)
+            break;
+
+        for (int i = 0; i < num_streams; ++i) {
+            Stream *leader = streams + i;
+
+            if (leader == stream || leader->busy || leader->leader || leader->loop->channels != channels ||
+                leader->loop->sample_rate != stream->loop->sample_rate || leader->block_frames != stream->block_frames ||
+                leader->start_offset != stream->start_offset || leader->batch != stream->batch || leader->next_block > stream->next_block)
+                    continue;
+
+            for (int b = 0; b < MAX_ANCHORS && b < leader->num_anchors; ++b) {
+                int64_t offset = leader->anchors [b].position - anchor->position;
+
+                if (leader->anchors [b].hash != anchor->hash || offset > 0 ||
+                    !history_matches (leader, block_start + offset, stream->block, stream->block_frames) ||
+                    !histories_match (stream, leader, stream->received - match_frames + offset, match_frames))
+                        continue;
+
+                if (offset % step_frames) {
+                    num_unaligned++;
+                    return;
+                }
+
+                if (!skipper_follow (stream->sk, leader->sk, offset)) {
+                    stream->leader = leader;
+                    stream->leader_offset = offset;
+                    stream->next_follower = leader->followers;
+                    leader->followers = stream;
+                    num_joins++;
+                }
+
+                return;
+            }
+        }
+    }
+}
+
+// Copy the most recent frames of the stream's history into a buffer.
+
+static void copy_history (Stream *stream, int16_t *frames, int num_frames)
+{
+    int channels = stream->loop->channels;
+
+    for (int64_t position = stream->received - num_frames; num_frames;) {
+        int index = position % stream->history_frames;
+        int chunk = stream->history_frames - index < num_frames ? stream->history_frames - index : num_frames;
+
+        memcpy (frames, stream->history + index * channels, chunk * channels * sizeof (int16_t));
+        frames += chunk * channels;
+        position += chunk;
+        num_frames -= chunk;
+    }
+}
+
+// Rebuild the front end of a stream that stopped following at a different point of the audio than
+// its leader from its own recent input (so that it doesn't have to wait for its level buffer to
+// refill).
+
+static void prime_stream (Stream *stream)
+{
+    int prime_frames = PRIME_SECONDS * stream->loop->sample_rate;
+    int16_t *prime_buffer;
+
+    if (prime_frames > stream->received)
+        prime_frames = stream->received;
+
+    if ((prime_buffer = malloc (prime_frames * stream->loop->channels * sizeof (int16_t)))) {
+        copy_history (stream, prime_buffer, prime_frames);
+        skipper_prime (stream->sk, prime_buffer, prime_frames);
+        free (prime_buffer);
+    }
+}
+
+// Stop following (with the schedule mutex held).
+
+static void leave_leader (Stream *stream)
+{
+    Stream **link = &stream->leader->followers;
+
+    while (*link != stream)
+        link = &(*link)->next_follower;
+
+    *link = stream->next_follower;
+    stream->leader = stream->next_follower = NULL;
+    num_divergences++;
+}
+
+static void finish_block (Stream *stream, int block, double cpu_start)
+{
+    double now = wall_clock ();
+
+    stream->cpu_seconds += thread_cpu_clock () - cpu_start;
+    stream->latencies [block] = now - block_arrival_time (stream, block);
+
+    if (now > block_deadline (stream, block))
+        stream->misses++;
+}
+
+/* A job is one block of a stream that isn't following another, and also the same block of all of
+ * its followers. The followers' blocks are compared to the leader's input first (before the
+ * leader processes its block, so a follower that differs can take over the leader's front end if
+ * it's at the same point) and the ones that differ stop following and go back to being scheduled
+ * on their own. The rest are processed after the leader, using its window scores. The followers
+ * of a stream only change in its own jobs, or while it's idle, so we can walk the list here
+ * without holding the lock.
+ */
+
+static void *worker_thread (void *ctx)
+{
+    int slept = 0;
+
+    trace_thread_name ("worker");
+
+    while (1) {
+        double wait_time;
+        Stream *stream;
+        int finished;
+
+        pthread_mutex_lock (&schedule_mutex);
+        stream = pick_stream (&wait_time, &finished);
+
+        if (adaptive && speed > 0.0) {
+            if (stream && !stream->batch && !slept) {
+                total_lateness += -wait_time / (stream->slack_seconds / speed);
+                num_lateness++;
+            }
+
+            govern (wall_clock ());
+        }
+
+        if (finished) {
+            pthread_mutex_unlock (&schedule_mutex);
+            break;
+        }
+
+        if (!stream || wait_time > 0.0) {
+            struct timespec sleep_time;
+
+            pthread_mutex_unlock (&schedule_mutex);
+
+            if (wait_time > 0.01) wait_time = 0.01;
+            sleep_time.tv_sec = 0;
+            sleep_time.tv_nsec = wait_time * 1e9;
+            nanosleep (&sleep_time, NULL);
+            slept = 1;
+            continue;
+        }
+
+        slept = 0;
+
+        int block = stream->next_block, degrade_level = stream->degrade_level;
+        stream->busy = 1;
+        pthread_mutex_unlock (&schedule_mutex);
+
+        if (degrade_level)
+            stream->degraded_blocks++;
+
+        skipper_degrade (stream->sk, degrade_level);
+
+        double cpu_start = thread_cpu_clock ();
+        int backlog = trace_enabled ? stream_backlog (stream, block) : 0;
+        uint64_t trace_start = TRACE_START ();
+        Stream *follower, *next;
+
+        read_block (stream, block);
+
+        if (!no_sharing) {
+            append_history (stream);
+
+            for (follower = stream->followers; follower; follower = next) {
+                next = follower->next_follower;
+
+                if (follower->next_block != block)
+                    continue;
+
+                double follower_cpu_start = thread_cpu_clock ();
+
+                read_block (follower, block);
+
+                if (!history_matches (stream, follower->received + follower->leader_offset, follower->block, follower->block_frames)) {
+                    skipper_follow (follower->sk, NULL, 0);
+
+                    // the front end can only come from the leader if it's at the same point of the audio
+
+                    if (follower->leader_offset)
+                        prime_stream (follower);
+
+                    append_history (follower);
+                    skipper_process (follower->sk, follower->block, follower->block_frames);
+                    finish_block (follower, block, follower_cpu_start);
+
+                    pthread_mutex_lock (&schedule_mutex);
+                    leave_leader (follower);
+                    follower->next_block++;
+                    pthread_mutex_unlock (&schedule_mutex);
+                }
+                else
+                    follower->cpu_seconds += thread_cpu_clock () - follower_cpu_start;
+            }
+        }
+
+        skipper_process (stream->sk, stream->block, stream->block_frames);
+        TRACE_SPAN ("block", trace_start, stream->index, backlog);
+        finish_block (stream, block, cpu_start);
+
+        for (follower = stream->followers; follower; follower = next) {
+            next = follower->next_follower;
+
+            if (follower->next_block != block)
+                continue;
+
+            double follower_cpu_start = thread_cpu_clock ();
+
+            trace_start = TRACE_START ();
+            append_history (follower);
+            skipper_process (follower->sk, follower->block, follower->block_frames);
+            TRACE_SPAN ("shared block", trace_start, follower->index, backlog);
+            finish_block (follower, block, follower_cpu_start);
+            follower->shared_blocks++;
+
+            pthread_mutex_lock (&schedule_mutex);
+
+            if (!follower->sk->leader) {    // the library ended it (the leader didn't have the scores)
+                if (follower->leader_offset)
+                    prime_stream (follower);
+
+                leave_leader (follower);
+            }
+
+            follower->next_block++;
+            pthread_mutex_unlock (&schedule_mutex);
+        }
+
+        pthread_mutex_lock (&schedule_mutex);
+        stream->next_block++;
+        stream->busy = 0;
+
+        if (!no_sharing && !stream->followers && stream->next_block < stream->num_blocks)
+            find_leader (stream);
+
+        pthread_mutex_unlock (&schedule_mutex);
+    }
+
+    return NULL;
+}
+
+static int compare_doubles (const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile (double *sorted, int count, double percent)
+{
+    int index = (int) floor (count * percent / 100.0);
+    return sorted [index < count ? index : count - 1];
+}
+
+int main (int argc, char **argv)
+{
+    double total_cpu = 0.0, total_audio = 0.0, batch_finish = 0.0, wall_time, *all_latencies;
+    int total_blocks = 0, live_blocks = 0, total_misses = 0, total_shared = 0, total_degraded = 0, all_count = 0;
+    size_t total_memory = 0;
+    char *trace_filename = NULL;
+    int trace_file_follows = 0;
+    pthread_t *threads;
+
+    if (argc == 1) {
+        fprintf (stderr, "%s", sign_on);
+        fprintf (stderr, "%s", usage);
+        return 0;
+    }
+
+    while (--argc) {
+        if ((**++argv == '-') && (*argv)[1])
+            while (*++*argv)
+                switch (**argv) {
+                    case 'A': case 'a':
+                        adaptive = 1;
+                        break;
+
+                    case 'B': case 'b':
+                        block_msecs = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'C': case 'c':
+                        ++*argv;
+                        num_channel_counts = parse_list (argv, channel_counts, MAX_CONFIGS);
+                        --*argv;
+                        break;
+
+                    case 'D': case 'd':
+                        duration_secs = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'E': case 'e':
+                        log_envelope = 1;
+                        break;
+
+                    case 'F': case 'f':
+                        num_feeds = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'G': case 'g':
+                        generic_pipeline = 1;
+                        break;
+
+                    case 'J': case 'j':
+                        num_workers = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'K': case 'k':
+                        num_batch = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'L': case 'l':
+                        ++*argv;
+                        num_slacks = parse_list (argv, slack_msecs, MAX_CONFIGS);
+                        --*argv;
+                        break;
+
+                    case 'M': case 'm':
+                        music_percent = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'N': case 'n':
+                        num_streams = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'O': case 'o':
+                        local_percent = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'P': case 'p':
+                        ++*argv;
+                        num_priorities = parse_list (argv, priorities, MAX_CONFIGS);
+                        --*argv;
+                        break;
+
+                    case 'Q': case 'q':
+                        fifo_schedule = 1;
+                        break;
+
+                    case 'R': case 'r':
+                        copy_delay_msecs = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'S': case 's':
+                        ++*argv;
+                        num_sample_rates = parse_list (argv, sample_rates, MAX_CONFIGS);
+                        --*argv;
+                        break;
+
+                    case 'T': case 't':
+                        trace_file_follows = 1;
+                        break;
+
+                    case 'U': case 'u':
+                        no_sharing = 1;
+                        break;
+
+                    case 'X': case 'x':
+                        speed = strtod (++*argv, argv);
+                        --*argv;
+                        break;
+
+                    default:
+                        fprintf (stderr, "\nillegal option: %c !\n", **argv);
+                        return 1;
+                }
+        else if (trace_file_follows) {
+            trace_filename = *argv;
+            trace_file_follows = 0;
+        }
+        else {
+            fprintf (stderr, "\nextra unknown argument: %s !\n", *argv);
+            return 1;
+        }
+    }
+
+    if (!num_workers)
+        num_workers = sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (!num_feeds || num_feeds > num_streams)
+        num_feeds = num_streams;
+
+    if (num_streams < 1 || num_workers < 1 || block_msecs < 10 || duration_secs < 1 || (int64_t) duration_secs * 1000 < block_msecs ||
+        music_percent < 0 || music_percent > 100 || !num_sample_rates || !num_channel_counts || !num_priorities || !num_slacks || num_feeds < 1 ||
+        num_batch < 0 || num_batch > num_streams || local_percent < 0 || local_percent > 100 || copy_delay_msecs < 0 || copy_delay_msecs > (HISTORY_SECONDS - 2) * 1000) {
+            fprintf (stderr, "\nerror: invalid parameters!\n");
+            return 1;
+    }
+
+    for (int i = 0; i < num_slacks; ++i)
+        if (slack_msecs [i] < 0) {
+            fprintf (stderr, "\nerror: invalid slack specified!\n");
+            return 1;
+        }
+
+    for (int i = 0; i < num_sample_rates; ++i)
+        if (sample_rates [i] < 11025 || sample_rates [i] > 96000) {
+            fprintf (stderr, "\nerror: invalid sample rate specified (11025 Hz - 96000 Hz only)\n");
+            return 1;
+        }
+
+    for (int i = 0; i < num_channel_counts; ++i)
+        if (channel_counts [i] < 1 || channel_counts [i] > 2) {
+            fprintf (stderr, "\nerror: channels must be 1 or 2\n");
+            return 1;
+        }
+
+    if (!(tensor = skipper_find_tensor ("default"))) {
+        fprintf (stderr, "\nerror: no tensor, exiting!\n");
+        return 1;
+    }
+
+    streams = calloc (num_streams, sizeof (Stream));
+    hash_power = 1;
+
+    for (int i = 0; i < HASH_FRAMES; ++i)
+        hash_power *= HASH_MULTIPLIER;
+
+    // the copies of a feed have the same format and arrival times, and start at the same point of
+    // the loop (minus the copy delay)
+
+    for (int i = 0; i < num_streams; ++i) {
+        Stream *stream = streams + i;
+        int feed = i % num_feeds;
+        SkipperConfig config;
+
+        memset (&config, 0, sizeof (config));
+        config.sample_rate = sample_rates [feed % num_sample_rates];
+        config.channels = channel_counts [feed % num_channel_counts];
+        config.skip_mode = SKIP_TALK;
+        config.quiet = 1;
+        config.tensor = tensor;
+        config.write_audio = count_output;
+        config.write_ctx = stream;
+        config.generic_pipeline = generic_pipeline;
+        config.log_envelope = log_envelope;
+        config.stream_id = i;
+
+        stream->index = i;
+        stream->copy = i / num_feeds;
+        stream->priority = priorities [i % num_priorities];
+        stream->loop = get_synth_loop (config.sample_rate, config.channels);
+        stream->loop_position = (int)((double) feed / num_feeds * stream->loop->num_frames);
+        stream->loop_position -= (int)((int64_t) config.sample_rate * copy_delay_msecs / 1000 * stream->copy % stream->loop->num_frames);
+        if (stream->loop_position < 0) stream->loop_position += stream->loop->num_frames;
+        stream->block_frames = (int)((int64_t) config.sample_rate * block_msecs / 1000);
+        stream->block_seconds = (double) stream->block_frames / config.sample_rate;
+        stream->num_blocks = (int)((int64_t) duration_secs * 1000 / block_msecs);
+        stream->start_offset = stream->block_seconds * feed / num_feeds;    // stagger arrivals
+        stream->slack_seconds = slack_msecs [i % num_slacks] ? slack_msecs [i % num_slacks] / 1000.0 : stream->block_seconds;
+        stream->batch = i >= num_streams - num_batch;
+        stream->latencies = calloc (stream->num_blocks, sizeof (double));
+        stream->block = malloc (stream->block_frames * config.channels * sizeof (int16_t));
+        stream->history_frames = HISTORY_SECONDS * config.sample_rate + stream->block_frames;
+        stream->history = no_sharing ? NULL : malloc (stream->history_frames * config.channels * sizeof (int16_t));
+        stream->last_anchor = -HASH_FRAMES;
+        stream->sk = skipper_create (&config);
+
+        if (!stream->latencies || !stream->block || (!no_sharing && !stream->history) || !stream->sk) {
+            fprintf (stderr, "\nerror: out of memory!\n");
+            return 1;
+        }
+    }
+
+    fprintf (stderr, "running %d streams (%d feeds) of %d seconds on %d worker threads at %s...\n",
+        num_streams, num_feeds, duration_secs, num_workers, speed > 0.0 ? "paced speed" : "maximum speed");
+
+    if (trace_filename) {
+        trace_init (TRACE_EVENTS);
+        trace_thread_name ("main");
+    }
+
+    threads = calloc (num_workers, sizeof (pthread_t));
+    start_time = wall_clock ();
+
+    for (int i = 0; i < num_workers; ++i)
+        pthread_create (threads + i, NULL, worker_thread, NULL);
+
+    for (int i = 0; i < num_workers; ++i)
+        pthread_join (threads [i], NULL);
+
+    wall_time = wall_clock () - start_time;
+    all_latencies = malloc (sizeof (double) * num_streams * streams [0].num_blocks);
+
+    fprintf (stderr, "\nstream  rate  ch slack ms   p50 ms   p95 ms   p99 ms   max ms  misses  cpu/audio  memory KB  written  shared degraded  pipeline\n");
+    fprintf (stderr, "------ ----- -- -------- -------- -------- -------- -------- ------- ---------- ---------- -------- ------- -------- ---------------\n");
+
+    // batch streams have no deadlines, so instead of latencies they just show when they finished
+    // (as the maximum, which is from the start)
+
+    for (int i = 0; i < num_streams; ++i) {
+        Stream *stream = streams + i;
+        double audio_seconds = stream->num_blocks * stream->block_seconds;
+        size_t memory = skipper_memory_usage (stream->sk);
+        char timing [64];
+
+        skipper_finish (stream->sk);
+        qsort (stream->latencies, stream->num_blocks, sizeof (double), compare_doubles);
+
+        if (stream->batch) {
+            sprintf (timing, "%8s %8s %8s %8s %8.2f %7s", "batch", "-", "-", "-", stream->latencies [stream->num_blocks - 1] * 1000.0, "-");
+
+            if (stream->latencies [stream->num_blocks - 1] > batch_finish)
+                batch_finish = stream->latencies [stream->num_blocks - 1];
+        }
+        else {
+            for (int b = 0; b < stream->num_blocks; ++b)
+                all_latencies [all_count++] = stream->latencies [b];
+
+            sprintf (timing, "%8.0f %8.2f %8.2f %8.2f %8.2f %7d", stream->slack_seconds * 1000.0,
+                percentile (stream->latencies, stream->num_blocks, 50) * 1000.0,
+                percentile (stream->latencies, stream->num_blocks, 95) * 1000.0,
+                percentile (stream->latencies, stream->num_blocks, 99) * 1000.0,
+                stream->latencies [stream->num_blocks - 1] * 1000.0, stream->misses);
+
+            live_blocks += stream->num_blocks;
+            total_misses += stream->misses;
+        }
+
+        fprintf (stderr, "%6d %5d %2d %s %9.4f%% %10lu %7.1f%% %6.1f%% %7.1f%%  %s\n", i,
+            stream->sk->config.sample_rate, stream->sk->config.channels, timing,
+            stream->cpu_seconds * 100.0 / audio_seconds, (unsigned long) (memory / 1024),
+            stream->frames_written * 100.0 / stream->sk->num_samples, stream->shared_blocks * 100.0 / stream->num_blocks,
+            stream->degraded_blocks * 100.0 / stream->num_blocks, skipper_pipeline_name (stream->sk));
+
+        total_cpu += stream->cpu_seconds;
+        total_audio += audio_seconds;
+        total_memory += memory;
+        total_blocks += stream->num_blocks;
+        total_shared += stream->shared_blocks;
+        total_degraded += stream->degraded_blocks;
+    }
+
+    qsort (all_latencies, all_count, sizeof (double), compare_doubles);
+
+    fprintf (stderr, "\nwall time = %.2f secs, audio processed = %.1f secs (%.1fx real time overall)\n",
+        wall_time, total_audio, total_audio / wall_time);
+
+    if (all_count) {
+        fprintf (stderr, "latency over all live blocks: p50 = %.2f ms, p95 = %.2f ms, p99 = %.2f ms, max = %.2f ms\n",
+            percentile (all_latencies, all_count, 50) * 1000.0, percentile (all_latencies, all_count, 95) * 1000.0,
+            percentile (all_latencies, all_count, 99) * 1000.0, all_latencies [all_count - 1] * 1000.0);
+        fprintf (stderr, "deadline misses = %d of %d live blocks (%.2f%%)\n", total_misses, live_blocks, total_misses * 100.0 / live_blocks);
+    }
+
+    if (num_batch)
+        fprintf (stderr, "batch streams = %d, all finished after %.2f secs (%.1fx real time each)\n",
+            num_batch, batch_finish, duration_secs / batch_finish);
+
+    if (!no_sharing)
+        fprintf (stderr, "shared analysis = %d of %d blocks (%.2f%%), %d joins, %d divergences, %d unaligned matches\n",
+            total_shared, total_blocks, total_shared * 100.0 / total_blocks, num_joins, num_divergences, num_unaligned);
+    if (adaptive)
+        fprintf (stderr, "degraded analysis = %d of %d blocks (%.2f%%), %d sheds, %d restores\n",
+            total_degraded, total_blocks, total_degraded * 100.0 / total_blocks, num_sheds, num_restores);
+
+    fprintf (stderr, "cpu per stream = %.3f%% of a core, memory per stream = %lu KB\n",
+        total_cpu * 100.0 / total_audio, (unsigned long) (total_memory / num_streams / 1024));
+
+    // this is only what the CPU time allows (scheduling, contention and slack are what decide
+    // whether that many streams actually meet their deadlines, so it's an upper bound)
+
+    fprintf (stderr, "cpu-bound stream ceiling = %.0f per core (%.0f on %ld cores), an upper bound%s\n\n",
+        floor (total_audio / total_cpu), floor (total_audio / total_cpu) * sysconf (_SC_NPROCESSORS_ONLN), sysconf (_SC_NPROCESSORS_ONLN),
+        total_misses ? " (this run missed deadlines, so fewer are sustainable)" : "");
+
+    for (int i = 0; i < num_streams; ++i) {
+        skipper_free (streams [i].sk);
+        free (streams [i].latencies);
+        free (streams [i].history);
+        free (streams [i].block);
+    }
+
+    for (int i = 0; i < num_synth_loops; ++i)
+        free (synth_loops [i].audio);
+
+    free (all_latencies);
+    free (threads);
+    free (streams);
+
+    if (trace_filename && trace_write (trace_filename))
+        return 1;
+
+    return 0;
+}
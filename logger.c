@@ -0,0 +1,303 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// logger.c
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ENABLE_THREADS
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "logger.h"
+
+/* This is a small asynchronous logger for the messages generated while
+ * processing audio. Rather than calling fprintf() on the processing path
+ * (which is slow and, worse, can block indefinitely on a stalled terminal
+ * or pipe) we just copy the event id and its binary arguments into a
+ * lock-free ring and return. A background thread pulls the records out,
+ * does the formatting and performs the actual writes. If the ring fills
+ * up the record is dropped (and counted) instead of blocking the caller.
+ *
+ * The ring is a bounded multi-producer queue where every slot carries a
+ * sequence number, so several processing threads may log to the same
+ * ring without locks; there is only ever one consumer.
+ *
+ * Without ENABLE_THREADS (or before log_init() is called) the events are
+ * simply formatted and written synchronously, which produces identical
+ * output.
+ */
+
+#define LOG_MAX_EVENTS  64
+#define LOG_IDLE_NSECS  1000000     // writer thread polling interval when idle
+
+static const char *log_formats [LOG_MAX_EVENTS];
+static int num_log_formats;
+static FILE *log_output;
+
+static void format_event (FILE *output, const char *format, int num_args, const log_arg *args);
+
+int log_register (const char *format)
+{
+    if (num_log_formats == LOG_MAX_EVENTS)
+        return -1;
+
+    log_formats [num_log_formats] = format;
+    return num_log_formats++;
+}
+
+#ifdef ENABLE_THREADS
+
+typedef struct {
+    atomic_size_t sequence;
+    int event_id, num_args;
+    log_arg args [LOG_MAX_ARGS];
+} log_record;
+
+static log_record *ring;
+static size_t ring_mask;
+static atomic_size_t enqueue_pos, flushed_pos;   // flushed_pos: records written and flushed
+static atomic_long dropped_records;
+static atomic_int running;
+static pthread_t writer_thread;
+
+static void *log_writer (void *ctx)
+{
+    size_t dequeue_pos = 0;
+
+    while (1) {
+        log_record *record = ring + (dequeue_pos & ring_mask);
+
+        if (atomic_load_explicit (&record->sequence, memory_order_acquire) == dequeue_pos + 1) {
+            format_event (log_output, log_formats [record->event_id], record->num_args, record->args);
+            atomic_store_explicit (&record->sequence, dequeue_pos + ring_mask + 1, memory_order_release);
+            dequeue_pos++;
+        }
+        else if (atomic_load (&running)) {
+            struct timespec idle = { 0, LOG_IDLE_NSECS };
+
+            // only tell log_flush() that records are written once they're out of the stdio buffer
+
+            fflush (log_output);
+            atomic_store_explicit (&flushed_pos, dequeue_pos, memory_order_release);
+            nanosleep (&idle, NULL);
+        }
+        else
+            break;
+    }
+
+    fflush (log_output);
+    return NULL;
+}
+
+// Start the writer thread with a ring of (at least) the specified number of records.
+
+void log_init (FILE *output, int ring_records)
+{
+    size_t ring_size = 16;
+
+    log_output = output;
+
+    while (ring_size < (size_t) ring_records)
+        ring_size <<= 1;
+
+    if (ring || !(ring = calloc (ring_size, sizeof (log_record))))
+        return;
+
+    for (size_t i = 0; i < ring_size; ++i)
+        atomic_init (&ring [i].sequence, i);
+
+    ring_mask = ring_size - 1;
+    atomic_store (&enqueue_pos, 0);
+    atomic_store (&flushed_pos, 0);
+    atomic_store (&dropped_records, 0);
+    atomic_store (&running, 1);
+
+    if (pthread_create (&writer_thread, NULL, log_writer, NULL)) {
+        free (ring);
+        ring = NULL;
+    }
+}
+
+void log_event (int event_id, int num_args, const log_arg *args)
+{
+    size_t pos;
+    log_record *record;
+
+    if (event_id < 0 || event_id >= num_log_formats)
+        return;
+
+    if (num_args > LOG_MAX_ARGS)
+        num_args = LOG_MAX_ARGS;
+
+    if (!ring) {
+        format_event (log_output ? log_output : stderr, log_formats [event_id], num_args, args);
+        return;
+    }
+
+    pos = atomic_load_explicit (&enqueue_pos, memory_order_relaxed);
+
+    while (1) {
+        record = ring + (pos & ring_mask);
+        size_t sequence = atomic_load_explicit (&record->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) pos;
+
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit (&enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (difference < 0) {
+            atomic_fetch_add_explicit (&dropped_records, 1, memory_order_relaxed);
+            return;
+        }
+        else
+            pos = atomic_load_explicit (&enqueue_pos, memory_order_relaxed);
+    }
+
+    record->event_id = event_id;
+    record->num_args = num_args;
+    memcpy (record->args, args, num_args * sizeof (log_arg));
+    atomic_store_explicit (&record->sequence, pos + 1, memory_order_release);
+}
+
+// Wait until everything logged so far has been written. This is not for the processing path,
+// but rather for before writing directly to the log output (e.g., final error messages).
+
+void log_flush (void)
+{
+    if (!ring) {
+        fflush (log_output ? log_output : stderr);
+        return;
+    }
+
+    size_t logged_pos = atomic_load (&enqueue_pos);
+
+    while (atomic_load_explicit (&flushed_pos, memory_order_acquire) < logged_pos) {
+        struct timespec idle = { 0, LOG_IDLE_NSECS };
+        nanosleep (&idle, NULL);
+    }
+}
+
+// Drain the ring, stop the writer thread and return the number of dropped records (which is
+// also reported on the log output, if non-zero).
+
+long log_close (void)
+{
+    long dropped;
+
+    if (!ring)
+        return 0;
+
+    atomic_store (&running, 0);
+    pthread_join (writer_thread, NULL);
+    dropped = atomic_load (&dropped_records);
+
+    if (dropped)
+        fprintf (log_output, "logger: %ld messages dropped (ring full)\n", dropped);
+
+    free (ring);
+    ring = NULL;
+    return dropped;
+}
+
+#else
+
+void log_init (FILE *output, int ring_records)
+{
+    log_output = output;
+}
+
+void log_event (int event_id, int num_args, const log_arg *args)
+{
+    if (event_id >= 0 && event_id < num_log_formats)
+        format_event (log_output ? log_output : stderr, log_formats [event_id], num_args > LOG_MAX_ARGS ? LOG_MAX_ARGS : num_args, args);
+}
+
+void log_flush (void)
+{
+    fflush (log_output ? log_output : stderr);
+}
+
+long log_close (void)
+{
+    return 0;
+}
+
+#endif
+
+// Format the event with its stored arguments. Since we can't construct a va_list, the format is
+// processed one conversion at a time, each with its own snprintf() and single argument.
+
+static void format_event (FILE *output, const char *format, int num_args, const log_arg *args)
+{
+    char buffer [1024], spec [32];
+    int length = 0, arg_index = 0;
+
+    while (*format && length < (int) sizeof (buffer) - 1) {
+        const char *start = format;
+        int spec_length, res, longs = 0;
+
+        if (*format != '%' || format [1] == '%') {
+            buffer [length++] = *format;
+            format += (*format == '%') ? 2 : 1;
+            continue;
+        }
+
+        while (*++format && !strchr ("diouxXeEfFgGcsp", *format))
+            if (*format == 'l') longs++;
+
+        if (!*format || arg_index == num_args || (spec_length = format - start + 1) >= (int) sizeof (spec))
+            break;
+
+        memcpy (spec, start, spec_length);
+        spec [spec_length] = 0;
+
+        switch (*format++) {
+            case 'd': case 'i': case 'c':
+                if (longs)
+                    res = snprintf (buffer + length, sizeof (buffer) - length, spec, (long long) args [arg_index].i);
+                else
+                    res = snprintf (buffer + length, sizeof (buffer) - length, spec, (int) args [arg_index].i);
+
+                break;
+
+            case 'o': case 'u': case 'x': case 'X':
+                if (longs)
+                    res = snprintf (buffer + length, sizeof (buffer) - length, spec, (unsigned long long) args [arg_index].i);
+                else
+                    res = snprintf (buffer + length, sizeof (buffer) - length, spec, (unsigned int) args [arg_index].i);
+
+                break;
+
+            case 's':
+                res = snprintf (buffer + length, sizeof (buffer) - length, spec, args [arg_index].s);
+                break;
+
+            case 'p':
+                res = snprintf (buffer + length, sizeof (buffer) - length, spec, (void *) args [arg_index].s);
+                break;
+
+            default:
+                res = snprintf (buffer + length, sizeof (buffer) - length, spec, args [arg_index].d);
+                break;
+        }
+
+        // if the conversion would be truncated, simply stop there
+
+        if (res < 0 || res >= (int) sizeof (buffer) - length)
+            break;
+
+        length += res;
+        arg_index++;
+    }
+
+    fwrite (buffer, 1, length, output);
+}
@@ -0,0 +1,49 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// logger.h
+
+#ifndef LOGGER_H_
+#define LOGGER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LOG_MAX_ARGS    14
+
+// A log argument is stored in binary and only formatted later by the writer thread. String
+// arguments are stored as pointers, so they must be literals (or otherwise outlive the logger).
+
+typedef union {
+    int64_t i;
+    double d;
+    const char *s;
+} log_arg;
+
+// Each event is registered once with a printf()-style format, and then logged with just its id
+// and arguments. Format conversions are limited to one argument each (no '*' widths).
+
+int log_register (const char *format);
+
+void log_init (FILE *output, int ring_records);
+void log_event (int event_id, int num_args, const log_arg *args);
+void log_flush (void);
+long log_close (void);
+
+// convenience wrappers to build the argument array in place
+
+#define LOG_I(v)    ((log_arg) { .i = (v) })
+#define LOG_D(v)    ((log_arg) { .d = (v) })
+#define LOG_S(v)    ((log_arg) { .s = (v) })
+
+#define LOG_EVENT(id, ...) do {                                                 \
+    const log_arg log_args_ [] = { __VA_ARGS__ };                               \
+    log_event ((id), sizeof (log_args_) / sizeof (log_args_ [0]), log_args_);   \
+} while (0)
+
+#endif /* LOGGER_H_ */
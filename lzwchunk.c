@@ -0,0 +1,374 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** LZW-AB ****                            //
+//               Adjusted Binary LZW Compressor/Decompressor              //
+//                  Copyright (c) 2016-2024 David Bryant                  //
+//                           All Rights Reserved                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "lzwlib.h"
+#include "lzwchunk.h"
+
+/* This module wraps the streaming LZW compressor in a simple container that
+ * splits the input into fixed-size chunks, each compressed independently
+ * with its own dictionary. Because no state is carried across chunk
+ * boundaries, any chunk can be decoded without touching the ones before it
+ * (random access) and all the chunks can be compressed or decompressed in
+ * parallel. The price is a little compression ratio at every boundary where
+ * the dictionary starts over, so chunks should not be made too small (a few
+ * hundred KB is a good compromise for data like the tensors).
+ *
+ * Threading is only available when built with ENABLE_THREADS (which requires
+ * pthreads); otherwise the "threads" parameters are ignored and the chunks are
+ * processed serially, producing identical results.
+ */
+
+#define MAX_THREADS 64
+
+typedef struct {
+    const unsigned char *buffer;
+    uint32_t size, index;
+} chunk_reader;
+
+typedef struct {
+    unsigned char *buffer;
+    uint32_t size, index, overflow;
+} chunk_writer;
+
+static int read_chunk (void *ctx)
+{
+    chunk_reader *stream = ctx;
+
+    if (stream->index == stream->size)
+        return EOF;
+
+    return stream->buffer [stream->index++];
+}
+
+static void write_chunk_growing (int value, void *ctx)
+{
+    chunk_writer *stream = ctx;
+
+    if (stream->overflow)
+        return;
+
+    if (stream->index == stream->size) {
+        unsigned char *new_buffer = realloc (stream->buffer, stream->size += (stream->size >> 1) + 256);
+
+        if (!new_buffer) {
+            stream->overflow = 1;
+            return;
+        }
+
+        stream->buffer = new_buffer;
+    }
+
+    stream->buffer [stream->index++] = value;
+}
+
+static void write_chunk_fixed (int value, void *ctx)
+{
+    chunk_writer *stream = ctx;
+
+    if (stream->index == stream->size)
+        stream->overflow = 1;
+    else
+        stream->buffer [stream->index++] = value;
+}
+
+static int decompress_chunk (const unsigned char *src, const struct lzw_chunk_header *header, uint32_t chunk_index, unsigned char *dst);
+
+// Shared context for a compress or decompress job. Worker threads pull chunk indices from
+// "next_chunk" until they run out; the first error encountered is latched in "error" (both are
+// only accessed under the mutex while the workers are running).
+
+typedef struct {
+    const unsigned char *src;
+    uint32_t src_size;
+    unsigned char *dst;
+    uint32_t dst_size;
+    struct lzw_chunk_header header;
+    chunk_writer *outputs;          // compress only: one growing output buffer per chunk
+    int maxbits, error;
+    uint32_t next_chunk;
+#ifdef ENABLE_THREADS
+    pthread_mutex_t mutex;
+#endif
+} chunk_job;
+
+static int next_chunk_index (chunk_job *job, uint32_t *chunk_index)
+{
+    int res = 0;
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_lock (&job->mutex);
+#endif
+
+    if (!job->error && job->next_chunk < job->header.num_chunks) {
+        *chunk_index = job->next_chunk++;
+        res = 1;
+    }
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_unlock (&job->mutex);
+#endif
+
+    return res;
+}
+
+// Latch an error in the job (under the lock, because next_chunk_index() reads it from any thread).
+
+static void set_error (chunk_job *job)
+{
+#ifdef ENABLE_THREADS
+    pthread_mutex_lock (&job->mutex);
+#endif
+
+    job->error = 1;
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_unlock (&job->mutex);
+#endif
+}
+
+static void *compress_worker (void *ctx)
+{
+    chunk_job *job = ctx;
+    uint32_t chunk_index;
+
+    while (next_chunk_index (job, &chunk_index)) {
+        uint32_t start = chunk_index * job->header.chunk_size;
+        chunk_writer *writer = job->outputs + chunk_index;
+        chunk_reader reader;
+
+        reader.buffer = job->src + start;
+        reader.size = job->src_size - start < job->header.chunk_size ? job->src_size - start : job->header.chunk_size;
+        reader.index = 0;
+
+        writer->size = reader.size + (reader.size >> 3) + 256;
+        writer->buffer = malloc (writer->size);
+        writer->index = writer->overflow = 0;
+
+        if (!writer->buffer || lzw_compress (write_chunk_growing, writer, read_chunk, &reader, job->maxbits) || writer->overflow)
+            set_error (job);
+    }
+
+    return NULL;
+}
+
+static void *decompress_worker (void *ctx)
+{
+    chunk_job *job = ctx;
+    uint32_t chunk_index;
+
+    while (next_chunk_index (job, &chunk_index))
+        if (decompress_chunk (job->src, &job->header, chunk_index, job->dst + chunk_index * job->header.chunk_size))
+            set_error (job);
+
+    return NULL;
+}
+
+// Run the specified worker over all the chunks of the job using up to "threads" threads (the
+// calling thread is always one of them, so with threads <= 1 nothing is spawned).
+
+static void run_chunk_job (chunk_job *job, void *(*worker)(void *), int threads)
+{
+#ifdef ENABLE_THREADS
+    pthread_t thread_ids [MAX_THREADS];
+    int spawned = 0;
+
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    if (threads > (int) job->header.num_chunks)
+        threads = job->header.num_chunks;
+
+    pthread_mutex_init (&job->mutex, NULL);
+
+    while (spawned < threads - 1 && !pthread_create (thread_ids + spawned, NULL, worker, job))
+        spawned++;
+
+    worker (job);
+
+    while (spawned--)
+        pthread_join (thread_ids [spawned], NULL);
+
+    pthread_mutex_destroy (&job->mutex);
+#else
+    worker (job);
+#endif
+}
+
+/* Compress "src_size" bytes at "src" into a newly allocated chunked container returned in "dst"
+ * (which the caller must free) with its size in "dst_size". The "chunk_size" specifies the number
+ * of uncompressed bytes per independent chunk and "maxbits" is passed to lzw_compress(). A
+ * non-zero return indicates an error (bad parameters or failed malloc()).
+ */
+
+int lzw_chunked_compress (const unsigned char *src, uint32_t src_size, unsigned char **dst, uint32_t *dst_size,
+    uint32_t chunk_size, int maxbits, int threads)
+{
+    uint32_t index_size, total_bytes, *offsets;
+    chunk_job job;
+
+    if (!chunk_size || maxbits < 9 || maxbits > 16)
+        return 1;
+
+    memset (&job, 0, sizeof (job));
+    memcpy (job.header.magic, LZW_CHUNK_MAGIC, sizeof (job.header.magic));
+    job.header.version = LZW_CHUNK_VERSION;
+    job.header.chunk_size = chunk_size;
+    job.header.num_chunks = (src_size + chunk_size - 1) / chunk_size;
+    job.header.total_size = src_size;
+    job.src = src;
+    job.src_size = src_size;
+    job.maxbits = maxbits;
+
+    if (job.header.num_chunks && !(job.outputs = calloc (job.header.num_chunks, sizeof (chunk_writer))))
+        return 1;
+
+    run_chunk_job (&job, compress_worker, threads);
+
+    index_size = (job.header.num_chunks + 1) * sizeof (uint32_t);
+    total_bytes = sizeof (job.header) + index_size;
+
+    for (uint32_t i = 0; i < job.header.num_chunks; ++i)
+        total_bytes += job.outputs [i].index;
+
+    if (!job.error && (*dst = malloc (total_bytes))) {
+        unsigned char *dptr = *dst + sizeof (job.header) + index_size;
+
+        memcpy (*dst, &job.header, sizeof (job.header));
+        offsets = (uint32_t *)(*dst + sizeof (job.header));
+        offsets [0] = 0;
+
+        for (uint32_t i = 0; i < job.header.num_chunks; ++i) {
+            memcpy (dptr, job.outputs [i].buffer, job.outputs [i].index);
+            offsets [i + 1] = offsets [i] + job.outputs [i].index;
+            dptr += job.outputs [i].index;
+        }
+
+        *dst_size = total_bytes;
+    }
+    else
+        job.error = 1;
+
+    for (uint32_t i = 0; i < job.header.num_chunks; ++i)
+        free (job.outputs [i].buffer);
+
+    free (job.outputs);
+    return job.error;
+}
+
+/* Validate the chunked container at "src" (including the entire chunk index) and return its
+ * header. This is the only validation performed on the container structure, so the other
+ * functions here call it too. Returns non-zero on a bad or truncated container.
+ */
+
+int lzw_chunked_info (const unsigned char *src, uint32_t src_size, struct lzw_chunk_header *header)
+{
+    uint64_t index_size;
+    uint32_t offset, prev_offset = 0;
+
+    if (src_size < sizeof (*header))
+        return 1;
+
+    memcpy (header, src, sizeof (*header));
+
+    if (memcmp (header->magic, LZW_CHUNK_MAGIC, sizeof (header->magic)) || header->version != LZW_CHUNK_VERSION || !header->chunk_size ||
+        header->num_chunks != (header->total_size + (uint64_t) header->chunk_size - 1) / header->chunk_size)
+            return 1;
+
+    // in 64 bits, so that a num_chunks of UINT32_MAX can't wrap around to an empty index
+
+    if ((src_size - sizeof (*header)) / sizeof (uint32_t) < (uint64_t) header->num_chunks + 1)
+        return 1;
+
+    index_size = ((uint64_t) header->num_chunks + 1) * sizeof (uint32_t);
+
+    for (uint32_t i = 0; i <= header->num_chunks; ++i) {
+        memcpy (&offset, src + sizeof (*header) + i * sizeof (uint32_t), sizeof (offset));
+
+        if (offset < prev_offset || (i == 0 && offset))
+            return 1;
+
+        prev_offset = offset;
+    }
+
+    return prev_offset > src_size - sizeof (*header) - index_size;
+}
+
+// Decompress one chunk from an already validated container (see lzw_chunked_decompress_chunk()).
+
+static int decompress_chunk (const unsigned char *src, const struct lzw_chunk_header *header, uint32_t chunk_index, unsigned char *dst)
+{
+    const unsigned char *data = src + sizeof (*header) + (header->num_chunks + 1) * sizeof (uint32_t);
+    uint32_t offsets [2], expected = header->total_size - chunk_index * header->chunk_size;
+    chunk_reader reader;
+    chunk_writer writer;
+
+    memcpy (offsets, src + sizeof (*header) + chunk_index * sizeof (uint32_t), sizeof (offsets));
+
+    if (expected > header->chunk_size)
+        expected = header->chunk_size;
+
+    reader.buffer = data + offsets [0];
+    reader.size = offsets [1] - offsets [0];
+    reader.index = 0;
+
+    writer.buffer = dst;
+    writer.size = expected;
+    writer.index = writer.overflow = 0;
+
+    if (lzw_decompress (write_chunk_fixed, &writer, read_chunk, &reader))
+        return 1;
+
+    return writer.overflow || writer.index != expected || reader.index != reader.size;
+}
+
+/* Decompress the single chunk "chunk_index" from the container at "src" into "dst", which must
+ * have room for a full chunk (or the remainder of the data, if this is the last chunk). None of
+ * the other chunks are touched, so this provides random access into the container.
+ */
+
+int lzw_chunked_decompress_chunk (const unsigned char *src, uint32_t src_size, uint32_t chunk_index, unsigned char *dst)
+{
+    struct lzw_chunk_header header;
+
+    if (lzw_chunked_info (src, src_size, &header) || chunk_index >= header.num_chunks)
+        return 1;
+
+    return decompress_chunk (src, &header, chunk_index, dst);
+}
+
+/* Decompress the entire container at "src" into "dst" (which must hold at least the total size
+ * stored in the header) using up to "threads" threads. Returns non-zero on any error.
+ */
+
+int lzw_chunked_decompress (const unsigned char *src, uint32_t src_size, unsigned char *dst, uint32_t dst_size, int threads)
+{
+    chunk_job job;
+
+    memset (&job, 0, sizeof (job));
+
+    if (lzw_chunked_info (src, src_size, &job.header) || dst_size < job.header.total_size)
+        return 1;
+
+    job.src = src;
+    job.src_size = src_size;
+    job.dst = dst;
+    job.dst_size = dst_size;
+
+    if (job.header.num_chunks)
+        run_chunk_job (&job, decompress_worker, threads);
+
+    return job.error;
+}
@@ -0,0 +1,38 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** LZW-AB ****                            //
+//               Adjusted Binary LZW Compressor/Decompressor              //
+//                  Copyright (c) 2016-2024 David Bryant                  //
+//                           All Rights Reserved                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+#ifndef LZWCHUNK_H_
+#define LZWCHUNK_H_
+
+#include <stdint.h>
+
+#define LZW_CHUNK_MAGIC     "LZWC"
+#define LZW_CHUNK_VERSION   1
+
+// The chunked container is this header, followed by an index of (num_chunks + 1)
+// uint32_t offsets (relative to the end of the index), followed by the independently compressed
+// chunks. Every chunk except the last decompresses to exactly chunk_size bytes.
+
+struct lzw_chunk_header {
+    char magic [4];
+    uint32_t version, chunk_size, num_chunks, total_size;
+};
+
+// The most that lzw_compress() can write for "n" bytes of input: a code of up to 16 bits for every
+// byte, which can also be followed by a clear code, plus the maxbits byte, the final code, the end
+// code and a partial byte. Used to bound the memory taken by containers of a known size.
+
+#define LZW_MAX_COMPRESSED(n) (4 * (uint64_t) (n) + 8)
+
+int lzw_chunked_compress (const unsigned char *src, uint32_t src_size, unsigned char **dst, uint32_t *dst_size,
+    uint32_t chunk_size, int maxbits, int threads);
+int lzw_chunked_info (const unsigned char *src, uint32_t src_size, struct lzw_chunk_header *header);
+int lzw_chunked_decompress_chunk (const unsigned char *src, uint32_t src_size, uint32_t chunk_index, unsigned char *dst);
+int lzw_chunked_decompress (const unsigned char *src, uint32_t src_size, unsigned char *dst, uint32_t dst_size, int threads);
+
+#endif /* LZWCHUNK_H_ */
@@ -325,15 +325,11 @@ int lzw_compress (void (*dst)(int,void*), void *dstctx, int (*src)(void*), void
     return 0;
 }
 
-/* LZW decompression function. Bytes (8-bit) are read and written through callbacks. The
- * "maxbits" parameter is read as the first byte in the stream and controls how much memory
- * is allocated for decoding. A return value of EOF from the "src" callback terminates the
- * decompression process (although this should not normally occur). A non-zero return value
- * indicates an error, which in this case can be a bad "maxbits" read from the stream, a
- * failed malloc(), or if an EOF is read from the input stream before the decompression
- * terminates naturally with END_CODE. There are contexts (void pointers) that are passed
- * to the callbacks to easily facilitate multiple instances of the decompression operation
- * (but simple applications can ignore these).
+/* LZW decompression. The decoder is a state object that is fed the compressed stream in
+ * pieces of any size (as they arrive from a file, socket or event loop) and writes the
+ * decompressed bytes either into a caller's buffer or through a callback, so it never has
+ * to wait for input. The "maxbits" parameter is the first byte in the stream and controls
+ * how much memory is allocated for decoding.
  */
 
 typedef struct {
@@ -341,92 +337,165 @@ typedef struct {
     unsigned short prefix;
 } decoder_entry_t;
 
-int lzw_decompress (void (*dst)(int,void*), void *dstctx, int (*src)(void*), void *srcctx)
-{
-    unsigned int maxcode = FIRST_STRING, next_string = FIRST_STRING - 1, prefix = CLEAR_CODE;
-    unsigned int dictionary_full = 0, max_available_code, total_codes;
-    unsigned int shifter = 0, bits = 0, read_byte, i;
+struct lzw_decoder {
+    unsigned int maxcode, next_string, prefix, dictionary_full, max_available_code, total_codes;
+    unsigned int shifter, bits;
     unsigned char *reverse_buffer, *referenced;
     decoder_entry_t *dictionary;
+    void (*dst)(int,void*);             // either a callback for each output byte
+    void *dstctx;
+    unsigned char *output;              // or a buffer to fill
+    size_t output_size, output_index;
+    int status;
+};
+
+static lzw_decoder *decoder_new (void)
+{
+    lzw_decoder *dec = calloc (1, sizeof (lzw_decoder));
 
-    if ((read_byte = ((*src)(srcctx))) == EOF || (read_byte & 0xf8))  //sanitize first byte
-        return 1;
+    if (dec) {
+        dec->maxcode = FIRST_STRING;
+        dec->next_string = FIRST_STRING - 1;
+        dec->prefix = CLEAR_CODE;
+    }
 
-    // based on the "maxbits" parameter, compute total codes and allocate dictionary storage
+    return dec;
+}
 
-    total_codes = 512 << (read_byte & 0x7);
-    max_available_code = total_codes - 2;
-    dictionary = malloc (total_codes * sizeof (decoder_entry_t));
-    reverse_buffer = malloc (total_codes - 256);
-    referenced = malloc (total_codes / 8);  // bitfield indicating code is referenced at least once
-
-    // Note that to implement the dictionary entry recycling we have to keep track of how many
-    // longer strings are based on each string in the dictionary. This can be between 0 (no
-    // references) to 256 (every possible next byte), but unfortunately that's one more value
-    // than what can be stored in a byte. The solution is to have a single bit for each entry
-    // indicating any references (i.e., the code cannot be recycled) and an additional byte
-    // in the dictionary entry struct counting the "extra" references (beyond one).
-
-    if (!reverse_buffer || !dictionary)         // check for malloc() failure
-        return 1;
+/* Create a decoder that writes its output to the specified buffer. Overflowing the buffer is
+ * an error, so it must be big enough for all the data (which is normally known beforehand).
+ * Returns NULL if out of memory.
+ */
 
-    for (i = 0; i < 256; ++i) {                 // these never change
-        dictionary [i].prefix = NULL_CODE;
-        dictionary [i].terminator = i;
+lzw_decoder *lzw_decoder_create (unsigned char *output, size_t output_size)
+{
+    lzw_decoder *dec = decoder_new ();
+
+    if (dec) {
+        dec->output = output;
+        dec->output_size = output_size;
     }
 
+    return dec;
+}
+
+/* Feed the next "num_bytes" of the compressed stream to the decoder. Returns LZW_NEED_INPUT
+ * if the stream isn't finished yet, LZW_FINISHED once the END_CODE has been decoded, or
+ * LZW_ERROR if the stream is corrupt (which includes anything after the END_CODE), the
+ * output buffer would overflow, or a malloc() failed. Once finished or in error, the same
+ * status is returned for every call.
+ */
+
+int lzw_decoder_feed (lzw_decoder *dec, const unsigned char *bytes, size_t num_bytes)
+{
+    const unsigned char *end = bytes + num_bytes;
+    unsigned int maxcode, next_string, prefix, shifter, bits;
+    decoder_entry_t *dictionary;
+    unsigned char *referenced;
+
+    if (dec->status != LZW_NEED_INPUT || !num_bytes)
+        return (dec->status == LZW_FINISHED && num_bytes) ? (dec->status = LZW_ERROR) : dec->status;
+
+    if (!dec->dictionary) {
+        unsigned int read_byte = *bytes++;
+
+        if (read_byte & 0xf8)               // sanitize first byte
+            return dec->status = LZW_ERROR;
+
+        // based on the "maxbits" parameter, compute total codes and allocate dictionary storage
+
+        dec->total_codes = 512 << (read_byte & 0x7);
+        dec->max_available_code = dec->total_codes - 2;
+        dec->dictionary = malloc (dec->total_codes * sizeof (decoder_entry_t));
+        dec->reverse_buffer = malloc (dec->total_codes - 256);
+        dec->referenced = calloc (dec->total_codes / 8, 1);    // bitfield indicating code is referenced at least once
+
+        // Note that to implement the dictionary entry recycling we have to keep track of how many
+        // longer strings are based on each string in the dictionary. This can be between 0 (no
+        // references) to 256 (every possible next byte), but unfortunately that's one more value
+        // than what can be stored in a byte. The solution is to have a single bit for each entry
+        // indicating any references (i.e., the code cannot be recycled) and an additional byte
+        // in the dictionary entry struct counting the "extra" references (beyond one).
+
+        if (!dec->reverse_buffer || !dec->dictionary || !dec->referenced)  // check for malloc() failure
+            return dec->status = LZW_ERROR;
+
+        for (int i = 0; i < 256; ++i) {     // these never change
+            dec->dictionary [i].prefix = NULL_CODE;
+            dec->dictionary [i].terminator = i;
+            dec->dictionary [i].extra_references = 0;
+        }
+    }
+
+    // the working state is kept in locals and stored back when we run out of input
+
+    maxcode = dec->maxcode;
+    next_string = dec->next_string;
+    prefix = dec->prefix;
+    shifter = dec->shifter;
+    bits = dec->bits;
+    dictionary = dec->dictionary;
+    referenced = dec->referenced;
+
     // This is the main loop where we read input symbols. The values range from 0 to the code value
     // of the "next" string in the dictionary (although the actual "next" code cannot be used yet,
-    // and so we reserve that code for the END_CODE). Note that receiving an EOF from the input
-    // stream is actually an error because we should have gotten the END_CODE first.
+    // and so we reserve that code for the END_CODE). A symbol can straddle calls, so we only take
+    // one once all of its bits are here (including the extra "adjusted binary" bit, if it needs it).
 
     while (1) {
         unsigned int code_bits = CODE_BITS (maxcode), code;
         unsigned int extras = (2 << code_bits) - maxcode - 1;
 
-        do {
-            if ((read_byte = ((*src)(srcctx))) == EOF) {
-                free (dictionary); free (reverse_buffer); free (referenced);
-                return 1;
-            }
+        while (bits < code_bits && bytes < end) {
+            shifter |= (unsigned int) *bytes++ << bits;
+            bits += 8;
+        }
 
-            shifter |= read_byte << bits;
-        } while ((bits += 8) < code_bits);
+        if (bits < code_bits)
+            break;
 
-        // first we assume the code will fit in the minimum number of required bits
+        // first we assume the code will fit in the minimum number of required bits,
+        // but if code >= extras, then we need another bit to calculate the real code
 
         code = shifter & ((1 << code_bits) - 1);
-        shifter >>= code_bits;
-        bits -= code_bits;
-
-        // but if code >= extras, then we need to read another bit to calculate the real code
-        // (this is the "adjusted binary" part)
 
         if (code >= extras) {
-            if (!bits) {
-                if ((read_byte = ((*src)(srcctx))) == EOF) {
-                    free (dictionary); free (reverse_buffer); free (referenced);
-                    return 1;
-                }
+            if (bits == code_bits) {
+                if (bytes == end)
+                    break;
 
-                shifter = read_byte;
-                bits = 8;
+                shifter |= (unsigned int) *bytes++ << bits;
+                bits += 8;
             }
 
-            code = (code << 1) - extras + (shifter & 1);
-            shifter >>= 1;
-            bits--;
+            code = (code << 1) - extras + ((shifter >> code_bits) & 1);
+            shifter >>= code_bits + 1;
+            bits -= code_bits + 1;
+        }
+        else {
+            shifter >>= code_bits;
+            bits -= code_bits;
         }
 
-        if (code == maxcode)                // sending the maximum code is reserved for the end of the file
+        if (code == maxcode) {              // sending the maximum code is reserved for the end of the file
+            dec->status = bytes == end ? LZW_FINISHED : LZW_ERROR;
             break;
+        }
         else if (code == CLEAR_CODE) {      // otherwise check for a CLEAR_CODE to start over early
             next_string = FIRST_STRING - 1;
             maxcode = FIRST_STRING;
-            dictionary_full = 0;
+            dec->dictionary_full = 0;
         }
         else if (prefix == CLEAR_CODE) {    // this only happens at the first symbol which is always sent
-            (*dst)(code, dstctx);           // literally and becomes our initial prefix
+            if (dec->dst)                   // literally and becomes our initial prefix
+                (*dec->dst)(code, dec->dstctx);
+            else if (dec->output_index < dec->output_size)
+                dec->output [dec->output_index++] = code;
+            else {
+                dec->status = LZW_ERROR;
+                break;
+            }
+
             next_string++;
             maxcode++;
         }
@@ -436,31 +505,53 @@ int lzw_decompress (void (*dst)(int,void*), void *dstctx, int (*src)(void*), voi
         // now (code == next_string).
         else {
             unsigned int cti = (code == next_string) ? prefix : code;
-            unsigned char *rbp = reverse_buffer, c;
+            unsigned char *rbp = dec->reverse_buffer, c;
 
             do {
                 *rbp++ = dictionary [cti].terminator;
-                if (rbp == reverse_buffer + total_codes - 256) {
-                    free (dictionary); free (reverse_buffer); free (referenced);
-                    return 1;
+                if (rbp == dec->reverse_buffer + dec->total_codes - 256) {
+                    dec->status = LZW_ERROR;
+                    break;
                 }
             } while ((cti = dictionary [cti].prefix) != NULL_CODE);
 
+            if (dec->status)
+                break;
+
             c = *--rbp;     // the first byte in this string is the terminator for the last string, which is
                             // the one that we'll create a new dictionary entry for this time
 
-            do      // send string in corrected order (except for the terminator which we don't know yet)
-                (*dst)(*rbp, dstctx);
-            while (rbp-- != reverse_buffer);
+            if (dec->dst) {
+                do      // send string in corrected order (except for the terminator which we don't know yet)
+                    (*dec->dst)(*rbp, dec->dstctx);
+                while (rbp-- != dec->reverse_buffer);
+
+                if (code == next_string)
+                    (*dec->dst)(c, dec->dstctx);
+            }
+            else {
+                size_t length = rbp - dec->reverse_buffer + 1 + (code == next_string);
+                unsigned char *out = dec->output + dec->output_index;
+
+                if (length > dec->output_size - dec->output_index) {
+                    dec->status = LZW_ERROR;
+                    break;
+                }
+
+                do
+                    *out++ = *rbp;
+                while (rbp-- != dec->reverse_buffer);
+
+                if (code == next_string)
+                    *out = c;
 
-            if (code == next_string) {
-                (*dst)(c,dstctx);
+                dec->output_index += length;
             }
 
             // This should always execute (the conditional is to catch corruptions) and is where we add a new string to
             // the dictionary, either at the end or elsewhere when we are "recycling" entries that were never referenced
 
-            if (next_string >= FIRST_STRING && next_string < total_codes) {
+            if (next_string >= FIRST_STRING && next_string < dec->total_codes) {
                 if (referenced [prefix >> 3] & (1 << (prefix & 7)))     // increment reference count on prefix
                     dictionary [prefix].extra_references++;
                 else
@@ -478,11 +569,11 @@ int lzw_decompress (void (*dst)(int,void*), void *dstctx, int (*src)(void*), voi
             // two less than total_codes because every string entry is available for matching, and the actual
             // maximum code is reserved for EOF.
 
-            if (!dictionary_full) {
+            if (!dec->dictionary_full) {
                 maxcode++;
 
-                if (++next_string > max_available_code) {
-                    dictionary_full = 1;
+                if (++next_string > dec->max_available_code) {
+                    dec->dictionary_full = 1;
                     maxcode--;
                 }
             }
@@ -492,8 +583,8 @@ int lzw_decompress (void (*dst)(int,void*), void *dstctx, int (*src)(void*), voi
             // has not been referenced). This also takes care of removing the entry to be recycled (which is
             // possible/easy because no longer strings have been based on it).
 
-            if (dictionary_full) {
-                for (next_string++; next_string <= max_available_code || (next_string = FIRST_STRING); next_string++)
+            if (dec->dictionary_full) {
+                for (next_string++; next_string <= dec->max_available_code || (next_string = FIRST_STRING); next_string++)
                     if (!(referenced [next_string >> 3] & (1 << (next_string & 7))))
                         break;
 
@@ -508,6 +599,62 @@ int lzw_decompress (void (*dst)(int,void*), void *dstctx, int (*src)(void*), voi
                             // (which we'll create once we find out the terminator)
     }
 
-    free (dictionary); free (reverse_buffer); free (referenced);
-    return 0;
+    dec->maxcode = maxcode;
+    dec->next_string = next_string;
+    dec->prefix = prefix;
+    dec->shifter = shifter;
+    dec->bits = bits;
+
+    return dec->status;
+}
+
+// Return the number of bytes written to the output buffer so far.
+
+size_t lzw_decoder_output (const lzw_decoder *dec)
+{
+    return dec->output_index;
+}
+
+void lzw_decoder_free (lzw_decoder *dec)
+{
+    if (dec) {
+        free (dec->dictionary);
+        free (dec->reverse_buffer);
+        free (dec->referenced);
+        free (dec);
+    }
+}
+
+/* LZW decompression function. Bytes (8-bit) are read and written through callbacks, with
+ * each byte read passed on to a decoder (above). A return value of EOF from the "src"
+ * callback terminates the decompression process (although this should not normally occur).
+ * A non-zero return value indicates an error, which in this case can be a bad "maxbits"
+ * read from the stream, a failed malloc(), or if an EOF is read from the input stream
+ * before the decompression terminates naturally with END_CODE. There are contexts (void
+ * pointers) that are passed to the callbacks to easily facilitate multiple instances of
+ * the decompression operation (but simple applications can ignore these).
+ */
+
+int lzw_decompress (void (*dst)(int,void*), void *dstctx, int (*src)(void*), void *srcctx)
+{
+    lzw_decoder *dec = decoder_new ();
+    int status = LZW_ERROR, read_byte;
+
+    if (!dec)
+        return 1;
+
+    dec->dst = dst;
+    dec->dstctx = dstctx;
+
+    // reading ahead would take bytes from the source that might not belong to us, so we go one at a time
+
+    while ((read_byte = (*src)(srcctx)) != EOF) {
+        unsigned char byte = read_byte;
+
+        if ((status = lzw_decoder_feed (dec, &byte, 1)) != LZW_NEED_INPUT)
+            break;
+    }
+
+    lzw_decoder_free (dec);
+    return status != LZW_FINISHED;
 }
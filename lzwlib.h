@@ -9,7 +9,22 @@
 #ifndef LZWLIB_H_
 #define LZWLIB_H_
 
+#include <stddef.h>
+
 int lzw_compress (void (*dst)(int,void*), void *dstctx, int (*src)(void*), void *srcctx, int maxbits);
 int lzw_decompress (void (*dst)(int,void*), void *dstctx, int (*src)(void*), void *srcctx);
 
+// resumable decoder that's fed the compressed stream in pieces (lzw_decoder_feed() returns status)
+
+#define LZW_NEED_INPUT  0
+#define LZW_FINISHED    1
+#define LZW_ERROR       (-1)
+
+typedef struct lzw_decoder lzw_decoder;
+
+lzw_decoder *lzw_decoder_create (unsigned char *output, size_t output_size);
+int lzw_decoder_feed (lzw_decoder *state, const unsigned char *bytes, size_t num_bytes);
+size_t lzw_decoder_output (const lzw_decoder *state);
+void lzw_decoder_free (lzw_decoder *state);
+
 #endif /* LZWLIB_H_ */
@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// model.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "model.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+#include <immintrin.h>
+#define MODEL_SSSE3
+#endif
+
+// Both dot product kernels compute exactly the same result because the inputs are limited to
+// 7 bits, so the pairwise 16-bit sums of _mm_maddubs_epi16() can never saturate.
+
+static int dot_product_scalar (const unsigned char *input, const signed char *weights)
+{
+    int sum = 0;
+
+    for (int i = 0; i < MODEL_INPUTS; ++i)
+        sum += input [i] * weights [i];
+
+    return sum;
+}
+
+#ifdef MODEL_SSSE3
+
+__attribute__ ((target ("ssse3")))
+static int dot_product_ssse3 (const unsigned char *input, const signed char *weights)
+{
+    const __m128i ones = _mm_set1_epi16 (1);
+    __m128i sum = _mm_setzero_si128 ();
+
+    for (int i = 0; i < MODEL_INPUTS; i += 16) {
+        __m128i products = _mm_maddubs_epi16 (_mm_loadu_si128 ((const __m128i *) (input + i)),
+            _mm_loadu_si128 ((const __m128i *) (weights + i)));
+
+        sum = _mm_add_epi32 (sum, _mm_madd_epi16 (products, ones));
+    }
+
+    sum = _mm_add_epi32 (sum, _mm_shuffle_epi32 (sum, 0x4e));
+    sum = _mm_add_epi32 (sum, _mm_shuffle_epi32 (sum, 0xb1));
+    return _mm_cvtsi128_si32 (sum);
+}
+
+#endif
+
+static int (*dot_product) (const unsigned char *input, const signed char *weights);
+
+static void select_kernel (void)
+{
+#ifdef MODEL_SSSE3
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("ssse3")) {
+        dot_product = dot_product_ssse3;
+        return;
+    }
+#endif
+    dot_product = dot_product_scalar;
+}
+
+const char *model_kernel_name (void)
+{
+    if (!dot_product)
+        select_kernel ();
+
+#ifdef MODEL_SSSE3
+    if (dot_product == dot_product_ssse3)
+        return "ssse3";
+#endif
+    return "scalar";
+}
+
+// Convert the analysis results of the current window and the history windows (newest first) into
+// the 7-bit model inputs. The range and cycles are small enough to use directly (but clipped) and
+// the others (which are 0-255 fractions) are halved.
+
+void model_build_input (unsigned char *input, const struct analysis_result *frames [MODEL_FRAMES])
+{
+    memset (input, 0, MODEL_INPUTS);
+
+    for (int f = 0; f < MODEL_FRAMES; ++f) {
+        const struct analysis_result *result = frames [f];
+        unsigned char *features = input + f * MODEL_FEATURES;
+
+        features [0] = result->range_dB > 127 ? 127 : result->range_dB;
+        features [1] = result->cycles > 127 ? 127 : result->cycles;
+        features [2] = result->low_third >> 1;
+        features [3] = result->mid_third >> 1;
+        features [4] = result->high_third >> 1;
+        features [5] = result->attack_ratio >> 1;
+        features [6] = result->peak_jitter >> 1;
+    }
+}
+
+// Evaluate the model for one window and return the result in the same range as the tensor values.
+// Only the scale, bias and squashing of each neuron are done in floating-point.
+
+int model_evaluate (const SkipperModel *model, const unsigned char *input)
+{
+    unsigned char hidden [MODEL_INPUTS] __attribute__ ((aligned (16))) = { 0 };
+    const unsigned char *layer_input = input;
+    double output;
+
+    if (!dot_product)
+        select_kernel ();
+
+    if (model->num_hidden) {
+        for (int n = 0; n < model->num_hidden; ++n) {
+            float value = dot_product (input, model->hidden_weights [n]) * model->hidden_scale [n] + model->hidden_bias [n];
+            hidden [n] = value <= 0.0f ? 0 : value >= 127.0f ? 127 : (int) (value + 0.5f);
+        }
+
+        layer_input = hidden;
+    }
+
+    output = dot_product (layer_input, model->output_weights) * model->output_scale + model->output_bias;
+    return (int) floor (99.0 * tanh (output * 0.5) + 0.5);
+}
+
+// Serialize the model after the header into a contiguous buffer (so that the checksum can be
+// calculated), returning the size, or zero on failure.
+
+static int model_payload (const SkipperModel *model, unsigned char **payload)
+{
+    int num_hidden = model->num_hidden;
+    int size = num_hidden * (MODEL_INPUTS + sizeof (float) * 2) + MODEL_INPUTS + sizeof (float) * 2;
+    unsigned char *buffer = malloc (size), *bp = buffer;
+
+    if (!buffer)
+        return 0;
+
+    memcpy (bp, model->hidden_weights, num_hidden * MODEL_INPUTS);
+    bp += num_hidden * MODEL_INPUTS;
+    memcpy (bp, model->hidden_scale, num_hidden * sizeof (float));
+    bp += num_hidden * sizeof (float);
+    memcpy (bp, model->hidden_bias, num_hidden * sizeof (float));
+    bp += num_hidden * sizeof (float);
+    memcpy (bp, model->output_weights, MODEL_INPUTS);
+    bp += MODEL_INPUTS;
+    memcpy (bp, &model->output_scale, sizeof (float));
+    bp += sizeof (float);
+    memcpy (bp, &model->output_bias, sizeof (float));
+
+    *payload = buffer;
+    return size;
+}
+
+int model_write (const SkipperModel *model, FILE *file)
+{
+    struct model_header header;
+    unsigned char *payload;
+    int payload_size = model_payload (model, &payload);
+
+    if (!payload_size)
+        return 0;
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, MODEL_MAGIC, sizeof (header.magic));
+    header.version = MODEL_VERSION;
+    header.frames = MODEL_FRAMES;
+    header.history_step = MODEL_HISTORY_STEP;
+    header.num_inputs = MODEL_INPUTS;
+    header.num_hidden = model->num_hidden;
+
+    for (int i = 0; i < payload_size; ++i)
+        header.checksum += payload [i];
+
+    if (fwrite (&header, sizeof (header), 1, file) != 1 || fwrite (payload, payload_size, 1, file) != 1) {
+        free (payload);
+        return 0;
+    }
+
+    free (payload);
+    return sizeof (header) + payload_size;
+}
+
+// Load a model from a memory image of the file, returning TRUE on success.
+
+int model_read (SkipperModel *model, const unsigned char *data, int data_size)
+{
+    struct model_header header;
+    uint32_t checksum = 0;
+    int payload_size;
+
+    if (data_size < (int) sizeof (header)) {
+        fprintf (stderr, "invalid model!\n");
+        return 0;
+    }
+
+    memcpy (&header, data, sizeof (header));
+    data += sizeof (header);
+    data_size -= sizeof (header);
+
+    if (memcmp (header.magic, MODEL_MAGIC, sizeof (header.magic)) || header.version != MODEL_VERSION ||
+        header.frames != MODEL_FRAMES || header.history_step != MODEL_HISTORY_STEP ||
+        header.num_inputs != MODEL_INPUTS || header.num_hidden > MODEL_MAX_HIDDEN) {
+            fprintf (stderr, "invalid model!\n");
+            return 0;
+    }
+
+    payload_size = header.num_hidden * (MODEL_INPUTS + sizeof (float) * 2) + MODEL_INPUTS + sizeof (float) * 2;
+
+    for (int i = 0; i < data_size; ++i)
+        checksum += data [i];
+
+    if (data_size != payload_size || checksum != header.checksum) {
+        fprintf (stderr, "model is corrupt!\n");
+        return 0;
+    }
+
+    memset (model, 0, sizeof (*model));
+    model->num_hidden = header.num_hidden;
+
+    memcpy (model->hidden_weights, data, model->num_hidden * MODEL_INPUTS);
+    data += model->num_hidden * MODEL_INPUTS;
+    memcpy (model->hidden_scale, data, model->num_hidden * sizeof (float));
+    data += model->num_hidden * sizeof (float);
+    memcpy (model->hidden_bias, data, model->num_hidden * sizeof (float));
+    data += model->num_hidden * sizeof (float);
+    memcpy (model->output_weights, data, MODEL_INPUTS);
+    data += MODEL_INPUTS;
+    memcpy (&model->output_scale, data, sizeof (float));
+    data += sizeof (float);
+    memcpy (&model->output_bias, data, sizeof (float));
+
+    return 1;
+}
@@ -0,0 +1,71 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// model.h
+
+#ifndef MODEL_H_
+#define MODEL_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "skipper.h"
+
+/* A small quantized classifier that is an alternative to the 4D tensor. It
+ * uses all seven analysis features of the current window plus the same
+ * features from one and two seconds earlier, and is either a logistic
+ * regression (no hidden layer) or a single hidden layer MLP. The inputs and
+ * hidden activations are 7-bit unsigned, the weights are signed bytes, and
+ * the dot products are exact in 32 bits (and in the 16-bit pairwise sums of
+ * the SSSE3 kernel). The result is scaled to -99 to +99, just like the
+ * tensor values.
+ *
+ * The model file is a model_header followed by (for each hidden neuron) the
+ * weights, then the hidden scales and biases (floats), then the output weights
+ * and finally the output scale and bias.
+ */
+
+#define MODEL_MAGIC         "SKMD"
+#define MODEL_VERSION       1
+
+#define MODEL_FEATURES      7       // per window (everything in analysis_result but spare)
+#define MODEL_FRAMES        3       // current window and two history windows
+#define MODEL_HISTORY_STEP  5       // windows between frames (5 * 200 ms = 1 second)
+#define MODEL_HISTORY_LEN   ((MODEL_FRAMES - 1) * MODEL_HISTORY_STEP + 1)
+#define MODEL_INPUTS        32      // MODEL_FRAMES * MODEL_FEATURES, padded for SIMD
+#define MODEL_MAX_HIDDEN    32
+
+struct model_header {
+    char magic [4];
+    uint32_t version, checksum;
+    unsigned char frames, history_step, num_inputs, num_hidden;
+};
+
+typedef struct {
+    signed char hidden_weights [MODEL_MAX_HIDDEN] [MODEL_INPUTS] __attribute__ ((aligned (16)));
+    signed char output_weights [MODEL_INPUTS] __attribute__ ((aligned (16)));
+    float hidden_scale [MODEL_MAX_HIDDEN], hidden_bias [MODEL_MAX_HIDDEN];
+    float output_scale, output_bias;
+    int num_hidden;                 // 0 = logistic regression on the inputs
+} SkipperModel;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void model_build_input (unsigned char *input, const struct analysis_result *frames [MODEL_FRAMES]);
+int model_evaluate (const SkipperModel *model, const unsigned char *input);
+int model_write (const SkipperModel *model, FILE *file);
+int model_read (SkipperModel *model, const unsigned char *data, int data_size);
+const char *model_kernel_name (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODEL_H_ */
@@ -0,0 +1,597 @@
+////////////////////////////////////////////////////////////////////////////
+//                           **** PARAMOPT ****                           //
+//               Decision Parameter Optimizer for Skipper                 //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "skipperlib.h"
+
+static const char *sign_on = "\n"
+" PARAMOPT  Decision Parameter Optimizer for Skipper  Version 0.1\n"
+" Copyright (c) 2024 David Bryant. All Rights Reserved.\n\n";
+
+static const char *usage =
+" Usage:     PARAMOPT [-options] music.bin talk.bin\n"
+"            PARAMOPT [-options] -l program.bin labels.txt [program.bin labels.txt ...]\n\n"
+" Operation: look up the window scores of a labeled corpus (analysis results\n"
+"            from SKIPPER -a) once, replay the decision logic over them for a\n"
+"            grid of decision parameters, and show the parameters on the Pareto\n"
+"            front of accuracy versus detection latency; the corpus is either\n"
+"            synthesized from all-music and all-talk files (as for TENSOR-GEN)\n"
+"            or programs with label files of \"[[hh:]mm:]ss music|talk\" lines\n"
+"            (the content from each time on)\n\n"
+" Options:  -d <name|file> = tensor for the window scores (default = embedded)\n"
+"           -j<n>          = worker threads (default = online CPUs)\n"
+"           -l             = files are programs and their labels\n"
+"           -m<n>          = maximum mean latency in seconds of the chosen\n"
+"                            parameters (default = the most accurate overall)\n"
+"           -n<n>          = minutes of corpus to synthesize (default 120)\n"
+"           -o <file>      = write the chosen parameters to file (for SKIPPER\n"
+"                            --params)\n\n"
+" Web:      Visit www.github.com/dbry/skipper for latest version and info\n\n";
+
+#define MAX_PROGRAMS    64
+
+// lengths of the segments of the synthesized corpus (roughly those of music radio)
+
+#define MUSIC_MIN_SECS  120
+#define MUSIC_MAX_SECS  360
+#define TALK_MIN_SECS   30
+#define TALK_MAX_SECS   180
+
+// The grid of parameters tried, in seconds (and threshold points).
+
+static const double average_secs [] = { 2, 3, 4, 5, 6, 8, 10 };
+static const double min_music_secs [] = { 5, 10, 15, 20, 25, 30 };
+static const double min_talk_secs [] = { 3, 5, 7.5, 10, 15, 20 };
+static const double max_pend_secs [] = { 20, 40, 60 };
+static const int thresholds [] = { -20, -15, -10, -5, 0, 5, 10, 15, 20 };
+
+#define COUNT(a) ((int) (sizeof (a) / sizeof ((a) [0])))
+
+#define NUM_COMBOS (COUNT (average_secs) * COUNT (min_music_secs) * COUNT (min_talk_secs) * COUNT (max_pend_secs) * COUNT (thresholds))
+
+// A program of the corpus: the window scores (one per STEP_MSECS) and the true mode at the center
+// of each window (MODE_NOTHING before the first label, which isn't scored), with the windows where
+// the true mode changes (including the first labeled window).
+
+typedef struct {
+    signed char *scores, *labels;
+    int num_windows, *boundaries, num_boundaries;
+} Program;
+
+typedef struct {
+    SkipperParams params;
+    int threshold;
+    int64_t errors;             // windows where the detected mode (after the fact) was wrong
+    int matched, missed, false_alarms;
+    double latency;             // mean time from a true transition to confirming it
+} Result;
+
+static Program programs [MAX_PROGRAMS];
+static int num_programs, total_windows, labeled_windows, total_boundaries;
+static Result *results;
+static atomic_int next_combo;
+
+static tensor_array *tensor;
+
+static int load_scores (const char *filename, signed char **scores);
+static int load_labels (const char *filename, Program *program);
+static void synthesize_corpus (signed char *music, int music_windows, signed char *talk, int talk_windows, int minutes);
+static void find_boundaries (Program *program);
+static void *worker_thread (void *arg);
+static void score_combo (Result *result, SkipperDecision *decisions, int max_decisions);
+static int write_params_file (const Result *result, const char *filename);
+static void display_result (const Result *result);
+static double wall_clock (void);
+
+int main (int argc, char **argv)
+{
+    int labeled = 0, num_workers = 0, synth_minutes = 120, tensor_file_follows = 0, output_file_follows = 0;
+    char *tensor_name = NULL, *output_filename = NULL, *filenames [MAX_PROGRAMS * 2];
+    int num_filenames = 0, num_front = 0, chosen = -1;
+    double max_latency = 0.0, start_time, elapsed;
+    Result **front, baseline;
+    pthread_t *threads;
+
+    if (argc == 1) {
+        fprintf (stderr, "%s", sign_on);
+        fprintf (stderr, "%s", usage);
+        return 0;
+    }
+
+    while (--argc) {
+        if ((**++argv == '-') && (*argv)[1])
+            while (*++*argv)
+                switch (**argv) {
+                    case 'D': case 'd':
+                        tensor_file_follows = 1;
+                        break;
+
+                    case 'J': case 'j':
+                        num_workers = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'L': case 'l':
+                        labeled = 1;
+                        break;
+
+                    case 'M': case 'm':
+                        max_latency = strtod (++*argv, argv);
+                        --*argv;
+                        break;
+
+                    case 'N': case 'n':
+                        synth_minutes = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'O': case 'o':
+                        output_file_follows = 1;
+                        break;
+
+                    default:
+                        fprintf (stderr, "\nillegal option: %c !\n", **argv);
+                        return 1;
+                }
+        else if (tensor_file_follows) {
+            tensor_name = *argv;
+            tensor_file_follows = 0;
+        }
+        else if (output_file_follows) {
+            output_filename = *argv;
+            output_file_follows = 0;
+        }
+        else if (num_filenames < MAX_PROGRAMS * 2)
+            filenames [num_filenames++] = *argv;
+        else {
+            fprintf (stderr, "\ntoo many files (%d programs max) !\n", MAX_PROGRAMS);
+            return 1;
+        }
+    }
+
+    if (labeled ? (!num_filenames || (num_filenames & 1)) : num_filenames != 2) {
+        fprintf (stderr, labeled ? "\nerror: need pairs of program and label files!\n" : "\nerror: need music and talk files!\n");
+        return 1;
+    }
+
+    if (synth_minutes < 1 || num_workers < 0 || max_latency < 0.0) {
+        fprintf (stderr, "\nerror: invalid option value!\n");
+        return 1;
+    }
+
+    if (!(tensor = skipper_find_tensor (tensor_name ? tensor_name : "default")) && tensor_name &&
+        (tensor = malloc (sizeof (tensor_array))) && !skipper_read_tensor_file (*tensor, tensor_name)) {
+            free (tensor);
+            tensor = NULL;
+    }
+
+    if (!tensor) {
+        fprintf (stderr, "\nerror: no tensor file, exiting!\n");
+        return 1;
+    }
+
+    // the scores are looked up once, and then every replay is just a pass over them
+
+    if (labeled)
+        for (int i = 0; i < num_filenames; i += 2) {
+            Program *program = programs + num_programs++;
+
+            if (!(program->num_windows = load_scores (filenames [i], &program->scores)) || load_labels (filenames [i + 1], program))
+                return 1;
+        }
+    else {
+        signed char *music, *talk;
+        int music_windows = load_scores (filenames [0], &music), talk_windows = load_scores (filenames [1], &talk);
+
+        if (!music_windows || !talk_windows)
+            return 1;
+
+        synthesize_corpus (music, music_windows, talk, talk_windows, synth_minutes);
+        free (music);
+        free (talk);
+    }
+
+    for (int i = 0; i < num_programs; ++i) {
+        find_boundaries (programs + i);
+        total_windows += programs [i].num_windows;
+        total_boundaries += programs [i].num_boundaries;
+    }
+
+    fprintf (stderr, "corpus: %d program%s, %.1f minutes, %d windows, %d transitions\n", num_programs, num_programs > 1 ? "s" : "",
+        total_windows * STEP_MSECS / 60000.0, total_windows, total_boundaries);
+
+    if (!num_workers)
+        num_workers = sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (num_workers < 1)
+        num_workers = 1;
+
+    results = calloc (NUM_COMBOS, sizeof (Result));
+    threads = calloc (num_workers, sizeof (pthread_t));
+    front = calloc (NUM_COMBOS, sizeof (Result *));
+
+    if (!results || !threads || !front) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        return 1;
+    }
+
+    start_time = wall_clock ();
+
+    for (int i = 0; i < num_workers; ++i)
+        pthread_create (threads + i, NULL, worker_thread, NULL);
+
+    for (int i = 0; i < num_workers; ++i)
+        pthread_join (threads [i], NULL);
+
+    elapsed = wall_clock () - start_time;
+
+    fprintf (stderr, "replayed %d parameter sets in %.2f secs (%d thread%s, %.0f M windows/sec)\n\n", NUM_COMBOS, elapsed,
+        num_workers, num_workers > 1 ? "s" : "", (double) NUM_COMBOS * total_windows / elapsed / 1e6);
+
+    // The Pareto front: sorted by latency (then errors), a result is on it if it has fewer errors
+    // than everything before it. Results that found no transitions at all have no latency.
+
+    for (int i = 0; i < NUM_COMBOS; ++i)
+        if (results [i].matched)
+            front [num_front++] = results + i;
+
+    for (int i = 1; i < num_front; ++i)
+        for (int j = i; j && (front [j - 1]->latency > front [j]->latency ||
+            (front [j - 1]->latency == front [j]->latency && front [j - 1]->errors > front [j]->errors)); --j) {
+                Result *temp = front [j - 1];
+                front [j - 1] = front [j];
+                front [j] = temp;
+        }
+
+    int count = 0;
+
+    for (int i = 0; i < num_front; ++i)
+        if (!count || front [i]->errors < front [count - 1]->errors)
+            front [count++] = front [i];
+
+    num_front = count;
+
+    // going along the front the errors go down and the latency goes up, so the last one within
+    // the latency limit is the most accurate
+
+    fprintf (stderr, " errors  latency  missed  false  average  min music  min talk  max pend  threshold\n");
+
+    for (int i = 0; i < num_front; ++i) {
+        display_result (front [i]);
+
+        if (!max_latency || front [i]->latency <= max_latency)
+            chosen = i;
+    }
+
+    // the defaults, for reference
+
+    memset (&baseline, 0, sizeof (baseline));
+    skipper_default_params (&baseline.params);
+    score_combo (&baseline, NULL, 0);
+    fprintf (stderr, "\n defaults:\n");
+    display_result (&baseline);
+
+    if (chosen < 0) {
+        fprintf (stderr, "\nno parameters found with a mean latency of %.1f secs or less!\n", max_latency);
+        return 1;
+    }
+
+    fprintf (stderr, "\n chosen:\n");
+    display_result (front [chosen]);
+
+    if (output_filename && write_params_file (front [chosen], output_filename))
+        return 1;
+
+    return 0;
+}
+
+// Each worker takes the next parameter combination until they're all done. The combination index
+// selects from the grid like a number with mixed radix (threshold varying fastest).
+
+static void *worker_thread (void *arg)
+{
+    SkipperDecision *decisions = malloc (total_windows * sizeof (SkipperDecision));
+    int combo;
+
+    if (!decisions)
+        return NULL;
+
+    while ((combo = atomic_fetch_add (&next_combo, 1)) < NUM_COMBOS) {
+        Result *result = results + combo;
+        int index = combo;
+
+        result->threshold = thresholds [index % COUNT (thresholds)];
+        index /= COUNT (thresholds);
+        result->params.max_pend_windows = (int) floor (max_pend_secs [index % COUNT (max_pend_secs)] * 1000.0 / STEP_MSECS + 0.5);
+        index /= COUNT (max_pend_secs);
+        result->params.min_talk_windows = (int) floor (min_talk_secs [index % COUNT (min_talk_secs)] * 1000.0 / STEP_MSECS + 0.5);
+        index /= COUNT (min_talk_secs);
+        result->params.min_music_windows = (int) floor (min_music_secs [index % COUNT (min_music_secs)] * 1000.0 / STEP_MSECS + 0.5);
+        index /= COUNT (min_music_secs);
+        result->params.average_windows = (int) floor (average_secs [index] * 1000.0 / STEP_MSECS + 0.5);
+
+        score_combo (result, decisions, total_windows);
+    }
+
+    free (decisions);
+    return NULL;
+}
+
+/* Replay all the programs with one set of parameters and score the decisions against the labels.
+ * Like Skipper's output, the detected mode applies from the start of each transition (which is
+ * half the window and average before the window where it started pending) and there is no mode
+ * until the first one. A true transition is matched by the first confirmed transition to the same
+ * mode at or after it (and before the next true one), and its latency is from the true transition
+ * to the end of the window where that was confirmed (the lookahead needed to skip it cleanly).
+ */
+
+static void score_combo (Result *result, SkipperDecision *decisions, int max_decisions)
+{
+    SkipperDecision *local = NULL;
+    double latency_sum = 0.0;
+    int total_decisions = 0;
+
+    if (!decisions && !(decisions = local = malloc (total_windows * sizeof (SkipperDecision))))
+        return;
+
+    if (!max_decisions)
+        max_decisions = total_windows;
+
+    for (int p = 0; p < num_programs; ++p) {
+        const Program *program = programs + p;
+        int num_decisions = skipper_replay (program->scores, program->num_windows, &result->params, result->threshold,
+            decisions, max_decisions), d = 0, mode = MODE_NOTHING;
+        double offset = result->params.average_windows / 2.0;
+
+        if (num_decisions < 0)
+            break;
+
+        for (int w = 0; w < program->num_windows; ++w) {
+            while (d < num_decisions && decisions [d].start_window - offset <= w)
+                mode = decisions [d++].mode;
+
+            if (program->labels [w] && mode != program->labels [w])
+                result->errors++;
+        }
+
+        for (int b = 0, m = 0; b < program->num_boundaries; ++b) {
+            int boundary = program->boundaries [b];
+            int next = b + 1 < program->num_boundaries ? program->boundaries [b + 1] : program->num_windows;
+
+            while (m < num_decisions && (decisions [m].confirm_window < boundary ||
+                (decisions [m].confirm_window < next && decisions [m].mode != program->labels [boundary])))
+                    m++;
+
+            if (m < num_decisions && decisions [m].confirm_window < next) {
+                latency_sum += (decisions [m].confirm_window - boundary) * STEP_MSECS / 1000.0 + WINDOW_SECONDS / 2.0;
+                result->matched++;
+                m++;
+            }
+            else
+                result->missed++;
+        }
+
+        total_decisions += num_decisions;
+    }
+
+    result->false_alarms = total_decisions - result->matched;
+    result->latency = result->matched ? latency_sum / result->matched : 0.0;
+    free (local);
+}
+
+static void display_result (const Result *result)
+{
+    fprintf (stderr, " %5.2f%%  %5.1f s  %6d  %5d  %5.1f s  %7.1f s  %6.1f s  %6.1f s  %7d\n",
+        result->errors * 100.0 / labeled_windows, result->latency, result->missed, result->false_alarms,
+        result->params.average_windows * STEP_MSECS / 1000.0, result->params.min_music_windows * STEP_MSECS / 1000.0,
+        result->params.min_talk_windows * STEP_MSECS / 1000.0, result->params.max_pend_windows * STEP_MSECS / 1000.0,
+        result->threshold);
+}
+
+static int write_params_file (const Result *result, const char *filename)
+{
+    FILE *file = fopen (filename, "w");
+
+    if (!file) {
+        fprintf (stderr, "\nerror: can't open \"%s\" for writing!\n", filename);
+        return 1;
+    }
+
+    fprintf (file, "# skipper decision parameters (from paramopt: %.2f%% errors, %.1f secs mean latency)\n",
+        result->errors * 100.0 / labeled_windows, result->latency);
+    fprintf (file, "average_secs %g\n", result->params.average_windows * STEP_MSECS / 1000.0);
+    fprintf (file, "min_music_secs %g\n", result->params.min_music_windows * STEP_MSECS / 1000.0);
+    fprintf (file, "min_talk_secs %g\n", result->params.min_talk_windows * STEP_MSECS / 1000.0);
+    fprintf (file, "max_pend_secs %g\n", result->params.max_pend_windows * STEP_MSECS / 1000.0);
+    fprintf (file, "threshold %d\n", result->threshold);
+
+    if (fclose (file)) {
+        fprintf (stderr, "\nerror: can't write \"%s\"!\n", filename);
+        return 1;
+    }
+
+    fprintf (stderr, "\nparameters written to %s\n", filename);
+    return 0;
+}
+
+// Load an analysis results file and look up the score of every window. Returns the number of
+// windows (zero on error).
+
+static int load_scores (const char *filename, signed char **scores)
+{
+    FILE *file = fopen (filename, "rb");
+    struct analysis_result result;
+    int count = 0, alloced = 0;
+
+    *scores = NULL;
+
+    if (!file) {
+        fprintf (stderr, "\nerror: can't open file \"%s\" for reading!\n", filename);
+        return 0;
+    }
+
+    while (fread (&result, sizeof (result), 1, file)) {
+        if (count == alloced && !(*scores = realloc (*scores, alloced += 65536))) {
+            fprintf (stderr, "\nerror: out of memory reading \"%s\"!\n", filename);
+            fclose (file);
+            return 0;
+        }
+
+        (*scores) [count++] = *analysis_result_to_tensor_pointer (&result, *tensor);
+    }
+
+    fclose (file);
+
+    if (!count)
+        fprintf (stderr, "\nerror: no analysis results in \"%s\"!\n", filename);
+
+    return count;
+}
+
+// Read the labels of a program and set the true mode of each window (at its center, which is
+// WINDOW_SECONDS / 2 after its start, and windows start every STEP_MSECS). Returns zero on success.
+
+static int load_labels (const char *filename, Program *program)
+{
+    FILE *file = fopen (filename, "r");
+    char line [128], mode_name [16];
+    int line_number = 0, window = 0;
+    signed char mode = MODE_NOTHING;
+
+    if (!file) {
+        fprintf (stderr, "\nerror: can't open file \"%s\" for reading!\n", filename);
+        return 1;
+    }
+
+    if (!(program->labels = malloc (program->num_windows))) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        fclose (file);
+        return 1;
+    }
+
+    while (fgets (line, sizeof (line), file)) {
+        double seconds = 0.0, field;
+        char *cp = line;
+
+        line_number++;
+
+        while (isspace (*cp))
+            cp++;
+
+        if (!*cp || *cp == '#')
+            continue;
+
+        // [[hh:]mm:]ss, then the mode
+
+        while (1) {
+            field = strtod (cp, &cp);
+            seconds = seconds * 60.0 + field;
+
+            if (*cp != ':')
+                break;
+
+            cp++;
+        }
+
+        if (sscanf (cp, "%15s", mode_name) != 1 || (strcmp (mode_name, "music") && strcmp (mode_name, "talk")) || seconds < 0.0) {
+            fprintf (stderr, "\nerror: \"%s\" line %d is not a time and \"music\" or \"talk\"!\n", filename, line_number);
+            fclose (file);
+            return 1;
+        }
+
+        // windows centered before this time have the previous mode
+
+        for (; window < program->num_windows && (WINDOW_SECONDS * 1000.0 / 2 + window * STEP_MSECS) < seconds * 1000.0; ++window)
+            program->labels [window] = mode;
+
+        mode = strcmp (mode_name, "music") ? MODE_TALK : MODE_MUSIC;
+    }
+
+    fclose (file);
+
+    while (window < program->num_windows)
+        program->labels [window++] = mode;
+
+    return 0;
+}
+
+/* Build a corpus of alternating music and talk segments (of random lengths) from runs of
+ * consecutive windows of the two files. Where a segment is longer than its file it wraps around,
+ * and the windows that straddle a segment boundary aren't quite what real audio would give (they
+ * come from one file or the other), but the decision logic only ever sees the averages anyway.
+ */
+
+static void synthesize_corpus (signed char *music, int music_windows, signed char *talk, int talk_windows, int minutes)
+{
+    Program *program = programs + num_programs++;
+    uint32_t random = 0x31415926;
+    int mode = MODE_MUSIC, window = 0;
+
+    program->num_windows = minutes * 60000 / STEP_MSECS;
+    program->scores = malloc (program->num_windows);
+    program->labels = malloc (program->num_windows);
+
+    if (!program->scores || !program->labels) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        exit (1);
+    }
+
+    while (window < program->num_windows) {
+        int min_secs = mode == MODE_MUSIC ? MUSIC_MIN_SECS : TALK_MIN_SECS, max_secs = mode == MODE_MUSIC ? MUSIC_MAX_SECS : TALK_MAX_SECS;
+        signed char *source = mode == MODE_MUSIC ? music : talk;
+        int source_windows = mode == MODE_MUSIC ? music_windows : talk_windows, length, position;
+
+        random = random * 1664525 + 1013904223;
+        length = (min_secs + (int) ((random >> 8) % (max_secs - min_secs + 1))) * 1000 / STEP_MSECS;
+        random = random * 1664525 + 1013904223;
+        position = (random >> 8) % source_windows;
+
+        for (int i = 0; i < length && window < program->num_windows; ++i, ++window) {
+            program->scores [window] = source [(position + i) % source_windows];
+            program->labels [window] = mode;
+        }
+
+        mode = -mode;
+    }
+}
+
+static void find_boundaries (Program *program)
+{
+    program->boundaries = malloc (program->num_windows * sizeof (int));
+
+    if (!program->boundaries) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        exit (1);
+    }
+
+    for (int w = 0; w < program->num_windows; ++w)
+        if (program->labels [w]) {
+            if (!w || program->labels [w] != program->labels [w - 1])
+                program->boundaries [program->num_boundaries++] = w;
+
+            labeled_windows++;
+        }
+}
+
+static double wall_clock (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
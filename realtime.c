@@ -0,0 +1,346 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// realtime.c
+
+#define _GNU_SOURCE             // for pthread_setaffinity_np()
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "realtime.h"
+#include "trace.h"
+
+#ifdef REALTIME_SUPPORTED
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Support for running the processing thread in real time (for live playback).
+ * The glitches there come from stalls on the processing thread, so in this
+ * mode it never does any I/O itself: a reader thread fills the input queue
+ * from the source and a writer thread drains the output queue to the sink,
+ * and the processing thread just copies to and from these (with the messages
+ * going through the asynchronous logger, as always). The queues are single
+ * producer, single consumer rings with no locks, and all the memory is
+ * allocated, touched and (if possible) locked before processing starts so
+ * that there are no allocations or page faults on the processing thread.
+ *
+ * The processing thread polls (with a short sleep) when it has to wait for
+ * input, and also when the output queue is full, which should never happen
+ * (the queue holds at least as much as the output staging buffer) and is
+ * counted as a stall if it does.
+ */
+
+#define RT_POLL_NSECS   500000      // polling interval when a queue is empty (or full)
+#define RT_STACK_BYTES  262144      // stack pre-faulted for the processing thread
+#define RT_PAGE_BYTES   4096        // stride for touching memory (smallest common page size)
+
+typedef struct {
+    unsigned char *buffer;
+    size_t size, mask;
+    atomic_size_t head, tail;       // total bytes ever written and read
+    atomic_int closed;              // producer is done (EOF on input, stop on output)
+    int fd;
+} byte_queue;
+
+static byte_queue input_queue, output_queue;
+static pthread_t reader_thread, writer_thread;
+static atomic_long output_stalls;
+
+static void touch_memory (void *data, size_t bytes);
+
+static void poll_wait (void)
+{
+    struct timespec idle = { 0, RT_POLL_NSECS };
+    nanosleep (&idle, NULL);
+}
+
+static int queue_init (byte_queue *queue, FILE *file, size_t bytes)
+{
+    size_t size = 4096;
+
+    while (size < bytes)
+        size <<= 1;
+
+    if (!(queue->buffer = malloc (size)))
+        return 1;
+
+    touch_memory (queue->buffer, size);
+    queue->size = size;
+    queue->mask = size - 1;
+    queue->fd = fileno (file);
+    atomic_init (&queue->head, 0);
+    atomic_init (&queue->tail, 0);
+    atomic_init (&queue->closed, 0);
+    return 0;
+}
+
+// read directly into the free space of the input queue (read() returns whatever is available)
+
+static void *reader (void *ctx)
+{
+    byte_queue *queue = &input_queue;
+
+    trace_thread_name ("reader");
+
+    while (1) {
+        size_t head = atomic_load_explicit (&queue->head, memory_order_relaxed);
+        size_t space = queue->size - (head - atomic_load_explicit (&queue->tail, memory_order_acquire));
+        size_t contiguous = queue->size - (head & queue->mask);
+        uint64_t start;
+        ssize_t bytes;
+
+        if (!space) {
+            poll_wait ();
+            continue;
+        }
+
+        start = TRACE_START ();
+        bytes = read (queue->fd, queue->buffer + (head & queue->mask), space < contiguous ? space : contiguous);
+
+        if (bytes > 0) {
+            atomic_store_explicit (&queue->head, head + bytes, memory_order_release);
+            TRACE_SPAN ("read", start, 0, queue->size - space + bytes);
+        }
+        else if (!bytes || errno != EINTR)
+            break;
+    }
+
+    atomic_store_explicit (&queue->closed, 1, memory_order_release);
+    return NULL;
+}
+
+// write from the output queue until it's empty and closed (if the sink fails, just discard)
+
+static void *writer (void *ctx)
+{
+    byte_queue *queue = &output_queue;
+    int failed = 0;
+
+    trace_thread_name ("writer");
+
+    while (1) {
+        int closed = atomic_load_explicit (&queue->closed, memory_order_acquire);
+        size_t tail = atomic_load_explicit (&queue->tail, memory_order_relaxed);
+        size_t available = atomic_load_explicit (&queue->head, memory_order_acquire) - tail;
+        size_t contiguous = queue->size - (tail & queue->mask);
+        uint64_t start = TRACE_START ();
+        ssize_t bytes;
+
+        if (!available) {
+            if (closed)
+                break;
+
+            poll_wait ();
+            continue;
+        }
+
+        if (failed)
+            bytes = available < contiguous ? available : contiguous;
+        else if ((bytes = write (queue->fd, queue->buffer + (tail & queue->mask), available < contiguous ? available : contiguous)) < 0) {
+            if (errno != EINTR)
+                failed = 1;
+
+            continue;
+        }
+
+        atomic_store_explicit (&queue->tail, tail + bytes, memory_order_release);
+        TRACE_SPAN ("write", start, 0, available - bytes);
+    }
+
+    return NULL;
+}
+
+static void free_queues (void)
+{
+    free (input_queue.buffer);
+    free (output_queue.buffer);
+    memset (&input_queue, 0, sizeof (input_queue));
+    memset (&output_queue, 0, sizeof (output_queue));
+}
+
+// Start the reader and writer threads. On failure nothing is left running or allocated.
+
+int rt_start (FILE *input, size_t input_bytes, FILE *output, size_t output_bytes)
+{
+    if (queue_init (&input_queue, input, input_bytes) || queue_init (&output_queue, output, output_bytes)) {
+        free_queues ();
+        return 1;
+    }
+
+    atomic_store (&output_stalls, 0);
+
+    if (pthread_create (&reader_thread, NULL, reader, NULL)) {
+        free_queues ();
+        return 1;
+    }
+
+    // the reader is blocked in read() or sleeping, both of which are cancellation points
+
+    if (pthread_create (&writer_thread, NULL, writer, NULL)) {
+        pthread_cancel (reader_thread);
+        pthread_join (reader_thread, NULL);
+        free_queues ();
+        return 1;
+    }
+
+    return 0;
+}
+
+// Read the specified number of bytes from the input queue, waiting for them if necessary. Returns
+// the number of bytes read, which is only less than requested at the end of the input.
+
+size_t rt_read (void *data, size_t bytes)
+{
+    byte_queue *queue = &input_queue;
+    size_t tail = atomic_load_explicit (&queue->tail, memory_order_relaxed), available;
+    uint64_t start = TRACE_START ();
+
+    while ((available = atomic_load_explicit (&queue->head, memory_order_acquire) - tail) < bytes) {
+        if (atomic_load_explicit (&queue->closed, memory_order_acquire)) {
+            available = atomic_load_explicit (&queue->head, memory_order_acquire) - tail;
+
+            if (available < bytes)
+                bytes = available;
+
+            break;
+        }
+
+        poll_wait ();
+    }
+
+    for (size_t copied = 0; copied < bytes;) {
+        size_t contiguous = queue->size - ((tail + copied) & queue->mask);
+        size_t count = bytes - copied < contiguous ? bytes - copied : contiguous;
+
+        memcpy ((unsigned char *) data + copied, queue->buffer + ((tail + copied) & queue->mask), count);
+        copied += count;
+    }
+
+    atomic_store_explicit (&queue->tail, tail + bytes, memory_order_release);
+    TRACE_SPAN ("input wait", start, 0, available - bytes);
+    return bytes;
+}
+
+// Copy the specified bytes into the output queue (waiting, and counting a stall, if it's full).
+
+void rt_write (const void *data, size_t bytes)
+{
+    byte_queue *queue = &output_queue;
+    size_t head = atomic_load_explicit (&queue->head, memory_order_relaxed);
+    uint64_t start = TRACE_START ();
+    int stalled = 0;
+
+    while (bytes) {
+        size_t space = queue->size - (head - atomic_load_explicit (&queue->tail, memory_order_acquire));
+        size_t contiguous = queue->size - (head & queue->mask), count = bytes;
+
+        if (!space) {
+            if (!stalled++)
+                atomic_fetch_add (&output_stalls, 1);
+
+            poll_wait ();
+            continue;
+        }
+
+        if (count > space) count = space;
+        if (count > contiguous) count = contiguous;
+
+        memcpy (queue->buffer + (head & queue->mask), data, count);
+        atomic_store_explicit (&queue->head, head += count, memory_order_release);
+        data = (const unsigned char *) data + count;
+        bytes -= count;
+    }
+
+    if (stalled)
+        TRACE_SPAN ("output stall", start, 0, queue->size);
+}
+
+// Wait for the reader to finish (it has normally seen EOF already) and for the output to drain.
+
+void rt_stop (void)
+{
+    atomic_store_explicit (&output_queue.closed, 1, memory_order_release);
+    pthread_join (writer_thread, NULL);
+    pthread_join (reader_thread, NULL);
+    free_queues ();
+}
+
+long rt_output_stalls (void)
+{
+    return atomic_load (&output_stalls);
+}
+
+// Lock all current and future memory of the process (which also faults it all in) and pre-fault
+// some stack for the calling thread. Returns 0 on success (failure is normally just a too-low
+// RLIMIT_MEMLOCK, in which case the memory that was touched will probably still stay resident).
+
+int rt_lock_memory (void)
+{
+    volatile unsigned char stack [RT_STACK_BYTES];
+
+    for (int i = 0; i < RT_STACK_BYTES; i += RT_PAGE_BYTES)
+        stack [i] = 0;
+
+    return mlockall (MCL_CURRENT | MCL_FUTURE) ? 1 : 0;
+}
+
+// Pin the calling thread to a CPU (if cpu >= 0) and give it SCHED_FIFO at the specified priority
+// (if priority > 0). Returns 0 on success, or 1 if either failed (they need privileges).
+
+int rt_set_scheduling (int cpu, int priority)
+{
+    int result = 0;
+
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO (&cpus);
+        CPU_SET (cpu, &cpus);
+
+        if (pthread_setaffinity_np (pthread_self (), sizeof (cpus), &cpus)) {
+            fprintf (stderr, "warning: can't pin processing thread to cpu %d\n", cpu);
+            result = 1;
+        }
+    }
+
+    if (priority > 0) {
+        struct sched_param param;
+
+        memset (&param, 0, sizeof (param));
+        param.sched_priority = priority;
+
+        if (pthread_setschedparam (pthread_self (), SCHED_FIFO, &param)) {
+            fprintf (stderr, "warning: can't set SCHED_FIFO priority %d for processing thread\n", priority);
+            result = 1;
+        }
+    }
+
+    return result;
+}
+
+// Write to every page of a buffer (without changing it) so that it's backed by real memory.
+
+static void touch_memory (void *data, size_t bytes)
+{
+    volatile unsigned char *bytes_ptr = data;
+
+    for (size_t i = 0; i < bytes; i += RT_PAGE_BYTES)
+        bytes_ptr [i] = bytes_ptr [i];
+
+    if (bytes)
+        bytes_ptr [bytes - 1] = bytes_ptr [bytes - 1];
+}
+
+#endif
@@ -0,0 +1,36 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// realtime.h
+
+#ifndef REALTIME_H_
+#define REALTIME_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+// real-time mode needs threads for the I/O and POSIX for memory locking and scheduling
+
+#if defined (ENABLE_THREADS) && !defined (_WIN32)
+#define REALTIME_SUPPORTED
+
+// Start the reader and writer threads with queues of (at least) the specified sizes. The processing
+// thread then only exchanges audio with the queues and never touches the files itself.
+
+int rt_start (FILE *input, size_t input_bytes, FILE *output, size_t output_bytes);
+size_t rt_read (void *data, size_t bytes);
+void rt_write (const void *data, size_t bytes);
+void rt_stop (void);
+long rt_output_stalls (void);
+
+int rt_lock_memory (void);
+int rt_set_scheduling (int cpu, int priority);
+
+#endif
+
+#endif /* REALTIME_H_ */
@@ -12,45 +12,44 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <fcntl.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
-#include "4d-tensor.h"
-#include "skipper.h"
-#include "lzwlib.h"
-#include "biquad.h"
-
-#define VERSION         0.1
-
-#define OUTPUT_AUDIO    0
-#define OUTPUT_MONO     1
-#define OUTPUT_FILTERED 2
-#define OUTPUT_LEVEL    3
-#define OUTPUT_TENSOR   4
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
 
-#define SKIP_NOTHING    0
-#define SKIP_TALK       1
-#define SKIP_MUSIC      2
-#define SKIP_EVERYTHING 3
+#include "skipperlib.h"
+#include "logger.h"
+#include "catalog.h"
+#include "realtime.h"
+#include "trace.h"
+#include "flacdec.h"
 
-#define MODE_NOTHING    0
-#define MODE_MUSIC      1
-#define MODE_TALK       -1
+#define VERSION         0.1
 
 static const char *sign_on = "\n"
 " SKIPPER  Selective Audio Detection and Filter  Version %.1f\n"
 " Copyright (c) 2024 David Bryant. All Rights Reserved.\n\n";
 
 static const char *usage =
-" Usage:     SKIPPER [-options] < SourceAudio.pcm > StereoOutput.pcm\n\n"
+" Usage:     SKIPPER [-options] < SourceAudio.pcm > StereoOutput.pcm\n"
+"            SKIPPER [-options] --flac SourceAudio.flac > StereoOutput.pcm\n\n"
 " Operation: scan source audio (stdin) using tensor discrimination to filter\n"
 "            output (stdout), skipping either music (-m) or talk (-t); or\n"
 "            output raw scan analytics for use with TENSOR-GEN util (-a)\n\n"
 " Options:  -a <file.bin>    = output analysis results to specified file\n"
 "           -c<n>            = override default channel count of 2\n"
-"           -d <file.tensor> = specify alternate discrimination tensor file\n"
+"           -d <name|file>   = specify alternate discrimination tensor, either\n"
+"                            = embedded (see --tensors) or from a file\n"
 "           -k               = keep-alive crossfading for long skips\n"
 "           -l<n>            = left output override (for debug, n = 1-4:\n"
 "                            = 1=mono, 2=filtered, 3=level, 4=tensor)\n"
@@ -65,62 +64,141 @@ static const char *usage =
 "           -t[<n>]          = skip over talk, with optional threshold offset\n"
 "                            = (raise or lower talk threshold +/- 99 points)\n"
 "           -v[<n>]          = set verbosity + [rate in seconds]\n\n"
+" Model:    --model <file>    = classify with quantized model (from TENSOR-GEN -m)\n"
+"                             = instead of tensor, and report their agreement\n"
+"           --forest          = classify with compiled-in decision-tree ensemble\n"
+"                             = (from TENSOR-GEN -f) and report agreement\n"
+"           --tensors         = list the embedded tensors (for -d) and exit\n"
+"           --params <file>   = load decision parameters (from PARAMOPT), with\n"
+"                             = -m<n> and -t<n> offsetting their threshold\n"
+"           --profile <file>  = add hit count of every tensor cell to profile\n"
+"                             = file (for pruning with TENSOR-GEN -p)\n"
+"           --hotset <file>   = classify with pruned tensor (from TENSOR-GEN -s)\n"
+"                             = and report how often hot cells were hit\n\n"
+" Catalog:  --catalog <file>  = append detected segments to archive catalog\n"
+"           --station <name>  = station name for catalog (up to 15 chars)\n"
+"           --program <id>    = program id for catalog (up to 31 chars)\n"
+"           --aired <time>    = air time of start of audio (UNIX time or\n"
+"                             = YYYY-MM-DD[THH:MM[:SS]] UTC, default = now)\n\n"
+" Input:    --flac <file>     = decode FLAC file directly (instead of raw PCM\n"
+"                             = on stdin) on multiple threads; channels and\n"
+"                             = sample rate come from the file\n"
+"           --start <time>    = start output at [[HH:]MM:]SS into the input,\n"
+"                             = analyzing only enough history before it to\n"
+"                             = establish the current mode (seeks if it can)\n\n"
+" Probe:    --probe <file>    = estimate music and talk fractions of raw PCM\n"
+"                             = file from sampled windows (no audio output)\n"
+"           --windows <n>     = number of windows to sample (default 256)\n\n"
+" Envelope: --log-envelope    = keep level envelope as 16-bit log levels (half\n"
+"                             = the memory, integer analysis); with --probe,\n"
+"                             = also report how it compares to the float one\n\n"
+" Live:     --realtime        = real-time processing for live playback (no\n"
+"                             = I/O, allocation or page faults on processing\n"
+"                             = thread) and report worst-case block time\n"
+"           --cpu <n>         = pin processing thread to cpu (with --realtime)\n"
+"           --fifo <n>        = SCHED_FIFO priority for processing thread\n"
+"                             = (with --realtime, needs privileges)\n\n"
+" Trace:    --trace <file>    = write timeline of processing stages to file\n"
+"                             = (Chrome trace JSON, for chrome://tracing or\n"
+"                             = ui.perfetto.dev)\n\n"
+" Tuning:   --autotune        = benchmark the processing kernels, block\n"
+"                             = sizes and probe threads on synthesized\n"
+"                             = audio (of the -s and -c format) and save the\n"
+"                             = fastest one with identical decisions in the\n"
+"                             = tuning profile, which is used from then on\n"
+"           --tuning <file>   = tuning profile (default $SKIPPER_TUNING or\n"
+"                             = ~/.skipper-tuning, empty for none)\n\n"
 " Web:      Visit www.github.com/dbry/skipper for latest version and info\n\n";
 
-#define CHANNELS        2       // default, overridable
-#define SAMPLE_RATE     44100   // default, overridable
+#define LOG_RECORDS     4096    // size of the asynchronous message ring
+
+#define PROBE_WINDOWS   256     // default number of windows sampled by --probe
+#define PROBE_WARMUP_MS 250     // front-end warm-up before each probe window
+#define PROBE_THREADS   4       // with ENABLE_THREADS (unless tuned)
+#define MAX_PROBE_THREADS 16
 
-#define LEVEL_WIN_MS    50
-#define WINDOW_SECONDS  5
-#define AVERAGE_SECONDS 5
-#define STEP_MSECS      200
-#define AVERAGE_COUNT   (AVERAGE_SECONDS*1000/STEP_MSECS)
+#define FLAC_THREADS    4       // for --flac (with ENABLE_THREADS)
 
-#define CROSSFADE_SECS  2
-#define MIN_TALK_SECS   10
-#define MIN_MUSIC_SECS  20
-#define MAX_PEND_SECS   60
-#define OUTPUT_SECONDS  120
+#define START_SETTLE_MS 1000    // filter settling before the first window of the --start history
 
-#define LOWPASS_FREQ    2000.0
-#define HIGHPASS_FREQ   250.0
+#define TRACE_EVENTS    262144  // per thread, for --trace
 
-#define MAX_CYCLES      128
+#define RT_BLOCK_MS     20      // processing block size for --realtime
+#define RT_INPUT_SECS   10      // input queue size for --realtime
 
-static void fade_out (int16_t *samples, int num_samples, int stride);
-static void fade_in (int16_t *samples, int num_samples, int stride);
+#define AUTOTUNE_SECONDS 40     // of synthesized audio for each --autotune benchmark
+#define AUTOTUNE_SEGMENT 10     // seconds of music and then talk in the synthesized audio
+#define AUTOTUNE_RUNS   5       // the fastest of these is the time of a candidate
+#define AUTOTUNE_WINDOWS 64     // probe windows for timing the probe threads
+#define AUTOTUNE_MARGIN 0.10    // how much faster a candidate has to be to replace the best one
+                                // (well outside the run-to-run noise of the fastest run)
+#define MAX_TUNINGS     16      // formats in a tuning profile
 
-static int read_tensor_file (tensor_array tensor, char *filename);
-static int local_tensor_file (tensor_array tensor, unsigned char *compressed_tensor, int compressed_size);
-static int analyze_window (float *levels, long sample_index, int num_samples, int sample_rate);
-static void display_histogram (const char *name, int *histogram, int count);
-static void display_analysis_results (void);
+// A configuration found by --autotune for one format (see tuning_filename()).
 
-static tensor_array tensor;
-static FILE *analysis_output_file;
-static int verbose, quiet;
+typedef struct {
+    int sample_rate, channels;
+    int generic_pipeline, log_envelope, block_msecs, probe_threads;
+} Tuning;
+
+static const int block_sizes [] = { 20, 100, 250, 1000, 4000 };    // in msecs, tried by --autotune
+#define NUM_BLOCK_SIZES (sizeof (block_sizes) / sizeof (block_sizes [0]))
+
+static void write_stdout (void *ctx, const int16_t *samples, int num_frames);
+static int write_catalog (Skipper *sk, char *catalog_filename, char *station, char *program, int64_t aired);
+static int write_profile (const uint32_t *cell_hits, char *filename);
+static int probe_file (const SkipperConfig *config, char *filename, int num_windows);
+static Skipper *start_stream (const SkipperConfig *config, FlacDecoder *flac, int64_t position);
+static int parse_start_time (const char *string, double *seconds);
+static const char *tuning_filename (const char *option, char *buffer, size_t buffer_size);
+static int load_tuning (const char *filename, int sample_rate, int channels, Tuning *tuning);
+static int autotune_host (const SkipperConfig *config, const char *filename);
+static int online_cpus (void);
+static const void *map_file (const char *filename, size_t *size, int random_access);
+static void unmap_file (const void *data, size_t size);
+static double wall_clock (void);
+static void list_tensors (void);
+
+#ifdef REALTIME_SUPPORTED
+static void write_queue (void *ctx, const int16_t *samples, int num_frames);
+static void process_realtime (Skipper *sk, int cpu, int priority);
+
+static struct {
+    int64_t num_blocks, late_blocks, worst_sample;
+    double total_time, worst_time;
+    long output_stalls;
+} rt_stats;
+#endif
 
-#define MINS(s,r) ((int)((s)/((r)*60)))
-#define SECS(s,r) ((int)(((s)/(r))%60))
+static tensor_array *tensor;
+static SkipperModel model;
+static SkipperHotSet hotset;
+static int verbose, quiet, probe_threads = PROBE_THREADS;
 
 int main (int argc, char **argv)
 {
     int channels = CHANNELS, sample_rate = SAMPLE_RATE, keepalive = 0;
     int left_output = 0, right_output = 0, skip_mode = 0, threshold = 0;
-    int level_buffer_index = 0, output_buffer_index = 0, num_windows = 0, step_samples;
-    int level_buff_len, output_buff_len, crossfade_buff_len, ring_buff_len, results_buffer_count = 0;
-    int music_hits = 0, talk_hits = 0, analysis_output_file_follows = 0, tensor_input_file_follows = 0;
-    int current_mode = 0, music_up_counter = 0, talk_up_counter = 0, pend_up_counter = 0, input_samples;
-    int64_t num_samples = 0, transition_sample = 0, confirmed_sample = 0, samples_discarded = 0, samples_written = 0;
+    int analysis_output_file_follows = 0, tensor_input_file_follows = 0, input_samples, use_forest = 0, log_envelope = 0;
     char *analysis_output_filename = NULL, *tensor_input_filename = NULL;
-    int16_t *input_buffer, *output_buffer, *crossfade_buffer;
-    double full_scale_rms = 32768.0 * 32767.0 * 0.5;
-    float *fsamples, *level_buffer, *ring_buffer;
-    signed char results_buffer [AVERAGE_COUNT];
-    Biquad lowpass [2], highpass [2];
-    BiquadCoefficients coefficients;
-    uint32_t random = 0x31415926;
-    double level = 0.0;
+    char *catalog_filename = NULL, *station = "", *program = "", *model_filename = NULL, *probe_filename = NULL;
+    char *trace_filename = NULL, *params_filename = NULL, *flac_filename = NULL;
+    char *profile_filename = NULL, *hotset_filename = NULL, *tuning_option = NULL, tuning_buffer [512];
+    int autotune = 0, generic_pipeline = 0, block_frames, tuning_found = 0;
+    const char *tuning_name;
+    uint32_t *cell_hits = NULL;
+    Tuning tuning;
+    int probe_windows = PROBE_WINDOWS, realtime = 0, rt_cpu = -1, rt_priority = 0;
+    double start_seconds = 0.0;
+    int64_t aired = time (NULL);
+    FILE *analysis_output_file = NULL;
+    SkipperParams params;
+    SkipperConfig config;
+    FlacDecoder *flac = NULL;
+    const void *flac_data;
+    size_t flac_size = 0;
+    int16_t *input_buffer;
+    Skipper *sk;
 
     if (argc == 1) {
         fprintf (stderr, sign_on, VERSION);
@@ -136,10 +214,111 @@ int main (int argc, char **argv)
     // loop through command-line arguments
 
     while (--argc) {
+        if (**++argv == '-' && (*argv)[1] == '-' && (*argv)[2]) {
+            char *option = *argv + 2;
+
+            if (!strcmp (option, "forest")) {
+                use_forest = 1;
+                continue;
+            }
+
+            if (!strcmp (option, "log-envelope")) {
+                log_envelope = 1;
+                continue;
+            }
+
+            if (!strcmp (option, "realtime")) {
+                realtime = 1;
+                continue;
+            }
+
+            if (!strcmp (option, "autotune")) {
+                autotune = 1;
+                continue;
+            }
+
+            if (!strcmp (option, "tensors")) {
+                list_tensors ();
+                return 0;
+            }
+
+            if (argc == 1) {
+                fprintf (stderr, "\nmissing argument for option: %s !\n", *argv);
+                return 1;
+            }
+
+            --argc;
+
+            if (!strcmp (option, "catalog"))
+                catalog_filename = *++argv;
+            else if (!strcmp (option, "station"))
+                station = *++argv;
+            else if (!strcmp (option, "program"))
+                program = *++argv;
+            else if (!strcmp (option, "model"))
+                model_filename = *++argv;
+            else if (!strcmp (option, "probe"))
+                probe_filename = *++argv;
+            else if (!strcmp (option, "flac"))
+                flac_filename = *++argv;
+            else if (!strcmp (option, "trace"))
+                trace_filename = *++argv;
+            else if (!strcmp (option, "params"))
+                params_filename = *++argv;
+            else if (!strcmp (option, "profile"))
+                profile_filename = *++argv;
+            else if (!strcmp (option, "hotset"))
+                hotset_filename = *++argv;
+            else if (!strcmp (option, "tuning"))
+                tuning_option = *++argv;
+            else if (!strcmp (option, "cpu")) {
+                rt_cpu = strtol (*++argv, NULL, 10);
+
+                if (rt_cpu < 0) {
+                    fprintf (stderr, "\nerror: cpu must be non-negative\n");
+                    return 1;
+                }
+            }
+            else if (!strcmp (option, "fifo")) {
+                rt_priority = strtol (*++argv, NULL, 10);
+
+                if (rt_priority < 1 || rt_priority > 99) {
+                    fprintf (stderr, "\nerror: SCHED_FIFO priority must be 1 - 99\n");
+                    return 1;
+                }
+            }
+            else if (!strcmp (option, "windows")) {
+                probe_windows = strtol (*++argv, NULL, 10);
+
+                if (probe_windows < 1) {
+                    fprintf (stderr, "\nerror: number of probe windows must be positive\n");
+                    return 1;
+                }
+            }
+            else if (!strcmp (option, "start")) {
+                if (parse_start_time (*++argv, &start_seconds)) {
+                    fprintf (stderr, "\nerror: invalid start time: %s\n", *argv);
+                    return 1;
+                }
+            }
+            else if (!strcmp (option, "aired")) {
+                if (catalog_parse_time (*++argv, &aired)) {
+                    fprintf (stderr, "\nerror: invalid air time: %s\n", *argv);
+                    return 1;
+                }
+            }
+            else {
+                fprintf (stderr, "\nillegal option: %s !\n", *argv);
+                return 1;
+            }
+
+            continue;
+        }
+
 #if defined (_WIN32)
-        if ((**++argv == '-' || **argv == '/') && (*argv)[1])
+        if ((**argv == '-' || **argv == '/') && (*argv)[1])
 #else
-        if ((**++argv == '-') && (*argv)[1])
+        if ((**argv == '-') && (*argv)[1])
 #endif
             while (*++*argv)
                 switch (**argv) {
@@ -265,11 +444,101 @@ int main (int argc, char **argv)
         }
     }
 
-    if (tensor_input_filename ? !read_tensor_file (tensor, tensor_input_filename) : !local_tensor_file (tensor, tensor_4d, sizeof (tensor_4d))) {
+    // a tensor name is looked up in the embedded ones first (which are only expanded when used)
+
+    if (!(tensor = skipper_find_tensor (tensor_input_filename ? tensor_input_filename : "default")) && tensor_input_filename &&
+        (tensor = malloc (sizeof (tensor_array))) && !skipper_read_tensor_file (*tensor, tensor_input_filename)) {
+            free (tensor);
+            tensor = NULL;
+    }
+
+    if (!tensor) {
         fprintf (stderr, "\nerror: no tensor file, exiting!\n");
         return 1;
     }
 
+    if (use_forest && (model_filename || !skipper_forest_trees ())) {
+        fprintf (stderr, model_filename ? "\nerror: can't use --model and --forest together!\n" :
+            "\nerror: no decision-tree ensemble compiled in (see TENSOR-GEN -f)!\n");
+        return 1;
+    }
+
+    if (probe_filename && (model_filename || catalog_filename)) {
+        fprintf (stderr, "\nerror: can't use --probe with --model or --catalog!\n");
+        return 1;
+    }
+
+    if (flac_filename && (probe_filename || realtime)) {
+        fprintf (stderr, "\nerror: can't use --flac with --probe or --realtime!\n");
+        return 1;
+    }
+
+    if (start_seconds > 0.0 && (probe_filename || realtime || catalog_filename)) {
+        fprintf (stderr, "\nerror: can't use --start with --probe, --realtime or --catalog!\n");
+        return 1;
+    }
+
+    if (autotune && (probe_filename || flac_filename || realtime || start_seconds > 0.0 || catalog_filename)) {
+        fprintf (stderr, "\nerror: can't use --autotune with --probe, --flac, --realtime, --start or --catalog!\n");
+        return 1;
+    }
+
+    if ((rt_cpu >= 0 || rt_priority) && !realtime) {
+        fprintf (stderr, "\nerror: --cpu and --fifo are only for --realtime!\n");
+        return 1;
+    }
+
+    if (realtime) {
+#ifdef REALTIME_SUPPORTED
+        if (probe_filename || catalog_filename || analysis_output_filename) {
+            fprintf (stderr, "\nerror: can't use --realtime with --probe, --catalog or -a!\n");
+            return 1;
+        }
+#else
+        fprintf (stderr, "\nerror: --realtime is not supported in this build!\n");
+        return 1;
+#endif
+    }
+
+    if (model_filename && !skipper_read_model_file (&model, model_filename)) {
+        fprintf (stderr, "\nerror: can't load model, exiting!\n");
+        return 1;
+    }
+
+    if (hotset_filename && !skipper_read_hotset_file (&hotset, hotset_filename)) {
+        fprintf (stderr, "\nerror: can't load hot set, exiting!\n");
+        return 1;
+    }
+
+    // the counts are touched now so that they won't page fault during processing (for --realtime)
+
+    if (profile_filename) {
+        if (!(cell_hits = malloc (TENSOR_CELLS * sizeof (uint32_t)))) {
+            fprintf (stderr, "\nerror: out of memory!\n");
+            return 1;
+        }
+
+        memset (cell_hits, 0, TENSOR_CELLS * sizeof (uint32_t));
+    }
+
+    skipper_default_params (&params);
+
+    if (params_filename) {
+        int params_threshold = 0;
+
+        if (!skipper_read_params_file (&params, &params_threshold, params_filename)) {
+            fprintf (stderr, "\nerror: can't load decision parameters, exiting!\n");
+            return 1;
+        }
+
+        threshold += params_threshold;
+
+        if (threshold < -99 || threshold > 99) {
+            fprintf (stderr, "\nerror: threshold offset takes the threshold out of range (-99 to 99)\n");
+            return 1;
+        }
+    }
+
     if (analysis_output_filename) {
         analysis_output_file = fopen (analysis_output_filename, "wb");
 
@@ -279,346 +548,229 @@ int main (int argc, char **argv)
         }
     }
 
-    input_buffer = calloc (sample_rate, sizeof (int16_t) * channels);
-    fsamples = calloc (sample_rate, sizeof (float));
+    // a FLAC file is opened first because it sets the channels and sample rate
 
-    step_samples = STEP_MSECS * sample_rate / 1000;
-    ring_buff_len = (sample_rate * LEVEL_WIN_MS + 500) / 1000;
-    ring_buffer = calloc (ring_buff_len, sizeof (float));
+    if (flac_filename) {
+        int threads = 1;
+        const char *error;
+        FlacInfo info;
 
-    level_buff_len = WINDOW_SECONDS * sample_rate;
-    level_buffer = calloc (level_buff_len, sizeof (float));
+#ifdef ENABLE_THREADS
+        threads = FLAC_THREADS;
+#ifdef _SC_NPROCESSORS_ONLN
+        if (threads > sysconf (_SC_NPROCESSORS_ONLN))
+            threads = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+#endif
+        if (!(flac_data = map_file (flac_filename, &flac_size, 0))) {
+            fprintf (stderr, "\nerror: can't read \"%s\"!\n", flac_filename);
+            return 1;
+        }
 
-    output_buff_len = OUTPUT_SECONDS * sample_rate;
-    output_buffer = calloc (output_buff_len, sizeof (int16_t) * 2);
+        if (!(flac = flac_open (flac_data, flac_size, threads, &info, &error))) {
+            fprintf (stderr, "\nerror: %s: %s\n", flac_filename, error);
+            unmap_file (flac_data, flac_size);
+            return 1;
+        }
 
-    crossfade_buff_len = CROSSFADE_SECS * sample_rate;
-    crossfade_buffer = calloc (crossfade_buff_len, sizeof (int16_t) * 2);
+        if (info.sample_rate < 11025 || info.sample_rate > 96000) {
+            fprintf (stderr, "\nerror: %s: sample rate of %d is not supported\n", flac_filename, info.sample_rate);
+            flac_close (flac);
+            unmap_file (flac_data, flac_size);
+            return 1;
+        }
 
-#ifdef HIGHPASS_FREQ
-    biquad_highpass (&coefficients, HIGHPASS_FREQ / sample_rate);
-    biquad_init (highpass + 0, &coefficients, 1.0);
-    biquad_init (highpass + 1, &coefficients, 1.0);
-#endif
+        channels = info.channels;
+        sample_rate = info.sample_rate;
+    }
 
-#ifdef LOWPASS_FREQ
-    biquad_lowpass (&coefficients, LOWPASS_FREQ / sample_rate);
-    biquad_init (lowpass + 0, &coefficients, 1.0);
-    biquad_init (lowpass + 1, &coefficients, 1.0);
-#endif
+    // The tuning profile (from --autotune) has the fastest configuration for the format that makes
+    // exactly the same decisions. A log envelope (only there if it was put in by hand) isn't used
+    // where the levels or analysis results themselves are output (or compared, with --probe).
 
-    for (int i = 0; i < ring_buff_len; ++i)
-        ring_buffer [i] = (int32_t)(random = ((random << 4) - random) ^ 1) >> 26;
+    block_frames = sample_rate;
+    tuning_name = tuning_filename (tuning_option, tuning_buffer, sizeof (tuning_buffer));
 
-#ifdef HIGHPASS_FREQ
-    biquad_apply_buffer (highpass + 0, ring_buffer, ring_buff_len, 1);
-    biquad_apply_buffer (highpass + 1, ring_buffer, ring_buff_len, 1);
-#endif
+    if (tuning_option && *tuning_option && !autotune) {
+        FILE *tuning_file = fopen (tuning_option, "r");
 
-#ifdef LOWPASS_FREQ
-    biquad_apply_buffer (lowpass + 0, ring_buffer, ring_buff_len, 1);
-    biquad_apply_buffer (lowpass + 1, ring_buffer, ring_buff_len, 1);
-#endif
+        if (!tuning_file) {
+            fprintf (stderr, "\nerror: can't open \"%s\" for reading!\n", tuning_option);
+            return 1;
+        }
 
-    while ((input_samples = fread (input_buffer, sizeof (int16_t) * channels, sample_rate, stdin))) {
+        fclose (tuning_file);
+    }
 
-        if (channels == 2)
-            for (int j = 0; j < input_samples; j++)
-                fsamples [j] = ((float) input_buffer [j * 2] + input_buffer [j * 2 + 1]) / 2.0 + ((int32_t)(random = ((random << 4) - random) ^ 1) >> 26);
-        else
-            for (int j = 0; j < input_samples; j++)
-                fsamples [j] = (float) input_buffer [j] + ((int32_t)(random = ((random << 4) - random) ^ 1) >> 26);
+    // like the decision parameters, a tuning profile that's not valid is fatal (rather than
+    // silently running untuned), so that it gets fixed (or regenerated with --autotune)
 
-#ifdef HIGHPASS_FREQ
-        biquad_apply_buffer (highpass + 0, fsamples, input_samples, 1);
-        biquad_apply_buffer (highpass + 1, fsamples, input_samples, 1);
-#endif
+    if (!autotune && tuning_name && (tuning_found = load_tuning (tuning_name, sample_rate, channels, &tuning)) < 0) {
+        fprintf (stderr, "\nerror: can't load tuning profile, exiting!\n");
+        return 1;
+    }
+
+    if (tuning_found > 0) {
+        generic_pipeline = tuning.generic_pipeline;
+        log_envelope |= tuning.log_envelope && !probe_filename && !analysis_output_filename && !left_output && !right_output;
+        block_frames = tuning.block_msecs * sample_rate / 1000;
+        probe_threads = tuning.probe_threads;
 
-#ifdef LOWPASS_FREQ
-        biquad_apply_buffer (lowpass + 0, fsamples, input_samples, 1);
-        biquad_apply_buffer (lowpass + 1, fsamples, input_samples, 1);
+        if (verbose)
+            fprintf (stderr, "tuning from \"%s\": %s pipeline, %s envelope, %d ms blocks, %d probe thread%s\n", tuning_name,
+                generic_pipeline ? "generic" : "specialized", log_envelope ? "log" : "float", tuning.block_msecs,
+                probe_threads, probe_threads > 1 ? "s" : "");
+    }
+
+    if (probe_threads > online_cpus ())
+        probe_threads = online_cpus ();
+
+    memset (&config, 0, sizeof (config));
+    config.channels = channels;
+    config.sample_rate = sample_rate;
+    config.keepalive = keepalive;
+    config.left_output = left_output;
+    config.right_output = right_output;
+    config.skip_mode = skip_mode;
+    config.threshold = threshold;
+    config.verbose = verbose;
+    config.quiet = quiet;
+    config.record_segments = catalog_filename != NULL;
+    config.tensor = tensor;
+    config.model = model_filename ? &model : NULL;
+    config.params = &params;
+    config.use_forest = use_forest;
+    config.generic_pipeline = generic_pipeline;
+    config.hotset = hotset_filename ? &hotset : NULL;
+    config.cell_hits = cell_hits;
+    config.log_envelope = log_envelope;
+    config.analysis_output_file = analysis_output_file;
+    config.write_audio = write_stdout;
+
+#ifdef REALTIME_SUPPORTED
+    if (realtime)
+        config.write_audio = write_queue;
 #endif
 
-        for (int j = 0; j < input_samples; j++) {
-            int ring_buff_index = num_samples % ring_buff_len;
+    if (autotune) {
+        if (!tuning_name) {
+            fprintf (stderr, "\nerror: no tuning profile to write (see --tuning)!\n");
+            return 1;
+        }
 
-            if (ring_buff_index == 0) {
-                level = (ring_buffer [0] = fsamples [j]) * fsamples [j];
+        return autotune_host (&config, tuning_name);
+    }
 
-                for (int i = 1; i < ring_buff_len; ++i)
-                    level += ring_buffer [i] * ring_buffer [i];
-            }
-            else {
-                level -= ring_buffer [ring_buff_index] * ring_buffer [ring_buff_index];
-                ring_buffer [ring_buff_index] = fsamples [j];
-                level += ring_buffer [ring_buff_index] * ring_buffer [ring_buff_index];
-            }
+    log_init (stderr, LOG_RECORDS);
 
-            level_buffer [level_buffer_index] = level / ring_buff_len;
-
-            if (left_output == OUTPUT_AUDIO)
-                output_buffer [output_buffer_index * 2] = input_buffer [j * channels];
-            else if (left_output == OUTPUT_MONO)
-                output_buffer [output_buffer_index * 2] = (input_buffer [j * channels] + input_buffer [j * channels + channels - 1]) >> 1;
-            else if (left_output == OUTPUT_FILTERED)
-                output_buffer [output_buffer_index * 2] = fsamples [j];
-            else if (left_output == OUTPUT_LEVEL && output_buffer_index >= ring_buff_len / 2)
-                output_buffer [(output_buffer_index - ring_buff_len / 2) * 2] = floor ((log10 (level_buffer [level_buffer_index] / full_scale_rms) + 9.6) * 3413 + 0.5);
-
-            if (right_output == OUTPUT_AUDIO)
-                output_buffer [output_buffer_index * 2 + 1] = input_buffer [j * channels + channels - 1];
-            else if (right_output == OUTPUT_MONO)
-                output_buffer [output_buffer_index * 2 + 1] = (input_buffer [j * channels] + input_buffer [j * channels + channels - 1]) >> 1;
-            else if (right_output == OUTPUT_FILTERED)
-                output_buffer [output_buffer_index * 2 + 1] = fsamples [j];
-            else if (right_output == OUTPUT_LEVEL && output_buffer_index >= ring_buff_len / 2)
-                output_buffer [(output_buffer_index - ring_buff_len / 2) * 2 + 1] = floor ((log10 (level_buffer [level_buffer_index] / full_scale_rms) + 9.6) * 3413 + 0.5);
-
-            ++level_buffer_index;
-            ++output_buffer_index;
-            ++num_samples;
-
-            if (level_buffer_index == level_buff_len) {
-                int tensor_value = analyze_window (level_buffer, num_samples, level_buff_len, sample_rate), detected_mode = MODE_NOTHING;
-
-                if (tensor_value > threshold)
-                    music_hits++;
-                else if (tensor_value < threshold)
-                    talk_hits++;
-
-                results_buffer [results_buffer_count++] = tensor_value;
-
-                if (results_buffer_count == AVERAGE_COUNT) {
-                    for (int i = tensor_value = 0; i < results_buffer_count; ++i)
-                        tensor_value += results_buffer [i];
-
-                    memmove (results_buffer, results_buffer + 1, AVERAGE_COUNT - 1);
-                    results_buffer_count--;
-
-                    if (left_output == OUTPUT_TENSOR || right_output == OUTPUT_TENSOR) {
-                        int16_t *outbuff_window = output_buffer + output_buffer_index * 2;
-
-                        outbuff_window -= WINDOW_SECONDS * sample_rate / 2 * 2;
-                        outbuff_window -= AVERAGE_SECONDS * sample_rate / 2 * 2;
-                        outbuff_window -= step_samples / 2 * 2;
-
-                        if (outbuff_window >= output_buffer) {
-                            int16_t value = (tensor_value * 100 + results_buffer_count / 2) / results_buffer_count;
-
-                            for (int i = 0; i < step_samples; ++i) {
-                                if (left_output == OUTPUT_TENSOR)
-                                    outbuff_window [i * 2] = value - threshold * 100;
-                                if (right_output == OUTPUT_TENSOR)
-                                    outbuff_window [i * 2 + 1] = value - threshold * 100;
-                            }
-                        }
-                    }
-
-                    if (tensor_value > threshold * results_buffer_count) {
-                        if (current_mode == MODE_MUSIC) {
-                            if (talk_up_counter && --talk_up_counter) {
-                                if (++pend_up_counter >= MAX_PEND_SECS * 1000 / STEP_MSECS) {
-                                    if (verbose)
-                                        fprintf (stderr, "TALK detection pending for %d secs, cancelled...\n",
-                                            (pend_up_counter * STEP_MSECS + 500) / 1000);
-
-                                    talk_up_counter = 0;
-                                }
-                            }
-                        }
-                        else {
-                            if (!music_up_counter) {
-                                transition_sample = num_samples - ((WINDOW_SECONDS + AVERAGE_SECONDS) * sample_rate) / 2;
-                                pend_up_counter = 0;
-                            }
-
-                            if (++music_up_counter == MIN_MUSIC_SECS * 1000 / STEP_MSECS) {
-                                detected_mode = MODE_MUSIC;
-                                music_up_counter = 0;
-                            }
-
-                            pend_up_counter++;
-                        }
-                    }
-                    else {
-                        if (current_mode == MODE_TALK) {
-                            if (music_up_counter && --music_up_counter) {
-                                if (++pend_up_counter >= MAX_PEND_SECS * 1000 / STEP_MSECS) {
-                                    if (verbose)
-                                        fprintf (stderr, "MUSIC detection pending for %d secs, cancelled...\n",
-                                            (pend_up_counter * STEP_MSECS + 500) / 1000);
-
-                                    music_up_counter = 0;
-                                }
-                            }
-                        }
-                        else {
-                            if (!talk_up_counter) {
-                                transition_sample = num_samples - ((WINDOW_SECONDS + AVERAGE_SECONDS) * sample_rate) / 2;
-                                pend_up_counter = 0;
-                            }
-
-                            if (++talk_up_counter == MIN_TALK_SECS * 1000 / STEP_MSECS) {
-                                detected_mode = MODE_TALK;
-                                talk_up_counter = 0;
-                            }
-
-                            pend_up_counter++;
-                        }
-                    }
-
-                    if (detected_mode) {
-                        if (skip_mode == SKIP_MUSIC || skip_mode == SKIP_TALK) {
-                            int audio_offset = transition_sample - num_samples + output_buffer_index;
-                            int crossfade_start = audio_offset - crossfade_buff_len / 2;
-
-                            if (skip_mode == (detected_mode == MODE_MUSIC ? SKIP_MUSIC : SKIP_TALK)) {
-                                if (crossfade_start >= 0) {
-                                    fwrite (output_buffer, sizeof (int16_t) * 2, crossfade_start, stdout);
-                                    samples_written += crossfade_start;
-                                    memmove (output_buffer, output_buffer + crossfade_start * 2, (output_buff_len - crossfade_start) * sizeof (int16_t) * 2);
-                                    output_buffer_index -= crossfade_start;
-
-                                    if (verbose)
-                                        fprintf (stderr, "fade out: wrote %d samples (%.1f secs), %.1f secs remaining in buffer\n",
-                                            crossfade_start, (float) crossfade_start / sample_rate, (float) output_buffer_index / sample_rate);
-
-                                    memcpy (crossfade_buffer, output_buffer, crossfade_buff_len * 4);
-                                    fade_out (crossfade_buffer, crossfade_buff_len * 2, 1);
-                                }
-                                else {
-                                    fprintf (stderr, "error: skipped transition, buffer out of range\n");
-                                    exit (1);
-                                }
-                            }
-                            else {
-                                if (crossfade_start >= 0) {
-                                    memmove (output_buffer, output_buffer + crossfade_start * 2, (output_buff_len - crossfade_start) * sizeof (int16_t) * 2);
-                                    output_buffer_index -= crossfade_start;
-                                    samples_discarded += crossfade_start;
-
-                                    if (verbose)
-                                        fprintf (stderr, "fade in: discarded %d samples (%.1f secs), %.1f secs remaining in buffer\n",
-                                            crossfade_start, (float) crossfade_start / sample_rate, (float) output_buffer_index / sample_rate);
-
-                                    if (!quiet)
-                                        fprintf (stderr, "crossfade to %s at %02d:%02d\n", detected_mode == MODE_MUSIC ? "MUSIC" : "TALK",
-                                            MINS (samples_written + crossfade_buff_len / 2, sample_rate), SECS (samples_written + crossfade_buff_len / 2, sample_rate));
-
-                                    fade_in (output_buffer, crossfade_buff_len * 2, 1);
-
-                                    for (int i = 0; i < crossfade_buff_len * 2; ++i) {
-                                        int32_t sum = output_buffer [i] + crossfade_buffer [i];
-
-                                        if (sum > 32767) output_buffer [i] = 32767;
-                                        else if (sum < -32768) output_buffer [i] = -32768;
-                                        else output_buffer [i] = sum;
-                                    }
-                                }
-                                else {
-                                    fprintf (stderr, "error: skipped transition, buffer out of range\n");
-                                    exit (1);
-                                }
-                            }
-                        }
-                        else if (!quiet)
-                            fprintf (stderr, "%02d:%02d: detected %s starting at %02d:%02d\n",
-                                MINS (num_samples, sample_rate), SECS (num_samples, sample_rate), detected_mode == MODE_MUSIC ? "MUSIC" : " TALK",
-                                MINS (transition_sample, sample_rate), SECS (transition_sample, sample_rate));
+    if (trace_filename) {
+        trace_init (TRACE_EVENTS);
+        trace_thread_name ("processing");
+    }
 
-                        current_mode = detected_mode;
-                    }
+    if (probe_filename) {
+        int result = probe_file (&config, probe_filename, probe_windows);
 
-                    if (!talk_up_counter && !music_up_counter)
-                        confirmed_sample = num_samples - ((WINDOW_SECONDS + AVERAGE_SECONDS) * sample_rate + step_samples + crossfade_buff_len) / 2;
-                }
+        log_close ();
+
+        if (!result && profile_filename && write_profile (cell_hits, profile_filename))
+            result = 1;
+
+        if (trace_filename && trace_write (trace_filename))
+            result = 1;
+
+        if (analysis_output_file)
+            fclose (analysis_output_file);
+
+        return result;
+    }
+
+    input_buffer = calloc (block_frames, sizeof (int16_t) * channels);
+
+    if (start_seconds > 0.0 && input_buffer) {
+        if (!(sk = start_stream (&config, flac, (int64_t) (start_seconds * sample_rate + 0.5))))
+            return 1;
+    }
+    else
+        sk = skipper_create (&config);
 
-                memmove (level_buffer, level_buffer + step_samples, (WINDOW_SECONDS * sample_rate - step_samples) * sizeof (float));
-                level_buffer_index -= step_samples;
-                num_windows++;
+    if (!input_buffer || !sk) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        return 1;
+    }
+
+#ifdef REALTIME_SUPPORTED
+    if (realtime)
+        process_realtime (sk, rt_cpu, rt_priority);
+    else
+#endif
+    while (1) {
+        uint64_t start = TRACE_START ();
+
+        if (flac) {
+            if ((input_samples = flac_decode (flac, input_buffer, block_frames)) < 0) {
+                fprintf (stderr, "\nerror: %s: %s\n", flac_filename, flac_error (flac));
+                skipper_free (sk);
+                exit (1);
             }
+        }
+        else
+            input_samples = fread (input_buffer, sizeof (int16_t) * channels, block_frames, stdin);
 
-            int available_samples = confirmed_sample - num_samples + output_buffer_index + step_samples / 2;
+        if (!input_samples)
+            break;
 
-            if (output_buffer_index == output_buff_len || available_samples >= sample_rate * 60) {
+        TRACE_SPAN ("read", start, 0, -1);
 
-                if (keepalive && available_samples > crossfade_buff_len * 2 && skip_mode == (current_mode == MODE_MUSIC ? SKIP_MUSIC : SKIP_TALK)) {
-                    int crossfade_start = available_samples / 2 - crossfade_buff_len;
-                    int16_t *crossfade_ptr = output_buffer + crossfade_start * 2;
+        if (skipper_process (sk, input_buffer, input_samples))
+            break;
+    }
 
-                    for (int i = 0; i < crossfade_buff_len * 4; ++i)
-                        crossfade_ptr [i] >>= 2;
+    if (!sk->error)
+        skipper_finish (sk);
 
-                    fade_in (crossfade_ptr, crossfade_buff_len * 2, 1);
+    log_close ();
 
-                    for (int i = 0; i < crossfade_buff_len * 2; ++i)
-                        crossfade_ptr [i] += crossfade_buffer [i];
+    if (sk->error) {
+        fprintf (stderr, "error: %s\n", sk->error);
+        exit (1);
+    }
 
-                    fwrite (crossfade_ptr, sizeof (int16_t) * 2, crossfade_buff_len, stdout);
-                    memcpy (crossfade_buffer, crossfade_ptr + crossfade_buff_len * 2, crossfade_buff_len * 4);
-                    fade_out (crossfade_buffer, crossfade_buff_len * 2, 1);
+    // a damaged FLAC file still decodes (with silence in place of what's lost, so the timing of
+    // the rest is right), but the results are only as good as what was there
 
-                    samples_discarded += available_samples - crossfade_buff_len;
-                    samples_written += crossfade_buff_len;
+    if (flac && !quiet) {
+        int64_t lost_blocks, lost_frames, missing_frames = flac_losses (flac, &lost_blocks, &lost_frames);
 
-                    memmove (output_buffer, output_buffer + available_samples * 2, (output_buff_len - available_samples) * sizeof (int16_t) * 2);
-                    output_buffer_index -= available_samples;
+        if (lost_blocks)
+            fprintf (stderr, "warning: %s: %lld FLAC frames didn't decode and were replaced with %.1f secs of silence\n",
+                flac_filename, (long long) lost_blocks, (double) lost_frames / sample_rate);
 
-                    if (verbose)
-                        fprintf (stderr, "discarded %d samples (%.1f secs), inserted a %s crossfade at %02d:%02d\n",
-                            available_samples - crossfade_buff_len, (float) (available_samples - crossfade_buff_len) / sample_rate,
-                            current_mode == MODE_MUSIC ? "MUSICAL" : "TALKING",
-                            MINS (samples_written - crossfade_buff_len / 2, sample_rate),
-                            SECS (samples_written - crossfade_buff_len / 2, sample_rate));
-                    else if (!quiet)
-                        fprintf (stderr, "%s keep-alive at %02d:%02d\n", current_mode == MODE_MUSIC ? "MUSICAL" : "TALKING",
-                            MINS (samples_written - crossfade_buff_len / 2, sample_rate),
-                            SECS (samples_written - crossfade_buff_len / 2, sample_rate));
-                }
-                else if (available_samples > 0) {
-                    int write_data = skip_mode == SKIP_NOTHING || skip_mode == (current_mode == MODE_MUSIC ? SKIP_TALK : SKIP_MUSIC);
-
-                    if (write_data) {
-                        fwrite (output_buffer, sizeof (int16_t) * 2, available_samples, stdout);
-                        samples_written += available_samples;
-                    }
-                    else
-                        samples_discarded += available_samples;
-
-                    memmove (output_buffer, output_buffer + available_samples * 2, (output_buff_len - available_samples) * sizeof (int16_t) * 2);
-                    output_buffer_index -= available_samples;
-
-                    if (verbose)
-                        fprintf (stderr, "%s %d samples (%.1f secs), output_buffer_index now %d (%.1f secs), music/talk counts = %d/%d\n",
-                            write_data ? "wrote" : "discarded", available_samples, (float) available_samples / sample_rate,
-                            output_buffer_index, (float) output_buffer_index / sample_rate, music_up_counter, talk_up_counter);
-                }
-                else {
-                    fprintf (stderr, "error: buffer full with no confirmed samples!\n");
-                    exit (1);
-                }
-            }
-        }
+        if (missing_frames)
+            fprintf (stderr, "warning: %s: %.1f secs shorter than its STREAMINFO says (truncated?)\n",
+                flac_filename, (double) missing_frames / sample_rate);
     }
 
-    if (output_buffer_index) {
-        int write_data = skip_mode == SKIP_NOTHING || skip_mode == (current_mode == MODE_MUSIC ? SKIP_TALK : SKIP_MUSIC);
+    if (trace_filename && trace_write (trace_filename)) {
+        skipper_free (sk);
+        exit (1);
+    }
 
-        if (write_data) {
-            fwrite (output_buffer, sizeof (int16_t) * 2, output_buffer_index, stdout);
-            samples_written += output_buffer_index;
-        }
-        else
-            samples_discarded += output_buffer_index;
+    if (catalog_filename && write_catalog (sk, catalog_filename, station, program, aired)) {
+        skipper_free (sk);
+        exit (1);
+    }
 
-        if (verbose)
-            fprintf (stderr, "final: %s %d samples (%.1f secs), music/talk counts = %d/%d\n",
-                write_data ? "wrote" : "discarded", output_buffer_index, (float) output_buffer_index / sample_rate,
-                music_up_counter, talk_up_counter);
+    if (profile_filename && write_profile (cell_hits, profile_filename)) {
+        skipper_free (sk);
+        exit (1);
     }
 
     if (!quiet) {
-        fprintf (stderr, "total input duration = %02d:%02d\n", MINS (num_samples, sample_rate), SECS (num_samples, sample_rate));
+        int num_windows = sk->num_windows, music_hits = sk->music_hits, talk_hits = sk->talk_hits;
+        int64_t samples_written = sk->samples_written, samples_discarded = sk->samples_discarded;
+
+        fprintf (stderr, "total input duration = %02d:%02d\n", MINS (sk->num_samples, sample_rate), SECS (sk->num_samples, sample_rate));
 
         if (verbose)
             fprintf (stderr, "total windows = %d\n", num_windows);
@@ -626,20 +778,42 @@ int main (int argc, char **argv)
         fprintf (stderr, "raw music hits = %d (%.1f%%), raw talk hits = %d (%.1f%%), unknowns = %d (%.1f%%)\n",
             music_hits, music_hits * 100.0 / num_windows, talk_hits, talk_hits * 100.0 / num_windows,
             num_windows - music_hits - talk_hits, (num_windows - music_hits - talk_hits) * 100.0 / num_windows);
+        if (model_filename)
+            fprintf (stderr, "model (%d hidden, %s kernel) agreed with tensor on %d of %d windows (%.1f%%)\n",
+                model.num_hidden, model_kernel_name (), sk->model_agreements, num_windows, sk->model_agreements * 100.0 / num_windows);
+        else if (use_forest)
+            fprintf (stderr, "forest (%d trees) agreed with tensor on %d of %d windows (%.1f%%)\n",
+                skipper_forest_trees (), sk->model_agreements, num_windows, sk->model_agreements * 100.0 / num_windows);
+
+        if (hotset_filename)
+            fprintf (stderr, "hot set (%d cells) served %d of %d windows (%.1f%%), the rest from the coarse tensor\n",
+                hotset.num_cells, sk->hotset_hits, num_windows, sk->hotset_hits * 100.0 / num_windows);
+
         fprintf (stderr, "audio written = %02d:%02d (%.1f%%), audio discarded = %02d:%02d (%.1f%%)\n\n",
             MINS (samples_written, sample_rate), SECS (samples_written, sample_rate), samples_written * 100.0 / (samples_written + samples_discarded),
             MINS (samples_discarded, sample_rate), SECS (samples_discarded, sample_rate), samples_discarded * 100.0 / (samples_written + samples_discarded));
 
+#ifdef REALTIME_SUPPORTED
+        if (realtime)
+            fprintf (stderr, "real-time: %lld blocks of %d ms, mean = %.3f ms, worst case = %.3f ms at %02d:%02d, "
+                "late = %lld, output stalls = %ld\n\n", (long long) rt_stats.num_blocks, RT_BLOCK_MS,
+                rt_stats.num_blocks ? rt_stats.total_time * 1000.0 / rt_stats.num_blocks : 0.0, rt_stats.worst_time * 1000.0,
+                MINS (rt_stats.worst_sample, sample_rate), SECS (rt_stats.worst_sample, sample_rate),
+                (long long) rt_stats.late_blocks, rt_stats.output_stalls);
+#endif
+
         if (analysis_output_file)
-            display_analysis_results ();
+            skipper_display_analysis (sk);
     }
 
-    free (crossfade_buffer);
-    free (output_buffer);
-    free (level_buffer);
-    free (ring_buffer);
-    free (fsamples);
+    skipper_free (sk);
     free (input_buffer);
+    free (cell_hits);
+
+    if (flac) {
+        flac_close (flac);
+        unmap_file (flac_data, flac_size);
+    }
 
     if (analysis_output_file)
         fclose (analysis_output_file);
@@ -647,359 +821,1136 @@ int main (int argc, char **argv)
     return 0;
 }
 
-static void fade_out (int16_t *samples, int num_samples, int stride)
+static void write_stdout (void *ctx, const int16_t *samples, int num_frames)
 {
-    for (int total_samples = num_samples; num_samples--; samples += stride)
-        *samples = (int64_t) *samples * num_samples / total_samples;
+    fwrite (samples, sizeof (int16_t) * 2, num_frames, stdout);
 }
 
-static void fade_in (int16_t *samples, int num_samples, int stride)
+#ifdef REALTIME_SUPPORTED
+
+static void write_queue (void *ctx, const int16_t *samples, int num_frames)
 {
-    for (int total_samples = num_samples; num_samples--; samples += stride)
-        *samples = (int64_t) *samples * (total_samples - num_samples) / total_samples;
+    rt_write (samples, num_frames * sizeof (int16_t) * 2);
 }
 
-static int peak_to_trough_histogram [96] = { 0 };
-static int cycles_histogram [256] = { 0 };
-static int low_third_histogram [256] = { 0 };
-static int mid_third_histogram [256] = { 0 };
-static int high_third_histogram [256] = { 0 };
-static int attack_ratio_histogram [256] = { 0 };
-static int peak_jitter_histogram [256] = { 0 };
+/* Process stdin to stdout in real-time mode. Everything is allocated, touched and locked before
+ * starting, the I/O is done by the reader and writer threads (see realtime.c) and the messages
+ * go through the asynchronous logger, so the processing thread only ever does the processing.
+ * The time of each block is measured and the worst case is reported at the end (the blocks are
+ * small so that this is representative of the latency added by processing).
+ */
 
-static int analyze_window (float *levels, long sample_index, int num_samples, int sample_rate)
+static void process_realtime (Skipper *sk, int cpu, int priority)
 {
-    double full_scale_rms = 32768.0 * 32767.0 * 0.5;
-    float prev_peak = levels [0], prev_trough = levels [0];
-    float peak = levels [0], trough = levels [0];
-    int prev_peak_pos = 0, prev_trough_pos = 0;
-    int zones [4] = { 0 }, cycles = 0;
-    int trigger_points [MAX_CYCLES];
-    struct analysis_result result;
-
-    for (int i = 1; i < num_samples; ++i) {
-        if (levels [i] < trough) trough = levels [i];
-        if (levels [i] > peak) peak = levels [i];
+    int channels = sk->config.channels, sample_rate = sk->config.sample_rate, block_frames = sample_rate * RT_BLOCK_MS / 1000;
+    size_t frame_bytes = sizeof (int16_t) * channels, output_frames = sk->output_buff_len + sample_rate, bytes;
+    int16_t *input_buffer = calloc (block_frames, frame_bytes);
+    double block_seconds = (double) block_frames / sample_rate;
+
+    if (!input_buffer || rt_start (stdin, (size_t) sample_rate * RT_INPUT_SECS * frame_bytes, stdout, output_frames * sizeof (int16_t) * 2)) {
+        sk->error = "can't start real-time I/O";
+        free (input_buffer);
+        return;
     }
 
-    double peak_to_trough_dB = log10 (peak / trough) * 10.0;
-    double square_root = sqrt (peak / trough);
-    double cube_root = cbrt (peak / trough);
+    skipper_touch_memory (sk);
 
-    result.range_dB = (int) floor (peak_to_trough_dB + 0.5);
+    if (rt_lock_memory ())
+        fprintf (stderr, "warning: can't lock memory (see ulimit -l), buffers are pre-touched only\n");
 
-    for (int i = 1; i < num_samples; ++i) {
-        int zone;
+    rt_set_scheduling (cpu, priority);
 
-        if (levels [i] > peak / cube_root) zone = 2;
-        else if (levels [i] > trough * cube_root) zone = 1;
-        else zone = 0;
+    while ((bytes = rt_read (input_buffer, block_frames * frame_bytes)) >= frame_bytes) {
+        int64_t position = sk->num_samples;
+        double start_time = wall_clock (), block_time;
+        int result = skipper_process (sk, input_buffer, bytes / frame_bytes);
 
-        zones [zone]++;
+        block_time = wall_clock () - start_time;
+        rt_stats.total_time += block_time;
+        rt_stats.num_blocks++;
 
-        if (cycles & 1) {       // cycles odd: finding peak level, trigger on trough (which stores peak)
-            if (levels [i] > prev_peak) {
-                prev_peak = levels [i];
-                prev_peak_pos = i;
-            }
-            else if (levels [i] < prev_peak / square_root) {
-                trigger_points [cycles++] = prev_peak_pos;
-                prev_trough = levels [i];
+        if (block_time > block_seconds)
+            rt_stats.late_blocks++;
 
-                if (cycles == MAX_CYCLES)
-                    cycles -= 2;
-            }
-        }
-        else {                  // cycles even (initial): finding trough level, trigger on peak (which stores trough)
-            if (levels [i] < prev_trough) {
-                prev_trough = levels [i];
-                prev_trough_pos = i;
-            }
-            else if (levels [i] > prev_trough * square_root) {
-                trigger_points [cycles++] = prev_trough_pos;
-                prev_peak = levels [i];
-            }
+        if (block_time > rt_stats.worst_time) {
+            rt_stats.worst_time = block_time;
+            rt_stats.worst_sample = position;
         }
+
+        if (result)
+            break;
     }
 
-    double attack_ratio = 0.5;
+    if (!sk->error)
+        skipper_finish (sk);
 
-    if (cycles >= 4) {
-        int attack_count = 0, attack_time = 0, decay_count = 0, decay_time = 0;
+    rt_stop ();
+    rt_stats.output_stalls = rt_output_stalls ();
+    free (input_buffer);
+}
 
-        for (int i = 2; i < cycles; ++i)
-            if (i & 1) {
-                attack_time += trigger_points [i] - trigger_points [i - 1];
-                attack_count++;
-            }
-            else {
-                decay_time += trigger_points [i] - trigger_points [i - 1];
-                decay_count++;
-            }
+#endif
+
+// Convert the detected segments to catalog format and append them to the catalog as one record.
+
+static int write_catalog (Skipper *sk, char *catalog_filename, char *station, char *program, int64_t aired)
+{
+    int sample_rate = sk->config.sample_rate, num_segments, result;
+    SkipperSegment *segments = skipper_get_segments (sk, &num_segments);
+    struct catalog_segment *entries = calloc (num_segments + 1, sizeof (*entries));
+    struct catalog_program header;
+
+    if (!segments || !entries) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        free (segments);
+        free (entries);
+        return 1;
+    }
+
+    memset (&header, 0, sizeof (header));
+    strncpy (header.station, station, sizeof (header.station) - 1);
+    strncpy (header.program, program, sizeof (header.program) - 1);
+    header.start_time = aired;
+    header.duration_ms = (uint32_t) (sk->num_samples * 1000 / sample_rate);
+    header.num_segments = num_segments;
+
+    for (int i = 0; i < num_segments; ++i) {
+        entries [i].start_ms = (uint32_t) (segments [i].start_sample * 1000 / sample_rate);
+        entries [i].end_ms = (uint32_t) (segments [i].end_sample * 1000 / sample_rate);
+        entries [i].mean_score = (int16_t) floor (segments [i].mean_score * 100.0 + 0.5);
+        entries [i].mode = segments [i].mode;
+    }
 
-        if (attack_count && decay_count) {
-            attack_ratio = (double) attack_time / (attack_time + decay_time);
+    result = catalog_append (catalog_filename, &header, entries);
 
-            if (attack_count != decay_count)
-                attack_ratio *= (double) (attack_count + decay_count) / (attack_count * 2.0);
+    if (!result && !quiet)
+        fprintf (stderr, "cataloged %d segment%s for station \"%s\", program \"%s\"\n",
+            num_segments, num_segments == 1 ? "" : "s", header.station, header.program);
+
+    free (segments);
+    free (entries);
+    return result;
+}
+
+// Add the cell hits of this run to the profile (creating it if it doesn't exist yet), so a profile
+// can be collected over any number of runs.
+
+static int write_profile (const uint32_t *cell_hits, char *filename)
+{
+    uint32_t *totals = malloc (TENSOR_CELLS * sizeof (uint32_t));
+    FILE *profile_file = fopen (filename, "rb");
+    int cells_hit = 0;
+    double windows = 0;
+
+    if (!totals) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        if (profile_file) fclose (profile_file);
+        return 1;
+    }
+
+    if (profile_file) {
+        int res = hotset_read_profile (totals, profile_file);
+
+        fclose (profile_file);
+
+        if (!res) {
+            fprintf (stderr, "\nerror: can't add to profile \"%s\"!\n", filename);
+            free (totals);
+            return 1;
         }
-        else
-            exit (1);
     }
+    else
+        memset (totals, 0, TENSOR_CELLS * sizeof (uint32_t));
 
-    double peak_jitter = 1.0;
+    for (int cell = 0; cell < TENSOR_CELLS; ++cell) {
+        totals [cell] = totals [cell] + cell_hits [cell] < totals [cell] ? UINT32_MAX : totals [cell] + cell_hits [cell];
+        cells_hit += totals [cell] != 0;
+        windows += totals [cell];
+    }
+
+    if (!(profile_file = fopen (filename, "wb")) || !hotset_write_profile (totals, profile_file)) {
+        fprintf (stderr, "\nerror: can't write profile \"%s\"!\n", filename);
+        if (profile_file) fclose (profile_file);
+        free (totals);
+        return 1;
+    }
 
-    if (cycles >= 6) {
-        int num_peaks = cycles >> 1;
-        double period = (double) (trigger_points [num_peaks * 2 - 1] - trigger_points [1]) / (num_peaks - 1), error_sum = 0.0;
+    fclose (profile_file);
+    free (totals);
 
-        for (int i = 3; i < cycles - 2; i += 2) {
-            double prediction = trigger_points [1] + (period * (i >> 1));
-            error_sum += fabs (trigger_points [i] - prediction);
+    if (!quiet)
+        fprintf (stderr, "profile has %.0f windows hitting %d of %d tensor cells (%.2f%%)\n",
+            windows, cells_hit, TENSOR_CELLS, cells_hit * 100.0 / TENSOR_CELLS);
+
+    return 0;
+}
+
+// Wilson score interval (95%) for a proportion of hits out of count samples, which behaves much
+// better than the normal approximation when the proportion is near 0 or 1.
+
+static void wilson_interval (int hits, int count, double *lower, double *upper)
+{
+    double z = 1.96, p = (double) hits / count, z2n = z * z / count;
+    double center = (p + z2n / 2.0) / (1.0 + z2n);
+    double margin = z * sqrt (p * (1.0 - p) / count + z2n / count / 4.0) / (1.0 + z2n);
+
+    *lower = center - margin < 0.0 ? 0.0 : center - margin;
+    *upper = center + margin > 1.0 ? 1.0 : center + margin;
+}
+
+/* Estimate the music and talk fractions of a whole raw PCM file by analyzing a sample of its
+ * windows instead of all of them. The file is divided into equal strata and one window is taken
+ * from a random position in each, aligned to the same 200 ms steps as a normal scan. Each window
+ * gets its own short warm-up of the filters and level buffer, so the windows are independent and
+ * are spread over several threads (each with its own Skipper context). This doesn't include the
+ * averaging and decision logic, so the result is the raw fraction of music and talk windows (with
+ * 95% confidence intervals), like the "raw hits" of a normal scan.
+ */
+
+typedef struct {
+    const SkipperConfig *config;
+    const int16_t *audio;
+    int64_t *window_starts;
+    int num_windows, warmup_samples, next_window, music_hits, talk_hits;
+    SkipperLogCheck log_check;      // totals, with config.log_envelope
+    Skipper *sk;                    // for the calling thread (other threads create their own)
+    const char *error;
+#ifdef ENABLE_THREADS
+    pthread_mutex_t mutex;
+    uint32_t *worker_hits [MAX_PROBE_THREADS];  // cell hits of the other threads, added in at the end
+    int num_worker_hits;
+#endif
+} probe_job;
+
+// Analyze windows until there are none left (or an error), then add this context's hits to the
+// totals. The windows are taken as many at a time as the library analyzes together (the last batch
+// may be short). The calling thread uses the job's context and any other threads create their own.
+
+static void probe_windows (probe_job *job, Skipper *sk)
+{
+    const int batch_windows = skipper_batch_windows ();
+    const int16_t *regions [batch_windows];
+    int64_t positions [batch_windows];
+    int num_frames [batch_windows], values [batch_windows];
+
+    while (1) {
+        int first, count;
+
+#ifdef ENABLE_THREADS
+        pthread_mutex_lock (&job->mutex);
+#endif
+        first = job->next_window;
+        count = job->error ? 0 : job->num_windows - first < batch_windows ? job->num_windows - first : batch_windows;
+        job->next_window += count;
+#ifdef ENABLE_THREADS
+        pthread_mutex_unlock (&job->mutex);
+#endif
+        if (!count)
+            break;
+
+        uint64_t start = TRACE_START ();
+
+        for (int i = 0; i < count; ++i) {
+            int64_t window_start = job->window_starts [first + i];
+            int64_t region_start = window_start < job->warmup_samples ? 0 : window_start - job->warmup_samples;
+
+            regions [i] = job->audio + region_start * job->config->channels;
+            num_frames [i] = (int) (window_start + sk->level_buff_len - region_start);
+            positions [i] = window_start + sk->level_buff_len;
         }
 
-        peak_jitter = (error_sum / (num_peaks - 2)) / period;
+        if (skipper_probe_windows (sk, regions, num_frames, positions, values, count)) {
+            job->error = sk->error;
+            break;
+        }
 
-        if (peak_jitter > 1.0)
-            peak_jitter = 1.0;
+        TRACE_SPAN ("probe windows", start, 0, job->num_windows - first - count);
     }
 
-    // calculate the low, mid and high zone fractions, then normalize them to 0.5
-    double low_fraction = (double) zones [0] / num_samples;
-    double mid_fraction = (double) zones [1] / num_samples;
-    double high_fraction = (double) zones [2] / num_samples;
+#ifdef ENABLE_THREADS
+    pthread_mutex_lock (&job->mutex);
+#endif
+    job->music_hits += sk->music_hits;
+    job->talk_hits += sk->talk_hits;
 
-    low_fraction *= (1.0 - low_fraction) * (3.0 / 4.0) + 1.0;
-    mid_fraction *= (1.0 - mid_fraction) * (3.0 / 4.0) + 1.0;
-    high_fraction *= (1.0 - high_fraction) * (3.0 / 4.0) + 1.0;
+    job->log_check.windows += sk->log_check.windows;
+    job->log_check.same_results += sk->log_check.same_results;
+    job->log_check.same_scores += sk->log_check.same_scores;
+    job->log_check.same_votes += sk->log_check.same_votes;
 
-    result.low_third = (int) floor (low_fraction * 255.0 + 0.5);
-    result.mid_third = (int) floor (mid_fraction * 255.0 + 0.5);
-    result.high_third = (int) floor (high_fraction * 255.0 + 0.5);
-    result.attack_ratio = (int) floor (attack_ratio * 255.0 + 0.5);
-    result.peak_jitter = (int) floor (peak_jitter * 255.0 + 0.5);
-    result.cycles = cycles;
+    for (int i = 0; i < MODEL_FEATURES; ++i) {
+        if (sk->log_check.max_error [i] > job->log_check.max_error [i])
+            job->log_check.max_error [i] = sk->log_check.max_error [i];
 
-    if (verbose && ((sample_index - num_samples) % (sample_rate * verbose)) == 0)
-        fprintf (stderr, "%02d:%02d-%02d:%02d: level: %5.1f dB - %5.1f dB, peak/trough = %4.1f dB, cycles = %2d, zones = %.3f, %.3f, %.3f, attack = %.3f, jitter = %.3f\n",
-            MINS (sample_index - num_samples, sample_rate), SECS (sample_index - num_samples, sample_rate),
-            MINS (sample_index, sample_rate), SECS (sample_index, sample_rate),
-            log10 (trough / full_scale_rms) * 10.0, log10 (peak / full_scale_rms) * 10.0,
-            peak_to_trough_dB, result.cycles,
-            result.low_third / 255.0, result.mid_third / 255.0, result.high_third / 255.0,
-            attack_ratio, peak_jitter);
+        job->log_check.total_error [i] += sk->log_check.total_error [i];
+    }
+#ifdef ENABLE_THREADS
+    pthread_mutex_unlock (&job->mutex);
+#endif
+}
 
-    peak_to_trough_histogram [result.range_dB]++;
-    cycles_histogram [result.cycles]++;
-    low_third_histogram [result.low_third]++;
-    mid_third_histogram [result.mid_third]++;
-    high_third_histogram [result.high_third]++;
+#ifdef ENABLE_THREADS
 
-    if (cycles >= 4)
-        attack_ratio_histogram [result.attack_ratio]++;
+// Each worker counts its own cell hits so that counting them needs no locking and no cache lines
+// are shared. The calling thread counts into the shared ones, so they're only added to those once
+// all the threads are done (see run_probe()).
 
-    if (cycles >= 6)
-        peak_jitter_histogram [result.peak_jitter]++;
+static void *probe_worker (void *ctx)
+{
+    probe_job *job = ctx;
+    SkipperConfig worker_config = *job->config;
+    Skipper *sk;
 
-    if (analysis_output_file)
-        fwrite (&result, sizeof (result), 1, analysis_output_file);
+    trace_thread_name ("probe");
+
+    if (worker_config.cell_hits && !(worker_config.cell_hits = calloc (TENSOR_CELLS, sizeof (uint32_t))))
+        return NULL;
+
+    if ((sk = skipper_create (&worker_config))) {
+        probe_windows (job, sk);
+        skipper_free (sk);
+    }
+
+    if (worker_config.cell_hits) {
+        pthread_mutex_lock (&job->mutex);
+        job->worker_hits [job->num_worker_hits++] = worker_config.cell_hits;
+        pthread_mutex_unlock (&job->mutex);
+    }
+
+    return NULL;
+}
+
+#endif
+
+// Pick the windows to probe (one from a random position in each of job->num_windows equal strata
+// of the num_steps window positions) and analyze them on the specified number of threads.
+
+static void run_probe (probe_job *job, int64_t num_steps, int threads)
+{
+    uint32_t random = 0x31415926;
+
+    job->next_window = job->music_hits = job->talk_hits = 0;
+    memset (&job->log_check, 0, sizeof (job->log_check));
+
+    for (int i = 0; i < job->num_windows; ++i) {
+        int64_t first_step = num_steps * i / job->num_windows, next_step = num_steps * (i + 1) / job->num_windows;
+
+        random = ((random << 4) - random) ^ 1;
+        random = ((random << 4) - random) ^ 1;
+        job->window_starts [i] = (first_step + (random >> 8) % (next_step - first_step)) * job->sk->step_samples;
+    }
+
+#ifdef ENABLE_THREADS
+    pthread_t thread_ids [MAX_PROBE_THREADS];
+    int spawned = 0;
+
+    pthread_mutex_init (&job->mutex, NULL);
+    job->num_worker_hits = 0;
+
+    while (spawned < threads - 1 && spawned < MAX_PROBE_THREADS && !pthread_create (thread_ids + spawned, NULL, probe_worker, job))
+        spawned++;
+
+    probe_windows (job, job->sk);
+
+    while (spawned--)
+        pthread_join (thread_ids [spawned], NULL);
+
+    while (job->num_worker_hits--) {
+        for (int cell = 0; cell < TENSOR_CELLS; ++cell)
+            job->config->cell_hits [cell] += job->worker_hits [job->num_worker_hits] [cell];
+
+        free (job->worker_hits [job->num_worker_hits]);
+    }
 
-    return *analysis_result_to_tensor_pointer (&result, tensor);
+    pthread_mutex_destroy (&job->mutex);
+#else
+    probe_windows (job, job->sk);
+#endif
 }
 
-static void display_analysis_results (void)
+static int probe_file (const SkipperConfig *config, char *filename, int num_windows)
 {
-    display_histogram ("peak_to_trough", peak_to_trough_histogram, 96);
-    display_histogram ("cycles", cycles_histogram, 256);
-    display_histogram ("lower third", low_third_histogram, 256);
-    display_histogram ("middle third", mid_third_histogram, 256);
-    display_histogram ("upper third", high_third_histogram, 256);
-    display_histogram ("attack ratio", attack_ratio_histogram, 256);
-    display_histogram ("peak jitter", peak_jitter_histogram, 256);
+    int channels = config->channels, sample_rate = config->sample_rate, result = 1;
+    double start_clock = wall_clock (), lower, upper;
+    SkipperConfig probe_config = *config;
+    int64_t num_frames, num_steps;
+    size_t file_size = 0;
+    probe_job job;
+
+    // the outputs and skip mode don't matter here, but this avoids allocating output buffers
+
+    probe_config.skip_mode = SKIP_EVERYTHING;
+    probe_config.left_output = probe_config.right_output = OUTPUT_AUDIO;
+
+    memset (&job, 0, sizeof (job));
+    job.config = &probe_config;
+    job.warmup_samples = sample_rate * PROBE_WARMUP_MS / 1000;
+
+    if (!(job.sk = skipper_create (&probe_config)) || !(job.window_starts = malloc (num_windows * sizeof (int64_t)))) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        skipper_free (job.sk);
+        return 1;
+    }
+
+    if (!(job.audio = map_file (filename, &file_size, 1))) {
+        fprintf (stderr, "\nerror: can't read \"%s\" for probing!\n", filename);
+        goto done;
+    }
+
+    num_frames = file_size / (sizeof (int16_t) * channels);
+    num_steps = num_frames < job.sk->level_buff_len ? 0 : (num_frames - job.sk->level_buff_len) / job.sk->step_samples + 1;
+    job.num_windows = num_steps < num_windows ? (int) num_steps : num_windows;
+
+    if (!job.num_windows) {
+        fprintf (stderr, "\nerror: \"%s\" is too short to probe!\n", filename);
+        goto done;
+    }
+
+    // the analysis results go to a file (and histograms), so keep those in order on one thread
+
+    run_probe (&job, num_steps, config->analysis_output_file ? 1 : probe_threads);
+
+    if (job.error)
+        fprintf (stderr, "\nerror: %s\n", job.error);
+    else {
+        int unknowns = job.num_windows - job.music_hits - job.talk_hits;
+
+        printf ("probed %d windows of %02d:%02d:%02d in %.3f secs\n", job.num_windows,
+            (int) (num_frames / sample_rate / 3600), MINS (num_frames, sample_rate) % 60, SECS (num_frames, sample_rate),
+            wall_clock () - start_clock);
+
+        wilson_interval (job.music_hits, job.num_windows, &lower, &upper);
+        printf ("music   = %5.1f%% (95%% confidence %5.1f%% - %5.1f%%)\n", job.music_hits * 100.0 / job.num_windows, lower * 100.0, upper * 100.0);
+        wilson_interval (job.talk_hits, job.num_windows, &lower, &upper);
+        printf ("talk    = %5.1f%% (95%% confidence %5.1f%% - %5.1f%%)\n", job.talk_hits * 100.0 / job.num_windows, lower * 100.0, upper * 100.0);
+        wilson_interval (unknowns, job.num_windows, &lower, &upper);
+        printf ("unknown = %5.1f%% (95%% confidence %5.1f%% - %5.1f%%)\n", unknowns * 100.0 / job.num_windows, lower * 100.0, upper * 100.0);
+
+        if (!quiet && config->analysis_output_file)
+            skipper_display_analysis (job.sk);
+
+        if (!quiet)
+            skipper_display_log_check (&job.log_check);
+
+        result = 0;
+    }
+
+done:
+    if (job.audio)
+        unmap_file (job.audio, file_size);
+
+    skipper_free (job.sk);
+    free (job.window_starts);
+    return result;
 }
 
-static void display_population (int *histogram, int count, int percent);
+/* Start the stream at the specified frame of the input (seeking to the history before it if the
+ * input is a file, or else reading up to it) with skipper_start(). The history has to reach back
+ * past the last decision for the current mode to be right there, and the shortest one that could
+ * is enough for the filters to settle, a window and an average, and the votes that confirm a
+ * mode. We try that first and double it as long as the mode isn't established with no transition
+ * pending, up to the longest one that a pending transition can last (which is all read at once).
+ * Trial streams are quiet and write nothing, and the real one then starts with what they found.
+ */
 
-static void display_histogram (const char *name, int *histogram, int count)
+static Skipper *start_stream (const SkipperConfig *config, FlacDecoder *flac, int64_t position)
 {
-    int min_value = 1000000, max_value = -1, hits = 0, sum = 0, hits2 = 0, max_hits = 0, mode1 = 0, mode2 = 0;
-    double median = 0.0;
-
-    for (int value = 0; value < count; ++value)
-        if (histogram [value]) {
-            if (histogram [value] > max_hits) max_hits = histogram [mode1 = mode2 = value, value];
-            else if (histogram [value] == max_hits) mode2 = value;
-            if (value < min_value) min_value = value;
-            if (value > max_value) max_value = value;
-            sum += histogram [value] * value;
-            hits += histogram [value];
-        }
-
-    for (int value = 0; value < count; ++value)
-        if (histogram [value]) {
-            if (hits2 + histogram [value] > hits / 2.0) {
-                median = value - 0.5 + (hits / 2.0 - hits2) / histogram [value];
+    const SkipperParams *params = config->params;
+    int channels = config->channels, sample_rate = config->sample_rate, step_samples = STEP_MSECS * sample_rate / 1000;
+    int confirm_windows = params->min_music_windows > params->min_talk_windows ? params->min_music_windows : params->min_talk_windows;
+    int64_t min_history = (int64_t) sample_rate * (START_SETTLE_MS / 1000 + WINDOW_SECONDS) + (params->average_windows + confirm_windows) * step_samples;
+    int64_t max_history = min_history + (int64_t) params->max_pend_windows * step_samples;
+    int64_t history_start = position > max_history ? (position - max_history) / step_samples * step_samples : 0, trial_start = history_start;
+    int history_frames = position - history_start, frames_read = 0, settled = 0;
+    double start_clock = wall_clock ();
+    SkipperConfig trial_config = *config;
+    int16_t *history = malloc ((size_t) history_frames * channels * sizeof (int16_t) + 1);
+    Skipper *sk = NULL;
+
+    if (!history) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        return NULL;
+    }
+
+    // get to the start of the history (skipping the input if stdin isn't a file)
+
+    if (flac) {
+        if (flac_seek (flac, history_start)) {
+            fprintf (stderr, "\nerror: out of memory!\n");
+            free (history);
+            return NULL;
+        }
+    }
+#ifdef _WIN32
+    else if (_fseeki64 (stdin, history_start * channels * sizeof (int16_t), SEEK_SET))
+#else
+    else if (fseeko (stdin, history_start * channels * sizeof (int16_t), SEEK_SET))
+#endif
+        for (int64_t skipped = 0, count; skipped < history_start; skipped += count) {
+            count = history_start - skipped < history_frames ? history_start - skipped : history_frames;
+
+            if ((count = fread (history, sizeof (int16_t) * channels, count, stdin)) <= 0)
                 break;
-            }
-            else
-                hits2 += histogram [value];
         }
 
-    if (hits) {
-        fprintf (stderr, "%s: range = %d to %d, mean = %g, median = %g, mode = %g\n",
-            name, min_value, max_value, (double) sum / hits, median, (mode1 + mode2) / 2.0);
-        display_population (histogram, count, 50);
-        display_population (histogram, count, 75);
-        display_population (histogram, count, 90);
-        display_population (histogram, count, 95);
-        display_population (histogram, count, 98);
+    while (frames_read < history_frames) {
+        int count = flac ? flac_decode (flac, history + frames_read * channels, history_frames - frames_read) :
+            (int) fread (history + frames_read * channels, sizeof (int16_t) * channels, history_frames - frames_read, stdin);
+
+        if (count <= 0)
+            break;
+
+        frames_read += count;
     }
+
+    if (frames_read < history_frames) {
+        fprintf (stderr, flac && flac_error (flac) ? "\nerror: %s\n" : "\nerror: the start time is past the end of the input!\n",
+            flac ? flac_error (flac) : "");
+        free (history);
+        return NULL;
+    }
+
+    trial_config.quiet = 1;
+    trial_config.verbose = 0;
+    trial_config.record_segments = 0;
+    trial_config.analysis_output_file = NULL;
+    trial_config.cell_hits = NULL;
+    trial_config.skip_mode = SKIP_EVERYTHING;
+    trial_config.left_output = trial_config.right_output = OUTPUT_AUDIO;
+
+    for (int64_t trial_history = min_history; !settled; trial_history *= 2) {
+        Skipper *trial;
+
+        trial_start = position > trial_history ? (position - trial_history) / step_samples * step_samples : 0;
+
+        if (trial_start <= history_start)
+            trial_start = history_start;
+
+        if (!(trial = skipper_create (&trial_config))) {
+            fprintf (stderr, "\nerror: out of memory!\n");
+            free (history);
+            return NULL;
+        }
+
+        settled = !skipper_start (trial, history + (trial_start - history_start) * channels, position - trial_start, position) &&
+            trial->current_mode != MODE_NOTHING && !trial->music_up_counter && !trial->talk_up_counter;
+
+        skipper_free (trial);
+
+        if (trial_start == history_start)
+            break;
+    }
+
+    if (!(sk = skipper_create (config)) ||
+        skipper_start (sk, history + (trial_start - history_start) * channels, position - trial_start, position)) {
+            fprintf (stderr, sk && sk->error ? "\nerror: %s\n" : "\nerror: out of memory!\n", sk ? sk->error : "");
+            skipper_free (sk);
+            free (history);
+            return NULL;
+    }
+
+    if (!config->quiet)
+        fprintf (stderr, "starting at %02d:%02d:%02d after %.1f seconds of history (%s) in %.3f secs\n",
+            (int) (position / sample_rate / 3600), MINS (position, sample_rate) % 60, SECS (position, sample_rate),
+            (double) (position - trial_start) / sample_rate, settled ? sk->current_mode == MODE_MUSIC ? "music" : "talk" : "unsettled",
+            wall_clock () - start_clock);
+
+    free (history);
+    return sk;
 }
 
-static void display_population (int *histogram, int count, int percent)
+// Parse a start time of [[HH:]MM:]SS (the seconds can have a fraction). Returns zero on success.
+
+static int parse_start_time (const char *string, double *seconds)
 {
-    int low_value, high_value, sum = 0, sum2, target;
+    int fields = 0;
+    char *end;
 
-    for (int value = 0; value < count; ++value)
-        if (histogram [value]) {
-            if (sum == 0) low_value = value;
-            sum += histogram [value];
-            high_value = value;
-        }
+    for (*seconds = 0.0; ; string = end + 1) {
+        double value = strtod (string, &end);
 
-    if (sum) {
-        int toggle = 0;
+        if (end == string || value < 0.0 || (fields && value >= 60.0) || ++fields > 3)
+            return 1;
 
-        target = floor ((double) sum * percent / 100.0 + 0.5);
-        sum2 = sum;
+        *seconds = *seconds * 60.0 + value;
 
-        while (sum2 > target)
-            if (histogram [low_value] < histogram [high_value] ||
-                (histogram [low_value] == histogram [high_value] && (toggle ^= 1))) {
-                    if (sum2 - histogram [low_value] / 2 > target)
-                        sum2 -= histogram [low_value++];
-                    else
-                        break;
-            }
-            else if (sum2 - histogram [high_value] / 2 > target)
-                sum2 -= histogram [high_value--];
-            else
-                break;
+        if (*end != ':')
+            return *end != '\0';
+    }
+}
+
+/* The tuning profile holds the fastest configuration that --autotune found on this host for each
+ * audio format (sample rate and channels) that it was run for, as a text file with a section per
+ * format:
+ *
+ *     format 44100 2
+ *     pipeline specialized
+ *     envelope float
+ *     block_msecs 250
+ *     probe_threads 4
+ *
+ * It's the --tuning file, or else $SKIPPER_TUNING, or else ~/.skipper-tuning (and an empty name
+ * means no profile). Returns NULL if there's no name at all.
+ */
+
+static const char *tuning_filename (const char *option, char *buffer, size_t buffer_size)
+{
+    const char *name = option ? option : getenv ("SKIPPER_TUNING");
 
-        int sum3 = 0;
+    if (!name) {
+#ifdef _WIN32
+        const char *home = getenv ("USERPROFILE");
+#else
+        const char *home = getenv ("HOME");
+#endif
+        if (!home || snprintf (buffer, buffer_size, "%s/.skipper-tuning", home) >= (int) buffer_size)
+            return NULL;
 
-        for (int value = low_value; value <= high_value; ++value)
-            sum3 += histogram [value];
+        name = buffer;
+    }
 
-        if (sum2 != sum3) {
-            fprintf (stderr, "display_population() error, sum = %d, target = %d, sum2 = %d, sum3 = %d, low = %d, high = %d\n",
-                sum, target, sum2, sum3, low_value, high_value);
+    return *name ? name : NULL;
+}
 
-            exit (1);
+// Read all the sections of a tuning profile. A profile that doesn't exist has no sections. Returns
+// zero on success, or 1 (after displaying a message) if it can't be read or has an error.
+
+static int read_tunings (const char *filename, Tuning *tunings, int *num_tunings)
+{
+    FILE *file = fopen (filename, "r");
+    char line [128], name [64], value [64];
+    int line_number = 0;
+
+    *num_tunings = 0;
+
+    if (!file)
+        return 0;
+
+    while (fgets (line, sizeof (line), file)) {
+        Tuning *tuning = *num_tunings ? tunings + *num_tunings - 1 : NULL;
+        char *cp = line;
+        int ok = 1;
+
+        line_number++;
+
+        while (*cp == ' ' || *cp == '\t')
+            cp++;
+
+        if (!*cp || *cp == '\n' || *cp == '\r' || *cp == '#')
+            continue;
+
+        if (sscanf (cp, "%63s %63s", name, value) != 2)
+            ok = 0;
+        else if (!strcmp (name, "format")) {
+            if (*num_tunings == MAX_TUNINGS)
+                ok = 0;
+            else {
+                tuning = tunings + (*num_tunings)++;
+                tuning->block_msecs = 1000;
+                tuning->probe_threads = PROBE_THREADS;
+                tuning->generic_pipeline = tuning->log_envelope = 0;
+                ok = sscanf (cp, "%*s %d %d", &tuning->sample_rate, &tuning->channels) == 2 &&
+                    tuning->channels >= 1 && tuning->channels <= 2;
+            }
         }
+        else if (!tuning)
+            ok = 0;
+        else if (!strcmp (name, "pipeline") && (!strcmp (value, "specialized") || !strcmp (value, "generic")))
+            tuning->generic_pipeline = !strcmp (value, "generic");
+        else if (!strcmp (name, "envelope") && (!strcmp (value, "float") || !strcmp (value, "log")))
+            tuning->log_envelope = !strcmp (value, "log");
+        else if (!strcmp (name, "block_msecs"))
+            ok = (tuning->block_msecs = atoi (value)) >= 10 && tuning->block_msecs <= 10000;
+        else if (!strcmp (name, "probe_threads"))
+            ok = (tuning->probe_threads = atoi (value)) >= 1 && tuning->probe_threads <= MAX_PROBE_THREADS;
+        else
+            ok = 0;
 
-        fprintf (stderr, "    %d (%.1f%%): %d to %d\n", sum2, sum2 * 100.0 / sum, low_value, high_value);
+        if (!ok) {
+            fprintf (stderr, "\nerror: tuning profile \"%s\" line %d is not valid!\n", filename, line_number);
+            fclose (file);
+            return 1;
+        }
     }
+
+    fclose (file);
+    return 0;
 }
 
-static int read_tensor_file (tensor_array tensor, char *filename)
+static int write_tunings (const char *filename, const Tuning *tunings, int num_tunings)
 {
-    int num_bytes = 0, alloced_bytes = 0, res, ch;
-    FILE *tensor_file = fopen (filename, "rb");
-    unsigned char *buffer = NULL;
+    FILE *file = fopen (filename, "w");
 
-    if (!tensor_file) {
-        fprintf (stderr, "\nerror: can't open \"%s\" for reading!\n", filename);
-        return 0;
+    if (!file) {
+        fprintf (stderr, "\nerror: can't open \"%s\" for writing!\n", filename);
+        return 1;
     }
 
-    while ((ch = getc (tensor_file)) != EOF) {
-        if (num_bytes == alloced_bytes)
-            buffer = realloc (buffer, alloced_bytes += 65536);
+    fprintf (file, "# SKIPPER tuning profile (from skipper --autotune)\n");
 
-        buffer [num_bytes++] = ch;
+    for (int i = 0; i < num_tunings; ++i)
+        fprintf (file, "\nformat %d %d\npipeline %s\nenvelope %s\nblock_msecs %d\nprobe_threads %d\n",
+            tunings [i].sample_rate, tunings [i].channels, tunings [i].generic_pipeline ? "generic" : "specialized",
+            tunings [i].log_envelope ? "log" : "float", tunings [i].block_msecs, tunings [i].probe_threads);
+
+    if (fclose (file)) {
+        fprintf (stderr, "\nerror: can't write \"%s\"!\n", filename);
+        return 1;
     }
 
-    fclose (tensor_file);
-    res = local_tensor_file (tensor, buffer, num_bytes);
-    free (buffer);
+    return 0;
+}
+
+// Find the section of the profile for the specified format, returning 1 (and the tuning) if found,
+// 0 if not (or there's no profile), or -1 if the profile isn't valid.
+
+static int load_tuning (const char *filename, int sample_rate, int channels, Tuning *tuning)
+{
+    Tuning tunings [MAX_TUNINGS];
+    int num_tunings;
+
+    if (read_tunings (filename, tunings, &num_tunings))
+        return -1;
+
+    for (int i = 0; i < num_tunings; ++i)
+        if (tunings [i].sample_rate == sample_rate && tunings [i].channels == channels) {
+            *tuning = tunings [i];
+            return 1;
+        }
+
+    return 0;
+}
+
+static int online_cpus (void)
+{
+#if defined (ENABLE_THREADS) && defined (_SC_NPROCESSORS_ONLN)
+    int cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+    return cpus > 0 ? cpus : 1;
+#else
+    return 1;
+#endif
+}
+
+// Synthesize audio that alternates between music (a slowly changing chord with a gentle tremolo)
+// and talk (noise shaped with a syllabic envelope and pauses) every AUTOTUNE_SEGMENT seconds, as
+// loadgen does, so that the benchmarks go through every part of the decision logic.
+
+static int16_t *synthesize_audio (int sample_rate, int channels, int64_t num_frames)
+{
+    int16_t *audio = malloc (num_frames * channels * sizeof (int16_t));
+    double phases [6] = { 0 }, freqs [6] = { 220, 277, 330, 440, 554, 659 }, syllable_phase = 0.0;
+    uint32_t random = 0x12345678;
+
+    if (!audio)
+        return NULL;
+
+    for (int64_t n = 0; n < num_frames; ++n) {
+        double t = (double) n / sample_rate, value = 0.0;
 
-    return res;
+        if (!((int) (t / AUTOTUNE_SEGMENT) & 1)) {
+            for (int k = 0; k < 6; ++k) {
+                phases [k] += 2.0 * M_PI * freqs [k] * (1.0 + 0.1 * ((int) (t / 0.5) % 4)) / sample_rate;
+                value += sin (phases [k]);
+            }
+
+            value *= 2500.0 * (0.8 + 0.2 * sin (2.0 * M_PI * 2.0 * t));
+        }
+        else {
+            double noise, envelope = sin (syllable_phase += 2.0 * M_PI * (2.1 + 0.6 * sin (t * 0.7)) / sample_rate);
+
+            random = random * 1103515245 + 12345;
+            noise = ((random >> 16) & 0x7fff) / 16384.0 - 1.0;
+
+            if (envelope < 0.0 || fmod (t, 3.1) > 2.6)
+                envelope = 0.0;
+
+            value = noise * 9000.0 * (0.06 + envelope * envelope * envelope);
+        }
+
+        for (int c = 0; c < channels; ++c)
+            audio [n * channels + c] = (int16_t) value;
+    }
+
+    return audio;
 }
 
+// Everything a candidate decided: the output, every window score and the transitions. Candidates
+// are only valid if theirs are identical to the reference configuration's.
+
 typedef struct {
-    unsigned int size, index, wrapped;
-    unsigned char *buffer;
-} streamer;
+    uint32_t output_hash, decision_hash;
+    int64_t frames_written;
+} autotune_check;
 
-static int read_buff (void *ctx)
+static uint32_t hash_bytes (uint32_t hash, const void *data, size_t size)
 {
-    streamer *stream = ctx;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ ((const unsigned char *) data) [i]) * 16777619U;
 
-    if (stream->index == stream->size)
-        return EOF;
+    return hash;
+}
+
+static void hash_output (void *ctx, const int16_t *samples, int num_frames)
+{
+    autotune_check *check = ctx;
 
-    return stream->buffer [stream->index++];
+    check->output_hash = hash_bytes (check->output_hash, samples, num_frames * sizeof (int16_t) * 2);
+    check->frames_written += num_frames;
 }
 
-static void write_buff (int value, void *ctx)
+// Run the synthesized audio through a stream with a candidate configuration AUTOTUNE_RUNS times,
+// returning the fastest time (or a negative value if a stream couldn't be created or failed).
+
+static double time_stream (const SkipperConfig *config, const Tuning *tuning, const int16_t *audio, int64_t num_frames, autotune_check *check)
 {
-    streamer *stream = ctx;
+    int block_frames = tuning->block_msecs * config->sample_rate / 1000;
+    SkipperConfig stream_config = *config;
+    double best_time = -1.0;
 
-    if (stream->index == stream->size) {
-        stream->index = 0;
-        stream->wrapped++;
+    stream_config.generic_pipeline = tuning->generic_pipeline;
+    stream_config.log_envelope = tuning->log_envelope;
+    stream_config.write_ctx = check;
+
+    for (int run = 0; run < AUTOTUNE_RUNS; ++run) {
+        Skipper *sk = skipper_create (&stream_config);
+        double start_time, elapsed;
+
+        if (!sk)
+            return -1.0;
+
+        memset (check, 0, sizeof (*check));
+        check->output_hash = check->decision_hash = 2166136261U;
+        start_time = wall_clock ();
+
+        for (int64_t frame = 0; frame < num_frames && !sk->error; frame += block_frames)
+            skipper_process (sk, audio + frame * config->channels, num_frames - frame < block_frames ? (int) (num_frames - frame) : block_frames);
+
+        if (!sk->error)
+            skipper_finish (sk);
+
+        elapsed = wall_clock () - start_time;
+
+        if (sk->error) {
+            skipper_free (sk);
+            return -1.0;
+        }
+
+        check->decision_hash = hash_bytes (check->decision_hash, sk->window_scores, sk->num_window_scores);
+
+        for (int i = 0; i < sk->num_transitions; ++i) {
+            check->decision_hash = hash_bytes (check->decision_hash, &sk->transitions [i].start_sample, sizeof (int64_t));
+            check->decision_hash = hash_bytes (check->decision_hash, &sk->transitions [i].mode, sizeof (int));
+        }
+
+        if (best_time < 0.0 || elapsed < best_time)
+            best_time = elapsed;
+
+        skipper_free (sk);
     }
 
-    stream->buffer [stream->index++] = value;
+    return best_time;
 }
 
-static int local_tensor_file (tensor_array tensor, unsigned char *compressed_tensor, int compressed_size)
+// Probe the synthesized audio on the specified number of threads AUTOTUNE_RUNS times, returning
+// the fastest time (or a negative value on failure) and the hits (which can't depend on threads).
+
+static double time_probe (const SkipperConfig *config, const int16_t *audio, int64_t num_frames, int threads, int *music_hits, int *talk_hits)
 {
-    unsigned char dimensions [4] = { ARRAY_BINS_1, ARRAY_BINS_2, ARRAY_BINS_3, ARRAY_BINS_4 };
-    struct tensor_header header;
-    streamer reader, writer;
+    SkipperConfig probe_config = *config;
+    double best_time = -1.0;
+    probe_job job;
+
+    probe_config.skip_mode = SKIP_EVERYTHING;
+    probe_config.left_output = probe_config.right_output = OUTPUT_AUDIO;
+    probe_config.record_segments = 0;
+    probe_config.analysis_output_file = NULL;
+    probe_config.cell_hits = NULL;
+
+    memset (&job, 0, sizeof (job));
+    job.config = &probe_config;
+    job.audio = audio;
+    job.warmup_samples = config->sample_rate * PROBE_WARMUP_MS / 1000;
+    job.num_windows = AUTOTUNE_WINDOWS;
+
+    if (!(job.sk = skipper_create (&probe_config)) || !(job.window_starts = malloc (job.num_windows * sizeof (int64_t)))) {
+        skipper_free (job.sk);
+        return -1.0;
+    }
 
-    if (compressed_size < sizeof (header)) {
-        fprintf (stderr, "invalid tensor!\n");
-        return 0;
+    for (int run = 0; run < AUTOTUNE_RUNS; ++run) {
+        double start_time = wall_clock (), elapsed;
+
+        job.sk->music_hits = job.sk->talk_hits = 0;
+        run_probe (&job, (num_frames - job.sk->level_buff_len) / job.sk->step_samples + 1, threads);
+        elapsed = wall_clock () - start_time;
+
+        if (job.error) {
+            best_time = -1.0;
+            break;
+        }
+
+        if (best_time < 0.0 || elapsed < best_time)
+            best_time = elapsed;
     }
 
-    memcpy (&header, compressed_tensor, sizeof (header));
-    compressed_tensor += sizeof (header);
-    compressed_size -= sizeof (header);
+    *music_hits = job.music_hits;
+    *talk_hits = job.talk_hits;
+    skipper_free (job.sk);
+    free (job.window_starts);
+    return best_time;
+}
 
-    if (memcmp (header.dimensions, dimensions, sizeof (dimensions)) || header.version != TENSOR_VERSION) {
-        fprintf (stderr, "invalid tensor!\n");
-        return 0;
+static void report_candidate (const char *description, double elapsed, int rejected, int reference)
+{
+    if (quiet)
+        return;
+
+    if (rejected)
+        fprintf (stderr, "  %-52s rejected (%s)\n", description, elapsed < 0.0 ? "failed" : "decisions differ");
+    else
+        fprintf (stderr, "  %-52s %7.3f secs%s\n", description, elapsed, reference ? " (reference)" : "");
+}
+
+static const char *describe_tuning (const Tuning *tuning, char *buffer, size_t buffer_size)
+{
+    snprintf (buffer, buffer_size, "%s pipeline, %s envelope, %d ms blocks", tuning->generic_pipeline ? "generic" : "specialized",
+        tuning->log_envelope ? "log" : "float", tuning->block_msecs);
+
+    return buffer;
+}
+
+/* Find the fastest configuration for the configured format on this host and save it in the
+ * tuning profile (replacing the format's section if it's already there). The processing kernel
+ * (the specialized pipeline for the format, if there is one, or the generic one) is tried first,
+ * with the default one second blocks; then the block size with the faster of those; and finally
+ * the number of probe threads. A candidate only counts if everything it decided (output, window
+ * scores and transitions) is identical to the default configuration, and it has to be
+ * AUTOTUNE_MARGIN faster than the best so far to replace it (so the noise in the timing doesn't
+ * pick a different configuration every time). The log envelope is never picked, because it can
+ * change decisions on real programs even when it doesn't on the synthesized audio (it's only used
+ * if it's put in the profile by hand, like --log-envelope). Returns zero on success.
+ */
+
+static int autotune_host (const SkipperConfig *config, const char *filename)
+{
+    int sample_rate = config->sample_rate, channels = config->channels, num_tunings, music_hits, talk_hits;
+    int64_t num_frames = (int64_t) AUTOTUNE_SECONDS * sample_rate;
+    Tuning tunings [MAX_TUNINGS], best = { sample_rate, channels, 0, 0, 1000, 1 }, candidate;
+    int16_t *audio = synthesize_audio (sample_rate, channels, num_frames);
+    SkipperConfig stream_config = *config;
+    autotune_check reference, check;
+    double best_time, elapsed;
+    char description [80];
+    int specialized = 0;
+
+    if (!audio) {
+        fprintf (stderr, "\nerror: out of memory!\n");
+        return 1;
     }
 
-    memset (&reader, 0, sizeof (reader));
-    memset (&writer, 0, sizeof (writer));
+    if (read_tunings (filename, tunings, &num_tunings)) {
+        free (audio);
+        return 1;
+    }
 
-    reader.buffer = compressed_tensor;
-    reader.size = compressed_size;
+    // the decisions are recorded so that they can be compared (and the output is only hashed)
 
-    writer.buffer = (unsigned char *) tensor;
-    writer.size = sizeof (tensor_array);
+    stream_config.skip_mode = SKIP_TALK;
+    stream_config.left_output = stream_config.right_output = OUTPUT_AUDIO;
+    stream_config.verbose = 0;
+    stream_config.quiet = 1;
+    stream_config.record_segments = 1;
+    stream_config.analysis_output_file = NULL;
+    stream_config.cell_hits = NULL;
+    stream_config.write_audio = hash_output;
 
-    if (lzw_decompress (write_buff, &writer, read_buff, &reader)) {
-        fprintf (stderr, "lzw_decompress() returned error!\n");
-        return 0;
+    Skipper *sk = skipper_create (&stream_config);
+
+    if (sk) {
+        specialized = strcmp (skipper_pipeline_name (sk), "generic") != 0;
+        skipper_free (sk);
     }
 
-    if (reader.index != reader.size || writer.index != writer.size || reader.wrapped || writer.wrapped) {
-        fprintf (stderr, "other error in decompressing tensor!\n");
-        return 0;
+    best.generic_pipeline = !specialized;
+
+    if (!quiet)
+        fprintf (stderr, "\nautotuning for %d Hz %s on %d seconds of synthesized audio (fastest of %d runs):\n\n",
+            sample_rate, channels == 1 ? "mono" : "stereo", AUTOTUNE_SECONDS, AUTOTUNE_RUNS);
+
+    if ((best_time = time_stream (&stream_config, &best, audio, num_frames, &reference)) < 0.0) {
+        fprintf (stderr, "\nerror: can't process the synthesized audio!\n");
+        free (audio);
+        return 1;
     }
 
-    for (int i = 0; i < sizeof (tensor_array); ++i)
-        header.checksum -= ((unsigned char *) tensor) [i];
+    report_candidate (describe_tuning (&best, description, sizeof (description)), best_time, 0, 1);
 
-    if (header.checksum) {
-        fprintf (stderr, "checksum error in decompressed tensor!\n");
-        return 0;
+    // the kernel (from the reference configuration), and then the block size
+
+    for (int stage = 0; stage < 2; ++stage) {
+        Tuning stage_best = best;
+        int num_candidates = stage ? NUM_BLOCK_SIZES : 2;
+
+        for (int i = 0; i < num_candidates; ++i) {
+            candidate = stage_best;
+
+            if (stage)
+                candidate.block_msecs = block_sizes [i];
+            else if (i && !specialized)
+                continue;
+            else
+                candidate.generic_pipeline = i || !specialized;
+
+            if (!memcmp (&candidate, &stage_best, sizeof (candidate)))
+                continue;
+
+            elapsed = time_stream (&stream_config, &candidate, audio, num_frames, &check);
+            report_candidate (describe_tuning (&candidate, description, sizeof (description)), elapsed,
+                elapsed < 0.0 || memcmp (&check, &reference, sizeof (check)), 0);
+
+            if (elapsed >= 0.0 && !memcmp (&check, &reference, sizeof (check)) && elapsed < best_time * (1.0 - AUTOTUNE_MARGIN)) {
+                best_time = elapsed;
+                best = candidate;
+            }
+        }
     }
 
-    return 1;
+    // the probe threads (only the number that there are cores for)
+
+    best.probe_threads = 1;
+
+    if (online_cpus () > 1) {
+        int reference_music, reference_talk;
+
+        if (!quiet)
+            fprintf (stderr, "\n");
+
+        if ((best_time = time_probe (config, audio, num_frames, 1, &reference_music, &reference_talk)) < 0.0) {
+            fprintf (stderr, "\nerror: can't probe the synthesized audio!\n");
+            free (audio);
+            return 1;
+        }
+
+        report_candidate ("1 probe thread", best_time, 0, 1);
+
+        for (int threads = 2; threads <= online_cpus () && threads <= MAX_PROBE_THREADS; threads *= 2) {
+            int rejected;
+
+            elapsed = time_probe (config, audio, num_frames, threads, &music_hits, &talk_hits);
+            rejected = elapsed < 0.0 || music_hits != reference_music || talk_hits != reference_talk;
+            snprintf (description, sizeof (description), "%d probe threads", threads);
+            report_candidate (description, elapsed, rejected, 0);
+
+            if (!rejected && elapsed < best_time * (1.0 - AUTOTUNE_MARGIN)) {
+                best_time = elapsed;
+                best.probe_threads = threads;
+            }
+        }
+    }
+
+    free (audio);
+
+    int index = 0;
+
+    while (index < num_tunings && (tunings [index].sample_rate != sample_rate || tunings [index].channels != channels))
+        index++;
+
+    if (index == MAX_TUNINGS) {
+        fprintf (stderr, "\nerror: tuning profile \"%s\" is full!\n", filename);
+        return 1;
+    }
+
+    tunings [index] = best;
+
+    if (index == num_tunings)
+        num_tunings++;
+
+    if (write_tunings (filename, tunings, num_tunings))
+        return 1;
+
+    if (!quiet)
+        fprintf (stderr, "\nwrote tuning to \"%s\": %s, %d probe thread%s\n\n", filename,
+            describe_tuning (&best, description, sizeof (description)), best.probe_threads, best.probe_threads > 1 ? "s" : "");
+
+    return 0;
+}
+
+// Map a whole file for reading (or read it into memory on Windows), advising the kernel whether
+// it will be read randomly or sequentially. Returns NULL if it can't (or it's empty).
+
+static const void *map_file (const char *filename, size_t *size, int random_access)
+{
+#ifndef _WIN32
+    int fd = open (filename, O_RDONLY);
+    struct stat statbuf;
+    void *data;
+
+    if (fd < 0 || fstat (fd, &statbuf) || !statbuf.st_size) {
+        if (fd >= 0) close (fd);
+        return NULL;
+    }
+
+    *size = statbuf.st_size;
+    data = mmap (NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    if (data == MAP_FAILED)
+        return NULL;
+
+    madvise (data, *size, random_access ? MADV_RANDOM : MADV_SEQUENTIAL);
+    return data;
+#else
+    FILE *file = fopen (filename, "rb");
+    void *data = NULL;
+    long length;
+
+    if (!file || fseek (file, 0, SEEK_END) || (length = ftell (file)) <= 0 ||
+        (rewind (file), !(data = malloc (length))) || fread (data, 1, length, file) != (size_t) length) {
+            if (file) fclose (file);
+            free (data);
+            return NULL;
+    }
+
+    fclose (file);
+    *size = length;
+    return data;
+#endif
+}
+
+static void unmap_file (const void *data, size_t size)
+{
+#ifndef _WIN32
+    munmap ((void *) data, size);
+#else
+    (void) size;
+    free ((void *) data);
+#endif
+}
+
+static double wall_clock (void)
+{
+#ifdef _WIN32
+    return (double) clock () / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static void list_tensors (void)
+{
+    int chunked, compressed_size;
+    uint32_t checksum;
+    const char *name;
+
+    fprintf (stderr, "\nname                            checksum   format   compressed\n");
+    fprintf (stderr, "------------------------------- ---------- -------- ----------\n");
+
+    for (int i = 0; skipper_registered_tensor (i, &name, &checksum, &chunked, &compressed_size); ++i)
+        fprintf (stderr, "%-31s %10u %-8s %10d\n", name, checksum, chunked ? "chunked" : "lzw", compressed_size);
+
+    fprintf (stderr, "\n");
 }
@@ -6,6 +6,9 @@
 //      Distributed under the BSD Software License (see license.txt)      //
 ////////////////////////////////////////////////////////////////////////////
 
+#ifndef SKIPPER_H_
+#define SKIPPER_H_
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -26,7 +29,68 @@ struct analysis_result {
 
 typedef signed char tensor_array [ARRAY_BINS_1] [ARRAY_BINS_2] [ARRAY_BINS_3] [ARRAY_BINS_4];
 
+// With BLOCKED_TENSOR the tensor is kept in memory as 4x4x4x4 blocks of 256 bytes (the blocks in
+// row-major order) with the cells of each block in Morton (Z) order, so cells that are near each
+// other on all four axes (like successive windows of a stream, which usually move by a bin or two
+// on several axes at once, or the neighbors visited by the border fill of tensor-gen) are mostly
+// in the same few cache lines instead of being 6 KB apart. This only pays when the tensor doesn't
+// stay in cache (the index arithmetic costs more than it saves otherwise, as in the border fill on
+// most machines) so it's a build option. Tensor files are always row-major (so they work with
+// either build) and the checksum (a byte sum) doesn't depend on the layout. The cells must only
+// be accessed through TENSOR_CELL().
+
+#ifdef BLOCKED_TENSOR
+
+#if ARRAY_BINS_1 % 4 || ARRAY_BINS_2 % 4 || ARRAY_BINS_3 % 4 || ARRAY_BINS_4 % 4
+#error BLOCKED_TENSOR requires all tensor dimensions to be multiples of 4
+#endif
+
+// spread the low two bits of each index (x = b1 b0) to bits 4 and 0 so that they interleave
+
+#define MORTON_SPREAD(x) (((x) & 1) | ((x) & 2) << 3)
+
+static inline int tensor_offset (int h, int i, int j, int k)
+{
+    int block = (((h >> 2) * (ARRAY_BINS_2 / 4) + (i >> 2)) * (ARRAY_BINS_3 / 4) + (j >> 2)) * (ARRAY_BINS_4 / 4) + (k >> 2);
+
+    return block * 256 + (MORTON_SPREAD (h) << 3 | MORTON_SPREAD (i) << 2 | MORTON_SPREAD (j) << 1 | MORTON_SPREAD (k));
+}
+
+#define TENSOR_CELL(t,h,i,j,k) (((signed char *) (t)) [tensor_offset (h, i, j, k)])
+#else
+#define TENSOR_CELL(t,h,i,j,k) ((t) [h] [i] [j] [k])
+#endif
+
+// Convert a tensor in place between the row-major order of files and the in-memory layout (which
+// is a no-op unless BLOCKED_TENSOR). Returns zero if out of memory.
+
+static inline int tensor_convert_layout (tensor_array tensor, int to_memory)
+{
+#ifdef BLOCKED_TENSOR
+    signed char *copy = malloc (sizeof (tensor_array)), *cells = (signed char *) tensor;
+    int row_major = 0;
+
+    if (!copy)
+        return 0;
+
+    memcpy (copy, tensor, sizeof (tensor_array));
+
+    for (int h = 0; h < ARRAY_BINS_1; ++h)
+        for (int i = 0; i < ARRAY_BINS_2; ++i)
+            for (int j = 0; j < ARRAY_BINS_3; ++j)
+                for (int k = 0; k < ARRAY_BINS_4; ++k, ++row_major)
+                    if (to_memory)
+                        cells [tensor_offset (h, i, j, k)] = copy [row_major];
+                    else
+                        cells [row_major] = copy [tensor_offset (h, i, j, k)];
+
+    free (copy);
+#endif
+    return 1;
+}
+
 #define TENSOR_VERSION  1
+#define TENSOR_VERSION_CHUNKED  2   // tensor data follows in a chunked LZW container (see lzwchunk.h)
 
 struct tensor_header {
     uint32_t version, checksum;
@@ -63,5 +127,7 @@ static signed char *analysis_result_to_tensor_pointer (const struct analysis_res
     if (j_index >= ARRAY_BINS_3) j_index = ARRAY_BINS_3 - 1;
     if (k_index >= ARRAY_BINS_4) k_index = ARRAY_BINS_4 - 1;
 
-    return &tensor [h_index] [i_index] [j_index] [k_index];
+    return &TENSOR_CELL (tensor, h_index, i_index, j_index, k_index);
 }
+
+#endif /* SKIPPER_H_ */
@@ -0,0 +1,2590 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// skipperlib.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "4d-tensor.h"
+#include "skipperlib.h"
+#include "forest.h"
+#include "lzwlib.h"
+#include "lzwchunk.h"
+#include "logger.h"
+#include "trace.h"
+
+// The embedded tensors are the default one (4d-tensor.h) plus any others listed in the Makefile,
+// which bin2c -r puts in tensors.h along with their names, checksums and formats.
+
+struct registered_tensor {
+    const char *name;
+    uint32_t checksum, version;
+    unsigned char *data;
+    int size;
+};
+
+#include "tensors.h"
+
+/* This is the processing engine of Skipper, separated from the command-line
+ * filter so that it can be embedded in other applications and so that a
+ * single process can run many streams. Each Skipper context holds all the
+ * state for one audio stream (filters, level and output buffers, decision
+ * counters and analysis statistics); the only thing shared between streams
+ * is the tensor, which is read-only.
+ */
+
+#define LEVEL_WIN_MS    50
+
+#define CROSSFADE_SECS  2
+#define MIN_TALK_SECS   10
+#define MIN_MUSIC_SECS  20
+#define MAX_PEND_SECS   60
+#define OUTPUT_SECONDS  120
+
+#define LOWPASS_FREQ    2000.0
+#define HIGHPASS_FREQ   250.0
+
+#define MAX_CYCLES      128
+
+#define TENSOR_THREADS  4       // for decompressing chunked tensors
+#define SHARED_SCORES   256     // window scores kept for following streams (51 seconds)
+#define ENVELOPE_DECIM  8       // level envelope decimation for the cheapest analysis
+#define LOG_STEPS       1024    // per octave in the log envelope (0.0029 dB)
+#define LOG_FLOOR       32      // octaves below 1.0 in the log envelope (which covers 64)
+#define DITHER_SEED     0x31415926
+
+// windows analyzed at once by the batched scan (one per SIMD lane, see scan_window_batch())
+
+#if defined (__AVX512F__)
+#define BATCH_WINDOWS   16
+#elif defined (__AVX__)
+#define BATCH_WINDOWS   8
+#else
+#define BATCH_WINDOWS   4
+#endif
+
+// The analysis levels a host can drop a stream to when it's short of CPU (see skipper_degrade()).
+// Analyzing a window is most of the work, so the cheaper levels analyze only every nth window
+// (holding the score for the others) and finally also look at only every ENVELOPE_DECIM'th level.
+
+static const struct {
+    int interval, decimate;
+    const char *name;
+} degrade_levels [DEGRADE_LEVELS] = {
+    { 1, 0, "full analysis" },
+    { 2, 0, "every 2nd window" },
+    { 5, 0, "every 5th window" },
+    { 5, 1, "every 5th window, decimated envelope" },
+};
+
+// All the buffer lengths derive from the sample rate. These are used both at runtime and for the
+// specialized pipelines (where the sample rate is a compile-time constant).
+
+#define STEP_SAMPLES(r)         (STEP_MSECS * (r) / 1000)
+#define RING_BUFF_LEN(r)        (((r) * LEVEL_WIN_MS + 500) / 1000)
+#define LEVEL_BUFF_LEN(r)       (WINDOW_SECONDS * (r))
+#define CROSSFADE_BUFF_LEN(r)   (CROSSFADE_SECS * (r))
+#define OUTPUT_BUFF_LEN(r)      (OUTPUT_SECONDS * (r))
+
+static void fade_out (int16_t *samples, int num_samples, int stride);
+static void fade_in (int16_t *samples, int num_samples, int stride);
+
+static inline __attribute__ ((always_inline)) int analyze_window (Skipper *sk, float *levels, long sample_index, int num_samples, const int stride);
+static void display_histogram (const char *name, const int *histogram, int count);
+
+typedef struct {
+    float peak, trough;
+    int zones [3], cycles;
+    int trigger_points [MAX_CYCLES];
+} window_scan;
+
+static inline __attribute__ ((always_inline)) void scan_window (const float *levels, int num_samples, const int stride, window_scan *scan);
+static void scan_window_batch (const float *const *levels, int num_windows, int num_samples, window_scan *scans);
+static int finish_window (Skipper *sk, const window_scan *scan, long sample_index, int num_samples, int num_levels);
+static int analyze_log_window (Skipper *sk, const uint16_t *levels, long sample_index, int num_samples, int stride);
+static int probe_log_window (Skipper *sk, const float *levels, const window_scan *float_scan, long sample_index);
+static int select_pipeline (const SkipperConfig *config);
+
+// messages generated while processing are sent through the asynchronous logger (see logger.c)
+
+static int EV_WINDOW, EV_PEND_CANCEL, EV_FADE_OUT, EV_FADE_IN, EV_CROSSFADE, EV_DETECTED;
+static int EV_KEEPALIVE_VERBOSE, EV_KEEPALIVE, EV_FLUSH, EV_FINAL;
+static int log_events_registered;
+
+static void register_log_events (void)
+{
+    if (log_events_registered++)
+        return;
+
+    EV_WINDOW = log_register ("%02d:%02d-%02d:%02d: level: %5.1f dB - %5.1f dB, peak/trough = %4.1f dB, cycles = %2d, "
+        "zones = %.3f, %.3f, %.3f, attack = %.3f, jitter = %.3f\n");
+    EV_PEND_CANCEL = log_register ("%s detection pending for %d secs, cancelled...\n");
+    EV_FADE_OUT = log_register ("fade out: wrote %d samples (%.1f secs), %.1f secs remaining in buffer\n");
+    EV_FADE_IN = log_register ("fade in: discarded %d samples (%.1f secs), %.1f secs remaining in buffer\n");
+    EV_CROSSFADE = log_register ("crossfade to %s at %02d:%02d\n");
+    EV_DETECTED = log_register ("%02d:%02d: detected %s starting at %02d:%02d\n");
+    EV_KEEPALIVE_VERBOSE = log_register ("discarded %d samples (%.1f secs), inserted a %s crossfade at %02d:%02d\n");
+    EV_KEEPALIVE = log_register ("%s keep-alive at %02d:%02d\n");
+    EV_FLUSH = log_register ("%s %d samples (%.1f secs), output_buffer_index now %d (%.1f secs), music/talk counts = %d/%d\n");
+    EV_FINAL = log_register ("final: %s %d samples (%.1f secs), music/talk counts = %d/%d\n");
+}
+
+// Segment recording just appends to a couple of growable arrays. Window scores are one byte each
+// (5 per second) so even a very long program only needs a few hundred KB.
+
+static void record_window_score (Skipper *sk, int tensor_value)
+{
+    if (sk->num_window_scores == sk->max_window_scores) {
+        signed char *new_scores = realloc (sk->window_scores, sk->max_window_scores += 65536);
+
+        if (!new_scores) {
+            sk->max_window_scores -= 65536;
+            return;
+        }
+
+        sk->window_scores = new_scores;
+    }
+
+    sk->window_scores [sk->num_window_scores++] = tensor_value;
+}
+
+static void record_transition (Skipper *sk, int64_t sample, int mode)
+{
+    if (sk->num_transitions == sk->max_transitions) {
+        SkipperSegment *new_transitions = realloc (sk->transitions, (sk->max_transitions + 64) * sizeof (SkipperSegment));
+
+        if (!new_transitions)
+            return;
+
+        sk->transitions = new_transitions;
+        sk->max_transitions += 64;
+    }
+
+    sk->transitions [sk->num_transitions].start_sample = sample < 0 ? 0 : sample;
+    sk->transitions [sk->num_transitions++].mode = mode;
+}
+
+// Write stereo frames that start at the specified stream position. Frames before the output start
+// (see skipper_start()) were only history, so they're dropped and counted as discarded instead.
+
+static void write_audio (Skipper *sk, const int16_t *samples, int num_frames, int64_t position)
+{
+    if (position < sk->output_start && num_frames > 0) {
+        int history = sk->output_start - position < num_frames ? (int) (sk->output_start - position) : num_frames;
+
+        sk->samples_written -= history;
+        sk->samples_discarded += history;
+        samples += history * 2;
+        num_frames -= history;
+    }
+
+    if (num_frames > 0 && sk->config.write_audio) {
+        uint64_t start = TRACE_START ();
+
+        sk->config.write_audio (sk->config.write_ctx, samples, num_frames);
+        TRACE_SPAN ("output", start, sk->config.stream_id, sk->output_buffer_index);
+    }
+}
+
+// Write (or drop) input frames immediately in pass-through mode. Stereo input with default outputs
+// is written directly; anything else is first converted to stereo in the pass buffer.
+
+static void pass_audio (Skipper *sk, const int16_t *samples, int num_frames)
+{
+    const int channels = sk->config.channels, left_output = sk->config.left_output, right_output = sk->config.right_output;
+
+    if (sk->config.skip_mode != SKIP_NOTHING) {
+        sk->samples_discarded += num_frames;
+        return;
+    }
+
+    if (channels == 2 && left_output == OUTPUT_AUDIO && right_output == OUTPUT_AUDIO)
+        write_audio (sk, samples, num_frames, sk->num_samples);
+    else {
+        for (int j = 0; j < num_frames; j++) {
+            int16_t left = samples [j * channels], right = samples [j * channels + channels - 1], mono = (left + right) >> 1;
+
+            sk->pass_buffer [j * 2] = left_output == OUTPUT_MONO ? mono : left;
+            sk->pass_buffer [j * 2 + 1] = right_output == OUTPUT_MONO ? mono : right;
+        }
+
+        write_audio (sk, sk->pass_buffer, num_frames, sk->num_samples);
+    }
+
+    sk->samples_written += num_frames;
+}
+
+// Return the dither generator state "steps" frames after "random" without stepping through them.
+// The generator alternates between odd and even values (the xor just flips the low bit of the
+// product), so each pair of steps is 225 * random + 14 from an even value (or - 14 from an odd
+// one), which can be applied repeatedly by squaring like any other linear congruential generator.
+
+static uint32_t advance_random (uint32_t random, uint64_t steps)
+{
+    uint32_t mult = 225, add;
+
+    if (steps & 1)
+        random = ((random << 4) - random) ^ 1;
+
+    add = random & 1 ? (uint32_t) -14 : 14;
+
+    for (steps >>= 1; steps; steps >>= 1) {
+        if (steps & 1)
+            random = random * mult + add;
+
+        add = add * mult + add;
+        mult *= mult;
+    }
+
+    return random;
+}
+
+// Initialize the filters and prime them (and the level ring buffer) with dither, which is done
+// at the start of the stream and before every probe window.
+
+static void init_front_end (Skipper *sk)
+{
+    BiquadCoefficients coefficients;
+
+#ifdef HIGHPASS_FREQ
+    biquad_highpass (&coefficients, HIGHPASS_FREQ / sk->config.sample_rate);
+    biquad_init (sk->highpass + 0, &coefficients, 1.0);
+    biquad_init (sk->highpass + 1, &coefficients, 1.0);
+#endif
+
+#ifdef LOWPASS_FREQ
+    biquad_lowpass (&coefficients, LOWPASS_FREQ / sk->config.sample_rate);
+    biquad_init (sk->lowpass + 0, &coefficients, 1.0);
+    biquad_init (sk->lowpass + 1, &coefficients, 1.0);
+#endif
+
+    for (int i = 0; i < sk->ring_buff_len; ++i)
+        sk->ring_buffer [i] = (int32_t)(sk->random = ((sk->random << 4) - sk->random) ^ 1) >> 26;
+
+#ifdef HIGHPASS_FREQ
+    biquad_apply_buffer (sk->highpass + 0, sk->ring_buffer, sk->ring_buff_len, 1);
+    biquad_apply_buffer (sk->highpass + 1, sk->ring_buffer, sk->ring_buff_len, 1);
+#endif
+
+#ifdef LOWPASS_FREQ
+    biquad_apply_buffer (sk->lowpass + 0, sk->ring_buffer, sk->ring_buff_len, 1);
+    biquad_apply_buffer (sk->lowpass + 1, sk->ring_buffer, sk->ring_buff_len, 1);
+#endif
+}
+
+// Downmix (with dither) and filter a block of up to sample_rate input frames into fsamples.
+
+static inline __attribute__ ((always_inline))
+void filter_block (Skipper *sk, const int16_t *samples, int input_samples, const int channels)
+{
+    if (channels == 2)
+        for (int j = 0; j < input_samples; j++)
+            sk->fsamples [j] = ((float) samples [j * 2] + samples [j * 2 + 1]) / 2.0 + ((int32_t)(sk->random = ((sk->random << 4) - sk->random) ^ 1) >> 26);
+    else
+        for (int j = 0; j < input_samples; j++)
+            sk->fsamples [j] = (float) samples [j] + ((int32_t)(sk->random = ((sk->random << 4) - sk->random) ^ 1) >> 26);
+
+#ifdef HIGHPASS_FREQ
+    biquad_apply_buffer (sk->highpass + 0, sk->fsamples, input_samples, 1);
+    biquad_apply_buffer (sk->highpass + 1, sk->fsamples, input_samples, 1);
+#endif
+
+#ifdef LOWPASS_FREQ
+    biquad_apply_buffer (sk->lowpass + 0, sk->fsamples, input_samples, 1);
+    biquad_apply_buffer (sk->lowpass + 1, sk->fsamples, input_samples, 1);
+#endif
+}
+
+/* The log envelope (config.log_envelope) stores each level as its log2 in 1/LOG_STEPS octaves,
+ * offset by LOG_FLOOR octaves so that it fits in 16 bits (the levels never get anywhere near
+ * either end, but are clamped to them). That's just the float's exponent followed by a fraction
+ * looked up from the top 10 bits of the mantissa. It's half the memory of the float envelope, and
+ * the ratios of levels that the analysis uses become differences (see scan_window_log()). The
+ * error is about a step, far below anything the analysis resolves, but a level right at one of
+ * its thresholds can still land on the other side.
+ */
+
+static uint16_t log_fractions [LOG_STEPS];
+static int log_fractions_ready;
+
+static void init_log_fractions (void)
+{
+    if (log_fractions_ready++)
+        return;
+
+    for (int i = 0; i < LOG_STEPS; ++i) {
+        int fraction = (int) floor (log2 (1.0 + (i + 0.5) / LOG_STEPS) * LOG_STEPS + 0.5);
+        log_fractions [i] = fraction < LOG_STEPS ? fraction : LOG_STEPS - 1;
+    }
+}
+
+static inline uint16_t log_level (float level)
+{
+    uint32_t bits;
+    int octave;
+
+    memcpy (&bits, &level, sizeof (bits));
+    octave = (int32_t) bits > 0 ? (int) (bits >> 23) - 127 + LOG_FLOOR : -1;
+
+    if (octave < 0)
+        return 0;
+    else if (octave >= 65536 / LOG_STEPS)
+        return 65535;
+    else
+        return octave * LOG_STEPS + log_fractions [(bits >> 13) & (LOG_STEPS - 1)];
+}
+
+static double log_level_value (int value)
+{
+    return exp2 ((double) value / LOG_STEPS - LOG_FLOOR);
+}
+
+// Add a span of filtered samples to the level ring buffer and store the mean square level after
+// each of them in levels[] (or in log_levels[] for the log envelope, with levels NULL). The span
+// must not cross the end of the ring, and when it starts at the beginning the sum is recalculated
+// from scratch (to avoid accumulating errors).
+
+static inline __attribute__ ((always_inline))
+void level_span (Skipper *sk, const float *fsamples, float *levels, uint16_t *log_levels, int span, const int ring_buff_len)
+{
+    int ring_buff_index = sk->num_samples % ring_buff_len, j = 0;
+    float *ring = sk->ring_buffer + ring_buff_index;
+    double level = sk->level;
+
+    if (ring_buff_index == 0) {
+        level = (ring [0] = fsamples [0]) * fsamples [0];
+
+        for (int i = 1; i < ring_buff_len; ++i)
+            level += ring [i] * ring [i];
+
+        if (levels)
+            levels [j++] = level / ring_buff_len;
+        else
+            log_levels [j++] = log_level (level / ring_buff_len);
+    }
+
+    for (; j < span; ++j) {
+        level -= ring [j] * ring [j];
+        ring [j] = fsamples [j];
+        level += ring [j] * ring [j];
+
+        if (levels)
+            levels [j] = level / ring_buff_len;
+        else
+            log_levels [j] = log_level (level / ring_buff_len);
+    }
+
+    sk->level = level;
+}
+
+// Stage a span of output samples (starting at output_buffer_index) for one channel (0 = left,
+// 1 = right). Level output lags by half the ring so that it lines up with the audio.
+
+static inline __attribute__ ((always_inline))
+void stage_channel (Skipper *sk, int output, int chan, const int16_t *samples, const float *fsamples,
+    const float *levels, const uint16_t *log_levels, int span, const int channels, const int ring_buff_len)
+{
+    int16_t *outptr = sk->output_buffer + sk->output_buffer_index * 2 + chan;
+    double full_scale_rms = 32768.0 * 32767.0 * 0.5;
+    int j = 0;
+
+    switch (output) {
+        case OUTPUT_AUDIO:
+            for (const int16_t *inptr = samples + (chan ? channels - 1 : 0); j < span; ++j)
+                outptr [j * 2] = inptr [j * channels];
+
+            break;
+
+        case OUTPUT_MONO:
+            for (; j < span; ++j)
+                outptr [j * 2] = (samples [j * channels] + samples [j * channels + channels - 1]) >> 1;
+
+            break;
+
+        case OUTPUT_FILTERED:
+            for (; j < span; ++j)
+                outptr [j * 2] = fsamples [j];
+
+            break;
+
+        case OUTPUT_LEVEL:
+            if (sk->output_buffer_index < ring_buff_len / 2)
+                j = ring_buff_len / 2 - sk->output_buffer_index;
+
+            for (; j < span; ++j) {
+                double level = levels ? levels [j] : log_level_value (log_levels [j]);
+                sk->output_buffer [(sk->output_buffer_index + j - ring_buff_len / 2) * 2 + chan] = floor ((log10 (level / full_scale_rms) + 9.6) * 3413 + 0.5);
+            }
+
+            break;
+    }
+}
+
+// Create a new Skipper context with the specified configuration (which is copied). The tensor
+// must remain valid for the life of the context. Returns NULL on failure (including config.use_forest
+// without a compiled-in ensemble).
+
+Skipper *skipper_create (const SkipperConfig *config)
+{
+    Skipper *sk;
+
+    if (!config->tensor || config->channels < 1 || config->channels > 2 || !config->sample_rate ||
+        (config->use_forest && !FOREST_TREES))
+            return NULL;
+
+    if (!(sk = calloc (1, sizeof (Skipper))))
+        return NULL;
+
+    register_log_events ();
+    init_log_fractions ();
+    sk->config = *config;
+    sk->config.params = NULL;
+
+    if (config->params)
+        sk->params = *config->params;
+    else
+        skipper_default_params (&sk->params);
+
+    if (skipper_check_params (&sk->params)) {
+        free (sk);
+        return NULL;
+    }
+
+    sk->random = DITHER_SEED;
+    sk->pipeline = select_pipeline (config);
+
+    sk->fsamples = calloc (sk->config.sample_rate, sizeof (float));
+
+    sk->step_samples = STEP_SAMPLES (sk->config.sample_rate);
+    sk->ring_buff_len = RING_BUFF_LEN (sk->config.sample_rate);
+    sk->ring_buffer = calloc (sk->ring_buff_len, sizeof (float));
+
+    sk->level_buff_len = LEVEL_BUFF_LEN (sk->config.sample_rate);
+
+    if (config->log_envelope)
+        sk->log_buffer = calloc (sk->level_buff_len, sizeof (uint16_t));
+    else
+        sk->level_buffer = calloc (sk->level_buff_len, sizeof (float));
+
+    sk->crossfade_buff_len = CROSSFADE_BUFF_LEN (sk->config.sample_rate);
+
+    // When passing (or dropping) everything and the outputs don't depend on the analysis, there's
+    // no reason to hold the audio until the decisions are confirmed, so we write it (or drop it)
+    // on arrival instead of staging it in the output buffer. Detection and reporting are the same.
+
+    sk->pass_through = (config->skip_mode == SKIP_NOTHING || config->skip_mode == SKIP_EVERYTHING) &&
+        (config->left_output == OUTPUT_AUDIO || config->left_output == OUTPUT_MONO) &&
+        (config->right_output == OUTPUT_AUDIO || config->right_output == OUTPUT_MONO);
+
+    if (sk->pass_through)
+        sk->pass_buffer = calloc (sk->config.sample_rate, sizeof (int16_t) * 2);
+    else {
+        sk->output_buff_len = OUTPUT_BUFF_LEN (sk->config.sample_rate);
+        sk->output_buffer = calloc (sk->output_buff_len, sizeof (int16_t) * 2);
+        sk->crossfade_buffer = calloc (sk->crossfade_buff_len, sizeof (int16_t) * 2);
+    }
+
+    if (!sk->fsamples || !sk->ring_buffer || !(sk->level_buffer || sk->log_buffer) ||
+        (sk->pass_through ? !sk->pass_buffer : !sk->output_buffer || !sk->crossfade_buffer)) {
+        skipper_free (sk);
+        return NULL;
+    }
+
+    init_front_end (sk);
+    return sk;
+}
+
+/* The decision state machine. Each window score goes into a moving average and, once there are
+ * enough for a full average, each average is a vote for music or talk. Votes against the current
+ * mode count up toward confirming a transition (which starts where the first of them was) and
+ * votes for it count back down, and a transition that stays pending too long is cancelled. This is
+ * shared by the streams and skipper_replay() so that replayed decisions are exactly the same. The
+ * sum of the averaged scores is returned in *tensor_value (when DECIDE_AVERAGED).
+ */
+
+#define DECIDE_AVERAGED     1       // there was a full average (nothing else happens without one)
+#define DECIDE_PENDING      2       // a possible transition starts at this window
+#define DECIDE_CANCELLED    4       // the pending transition has been cancelled
+#define DECIDE_MUSIC        8       // a transition to music is confirmed (and is the current mode)
+#define DECIDE_TALK         16      // a transition to talk is confirmed (and is the current mode)
+
+static inline int decide_window (Skipper *sk, int threshold, int *tensor_value)
+{
+    const SkipperParams *params = &sk->params;
+    int decision = DECIDE_AVERAGED;
+
+    sk->results_buffer [sk->results_buffer_count++] = *tensor_value;
+
+    if (sk->results_buffer_count < params->average_windows)
+        return 0;
+
+    for (int i = *tensor_value = 0; i < sk->results_buffer_count; ++i)
+        *tensor_value += sk->results_buffer [i];
+
+    memmove (sk->results_buffer, sk->results_buffer + 1, params->average_windows - 1);
+    sk->results_buffer_count--;
+
+    if (*tensor_value > threshold * sk->results_buffer_count) {
+        if (sk->current_mode == MODE_MUSIC) {
+            if (sk->talk_up_counter && --sk->talk_up_counter) {
+                if (++sk->pend_up_counter >= params->max_pend_windows) {
+                    sk->talk_up_counter = 0;
+                    decision |= DECIDE_CANCELLED;
+                }
+            }
+        }
+        else {
+            if (!sk->music_up_counter) {
+                sk->pend_up_counter = 0;
+                decision |= DECIDE_PENDING;
+            }
+
+            if (++sk->music_up_counter == params->min_music_windows) {
+                sk->current_mode = MODE_MUSIC;
+                sk->music_up_counter = 0;
+                decision |= DECIDE_MUSIC;
+            }
+
+            sk->pend_up_counter++;
+        }
+    }
+    else {
+        if (sk->current_mode == MODE_TALK) {
+            if (sk->music_up_counter && --sk->music_up_counter) {
+                if (++sk->pend_up_counter >= params->max_pend_windows) {
+                    sk->music_up_counter = 0;
+                    decision |= DECIDE_CANCELLED;
+                }
+            }
+        }
+        else {
+            if (!sk->talk_up_counter) {
+                sk->pend_up_counter = 0;
+                decision |= DECIDE_PENDING;
+            }
+
+            if (++sk->talk_up_counter == params->min_talk_windows) {
+                sk->current_mode = MODE_TALK;
+                sk->talk_up_counter = 0;
+                decision |= DECIDE_TALK;
+            }
+
+            sk->pend_up_counter++;
+        }
+    }
+
+    return decision;
+}
+
+/* Process one block of up to sample_rate input frames. This is always inlined with the channel
+ * count and sample rate as arguments so that the specialized pipelines below (where they are
+ * constants) get all the buffer lengths, trip counts and divisors as compile-time constants. The
+ * buffers themselves are still allocated per stream (so any number of streams can run), but
+ * their sizes are always exactly these.
+ */
+
+static inline __attribute__ ((always_inline))
+int process_block (Skipper *sk, const int16_t *samples, int input_samples, const int channels, const int sample_rate)
+{
+    const int keepalive = sk->config.keepalive;
+    const int left_output = sk->config.left_output, right_output = sk->config.right_output;
+    const int skip_mode = sk->config.skip_mode, threshold = sk->config.threshold;
+    const int verbose = sk->config.verbose, quiet = sk->config.quiet;
+    const int step_samples = STEP_SAMPLES (sample_rate), ring_buff_len = RING_BUFF_LEN (sample_rate);
+    const int level_buff_len = LEVEL_BUFF_LEN (sample_rate), crossfade_buff_len = CROSSFADE_BUFF_LEN (sample_rate);
+    const int output_buff_len = OUTPUT_BUFF_LEN (sample_rate);
+    const int average_samples = sk->params.average_windows * STEP_MSECS * sample_rate / 1000;
+    Skipper *leader = sk->leader;
+
+    if (sk->pass_through)
+        pass_audio (sk, samples, input_samples);
+
+    // a stream following another one (see skipper_follow()) has no front end or analysis
+
+    if (!leader) {
+        uint64_t start = TRACE_START ();
+
+        filter_block (sk, samples, input_samples, channels);
+        TRACE_SPAN ("front end", start, sk->config.stream_id, -1);
+    }
+
+    // The loop works on spans of samples that end at the next boundary where something other than
+    // buffering can happen: the ring wrapping, a window completing, the output buffer filling, or
+    // the end of the block. Between these the number of available (confirmed) samples can't change
+    // (the sample count and the output buffer index advance together), so checking for a flush at
+    // the end of each span is the same as checking after every sample.
+
+    for (int j = 0, span; j < input_samples; j += span) {
+        float *levels = sk->level_buffer ? sk->level_buffer + sk->level_buffer_index : NULL;
+        uint16_t *log_levels = sk->log_buffer ? sk->log_buffer + sk->level_buffer_index : NULL;
+
+        span = input_samples - j;
+
+        if (span > ring_buff_len - sk->num_samples % ring_buff_len)
+            span = ring_buff_len - sk->num_samples % ring_buff_len;
+
+        if (span > level_buff_len - sk->level_buffer_index)
+            span = level_buff_len - sk->level_buffer_index;
+
+        if (!sk->pass_through && span > output_buff_len - sk->output_buffer_index)
+            span = output_buff_len - sk->output_buffer_index;
+
+        if (!leader) {
+            if (log_levels)
+                level_span (sk, sk->fsamples + j, NULL, log_levels, span, ring_buff_len);
+            else
+                level_span (sk, sk->fsamples + j, levels, NULL, span, ring_buff_len);
+        }
+
+        if (!sk->pass_through) {
+            if (channels == 2 && left_output == OUTPUT_AUDIO && right_output == OUTPUT_AUDIO)
+                memcpy (sk->output_buffer + sk->output_buffer_index * 2, samples + j * 2, span * sizeof (int16_t) * 2);
+            else {
+                stage_channel (sk, left_output, 0, samples + j * channels, sk->fsamples + j, levels, log_levels, span, channels, ring_buff_len);
+                stage_channel (sk, right_output, 1, samples + j * channels, sk->fsamples + j, levels, log_levels, span, channels, ring_buff_len);
+            }
+
+            sk->output_buffer_index += span;
+        }
+
+        sk->level_buffer_index += span;
+        sk->num_samples += span;
+
+        if (sk->level_buffer_index == level_buff_len) {
+            int tensor_value, decision, detected_mode = MODE_NOTHING, previous_mode = sk->current_mode;
+
+            if (leader)
+                tensor_value = leader->shared_scores [((sk->num_samples + sk->leader_offset) / step_samples) % SHARED_SCORES].value;
+            else if (sk->num_windows % degrade_levels [sk->degrade_level].interval)
+                tensor_value = sk->held_value;
+            else {
+                uint64_t window_start = TRACE_START ();
+
+                if (sk->log_buffer)
+                    tensor_value = analyze_log_window (sk, sk->log_buffer, sk->num_samples, level_buff_len,
+                        degrade_levels [sk->degrade_level].decimate ? ENVELOPE_DECIM : 1);
+                else if (degrade_levels [sk->degrade_level].decimate)
+                    tensor_value = analyze_window (sk, sk->level_buffer, sk->num_samples, level_buff_len, ENVELOPE_DECIM);
+                else
+                    tensor_value = analyze_window (sk, sk->level_buffer, sk->num_samples, level_buff_len, 1);
+
+                TRACE_SPAN ("analysis", window_start, sk->config.stream_id, -1);
+            }
+
+            sk->held_value = tensor_value;
+
+            if (sk->shared_scores) {
+                SkipperScore *score = sk->shared_scores + (sk->num_samples / step_samples) % SHARED_SCORES;
+
+                score->position = sk->num_samples;
+                score->value = tensor_value;
+            }
+
+            if (sk->config.record_segments)
+                record_window_score (sk, tensor_value);
+
+            if (tensor_value > threshold)
+                sk->music_hits++;
+            else if (tensor_value < threshold)
+                sk->talk_hits++;
+
+            decision = decide_window (sk, threshold, &tensor_value);
+
+            if (decision & DECIDE_AVERAGED) {
+                if (left_output == OUTPUT_TENSOR || right_output == OUTPUT_TENSOR) {
+                    int16_t *outbuff_window = sk->output_buffer + sk->output_buffer_index * 2;
+
+                    outbuff_window -= WINDOW_SECONDS * sample_rate / 2 * 2;
+                    outbuff_window -= average_samples / 2 * 2;
+                    outbuff_window -= step_samples / 2 * 2;
+
+                    if (outbuff_window >= sk->output_buffer) {
+                        int16_t value = (tensor_value * 100 + sk->results_buffer_count / 2) / sk->results_buffer_count;
+
+                        for (int i = 0; i < step_samples; ++i) {
+                            if (left_output == OUTPUT_TENSOR)
+                                outbuff_window [i * 2] = value - threshold * 100;
+                            if (right_output == OUTPUT_TENSOR)
+                                outbuff_window [i * 2 + 1] = value - threshold * 100;
+                        }
+                    }
+                }
+
+                if (decision & DECIDE_PENDING)
+                    sk->transition_sample = sk->num_samples - (WINDOW_SECONDS * sample_rate + average_samples) / 2;
+
+                if ((decision & DECIDE_CANCELLED) && verbose)
+                    LOG_EVENT (EV_PEND_CANCEL, LOG_S (sk->current_mode == MODE_MUSIC ? "TALK" : "MUSIC"),
+                        LOG_I ((sk->pend_up_counter * STEP_MSECS + 500) / 1000));
+
+                if (decision & DECIDE_MUSIC)
+                    detected_mode = MODE_MUSIC;
+                else if (decision & DECIDE_TALK)
+                    detected_mode = MODE_TALK;
+
+                if (detected_mode) {
+                    if (skip_mode == SKIP_MUSIC || skip_mode == SKIP_TALK) {
+                        int audio_offset = sk->transition_sample - sk->num_samples + sk->output_buffer_index;
+                        int crossfade_start = audio_offset - crossfade_buff_len / 2;
+
+                        if (skip_mode == (detected_mode == MODE_MUSIC ? SKIP_MUSIC : SKIP_TALK)) {
+                            if (crossfade_start >= 0) {
+                                write_audio (sk, sk->output_buffer, crossfade_start, sk->num_samples - sk->output_buffer_index);
+                                sk->samples_written += crossfade_start;
+                                memmove (sk->output_buffer, sk->output_buffer + crossfade_start * 2, (output_buff_len - crossfade_start) * sizeof (int16_t) * 2);
+                                sk->output_buffer_index -= crossfade_start;
+
+                                if (verbose)
+                                    LOG_EVENT (EV_FADE_OUT, LOG_I (crossfade_start), LOG_D ((float) crossfade_start / sample_rate),
+                                        LOG_D ((float) sk->output_buffer_index / sample_rate));
+
+                                memcpy (sk->crossfade_buffer, sk->output_buffer, crossfade_buff_len * 4);
+                                fade_out (sk->crossfade_buffer, crossfade_buff_len * 2, 1);
+
+                                // If this only established the mode that the history (see skipper_start())
+                                // started in (it was pending from the first averaged window), there was no
+                                // transition here in a stream started from the beginning, so the next fade
+                                // in mustn't mix in this audio (which that stream skipped). A transition
+                                // within the history is real, and keeps its tail.
+
+                                int64_t first_transition = sk->num_samples - (WINDOW_SECONDS * sample_rate + average_samples) / 2 -
+                                    (int64_t) (sk->num_windows - sk->params.average_windows + 1) * step_samples;
+
+                                if (previous_mode == MODE_NOTHING && sk->transition_sample == first_transition &&
+                                    sk->num_samples - sk->output_buffer_index < sk->output_start)
+                                        memset (sk->crossfade_buffer, 0, crossfade_buff_len * 4);
+                            }
+                            else {
+                                sk->error = "skipped transition, buffer out of range";
+                                return -1;
+                            }
+                        }
+                        else {
+                            if (crossfade_start >= 0) {
+                                memmove (sk->output_buffer, sk->output_buffer + crossfade_start * 2, (output_buff_len - crossfade_start) * sizeof (int16_t) * 2);
+                                sk->output_buffer_index -= crossfade_start;
+                                sk->samples_discarded += crossfade_start;
+
+                                if (verbose)
+                                    LOG_EVENT (EV_FADE_IN, LOG_I (crossfade_start), LOG_D ((float) crossfade_start / sample_rate),
+                                        LOG_D ((float) sk->output_buffer_index / sample_rate));
+
+                                if (!quiet)
+                                    LOG_EVENT (EV_CROSSFADE, LOG_S (detected_mode == MODE_MUSIC ? "MUSIC" : "TALK"),
+                                        LOG_I (MINS (sk->samples_written + crossfade_buff_len / 2, sample_rate)),
+                                        LOG_I (SECS (sk->samples_written + crossfade_buff_len / 2, sample_rate)));
+
+                                fade_in (sk->output_buffer, crossfade_buff_len * 2, 1);
+
+                                for (int i = 0; i < crossfade_buff_len * 2; ++i) {
+                                    int32_t sum = sk->output_buffer [i] + sk->crossfade_buffer [i];
+
+                                    if (sum > 32767) sk->output_buffer [i] = 32767;
+                                    else if (sum < -32768) sk->output_buffer [i] = -32768;
+                                    else sk->output_buffer [i] = sum;
+                                }
+                            }
+                            else {
+                                sk->error = "skipped transition, buffer out of range";
+                                return -1;
+                            }
+                        }
+                    }
+                    else if (!quiet)
+                        LOG_EVENT (EV_DETECTED, LOG_I (MINS (sk->num_samples, sample_rate)), LOG_I (SECS (sk->num_samples, sample_rate)),
+                            LOG_S (detected_mode == MODE_MUSIC ? "MUSIC" : " TALK"),
+                            LOG_I (MINS (sk->transition_sample, sample_rate)), LOG_I (SECS (sk->transition_sample, sample_rate)));
+
+                    if (sk->config.record_segments)
+                        record_transition (sk, sk->transition_sample, detected_mode);
+                }
+
+                if (!sk->talk_up_counter && !sk->music_up_counter)
+                    sk->confirmed_sample = sk->num_samples - (WINDOW_SECONDS * sample_rate + average_samples + step_samples + crossfade_buff_len) / 2;
+            }
+
+            if (!leader) {
+                if (sk->log_buffer)
+                    memmove (sk->log_buffer, sk->log_buffer + step_samples, (WINDOW_SECONDS * sample_rate - step_samples) * sizeof (uint16_t));
+                else
+                    memmove (sk->level_buffer, sk->level_buffer + step_samples, (WINDOW_SECONDS * sample_rate - step_samples) * sizeof (float));
+            }
+
+            sk->level_buffer_index -= step_samples;
+            sk->num_windows++;
+        }
+
+        if (sk->pass_through)
+            continue;
+
+        int available_samples = sk->confirmed_sample - sk->num_samples + sk->output_buffer_index + step_samples / 2;
+
+        if (sk->output_buffer_index == output_buff_len || available_samples >= sample_rate * 60) {
+
+            if (keepalive && available_samples > crossfade_buff_len * 2 && skip_mode == (sk->current_mode == MODE_MUSIC ? SKIP_MUSIC : SKIP_TALK)) {
+                int crossfade_start = available_samples / 2 - crossfade_buff_len;
+                int16_t *crossfade_ptr = sk->output_buffer + crossfade_start * 2;
+
+                for (int i = 0; i < crossfade_buff_len * 4; ++i)
+                    crossfade_ptr [i] >>= 2;
+
+                fade_in (crossfade_ptr, crossfade_buff_len * 2, 1);
+
+                for (int i = 0; i < crossfade_buff_len * 2; ++i)
+                    crossfade_ptr [i] += sk->crossfade_buffer [i];
+
+                write_audio (sk, crossfade_ptr, crossfade_buff_len, sk->num_samples - sk->output_buffer_index + crossfade_start);
+                memcpy (sk->crossfade_buffer, crossfade_ptr + crossfade_buff_len * 2, crossfade_buff_len * 4);
+                fade_out (sk->crossfade_buffer, crossfade_buff_len * 2, 1);
+
+                sk->samples_discarded += available_samples - crossfade_buff_len;
+                sk->samples_written += crossfade_buff_len;
+
+                memmove (sk->output_buffer, sk->output_buffer + available_samples * 2, (output_buff_len - available_samples) * sizeof (int16_t) * 2);
+                sk->output_buffer_index -= available_samples;
+
+                if (verbose)
+                    LOG_EVENT (EV_KEEPALIVE_VERBOSE, LOG_I (available_samples - crossfade_buff_len),
+                        LOG_D ((float) (available_samples - crossfade_buff_len) / sample_rate),
+                        LOG_S (sk->current_mode == MODE_MUSIC ? "MUSICAL" : "TALKING"),
+                        LOG_I (MINS (sk->samples_written - crossfade_buff_len / 2, sample_rate)),
+                        LOG_I (SECS (sk->samples_written - crossfade_buff_len / 2, sample_rate)));
+                else if (!quiet)
+                    LOG_EVENT (EV_KEEPALIVE, LOG_S (sk->current_mode == MODE_MUSIC ? "MUSICAL" : "TALKING"),
+                        LOG_I (MINS (sk->samples_written - crossfade_buff_len / 2, sample_rate)),
+                        LOG_I (SECS (sk->samples_written - crossfade_buff_len / 2, sample_rate)));
+            }
+            else if (available_samples > 0) {
+                int write_data = skip_mode == SKIP_NOTHING || skip_mode == (sk->current_mode == MODE_MUSIC ? SKIP_TALK : SKIP_MUSIC);
+
+                if (write_data) {
+                    write_audio (sk, sk->output_buffer, available_samples, sk->num_samples - sk->output_buffer_index);
+                    sk->samples_written += available_samples;
+                }
+                else
+                    sk->samples_discarded += available_samples;
+
+                memmove (sk->output_buffer, sk->output_buffer + available_samples * 2, (output_buff_len - available_samples) * sizeof (int16_t) * 2);
+                sk->output_buffer_index -= available_samples;
+
+                if (verbose)
+                    LOG_EVENT (EV_FLUSH, LOG_S (write_data ? "wrote" : "discarded"), LOG_I (available_samples),
+                        LOG_D ((float) available_samples / sample_rate), LOG_I (sk->output_buffer_index),
+                        LOG_D ((float) sk->output_buffer_index / sample_rate), LOG_I (sk->music_up_counter), LOG_I (sk->talk_up_counter));
+            }
+            else {
+                sk->error = "buffer full with no confirmed samples!";
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+#define SPECIALIZED_PIPELINE(rate, chans) \
+static int process_block_##rate##_##chans (Skipper *sk, const int16_t *samples, int num_frames) \
+{ \
+    return process_block (sk, samples, num_frames, chans, rate); \
+}
+
+SPECIALIZED_PIPELINE (44100, 1)
+SPECIALIZED_PIPELINE (44100, 2)
+SPECIALIZED_PIPELINE (48000, 1)
+SPECIALIZED_PIPELINE (48000, 2)
+
+static int process_block_generic (Skipper *sk, const int16_t *samples, int num_frames)
+{
+    return process_block (sk, samples, num_frames, sk->config.channels, sk->config.sample_rate);
+}
+
+// the first entry is the generic pipeline (for any other configuration)
+
+static const struct {
+    int sample_rate, channels;
+    int (*process) (Skipper *sk, const int16_t *samples, int num_frames);
+    const char *name;
+} pipelines [] = {
+    { 0,     0, process_block_generic,  "generic" },
+    { 44100, 1, process_block_44100_1,  "44.1 kHz mono" },
+    { 44100, 2, process_block_44100_2,  "44.1 kHz stereo" },
+    { 48000, 1, process_block_48000_1,  "48 kHz mono" },
+    { 48000, 2, process_block_48000_2,  "48 kHz stereo" },
+};
+
+#define NUM_PIPELINES (sizeof (pipelines) / sizeof (pipelines [0]))
+
+static int select_pipeline (const SkipperConfig *config)
+{
+    if (!config->generic_pipeline)
+        for (int i = 1; i < NUM_PIPELINES; ++i)
+            if (pipelines [i].sample_rate == config->sample_rate && pipelines [i].channels == config->channels)
+                return i;
+
+    return 0;
+}
+
+const char *skipper_pipeline_name (const Skipper *sk)
+{
+    return pipelines [sk->pipeline].name;
+}
+
+// Run frames through the front end only (starting at num_samples) and leave the levels of the last
+// num_levels of them at the start of levels[] (or log_levels[], with levels NULL). The levels
+// before those are just warm-up, so they also go into the start of the buffer (which is
+// overwritten later). Spans end at ring wraps and the start of the kept levels.
+
+static void front_end_levels (Skipper *sk, const int16_t *samples, int num_frames, float *levels, uint16_t *log_levels, int num_levels)
+{
+    const int channels = sk->config.channels, sample_rate = sk->config.sample_rate, window_start = num_frames - num_levels;
+
+    for (int frame = 0; frame < num_frames; frame += sample_rate) {
+        int block_frames = num_frames - frame > sample_rate ? sample_rate : num_frames - frame;
+
+        filter_block (sk, samples + frame * channels, block_frames, channels);
+
+        for (int j = 0, span; j < block_frames; j += span) {
+            span = block_frames - j;
+
+            if (span > sk->ring_buff_len - sk->num_samples % sk->ring_buff_len)
+                span = sk->ring_buff_len - sk->num_samples % sk->ring_buff_len;
+
+            if (frame + j < window_start && span > window_start - frame - j)
+                span = window_start - frame - j;
+
+            int offset = frame + j < window_start ? 0 : frame + j - window_start;
+
+            level_span (sk, sk->fsamples + j, levels ? levels + offset : NULL, log_levels ? log_levels + offset : NULL,
+                span, sk->ring_buff_len);
+
+            sk->num_samples += span;
+        }
+    }
+}
+
+/* Make a stream use the window scores of another stream (the leader) instead of running its own
+ * front end and analysis, for hosts that carry the same feed on several streams (simulcast). The
+ * offset is the leader's sample position for the same audio minus ours, and must be a multiple
+ * of the window step (and not positive in practice, because the leader must already have
+ * analyzed every window before we process it, starting with its first). Everything after the
+ * analysis (the decision logic, output staging and statistics) is still done by each stream,
+ * although the analysis histograms and verbose window reports are only kept by the leader. The
+ * host is responsible for checking that the audio really is the same (including the last
+ * WINDOW_SECONDS before following starts), for processing the leader's audio first, and for
+ * calling this with a NULL leader as soon as it differs. Following also ends automatically if the
+ * leader doesn't have the needed scores (it keeps the last SHARED_SCORES windows).
+ *
+ * A leader only starts keeping its scores the first time another stream tries to follow it, so
+ * a stream that is behind the leader (a negative offset) can't follow it until the leader has
+ * kept the scores of all the windows that it has analyzed and we haven't, and until then the
+ * attempts fail (but may be repeated, for example on every block).
+ *
+ * When following ends our front end is restored: from the leader's if it's at exactly the same
+ * point of the same audio, or else from scratch, in which case no windows are analyzed until the
+ * level buffer refills (5 seconds) unless the host has the recent audio for skipper_prime(). The
+ * leader must not be processed or freed while followed. Returns zero on success or 1 if the
+ * streams aren't compatible or the leader doesn't have the scores yet.
+ */
+
+int skipper_follow (Skipper *sk, Skipper *leader, int64_t offset)
+{
+    Skipper *previous = sk->leader;
+
+    if (leader && (leader == sk || leader->leader || sk->num_followers ||
+        leader->config.sample_rate != sk->config.sample_rate || leader->config.channels != sk->config.channels ||
+        leader->config.tensor != sk->config.tensor || leader->config.model != sk->config.model ||
+        leader->config.hotset != sk->config.hotset ||
+        leader->config.use_forest != sk->config.use_forest || leader->config.log_envelope != sk->config.log_envelope ||
+        offset % sk->step_samples ||
+        sk->config.left_output == OUTPUT_FILTERED || sk->config.left_output == OUTPUT_LEVEL ||
+        sk->config.right_output == OUTPUT_FILTERED || sk->config.right_output == OUTPUT_LEVEL ||
+        sk->num_samples + sk->level_buff_len - sk->level_buffer_index + offset < leader->level_buff_len))
+            return 1;
+
+    if (leader) {
+        int64_t window = sk->num_samples + sk->level_buff_len - sk->level_buffer_index + offset;
+
+        if (!leader->shared_scores) {
+            if (!(leader->shared_scores = malloc (SHARED_SCORES * sizeof (SkipperScore))))
+                return 1;
+
+            for (int i = 0; i < SHARED_SCORES; ++i)
+                leader->shared_scores [i].position = -1;
+        }
+
+        // the leader must already have the scores of the windows it has analyzed and we haven't
+
+        for (; window <= leader->num_samples; window += sk->step_samples)
+            if (leader->shared_scores [(window / sk->step_samples) % SHARED_SCORES].position != window)
+                return 1;
+    }
+
+    if (previous) {
+        if (!sk->leader_offset && previous->num_samples == sk->num_samples) {
+            memcpy (sk->highpass, previous->highpass, sizeof (sk->highpass));
+            memcpy (sk->lowpass, previous->lowpass, sizeof (sk->lowpass));
+            memcpy (sk->ring_buffer, previous->ring_buffer, sk->ring_buff_len * sizeof (float));
+
+            if (sk->log_buffer)
+                memcpy (sk->log_buffer, previous->log_buffer, sk->level_buff_len * sizeof (uint16_t));
+            else
+                memcpy (sk->level_buffer, previous->level_buffer, sk->level_buff_len * sizeof (float));
+
+            sk->level_buffer_index = previous->level_buffer_index;
+            sk->level = previous->level;
+            sk->random = previous->random;
+        }
+        else {
+            init_front_end (sk);
+            sk->level_buffer_index = sk->num_samples % sk->step_samples;
+        }
+
+        previous->num_followers--;
+    }
+
+    if ((sk->leader = leader)) {
+        sk->leader_offset = offset;
+        leader->num_followers++;
+    }
+
+    return 0;
+}
+
+/* Run audio that immediately precedes the current position of the stream through the front end
+ * (only), leaving the filters and the level buffer as if the stream had processed it itself. This
+ * is for a stream that stops following another one at a different point of the same audio (see
+ * skipper_follow()), which otherwise analyzes no windows until its level buffer refills. A second
+ * or so more than WINDOW_SECONDS should be supplied so that the filters settle. Returns zero on
+ * success or 1 if there isn't enough audio (or more than the stream has had).
+ */
+
+int skipper_prime (Skipper *sk, const int16_t *samples, int num_frames)
+{
+    int64_t position = sk->num_samples;
+    int num_levels = position < sk->level_buff_len ? position :
+        sk->level_buff_len - sk->step_samples + position % sk->step_samples;
+
+    if (num_frames < num_levels || num_frames > position || sk->leader)
+        return 1;
+
+    // the dither continues from where a stream that processed all the audio itself would be
+
+    sk->random = advance_random (DITHER_SEED, position - num_frames);
+    init_front_end (sk);
+    sk->num_samples = position - num_frames;
+    front_end_levels (sk, samples, num_frames, sk->level_buffer, sk->log_buffer, num_levels);
+    sk->level_buffer_index = num_levels;
+    return 0;
+}
+
+/* Start a new stream partway into its audio (at frame "position" of it) instead of at the
+ * beginning, for hosts that seek. The history_frames frames just before position go through the
+ * whole stream (front end, analysis and decisions) but none of them are written, so the output
+ * starts at position with the current mode already established, provided the history reaches
+ * back past the last decision (the --start option of SKIPPER looks for the shortest history
+ * that does). Sample positions (reported, recorded and returned) still count from the beginning,
+ * and the history counts as discarded audio. If the history starts in the mode that is skipped,
+ * the first crossfade after position is a plain fade in (a stream started from the beginning
+ * would also mix in the tail of the transition into that mode, but it's before the history).
+ * Returns zero on success or 1 if the stream has already had audio or is following another one,
+ * there's more history than position, or the processing fails.
+ */
+
+int skipper_start (Skipper *sk, const int16_t *history, int history_frames, int64_t position)
+{
+    if (sk->num_samples || sk->leader || history_frames < 0 || history_frames > position)
+        return 1;
+
+    // the dither is where it would be after the audio before the history (so that the levels,
+    // and therefore the decisions, are the same as a stream started from the beginning)
+
+    sk->random = advance_random (sk->random, position - history_frames);
+    sk->num_samples = sk->transition_sample = sk->confirmed_sample = position - history_frames;
+    sk->output_start = position;
+
+    return history_frames && skipper_process (sk, history, history_frames) ? 1 : 0;
+}
+
+/* Set the analysis level of a stream, from 0 (full analysis, the default) to DEGRADE_LEVELS - 1
+ * (cheapest), for hosts that run more streams than they can always keep up with. The cheaper
+ * levels analyze fewer windows (repeating the last score for the others) and so cost some
+ * accuracy in finding the transitions, but everything else (the decision logic, output staging
+ * and timing) is unchanged, so the level can be changed at any time between calls to
+ * skipper_process() and the stream keeps running without a glitch. A stream following another
+ * one uses the leader's scores, so only the leader's level matters. Returns zero on success or 1
+ * if the level is out of range.
+ */
+
+int skipper_degrade (Skipper *sk, int level)
+{
+    if (level < 0 || level >= DEGRADE_LEVELS)
+        return 1;
+
+    sk->degrade_level = level;
+    return 0;
+}
+
+const char *skipper_degrade_name (int level)
+{
+    return level >= 0 && level < DEGRADE_LEVELS ? degrade_levels [level].name : "unknown";
+}
+
+// The default decision parameters (the ones Skipper was tuned with).
+
+void skipper_default_params (SkipperParams *params)
+{
+    params->average_windows = AVERAGE_COUNT;
+    params->min_music_windows = MIN_MUSIC_SECS * 1000 / STEP_MSECS;
+    params->min_talk_windows = MIN_TALK_SECS * 1000 / STEP_MSECS;
+    params->max_pend_windows = MAX_PEND_SECS * 1000 / STEP_MSECS;
+}
+
+// Check that the decision parameters are in range (the output buffer holds enough lookahead for
+// the longest pending transition and average allowed, and decide_window() needs at least two
+// windows because it scales the threshold by one less than the number averaged). Returns zero if
+// they're good.
+
+int skipper_check_params (const SkipperParams *params)
+{
+    const int max_pend_windows = MAX_PEND_SECS * 1000 / STEP_MSECS;
+
+    return params->average_windows < 2 || params->average_windows > MAX_AVERAGE ||
+        params->max_pend_windows < 1 || params->max_pend_windows > max_pend_windows ||
+        params->min_music_windows < 1 || params->min_music_windows > max_pend_windows ||
+        params->min_talk_windows < 1 || params->min_talk_windows > max_pend_windows;
+}
+
+/* Read decision parameters from a text file (as written by PARAMOPT) with one "name value" pair
+ * per line, where the times are in seconds and blank lines and lines starting with # are
+ * ignored. Anything not in the file keeps the value it had (normally from skipper_default_params())
+ * and the threshold is only stored if it's there. Returns 1 on success, or 0 (with a message) if
+ * the file can't be read or has anything wrong with it.
+ */
+
+int skipper_read_params_file (SkipperParams *params, int *threshold, char *filename)
+{
+    FILE *file = fopen (filename, "r");
+    char line [128], name [64];
+    int line_number = 0;
+    double value;
+
+    if (!file) {
+        fprintf (stderr, "\nerror: can't open \"%s\" for reading!\n", filename);
+        return 0;
+    }
+
+    while (fgets (line, sizeof (line), file)) {
+        char *cp = line;
+        int windows;
+
+        line_number++;
+
+        while (*cp == ' ' || *cp == '\t')
+            cp++;
+
+        if (!*cp || *cp == '\n' || *cp == '\r' || *cp == '#')
+            continue;
+
+        if (sscanf (cp, "%63s %lf", name, &value) != 2) {
+            fprintf (stderr, "\nerror: \"%s\" line %d is not a name and a value!\n", filename, line_number);
+            fclose (file);
+            return 0;
+        }
+
+        windows = (int) floor (value * 1000.0 / STEP_MSECS + 0.5);
+
+        if (!strcmp (name, "average_secs"))
+            params->average_windows = windows;
+        else if (!strcmp (name, "min_music_secs"))
+            params->min_music_windows = windows;
+        else if (!strcmp (name, "min_talk_secs"))
+            params->min_talk_windows = windows;
+        else if (!strcmp (name, "max_pend_secs"))
+            params->max_pend_windows = windows;
+        else if (!strcmp (name, "threshold") && value >= -99 && value <= 99)
+            *threshold = (int) value;
+        else {
+            fprintf (stderr, "\nerror: \"%s\" line %d has an unknown parameter or bad value!\n", filename, line_number);
+            fclose (file);
+            return 0;
+        }
+    }
+
+    fclose (file);
+
+    if (skipper_check_params (params)) {
+        fprintf (stderr, "\nerror: \"%s\" has parameters out of range!\n", filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Run the decision logic over stored window scores (one per STEP_MSECS, e.g. looked up from the
+ * analysis results written with -a) exactly as a stream would, but without any audio. This is
+ * cheap enough (a pass over a byte per window) to try thousands of parameter combinations on a
+ * labeled corpus, which is what PARAMOPT does. The confirmed transitions are stored in decisions
+ * (up to max_decisions of them). Returns the total number of transitions, or -1 if the
+ * parameters are out of range (or out of memory).
+ */
+
+int skipper_replay (const signed char *scores, int num_scores, const SkipperParams *params, int threshold,
+    SkipperDecision *decisions, int max_decisions)
+{
+    int num_decisions = 0, start_window = 0;
+    Skipper *sk;
+
+    if (skipper_check_params (params) || !(sk = calloc (1, sizeof (Skipper))))
+        return -1;
+
+    sk->params = *params;
+
+    for (int window = 0; window < num_scores; ++window) {
+        int tensor_value = scores [window], decision = decide_window (sk, threshold, &tensor_value);
+
+        if (decision & DECIDE_PENDING)
+            start_window = window;
+
+        if (decision & (DECIDE_MUSIC | DECIDE_TALK)) {
+            if (num_decisions < max_decisions) {
+                decisions [num_decisions].start_window = start_window;
+                decisions [num_decisions].confirm_window = window;
+                decisions [num_decisions].mode = sk->current_mode;
+            }
+
+            num_decisions++;
+        }
+    }
+
+    free (sk);
+    return num_decisions;
+}
+
+// Check that the leader has the scores of all the windows that will complete in the next block.
+
+static int shared_scores_ready (Skipper *sk, int num_frames)
+{
+    int64_t window = sk->num_samples + sk->level_buff_len - sk->level_buffer_index;
+
+    for (; window <= sk->num_samples + num_frames; window += sk->step_samples) {
+        int64_t position = window + sk->leader_offset;
+
+        if (position < 0 || sk->leader->shared_scores [(position / sk->step_samples) % SHARED_SCORES].position != position)
+            return 0;
+    }
+
+    return 1;
+}
+
+// Process the specified number of input frames (interleaved if stereo). Any number of frames
+// may be passed, and audio is written through the output callback as it is released. Returns
+// zero on success, or -1 on a fatal error (see sk->error).
+
+int skipper_process (Skipper *sk, const int16_t *samples, int num_frames)
+{
+    int (*process) (Skipper *sk, const int16_t *samples, int num_frames) = pipelines [sk->pipeline].process;
+    const int channels = sk->config.channels, sample_rate = sk->config.sample_rate;
+
+    if (sk->error)
+        return -1;
+
+    do {
+        int block_frames = num_frames > sample_rate ? sample_rate : num_frames;
+        uint64_t start = TRACE_START ();
+
+        if (sk->leader && !shared_scores_ready (sk, block_frames))
+            skipper_follow (sk, NULL, 0);
+
+        if (process (sk, samples, block_frames))
+            return -1;
+
+        TRACE_SPAN ("process", start, sk->config.stream_id, -1);
+
+        samples += block_frames * channels;
+        num_frames -= block_frames;
+    } while (num_frames > 0);
+
+    return 0;
+}
+
+// Flush any remaining buffered audio at the end of the stream (there is no more lookahead, so it
+// is written or discarded based on the current mode).
+
+int skipper_finish (Skipper *sk)
+{
+    const int skip_mode = sk->config.skip_mode, sample_rate = sk->config.sample_rate;
+
+    if (sk->error)
+        return -1;
+
+    if (sk->output_buffer_index) {
+        int write_data = skip_mode == SKIP_NOTHING || skip_mode == (sk->current_mode == MODE_MUSIC ? SKIP_TALK : SKIP_MUSIC);
+
+        if (write_data) {
+            write_audio (sk, sk->output_buffer, sk->output_buffer_index, sk->num_samples - sk->output_buffer_index);
+            sk->samples_written += sk->output_buffer_index;
+        }
+        else
+            sk->samples_discarded += sk->output_buffer_index;
+
+        if (sk->config.verbose)
+            LOG_EVENT (EV_FINAL, LOG_S (write_data ? "wrote" : "discarded"), LOG_I (sk->output_buffer_index),
+                LOG_D ((float) sk->output_buffer_index / sample_rate), LOG_I (sk->music_up_counter), LOG_I (sk->talk_up_counter));
+
+        sk->output_buffer_index = 0;
+    }
+
+    return 0;
+}
+
+/* Analyze windows in isolation, for estimating the content of a whole file from a sample of
+ * windows (see --probe in skipper.c) without running the decision logic. The frames of each
+ * window are run through the front end from a freshly initialized state and the window is the last
+ * WINDOW_SECONDS of them, so anything before that is just filter and level warm-up. The position
+ * of the end of each window in the audio is only used for verbose reporting. The windows go
+ * through the batched analysis (see scan_window_batch()) skipper_batch_windows() at a time, which
+ * needs a buffer for all their envelopes (allocated on first use). The context should be created
+ * for pass-through (e.g., SKIP_EVERYTHING) and used only for probing, and can't use the quantized
+ * model (which needs the history of consecutive windows). With config.log_envelope the windows
+ * are also converted to the log envelope and their values come from its analysis, which is
+ * compared to the float analysis in sk->log_check (see probe_log_window()). The windows' values
+ * (-99 to +99) are stored in values and counted in music_hits and talk_hits as usual. Returns
+ * zero on success, or -1 on error (see sk->error).
+ */
+
+int skipper_probe_windows (Skipper *sk, const int16_t *const *samples, const int *num_frames, const int64_t *positions,
+    int *values, int num_windows)
+{
+    const int threshold = sk->config.threshold, level_buff_len = sk->level_buff_len;
+
+    if (sk->config.model) {
+        sk->error = "can't probe with a model";
+        return -1;
+    }
+
+    for (int i = 0; i < num_windows; ++i)
+        if (num_frames [i] < level_buff_len) {
+            sk->error = "not enough audio for a probe window";
+            return -1;
+        }
+
+    // the float envelopes of a whole batch are needed for batching and for the log envelope checks
+
+    if ((num_windows > 1 || sk->log_buffer) && !sk->batch_levels && !(sk->batch_levels = malloc (BATCH_WINDOWS * level_buff_len * sizeof (float)))) {
+        sk->error = "out of memory";
+        return -1;
+    }
+
+    for (int first = 0; first < num_windows; first += BATCH_WINDOWS) {
+        int count = num_windows - first < BATCH_WINDOWS ? num_windows - first : BATCH_WINDOWS;
+        int batched = count > BATCH_WINDOWS / 2;    // otherwise scanning them one at a time is faster
+        const float *envelopes [BATCH_WINDOWS];
+        window_scan scans [BATCH_WINDOWS];
+
+        for (int i = 0; i < count; ++i) {
+            float *levels = batched || sk->log_buffer ? sk->batch_levels + i * level_buff_len : sk->level_buffer;
+
+            sk->random = DITHER_SEED;       // so the result doesn't depend on the previous windows
+            sk->num_samples = 0;
+            init_front_end (sk);
+
+            front_end_levels (sk, samples [first + i], num_frames [first + i], levels, NULL, level_buff_len);
+            envelopes [i] = levels;
+
+            if (!batched)
+                scan_window (levels, level_buff_len, 1, scans + i);
+        }
+
+        if (batched)
+            scan_window_batch (envelopes, count, level_buff_len, scans);
+
+        for (int i = 0; i < count; ++i) {
+            int tensor_value = sk->log_buffer ?
+                probe_log_window (sk, envelopes [i], scans + i, (long) positions [first + i]) :
+                finish_window (sk, scans + i, (long) positions [first + i], level_buff_len, level_buff_len);
+
+            if (tensor_value > threshold)
+                sk->music_hits++;
+            else if (tensor_value < threshold)
+                sk->talk_hits++;
+
+            sk->num_windows++;
+            values [first + i] = tensor_value;
+        }
+    }
+
+    return 0;
+}
+
+int skipper_probe_window (Skipper *sk, const int16_t *samples, int num_frames, int64_t position, int *value)
+{
+    return skipper_probe_windows (sk, &samples, &num_frames, &position, value, 1);
+}
+
+// The number of windows that the batched analysis does at once (with the target's SIMD width).
+
+int skipper_batch_windows (void)
+{
+    return BATCH_WINDOWS;
+}
+
+// Write to every page of all the buffers of the context (without changing them) so that there
+// are no page faults on them later, which is the first thing a real-time application must do.
+
+static void touch_memory (void *data, size_t bytes)
+{
+    volatile unsigned char *bytes_ptr = data;
+
+    for (size_t i = 0; i < bytes; i += 4096)
+        bytes_ptr [i] = bytes_ptr [i];
+
+    if (bytes)
+        bytes_ptr [bytes - 1] = bytes_ptr [bytes - 1];
+}
+
+void skipper_touch_memory (Skipper *sk)
+{
+    touch_memory (sk, sizeof (Skipper));
+    touch_memory (sk->fsamples, sk->config.sample_rate * sizeof (float));
+    touch_memory (sk->ring_buffer, sk->ring_buff_len * sizeof (float));
+
+    if (sk->log_buffer)
+        touch_memory (sk->log_buffer, sk->level_buff_len * sizeof (uint16_t));
+    else
+        touch_memory (sk->level_buffer, sk->level_buff_len * sizeof (float));
+
+    if (sk->pass_through)
+        touch_memory (sk->pass_buffer, sk->config.sample_rate * sizeof (int16_t) * 2);
+    else {
+        touch_memory (sk->output_buffer, sk->output_buff_len * sizeof (int16_t) * 2);
+        touch_memory (sk->crossfade_buffer, sk->crossfade_buff_len * sizeof (int16_t) * 2);
+    }
+}
+
+// Return the number of bytes allocated for this stream (useful for capacity planning).
+
+size_t skipper_memory_usage (const Skipper *sk)
+{
+    return sizeof (Skipper) +
+        sk->config.sample_rate * sizeof (float) +
+        sk->ring_buff_len * sizeof (float) +
+        sk->level_buff_len * (sk->log_buffer ? sizeof (uint16_t) : sizeof (float)) +
+        (sk->pass_through ? sk->config.sample_rate * sizeof (int16_t) * 2 :
+        (sk->output_buff_len + sk->crossfade_buff_len) * sizeof (int16_t) * 2) +
+        (sk->shared_scores ? SHARED_SCORES * sizeof (SkipperScore) : 0) +
+        (sk->batch_levels ? BATCH_WINDOWS * sk->level_buff_len * sizeof (float) : 0);
+}
+
+// Return the segments detected so far (normally called after skipper_finish()) in a newly
+// allocated array that the caller must free. Each window's score is attributed to the segment
+// containing the window's center. Requires config.record_segments.
+
+SkipperSegment *skipper_get_segments (const Skipper *sk, int *num_segments)
+{
+    SkipperSegment *segments = calloc (sk->num_transitions + 1, sizeof (SkipperSegment));
+    int count = 0, window = 0;
+
+    if (!segments)
+        return NULL;
+
+    segments [0].mode = MODE_NOTHING;
+
+    for (int i = 0; i <= sk->num_transitions; ++i) {
+        int64_t end_sample = i < sk->num_transitions ? sk->transitions [i].start_sample : sk->num_samples;
+        int64_t score_sum = 0;
+        int num_scores = 0;
+
+        if (end_sample > segments [count].start_sample || i == sk->num_transitions) {
+            segments [count].end_sample = end_sample;
+
+            for (; window < sk->num_window_scores; ++window) {
+                int64_t center = (int64_t) window * sk->step_samples + sk->level_buff_len / 2;
+
+                if (center >= end_sample && i < sk->num_transitions)
+                    break;
+
+                score_sum += sk->window_scores [window];
+                num_scores++;
+            }
+
+            segments [count].mean_score = num_scores ? (double) score_sum / num_scores : 0.0;
+            count++;
+        }
+
+        if (i < sk->num_transitions) {
+            segments [count].start_sample = end_sample;
+            segments [count].mode = sk->transitions [i].mode;
+        }
+    }
+
+    *num_segments = count;
+    return segments;
+}
+
+void skipper_free (Skipper *sk)
+{
+    if (sk) {
+        free (sk->shared_scores);
+        free (sk->transitions);
+        free (sk->window_scores);
+        free (sk->crossfade_buffer);
+        free (sk->pass_buffer);
+        free (sk->output_buffer);
+        free (sk->level_buffer);
+        free (sk->batch_levels);
+        free (sk->log_buffer);
+        free (sk->ring_buffer);
+        free (sk->fsamples);
+        free (sk);
+    }
+}
+
+// Return the number of trees in the decision-tree ensemble compiled into the library (see
+// forest.h, which is generated by tensor-gen); zero means config.use_forest is not available.
+
+int skipper_forest_trees (void)
+{
+    return FOREST_TREES;
+}
+
+// Load the tensor that's embedded in the library (see 4d-tensor.h).
+
+int skipper_default_tensor (tensor_array tensor)
+{
+    return skipper_load_tensor (tensor, tensor_4d, sizeof (tensor_4d));
+}
+
+/* The embedded tensors are kept compressed until they're first looked up by name, and then each
+ * is decompressed (and its checksum verified) just once into its own anonymous mapping, which is
+ * made read-only and shared by every stream that uses it for the life of the process. So the
+ * binary only grows by the compressed size of each tensor, and startup (and memory) only pays
+ * for the ones that are actually used.
+ */
+
+static tensor_array *expanded_tensors [REGISTERED_TENSORS + 1];
+
+#ifdef ENABLE_THREADS
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int get_registered_tensor (int index, struct registered_tensor *entry)
+{
+    if (index == 0) {
+        struct tensor_header header;
+
+        memcpy (&header, tensor_4d, sizeof (header));
+        entry->name = "default";
+        entry->checksum = header.checksum;
+        entry->version = header.version;
+        entry->data = tensor_4d;
+        entry->size = sizeof (tensor_4d);
+        return 1;
+    }
+
+#if REGISTERED_TENSORS
+    if (index <= REGISTERED_TENSORS) {
+        *entry = registered_tensors [index - 1];
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+
+static tensor_array *expand_tensor (const struct registered_tensor *entry)
+{
+#ifdef _WIN32
+    tensor_array *tensor = malloc (sizeof (tensor_array));
+
+    if (tensor && !skipper_load_tensor (*tensor, entry->data, entry->size)) {
+        free (tensor);
+        return NULL;
+    }
+#else
+    tensor_array *tensor = mmap (NULL, sizeof (tensor_array), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (tensor == MAP_FAILED)
+        return NULL;
+
+    if (!skipper_load_tensor (*tensor, entry->data, entry->size)) {
+        munmap (tensor, sizeof (tensor_array));
+        return NULL;
+    }
+
+    mprotect (tensor, sizeof (tensor_array), PROT_READ);
+#endif
+
+    return tensor;
+}
+
+// Return the embedded tensor with the specified name (decompressing it if this is the first time),
+// or NULL if there's no such tensor (or it's corrupt). The tensor is read-only.
+
+tensor_array *skipper_find_tensor (const char *name)
+{
+    struct registered_tensor entry;
+    tensor_array *tensor = NULL;
+    int index;
+
+    for (index = 0; get_registered_tensor (index, &entry); ++index)
+        if (!strcmp (entry.name, name))
+            break;
+
+    if (!get_registered_tensor (index, &entry))
+        return NULL;
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_lock (&registry_mutex);
+#endif
+
+    if (!(tensor = expanded_tensors [index]))
+        tensor = expanded_tensors [index] = expand_tensor (&entry);
+
+#ifdef ENABLE_THREADS
+    pthread_mutex_unlock (&registry_mutex);
+#endif
+
+    return tensor;
+}
+
+// Get the details of the embedded tensor with the specified index (for listing them). Returns
+// zero if there's no such tensor.
+
+int skipper_registered_tensor (int index, const char **name, uint32_t *checksum, int *chunked, int *compressed_size)
+{
+    struct registered_tensor entry;
+
+    if (!get_registered_tensor (index, &entry))
+        return 0;
+
+    *name = entry.name;
+    *checksum = entry.checksum;
+    *chunked = entry.version == TENSOR_VERSION_CHUNKED;
+    *compressed_size = entry.size;
+    return 1;
+}
+
+static void fade_out (int16_t *samples, int num_samples, int stride)
+{
+    for (int total_samples = num_samples; num_samples--; samples += stride)
+        *samples = (int64_t) *samples * num_samples / total_samples;
+}
+
+static void fade_in (int16_t *samples, int num_samples, int stride)
+{
+    for (int total_samples = num_samples; num_samples--; samples += stride)
+        *samples = (int64_t) *samples * (total_samples - num_samples) / total_samples;
+}
+
+/* Window analysis is in two parts: the passes over the level envelope (finding the peak and the
+ * trough, counting the levels in each third of that range in dB, and running the cycle state
+ * machine) produce a window_scan, and everything else is computed from that. The passes are nearly
+ * all the work, and there's also a batched version of them (see scan_window_batch()) that gives
+ * exactly the same scans.
+ */
+
+static inline __attribute__ ((always_inline)) void scan_window (const float *levels, int num_samples, const int stride, window_scan *scan)
+{
+    float prev_peak = levels [0], prev_trough = levels [0];
+    float peak = levels [0], trough = levels [0];
+    int prev_peak_pos = 0, prev_trough_pos = 0;
+    int zones [4] = { 0 }, cycles = 0;
+    int *trigger_points = scan->trigger_points;
+
+    for (int i = stride; i < num_samples; i += stride) {
+        if (levels [i] < trough) trough = levels [i];
+        if (levels [i] > peak) peak = levels [i];
+    }
+
+    double square_root = sqrt (peak / trough);
+    double cube_root = cbrt (peak / trough);
+
+    for (int i = stride; i < num_samples; i += stride) {
+        int zone;
+
+        if (levels [i] > peak / cube_root) zone = 2;
+        else if (levels [i] > trough * cube_root) zone = 1;
+        else zone = 0;
+
+        zones [zone]++;
+
+        if (cycles & 1) {       // cycles odd: finding peak level, trigger on trough (which stores peak)
+            if (levels [i] > prev_peak) {
+                prev_peak = levels [i];
+                prev_peak_pos = i;
+            }
+            else if (levels [i] < prev_peak / square_root) {
+                trigger_points [cycles++] = prev_peak_pos;
+                prev_trough = levels [i];
+
+                if (cycles == MAX_CYCLES)
+                    cycles -= 2;
+            }
+        }
+        else {                  // cycles even (initial): finding trough level, trigger on peak (which stores trough)
+            if (levels [i] < prev_trough) {
+                prev_trough = levels [i];
+                prev_trough_pos = i;
+            }
+            else if (levels [i] > prev_trough * square_root) {
+                trigger_points [cycles++] = prev_trough_pos;
+                prev_peak = levels [i];
+            }
+        }
+    }
+
+    scan->peak = peak;
+    scan->trough = trough;
+    scan->cycles = cycles;
+    memcpy (scan->zones, zones, sizeof (scan->zones));
+}
+
+/* The batched scan does the same passes over BATCH_WINDOWS envelopes at once (as when probing),
+ * with each SIMD lane owning one window: its peak and trough, zone counts and cycle state machine
+ * (using GCC vector extensions, so it's whatever the target has). It gives exactly the same scans
+ * as scan_window(). The zone thresholds (which scan_window() compares in double precision) are
+ * rounded to the floats that give the same comparisons, and the trigger test of the state machine
+ * (a double division or multiplication for every level) is done in float with a small guard band
+ * so that only the levels that might be triggers (which are rare) are checked exactly, one lane
+ * at a time.
+ */
+
+#define TRIGGER_GUARD   1e-5f
+
+typedef float batch_float __attribute__ ((vector_size (BATCH_WINDOWS * sizeof (float))));
+typedef int32_t batch_int __attribute__ ((vector_size (BATCH_WINDOWS * sizeof (int32_t))));
+typedef int64_t batch_wide __attribute__ ((vector_size (BATCH_WINDOWS * sizeof (int32_t))));
+
+static inline __attribute__ ((always_inline)) batch_float blend_float (batch_int mask, batch_float a, batch_float b)
+{
+    return (batch_float) (((batch_int) a & mask) | ((batch_int) b & ~mask));
+}
+
+static inline __attribute__ ((always_inline)) int any_lane (batch_int mask)
+{
+    batch_wide wide = (batch_wide) mask;
+    int64_t any = 0;
+
+    for (int i = 0; i < BATCH_WINDOWS / 2; ++i)
+        any |= wide [i];
+
+    return any != 0;
+}
+
+// the float f for which (x > f) is the same as ((double) x > value) for every float x
+
+static float float_below (double value)
+{
+    float result = (float) value;
+
+    if (result > value)
+        result = nextafterf (result, -INFINITY);
+
+    return result;
+}
+
+static void scan_window_batch (const float *const *levels, int num_windows, int num_samples, window_scan *scans)
+{
+    const float *lanes [BATCH_WINDOWS];
+    batch_float peak, trough, prev_peak, prev_trough, x, upper, lower, peak_factor, trough_factor;
+    batch_int prev_peak_pos = { 0 }, prev_trough_pos = { 0 }, cycles = { 0 }, high = { 0 }, mid = { 0 };
+    int trigger_points [BATCH_WINDOWS] [MAX_CYCLES];
+    double square_roots [BATCH_WINDOWS];
+
+    // unused lanes just repeat the first window
+
+    for (int w = 0; w < BATCH_WINDOWS; ++w)
+        lanes [w] = levels [w < num_windows ? w : 0];
+
+#if BATCH_WINDOWS == 16
+#define LOAD_LEVELS(i) (batch_float) { lanes [0] [i], lanes [1] [i], lanes [2] [i], lanes [3] [i], \
+    lanes [4] [i], lanes [5] [i], lanes [6] [i], lanes [7] [i], lanes [8] [i], lanes [9] [i], \
+    lanes [10] [i], lanes [11] [i], lanes [12] [i], lanes [13] [i], lanes [14] [i], lanes [15] [i] }
+#elif BATCH_WINDOWS == 8
+#define LOAD_LEVELS(i) (batch_float) { lanes [0] [i], lanes [1] [i], lanes [2] [i], lanes [3] [i], \
+    lanes [4] [i], lanes [5] [i], lanes [6] [i], lanes [7] [i] }
+#else
+#define LOAD_LEVELS(i) (batch_float) { lanes [0] [i], lanes [1] [i], lanes [2] [i], lanes [3] [i] }
+#endif
+
+    peak = trough = prev_peak = prev_trough = LOAD_LEVELS (0);
+
+    for (int i = 1; i < num_samples; ++i) {
+        x = LOAD_LEVELS (i);
+        trough = blend_float (x < trough, x, trough);
+        peak = blend_float (x > peak, x, peak);
+    }
+
+    for (int w = 0; w < BATCH_WINDOWS; ++w) {
+        double square_root = sqrt (peak [w] / trough [w]);
+        double cube_root = cbrt (peak [w] / trough [w]);
+
+        square_roots [w] = square_root;
+        upper [w] = float_below (peak [w] / cube_root);
+        lower [w] = float_below (trough [w] * cube_root);
+        peak_factor [w] = (float) (1.0 / square_root) * (1.0f + TRIGGER_GUARD);
+        trough_factor [w] = (float) square_root * (1.0f - TRIGGER_GUARD);
+    }
+
+    for (int i = 1; i < num_samples; ++i) {
+        batch_int odd = (cycles & 1) != 0, is_high, rising, falling, candidates;
+
+        x = LOAD_LEVELS (i);
+        is_high = x > upper;
+        high -= is_high;
+        mid -= ~is_high & (x > lower);
+
+        rising = odd & (x > prev_peak);
+        falling = ~odd & (x < prev_trough);
+        candidates = (odd & ~rising & (x < prev_peak * peak_factor)) | (~odd & ~falling & (x > prev_trough * trough_factor));
+
+        prev_peak = blend_float (rising, x, prev_peak);
+        prev_peak_pos = (rising & i) | (~rising & prev_peak_pos);
+        prev_trough = blend_float (falling, x, prev_trough);
+        prev_trough_pos = (falling & i) | (~falling & prev_trough_pos);
+
+        if (any_lane (candidates))
+            for (int w = 0; w < BATCH_WINDOWS; ++w)
+                if (candidates [w]) {
+                    if (cycles [w] & 1) {
+                        if (x [w] < prev_peak [w] / square_roots [w]) {
+                            trigger_points [w] [cycles [w]++] = prev_peak_pos [w];
+                            prev_trough [w] = x [w];
+
+                            if (cycles [w] == MAX_CYCLES)
+                                cycles [w] -= 2;
+                        }
+                    }
+                    else if (x [w] > prev_trough [w] * square_roots [w]) {
+                        trigger_points [w] [cycles [w]++] = prev_trough_pos [w];
+                        prev_peak [w] = x [w];
+                    }
+                }
+    }
+
+#undef LOAD_LEVELS
+
+    for (int w = 0; w < num_windows; ++w) {
+        scans [w].peak = peak [w];
+        scans [w].trough = trough [w];
+        scans [w].cycles = cycles [w];
+        scans [w].zones [2] = high [w];
+        scans [w].zones [1] = mid [w];
+        scans [w].zones [0] = num_samples - 1 - high [w] - mid [w];
+        memcpy (scans [w].trigger_points, trigger_points [w], cycles [w] * sizeof (int));
+    }
+}
+
+static inline __attribute__ ((always_inline)) int analyze_window (Skipper *sk, float *levels, long sample_index, int num_samples, const int stride)
+{
+    window_scan scan;
+
+    scan_window (levels, num_samples, stride, &scan);
+    return finish_window (sk, &scan, sample_index, num_samples, num_samples / stride);
+}
+
+/* The same passes over the log envelope (see log_level()), where the ratios of levels are
+ * differences: a level is in the upper zone if it's within a third of the range of the peak, and
+ * the state machine triggers on a move of half the range from the last peak or trough. Comparing
+ * three (or two) times the levels keeps these exact in integers. The zones are counted in their
+ * own pass so that it vectorizes along with the peak and trough (the state machine can't).
+ */
+
+static inline __attribute__ ((always_inline)) void scan_window_log (const uint16_t *levels, int num_samples, const int stride, window_scan *scan)
+{
+    int peak = levels [0], trough = levels [0], prev_peak = levels [0], prev_trough = levels [0];
+    int prev_peak_pos = 0, prev_trough_pos = 0, cycles = 0, range, count = 0, upper = 0, middle_up = 0;
+    int *trigger_points = scan->trigger_points;
+
+    for (int i = stride; i < num_samples; i += stride) {
+        if (levels [i] < trough) trough = levels [i];
+        if (levels [i] > peak) peak = levels [i];
+    }
+
+    range = peak - trough;
+
+    for (int i = stride; i < num_samples; i += stride) {
+        upper += levels [i] * 3 > peak * 3 - range;
+        middle_up += levels [i] * 3 > trough * 3 + range;
+        count++;
+    }
+
+    for (int i = stride; i < num_samples; i += stride) {
+        if (cycles & 1) {       // cycles odd: finding peak level, trigger on trough (which stores peak)
+            if (levels [i] > prev_peak) {
+                prev_peak = levels [i];
+                prev_peak_pos = i;
+            }
+            else if (levels [i] * 2 < prev_peak * 2 - range) {
+                trigger_points [cycles++] = prev_peak_pos;
+                prev_trough = levels [i];
+
+                if (cycles == MAX_CYCLES)
+                    cycles -= 2;
+            }
+        }
+        else {                  // cycles even (initial): finding trough level, trigger on peak (which stores trough)
+            if (levels [i] < prev_trough) {
+                prev_trough = levels [i];
+                prev_trough_pos = i;
+            }
+            else if (levels [i] * 2 > prev_trough * 2 + range) {
+                trigger_points [cycles++] = prev_trough_pos;
+                prev_peak = levels [i];
+            }
+        }
+    }
+
+    scan->peak = log_level_value (peak);
+    scan->trough = log_level_value (trough);
+    scan->cycles = cycles;
+    scan->zones [2] = upper;
+    scan->zones [1] = middle_up - upper;
+    scan->zones [0] = count - middle_up;
+}
+
+static int analyze_log_window (Skipper *sk, const uint16_t *levels, long sample_index, int num_samples, int stride)
+{
+    window_scan scan;
+
+    if (stride == 1)
+        scan_window_log (levels, num_samples, 1, &scan);
+    else
+        scan_window_log (levels, num_samples, stride, &scan);
+
+    return finish_window (sk, &scan, sample_index, num_samples, num_samples / stride);
+}
+
+// Compute the analysis results of a window from its scan (num_levels is how many levels of the
+// envelope were scanned), along with the attack ratio and peak jitter before they're quantized.
+
+static void scan_results (const window_scan *scan, int num_levels, struct analysis_result *result,
+    double *attack_ratio_out, double *peak_jitter_out)
+{
+    const int *zones = scan->zones, *trigger_points = scan->trigger_points, cycles = scan->cycles;
+    double peak_to_trough_dB = log10 (scan->peak / scan->trough) * 10.0;
+
+    result->range_dB = (int) floor (peak_to_trough_dB + 0.5);
+    result->spare = 0;      // so analysis files don't depend on what was on the stack
+
+    double attack_ratio = 0.5;
+
+    if (cycles >= 4) {
+        int attack_count = 0, attack_time = 0, decay_count = 0, decay_time = 0;
+
+        for (int i = 2; i < cycles; ++i)
+            if (i & 1) {
+                attack_time += trigger_points [i] - trigger_points [i - 1];
+                attack_count++;
+            }
+            else {
+                decay_time += trigger_points [i] - trigger_points [i - 1];
+                decay_count++;
+            }
+
+        if (attack_count && decay_count) {
+            attack_ratio = (double) attack_time / (attack_time + decay_time);
+
+            if (attack_count != decay_count)
+                attack_ratio *= (double) (attack_count + decay_count) / (attack_count * 2.0);
+        }
+        else
+            exit (1);
+    }
+
+    double peak_jitter = 1.0;
+
+    if (cycles >= 6) {
+        int num_peaks = cycles >> 1;
+        double period = (double) (trigger_points [num_peaks * 2 - 1] - trigger_points [1]) / (num_peaks - 1), error_sum = 0.0;
+
+        for (int i = 3; i < cycles - 2; i += 2) {
+            double prediction = trigger_points [1] + (period * (i >> 1));
+            error_sum += fabs (trigger_points [i] - prediction);
+        }
+
+        peak_jitter = (error_sum / (num_peaks - 2)) / period;
+
+        if (peak_jitter > 1.0)
+            peak_jitter = 1.0;
+    }
+
+    // calculate the low, mid and high zone fractions, then normalize them to 0.5
+    double low_fraction = (double) zones [0] / num_levels;
+    double mid_fraction = (double) zones [1] / num_levels;
+    double high_fraction = (double) zones [2] / num_levels;
+
+    low_fraction *= (1.0 - low_fraction) * (3.0 / 4.0) + 1.0;
+    mid_fraction *= (1.0 - mid_fraction) * (3.0 / 4.0) + 1.0;
+    high_fraction *= (1.0 - high_fraction) * (3.0 / 4.0) + 1.0;
+
+    result->low_third = (int) floor (low_fraction * 255.0 + 0.5);
+    result->mid_third = (int) floor (mid_fraction * 255.0 + 0.5);
+    result->high_third = (int) floor (high_fraction * 255.0 + 0.5);
+    result->attack_ratio = (int) floor (attack_ratio * 255.0 + 0.5);
+    result->peak_jitter = (int) floor (peak_jitter * 255.0 + 0.5);
+    result->cycles = cycles;
+
+    *attack_ratio_out = attack_ratio;
+    *peak_jitter_out = peak_jitter;
+}
+
+// Compute the analysis results of a window from its scan and return its score (also keeping the
+// histograms, verbose reports and analysis file up to date).
+
+static int finish_window (Skipper *sk, const window_scan *scan, long sample_index, int num_samples, int num_levels)
+{
+    int sample_rate = sk->config.sample_rate, verbose = sk->config.verbose, cycles = scan->cycles;
+    double full_scale_rms = 32768.0 * 32767.0 * 0.5, attack_ratio, peak_jitter;
+    float peak = scan->peak, trough = scan->trough;
+    double peak_to_trough_dB = log10 (peak / trough) * 10.0;
+    struct analysis_result result;
+
+    scan_results (scan, num_levels, &result, &attack_ratio, &peak_jitter);
+
+    // rather than a modulo every window, just track the start of the next window to report
+
+    if (verbose) {
+        long window_start = sample_index - num_samples;
+
+        while (sk->next_verbose_sample < window_start)
+            sk->next_verbose_sample += (long) sample_rate * verbose;
+
+        if (window_start == sk->next_verbose_sample)
+            LOG_EVENT (EV_WINDOW,
+                LOG_I (MINS (window_start, sample_rate)), LOG_I (SECS (window_start, sample_rate)),
+                LOG_I (MINS (sample_index, sample_rate)), LOG_I (SECS (sample_index, sample_rate)),
+                LOG_D (log10 (trough / full_scale_rms) * 10.0), LOG_D (log10 (peak / full_scale_rms) * 10.0),
+                LOG_D (peak_to_trough_dB), LOG_I (result.cycles),
+                LOG_D (result.low_third / 255.0), LOG_D (result.mid_third / 255.0), LOG_D (result.high_third / 255.0),
+                LOG_D (attack_ratio), LOG_D (peak_jitter));
+    }
+
+    sk->peak_to_trough_histogram [result.range_dB]++;
+    sk->cycles_histogram [result.cycles]++;
+    sk->low_third_histogram [result.low_third]++;
+    sk->mid_third_histogram [result.mid_third]++;
+    sk->high_third_histogram [result.high_third]++;
+
+    if (cycles >= 4)
+        sk->attack_ratio_histogram [result.attack_ratio]++;
+
+    if (cycles >= 6)
+        sk->peak_jitter_histogram [result.peak_jitter]++;
+
+    if (sk->config.analysis_output_file)
+        fwrite (&result, sizeof (result), 1, sk->config.analysis_output_file);
+
+    if (sk->config.cell_hits)
+        sk->config.cell_hits [hotset_cell (&result)]++;
+
+    int tensor_value;
+
+    if (sk->config.hotset) {
+        int hot;
+
+        tensor_value = hotset_lookup (sk->config.hotset, &result, &hot);
+        sk->hotset_hits += hot;
+    }
+    else
+        tensor_value = *analysis_result_to_tensor_pointer (&result, *sk->config.tensor);
+
+    // With a model or forest, the tensor is still evaluated (it's just a lookup) so they can be compared.
+
+    if (sk->config.model || sk->config.use_forest) {
+        int classifier_value;
+
+        if (sk->config.model) {
+            const struct analysis_result *frames [MODEL_FRAMES];
+            unsigned char input [MODEL_INPUTS] __attribute__ ((aligned (16)));
+
+            sk->model_history [sk->num_windows % MODEL_HISTORY_LEN] = result;
+
+            for (int f = 0; f < MODEL_FRAMES; ++f) {
+                int window = sk->num_windows - f * MODEL_HISTORY_STEP;
+                frames [f] = sk->model_history + (window < 0 ? 0 : window) % MODEL_HISTORY_LEN;
+            }
+
+            model_build_input (input, frames);
+            classifier_value = model_evaluate (sk->config.model, input);
+        }
+        else
+            classifier_value = forest_evaluate (&result);
+
+        if ((classifier_value > 0) == (tensor_value > 0) && (classifier_value < 0) == (tensor_value < 0))
+            sk->model_agreements++;
+
+        return classifier_value;
+    }
+
+    return tensor_value;
+}
+
+/* Analyze a probe window with the log envelope, which is converted from its float envelope (so
+ * it's exactly what the level stage would have produced), and compare the results and score to
+ * those of the float analysis (already scanned). Only the log analysis goes to the histograms and
+ * analysis file, and its score is returned.
+ */
+
+static int probe_log_window (Skipper *sk, const float *levels, const window_scan *float_scan, long sample_index)
+{
+    const int threshold = sk->config.threshold, level_buff_len = sk->level_buff_len;
+    struct analysis_result float_result, log_result;
+    const unsigned char *float_values = (const unsigned char *) &float_result;
+    const unsigned char *log_values = (const unsigned char *) &log_result;
+    SkipperLogCheck *check = &sk->log_check;
+    double attack_ratio, peak_jitter;
+    int float_value, log_value, same = 1;
+    window_scan scan;
+
+    for (int i = 0; i < level_buff_len; ++i)
+        sk->log_buffer [i] = log_level (levels [i]);
+
+    scan_window_log (sk->log_buffer, level_buff_len, 1, &scan);
+    scan_results (&scan, level_buff_len, &log_result, &attack_ratio, &peak_jitter);
+    scan_results (float_scan, level_buff_len, &float_result, &attack_ratio, &peak_jitter);
+
+    log_value = finish_window (sk, &scan, sample_index, level_buff_len, level_buff_len);
+    float_value = sk->config.use_forest ? forest_evaluate (&float_result) :
+        sk->config.hotset ? hotset_lookup (sk->config.hotset, &float_result, NULL) :
+        *analysis_result_to_tensor_pointer (&float_result, *sk->config.tensor);
+
+    for (int i = 0; i < MODEL_FEATURES; ++i) {
+        int error = abs (log_values [i] - float_values [i]);
+
+        if (error > check->max_error [i])
+            check->max_error [i] = error;
+
+        check->total_error [i] += error;
+        same &= !error;
+    }
+
+    check->windows++;
+    check->same_results += same;
+    check->same_scores += log_value == float_value;
+    check->same_votes += (log_value > threshold) == (float_value > threshold) && (log_value < threshold) == (float_value < threshold);
+
+    return log_value;
+}
+
+void skipper_display_log_check (const SkipperLogCheck *check)
+{
+    static const char *names [MODEL_FEATURES] = {
+        "peak_to_trough", "cycles", "lower third", "middle third", "upper third", "attack ratio", "peak jitter"
+    };
+
+    if (!check->windows)
+        return;
+
+    fprintf (stderr, "log envelope vs float: %d windows, same results %.1f%%, same scores %.1f%%, same votes %.1f%%\n",
+        check->windows, check->same_results * 100.0 / check->windows, check->same_scores * 100.0 / check->windows,
+        check->same_votes * 100.0 / check->windows);
+
+    for (int i = 0; i < MODEL_FEATURES; ++i)
+        fprintf (stderr, "    %-14s  mean error = %.3f, max error = %d\n", names [i],
+            (double) check->total_error [i] / check->windows, check->max_error [i]);
+}
+
+void skipper_display_analysis (const Skipper *sk)
+{
+    display_histogram ("peak_to_trough", sk->peak_to_trough_histogram, 96);
+    display_histogram ("cycles", sk->cycles_histogram, 256);
+    display_histogram ("lower third", sk->low_third_histogram, 256);
+    display_histogram ("middle third", sk->mid_third_histogram, 256);
+    display_histogram ("upper third", sk->high_third_histogram, 256);
+    display_histogram ("attack ratio", sk->attack_ratio_histogram, 256);
+    display_histogram ("peak jitter", sk->peak_jitter_histogram, 256);
+}
+
+static void display_population (const int *histogram, int count, int percent);
+
+static void display_histogram (const char *name, const int *histogram, int count)
+{
+    int min_value = 1000000, max_value = -1, hits = 0, sum = 0, hits2 = 0, max_hits = 0, mode1 = 0, mode2 = 0;
+    double median = 0.0;
+
+    for (int value = 0; value < count; ++value)
+        if (histogram [value]) {
+            if (histogram [value] > max_hits) max_hits = histogram [mode1 = mode2 = value, value];
+            else if (histogram [value] == max_hits) mode2 = value;
+            if (value < min_value) min_value = value;
+            if (value > max_value) max_value = value;
+            sum += histogram [value] * value;
+            hits += histogram [value];
+        }
+
+    for (int value = 0; value < count; ++value)
+        if (histogram [value]) {
+            if (hits2 + histogram [value] > hits / 2.0) {
+                median = value - 0.5 + (hits / 2.0 - hits2) / histogram [value];
+                break;
+            }
+            else
+                hits2 += histogram [value];
+        }
+
+    if (hits) {
+        fprintf (stderr, "%s: range = %d to %d, mean = %g, median = %g, mode = %g\n",
+            name, min_value, max_value, (double) sum / hits, median, (mode1 + mode2) / 2.0);
+        display_population (histogram, count, 50);
+        display_population (histogram, count, 75);
+        display_population (histogram, count, 90);
+        display_population (histogram, count, 95);
+        display_population (histogram, count, 98);
+    }
+}
+
+static void display_population (const int *histogram, int count, int percent)
+{
+    int low_value, high_value, sum = 0, sum2, target;
+
+    for (int value = 0; value < count; ++value)
+        if (histogram [value]) {
+            if (sum == 0) low_value = value;
+            sum += histogram [value];
+            high_value = value;
+        }
+
+    if (sum) {
+        int toggle = 0;
+
+        target = floor ((double) sum * percent / 100.0 + 0.5);
+        sum2 = sum;
+
+        while (sum2 > target)
+            if (histogram [low_value] < histogram [high_value] ||
+                (histogram [low_value] == histogram [high_value] && (toggle ^= 1))) {
+                    if (sum2 - histogram [low_value] / 2 > target)
+                        sum2 -= histogram [low_value++];
+                    else
+                        break;
+            }
+            else if (sum2 - histogram [high_value] / 2 > target)
+                sum2 -= histogram [high_value--];
+            else
+                break;
+
+        int sum3 = 0;
+
+        for (int value = low_value; value <= high_value; ++value)
+            sum3 += histogram [value];
+
+        if (sum2 != sum3) {
+            fprintf (stderr, "display_population() error, sum = %d, target = %d, sum2 = %d, sum3 = %d, low = %d, high = %d\n",
+                sum, target, sum2, sum3, low_value, high_value);
+
+            exit (1);
+        }
+
+        fprintf (stderr, "    %d (%.1f%%): %d to %d\n", sum2, sum2 * 100.0 / sum, low_value, high_value);
+    }
+}
+
+int skipper_read_tensor_file (tensor_array tensor, char *filename)
+{
+    FILE *tensor_file = fopen (filename, "rb");
+    SkipperTensorLoader *loader;
+    unsigned char buffer [65536];
+    int res = 1, num_bytes;
+
+    if (!tensor_file) {
+        fprintf (stderr, "\nerror: can't open \"%s\" for reading!\n", filename);
+        return 0;
+    }
+
+    if (!(loader = skipper_tensor_loader_create (tensor))) {
+        fprintf (stderr, "out of memory loading tensor!\n");
+        fclose (tensor_file);
+        return 0;
+    }
+
+    while (res && (num_bytes = fread (buffer, 1, sizeof (buffer), tensor_file)))
+        res = skipper_tensor_loader_feed (loader, buffer, num_bytes);
+
+    fclose (tensor_file);
+    return skipper_tensor_loader_finish (loader) && res;
+}
+
+int skipper_read_model_file (SkipperModel *model, char *filename)
+{
+    FILE *model_file = fopen (filename, "rb");
+    unsigned char buffer [sizeof (struct model_header) + sizeof (SkipperModel)];
+    int num_bytes;
+
+    if (!model_file) {
+        fprintf (stderr, "\nerror: can't open \"%s\" for reading!\n", filename);
+        return 0;
+    }
+
+    num_bytes = fread (buffer, 1, sizeof (buffer), model_file);
+    fclose (model_file);
+
+    return model_read (model, buffer, num_bytes);
+}
+
+int skipper_read_hotset_file (SkipperHotSet *hotset, char *filename)
+{
+    FILE *hotset_file = fopen (filename, "rb");
+    unsigned char *buffer = malloc (sizeof (struct hotset_header) + sizeof (SkipperHotSet));
+    int num_bytes, res;
+
+    if (!hotset_file) {
+        fprintf (stderr, "\nerror: can't open \"%s\" for reading!\n", filename);
+        free (buffer);
+        return 0;
+    }
+
+    if (!buffer) {
+        fprintf (stderr, "out of memory loading hot set!\n");
+        fclose (hotset_file);
+        return 0;
+    }
+
+    num_bytes = fread (buffer, 1, sizeof (struct hotset_header) + sizeof (SkipperHotSet), hotset_file);
+    fclose (hotset_file);
+
+    res = hotset_read (hotset, buffer, num_bytes);
+    free (buffer);
+    return res;
+}
+
+// Verify a decompressed tensor's checksum and convert it to the in-memory layout.
+
+static int check_tensor (tensor_array tensor, uint32_t checksum)
+{
+    for (int i = 0; i < sizeof (tensor_array); ++i)
+        checksum -= ((unsigned char *) tensor) [i];
+
+    if (checksum) {
+        fprintf (stderr, "checksum error in decompressed tensor!\n");
+        return 0;
+    }
+
+    if (!tensor_convert_layout (tensor, 1)) {
+        fprintf (stderr, "out of memory converting tensor layout!\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Tensors can be loaded incrementally, as the file (or socket) delivers them, with the memory
+ * used not depending on how the data arrives. Plain LZW tensors are decompressed directly into
+ * the tensor as the bytes are fed in, but chunked tensors are collected first because their
+ * chunks are decompressed in parallel. That's bounded by the largest container that the chunk
+ * header allows for a tensor (once it has arrived), so a bad or hostile stream can't make it
+ * grow without limit.
+ */
+
+struct SkipperTensorLoader {
+    tensor_array *tensor;
+    struct tensor_header header;
+    int header_bytes, error;
+    lzw_decoder *decoder;               // for TENSOR_VERSION
+    struct lzw_chunk_header chunk_header;
+    unsigned char *container;           // for TENSOR_VERSION_CHUNKED
+    int container_bytes, container_alloced, container_limit;
+};
+
+SkipperTensorLoader *skipper_tensor_loader_create (tensor_array tensor)
+{
+    SkipperTensorLoader *loader = calloc (1, sizeof (SkipperTensorLoader));
+
+    if (loader)
+        loader->tensor = (tensor_array *) tensor;
+
+    return loader;
+}
+
+// Feed the next bytes of a compressed tensor. Returns 0 (after displaying a message) if the
+// tensor can't be loaded; otherwise 1, although it's not known until the end if it's complete.
+
+int skipper_tensor_loader_feed (SkipperTensorLoader *loader, const unsigned char *bytes, int num_bytes)
+{
+    unsigned char dimensions [4] = { ARRAY_BINS_1, ARRAY_BINS_2, ARRAY_BINS_3, ARRAY_BINS_4 };
+
+    if (loader->error)
+        return 0;
+
+    if (loader->header_bytes < sizeof (loader->header)) {
+        int count = sizeof (loader->header) - loader->header_bytes;
+
+        if (count > num_bytes)
+            count = num_bytes;
+
+        memcpy ((unsigned char *) &loader->header + loader->header_bytes, bytes, count);
+        loader->header_bytes += count;
+        bytes += count;
+        num_bytes -= count;
+
+        if (loader->header_bytes < sizeof (loader->header))
+            return 1;
+
+        if (memcmp (loader->header.dimensions, dimensions, sizeof (dimensions)) ||
+            (loader->header.version != TENSOR_VERSION && loader->header.version != TENSOR_VERSION_CHUNKED)) {
+                fprintf (stderr, "invalid tensor!\n");
+                loader->error = 1;
+                return 0;
+        }
+
+        if (loader->header.version == TENSOR_VERSION &&
+            !(loader->decoder = lzw_decoder_create ((unsigned char *) loader->tensor, sizeof (tensor_array)))) {
+                fprintf (stderr, "out of memory loading tensor!\n");
+                loader->error = 1;
+                return 0;
+        }
+    }
+
+    if (!num_bytes)
+        return 1;
+
+    if (loader->decoder) {
+        if (lzw_decoder_feed (loader->decoder, bytes, num_bytes) == LZW_ERROR) {
+            fprintf (stderr, "lzw_decoder_feed() returned error!\n");
+            loader->error = 1;
+            return 0;
+        }
+
+        return 1;
+    }
+
+    if (loader->container_bytes < sizeof (loader->chunk_header)) {
+        struct lzw_chunk_header *chunk_header = &loader->chunk_header;
+        int count = sizeof (*chunk_header) - loader->container_bytes;
+        uint64_t container_limit;
+
+        if (count > num_bytes)
+            count = num_bytes;
+
+        memcpy ((unsigned char *) chunk_header + loader->container_bytes, bytes, count);
+        loader->container_bytes += count;
+        bytes += count;
+        num_bytes -= count;
+
+        if (loader->container_bytes < sizeof (*chunk_header))
+            return 1;
+
+        // the rest of the header is checked (along with the index) by lzw_chunked_info() at the end
+
+        if (chunk_header->total_size != sizeof (tensor_array) || !chunk_header->chunk_size ||
+            chunk_header->num_chunks != (chunk_header->total_size + (uint64_t) chunk_header->chunk_size - 1) / chunk_header->chunk_size) {
+                fprintf (stderr, "invalid chunked tensor!\n");
+                loader->error = 1;
+                return 0;
+        }
+
+        // every chunk can be no larger than LZW_MAX_COMPRESSED() of its bytes (and there can be
+        // no more chunks than bytes in the tensor, so this is never more than a few MB)
+
+        container_limit = sizeof (*chunk_header) + ((uint64_t) chunk_header->num_chunks + 1) * sizeof (uint32_t) +
+            LZW_MAX_COMPRESSED (chunk_header->total_size) + (uint64_t) chunk_header->num_chunks * LZW_MAX_COMPRESSED (0);
+
+        if (!(loader->container = malloc (loader->container_alloced = sizeof (*chunk_header) * 2))) {
+            fprintf (stderr, "out of memory loading tensor!\n");
+            loader->error = 1;
+            return 0;
+        }
+
+        memcpy (loader->container, chunk_header, sizeof (*chunk_header));
+        loader->container_limit = container_limit;
+
+        if (!num_bytes)
+            return 1;
+    }
+
+    if (num_bytes > loader->container_limit - loader->container_bytes) {
+        fprintf (stderr, "chunked tensor is too large!\n");
+        loader->error = 1;
+        return 0;
+    }
+
+    if (loader->container_bytes + num_bytes > loader->container_alloced) {
+        int new_alloced = loader->container_alloced > loader->container_limit / 2 ? loader->container_limit : loader->container_alloced * 2;
+        unsigned char *new_container;
+
+        if (new_alloced < loader->container_bytes + num_bytes)
+            new_alloced = loader->container_bytes + num_bytes;
+
+        new_container = realloc (loader->container, new_alloced);
+
+        if (!new_container) {
+            fprintf (stderr, "out of memory loading tensor!\n");
+            loader->error = 1;
+            return 0;
+        }
+
+        loader->container = new_container;
+        loader->container_alloced = new_alloced;
+    }
+
+    memcpy (loader->container + loader->container_bytes, bytes, num_bytes);
+    loader->container_bytes += num_bytes;
+    return 1;
+}
+
+// Finish loading a tensor (checking that it's all there and verifying the checksum) and free
+// the loader. Returns 1 if the tensor is good.
+
+int skipper_tensor_loader_finish (SkipperTensorLoader *loader)
+{
+    int res = 0;
+
+    if (loader->error)
+        ;
+    else if (loader->header_bytes < sizeof (loader->header))
+        fprintf (stderr, "invalid tensor!\n");
+    else if (loader->decoder) {
+        if (lzw_decoder_feed (loader->decoder, NULL, 0) != LZW_FINISHED || lzw_decoder_output (loader->decoder) != sizeof (tensor_array))
+            fprintf (stderr, "other error in decompressing tensor!\n");
+        else
+            res = 1;
+    }
+    else {
+        struct lzw_chunk_header chunk_header;
+
+        if (lzw_chunked_info (loader->container, loader->container_bytes, &chunk_header) || chunk_header.total_size != sizeof (tensor_array))
+            fprintf (stderr, "invalid chunked tensor!\n");
+        else if (lzw_chunked_decompress (loader->container, loader->container_bytes, (unsigned char *) loader->tensor, sizeof (tensor_array), TENSOR_THREADS))
+            fprintf (stderr, "lzw_chunked_decompress() returned error!\n");
+        else
+            res = 1;
+    }
+
+    if (res)
+        res = check_tensor (*loader->tensor, loader->header.checksum);
+
+    lzw_decoder_free (loader->decoder);
+    free (loader->container);
+    free (loader);
+    return res;
+}
+
+int skipper_load_tensor (tensor_array tensor, unsigned char *compressed_tensor, int compressed_size)
+{
+    SkipperTensorLoader *loader = skipper_tensor_loader_create (tensor);
+
+    if (!loader) {
+        fprintf (stderr, "out of memory loading tensor!\n");
+        return 0;
+    }
+
+    skipper_tensor_loader_feed (loader, compressed_tensor, compressed_size);
+    return skipper_tensor_loader_finish (loader);
+}
@@ -0,0 +1,216 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// skipperlib.h
+
+#ifndef SKIPPERLIB_H_
+#define SKIPPERLIB_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "skipper.h"
+#include "biquad.h"
+#include "model.h"
+#include "hotset.h"
+
+#define OUTPUT_AUDIO    0
+#define OUTPUT_MONO     1
+#define OUTPUT_FILTERED 2
+#define OUTPUT_LEVEL    3
+#define OUTPUT_TENSOR   4
+
+#define SKIP_NOTHING    0
+#define SKIP_TALK       1
+#define SKIP_MUSIC      2
+#define SKIP_EVERYTHING 3
+
+#define MODE_NOTHING    0
+#define MODE_MUSIC      1
+#define MODE_TALK       -1
+
+#define CHANNELS        2       // default, overridable
+#define SAMPLE_RATE     44100   // default, overridable
+
+#define WINDOW_SECONDS  5
+#define AVERAGE_SECONDS 5
+#define STEP_MSECS      200
+#define AVERAGE_COUNT   (AVERAGE_SECONDS*1000/STEP_MSECS)
+#define MAX_AVERAGE     (AVERAGE_COUNT*2)   // longest average allowed in SkipperParams
+
+#define DEGRADE_LEVELS  4       // analysis levels for skipper_degrade() (0 = full)
+
+#define MINS(s,r) ((int)((s)/((r)*60)))
+#define SECS(s,r) ((int)(((s)/(r))%60))
+
+// Output audio (always stereo) is delivered through this callback, which is given the context
+// pointer supplied in the configuration.
+
+typedef void (*skipper_write_fn) (void *ctx, const int16_t *samples, int num_frames);
+
+// The parameters of the decision logic, all in windows (steps of STEP_MSECS). The defaults (from
+// skipper_default_params()) are what Skipper has always used; others can be found for a corpus
+// with PARAMOPT and loaded with skipper_read_params_file().
+
+typedef struct {
+    int average_windows;                // window scores averaged for each decision (2 - MAX_AVERAGE)
+    int min_music_windows;              // votes needed to confirm a transition to music
+    int min_talk_windows;               // votes needed to confirm a transition to talk
+    int max_pend_windows;               // a transition still pending after this long is cancelled
+} SkipperParams;
+
+typedef struct {
+    int channels, sample_rate, keepalive;
+    int left_output, right_output, skip_mode, threshold;
+    int verbose, quiet;
+    int record_segments;                // keep window scores and transitions for skipper_get_segments()
+    tensor_array *tensor;               // shared and read-only, so may be used by many streams
+    const SkipperModel *model;          // optional classifier used instead of the tensor (also shared)
+    const SkipperParams *params;        // optional decision parameters (NULL for the defaults)
+    int use_forest;                     // use the compiled-in decision-tree ensemble instead of the tensor
+    const SkipperHotSet *hotset;        // optional pruned tensor used instead of the tensor (also shared)
+    uint32_t *cell_hits;                // optional hit counts of tensor cells (see hotset.h), one array per thread
+    int generic_pipeline;               // don't use a specialized pipeline (for benchmarking)
+    int log_envelope;                   // keep the level envelope as 16-bit log levels (integer analysis)
+    int stream_id;                      // only for identifying the stream in traces
+    FILE *analysis_output_file;         // optional raw analysis results (for tensor-gen)
+    skipper_write_fn write_audio;
+    void *write_ctx;
+} SkipperConfig;
+
+// A detected segment of the stream (the first one has MODE_NOTHING until a detection is made)
+// with the mean of the raw tensor values of the windows centered inside it.
+
+typedef struct {
+    int64_t start_sample, end_sample;
+    int mode;
+    double mean_score;
+} SkipperSegment;
+
+// A transition found by skipper_replay(): the new mode starts at the center of the averaged windows
+// of start_window (i.e., (WINDOW_SECONDS + average) / 2 before its end) and it was confirmed at the
+// end of confirm_window.
+
+typedef struct {
+    int start_window, confirm_window, mode;
+} SkipperDecision;
+
+// How the analysis of the log envelope compares to the float analysis of the same windows (see
+// skipper_probe_windows() with config.log_envelope). The errors are in analysis result units, in
+// the order of struct analysis_result.
+
+typedef struct {
+    int windows, same_results, same_scores, same_votes;
+    int max_error [MODEL_FEATURES];
+    int64_t total_error [MODEL_FEATURES];
+} SkipperLogCheck;
+
+// A window score kept for streams that share this stream's analysis (see skipper_follow()).
+
+typedef struct {
+    int64_t position;                   // stream sample at the end of the window
+    int value;
+} SkipperScore;
+
+// All the state of a single stream. A process can run any number of these (even on different
+// threads) as long as each one is only used by one thread at a time.
+
+typedef struct Skipper {
+    SkipperConfig config;
+
+    int level_buffer_index, output_buffer_index, num_windows, step_samples;
+    int level_buff_len, output_buff_len, crossfade_buff_len, ring_buff_len, results_buffer_count;
+    int music_hits, talk_hits, current_mode, music_up_counter, talk_up_counter, pend_up_counter;
+    int64_t num_samples, transition_sample, confirmed_sample, samples_discarded, samples_written;
+    int64_t output_start;               // nothing before this is written (see skipper_start())
+    int16_t *output_buffer, *crossfade_buffer;
+    int16_t *pass_buffer;               // only for pass-through that can't write input directly
+    int pass_through;                   // nothing will be skipped, so no output staging required
+    float *fsamples, *level_buffer, *ring_buffer;
+    float *batch_levels;                // envelopes of windows analyzed together (only for probing)
+    uint16_t *log_buffer;               // log envelope (with config.log_envelope, instead of level_buffer)
+    SkipperLogCheck log_check;          // only for probing with config.log_envelope
+    signed char results_buffer [MAX_AVERAGE];
+    SkipperParams params;
+    Biquad lowpass [2], highpass [2];
+    uint32_t random;
+    double level;
+
+    long next_verbose_sample;
+    const char *error;
+    int pipeline;                       // index of the processing pipeline (0 = generic)
+    int degrade_level;                  // cheaper analysis when the host is short of CPU (0 = full)
+    int held_value;                     // score of the last window (for windows not analyzed)
+
+    struct Skipper *leader;             // stream whose window scores are used instead of our analysis
+    int64_t leader_offset;              // leader's sample position for the same audio minus ours
+    SkipperScore *shared_scores;        // recent window scores, only once another stream follows
+    int num_followers;
+
+    signed char *window_scores;         // only with config.record_segments
+    int num_window_scores, max_window_scores;
+    SkipperSegment *transitions;
+    int num_transitions, max_transitions;
+
+    struct analysis_result model_history [MODEL_HISTORY_LEN];
+    int model_agreements;               // windows where the model (or forest) and tensor have the same sign
+    int hotset_hits;                    // windows served from hot cells (rather than the coarse tensor)
+
+    int peak_to_trough_histogram [96], cycles_histogram [256];
+    int low_third_histogram [256], mid_third_histogram [256], high_third_histogram [256];
+    int attack_ratio_histogram [256], peak_jitter_histogram [256];
+} Skipper;
+
+typedef struct SkipperTensorLoader SkipperTensorLoader;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+Skipper *skipper_create (const SkipperConfig *config);
+int skipper_process (Skipper *sk, const int16_t *samples, int num_frames);
+int skipper_finish (Skipper *sk);
+int skipper_follow (Skipper *sk, Skipper *leader, int64_t offset);
+int skipper_prime (Skipper *sk, const int16_t *samples, int num_frames);
+int skipper_start (Skipper *sk, const int16_t *history, int history_frames, int64_t position);
+int skipper_degrade (Skipper *sk, int level);
+const char *skipper_degrade_name (int level);
+void skipper_default_params (SkipperParams *params);
+int skipper_check_params (const SkipperParams *params);
+int skipper_read_params_file (SkipperParams *params, int *threshold, char *filename);
+int skipper_replay (const signed char *scores, int num_scores, const SkipperParams *params, int threshold,
+    SkipperDecision *decisions, int max_decisions);
+int skipper_probe_window (Skipper *sk, const int16_t *samples, int num_frames, int64_t position, int *value);
+int skipper_probe_windows (Skipper *sk, const int16_t *const *samples, const int *num_frames, const int64_t *positions,
+    int *values, int num_windows);
+int skipper_batch_windows (void);
+size_t skipper_memory_usage (const Skipper *sk);
+void skipper_touch_memory (Skipper *sk);
+const char *skipper_pipeline_name (const Skipper *sk);
+SkipperSegment *skipper_get_segments (const Skipper *sk, int *num_segments);
+void skipper_display_analysis (const Skipper *sk);
+void skipper_display_log_check (const SkipperLogCheck *check);
+void skipper_free (Skipper *sk);
+
+int skipper_default_tensor (tensor_array tensor);
+tensor_array *skipper_find_tensor (const char *name);
+int skipper_registered_tensor (int index, const char **name, uint32_t *checksum, int *chunked, int *compressed_size);
+int skipper_read_tensor_file (tensor_array tensor, char *filename);
+int skipper_load_tensor (tensor_array tensor, unsigned char *compressed_tensor, int compressed_size);
+SkipperTensorLoader *skipper_tensor_loader_create (tensor_array tensor);
+int skipper_tensor_loader_feed (SkipperTensorLoader *loader, const unsigned char *bytes, int num_bytes);
+int skipper_tensor_loader_finish (SkipperTensorLoader *loader);
+int skipper_read_model_file (SkipperModel *model, char *filename);
+int skipper_read_hotset_file (SkipperHotSet *hotset, char *filename);
+int skipper_forest_trees (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SKIPPERLIB_H_ */
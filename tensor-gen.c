@@ -10,10 +10,15 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
+#include <time.h>
 
 #include "skipper.h"
 #include "lzwlib.h"
+#include "lzwchunk.h"
+#include "model.h"
+#include "hotset.h"
 
 static const char *sign_on = "\n"
 " TENSOR-GEN  Tensor Generator for Skipper  Version 0.1\n"
@@ -25,7 +30,21 @@ static const char *usage =
 "            to create a compressed discriminator file, using\n"
 "            either 1, 2, 3, or 4 dimensions\n\n"
 " Options:  -a            = alternate windows between analysis & test\n"
-"           -d<n>         = dimension count (1-4)\n\n"
+"           -c[<n>]       = store in chunked container with <n> KB chunks\n"
+"                           (independently decodable, default 64 KB)\n"
+"           -d<n>         = dimension count (1-4)\n"
+"           -f <file.h>   = also fit a boosted decision-tree ensemble and write\n"
+"                           it as C code (for building into SKIPPER --forest)\n"
+"           -k<n>         = hot cells kept by -s (default 2048, max 16384)\n"
+"           -m <file>     = also train a quantized model and write it to file\n"
+"                           (for SKIPPER --model, compared with the tensor)\n"
+"           -n<n>         = model hidden neurons (0 = logistic, default 16)\n"
+"           -p <file>     = tensor cell hit profile (from SKIPPER --profile)\n"
+"           -r<n>         = ensemble boosting rounds (trees, default 32)\n"
+"           -s <file>     = also write pruned tensor of the cells hit most in\n"
+"                           the profile plus a coarse tensor for the rest,\n"
+"                           reporting its coverage and accuracy (for SKIPPER\n"
+"                           --hotset, needs -p)\n\n"
 " Web:      Visit www.github.com/dbry/skipper for latest version and info\n\n";
 
 struct distribution {
@@ -41,15 +60,25 @@ static int array_bins_2 = ARRAY_BINS_2;
 static int array_bins_3 = ARRAY_BINS_3;
 static int array_bins_4 = ARRAY_BINS_4;
 
-static int alternate, dimensions;
+static int alternate, dimensions, chunk_kbytes, hidden_neurons = 16, forest_trees = 32, hot_cells = HOTSET_CELLS;
+static SkipperHotSet hotset;
 
 static void display_2D_tensor (tensor_array tensor);
 static int read_analysis_results (FILE *file, struct distribution *dist);
 static void write_tensor_file (tensor_array tensor, char *filename);
+static struct analysis_result *load_analysis_results (const char *filename, int *count);
+static void train_model (SkipperModel *model, struct analysis_result *results [2], int counts [2]);
+static void compare_model (const SkipperModel *model, struct analysis_result *results [2], int counts [2]);
+static void write_model (struct analysis_result *results [2], int counts [2], char *model_filename);
+static void fit_forest (struct analysis_result *results [2], int counts [2], char *filename);
+static int write_hotset (tensor_array tensor, char *profile_filename, char *hotset_filename);
 
 int main (int argc, char **argv)
 {
-    char *filenames [3] = { NULL };
+    char *filenames [3] = { NULL }, *model_filename = NULL, *forest_filename = NULL;
+    char *profile_filename = NULL, *hotset_filename = NULL;
+    int model_file_follows = 0, forest_file_follows = 0, profile_file_follows = 0, hotset_file_follows = 0;
+    int use_hotset = 0;
     FILE *files [3];
 
     // loop through command-line arguments
@@ -66,6 +95,20 @@ int main (int argc, char **argv)
                         alternate = 1;
                         break;
 
+                    case 'C': case 'c':
+                        if (isdigit (*++*argv))
+                            chunk_kbytes = strtol (*argv, argv, 10);
+                        else
+                            chunk_kbytes = 64;
+
+                        if (chunk_kbytes < 1 || chunk_kbytes > 65536) {
+                            fprintf (stderr, "\nchunk size must be 1 to 65536 KB!\n");
+                            return -1;
+                        }
+
+                        --*argv;
+                        break;
+
                     case 'D': case 'd':
                         dimensions = strtol (++*argv, argv, 10);
 
@@ -77,10 +120,75 @@ int main (int argc, char **argv)
                         --*argv;
                         break;
 
+                    case 'F': case 'f':
+                        forest_file_follows = 1;
+                        break;
+
+                    case 'K': case 'k':
+                        hot_cells = strtol (++*argv, argv, 10);
+
+                        if (hot_cells < 1 || hot_cells > HOTSET_MAX_CELLS) {
+                            fprintf (stderr, "\nhot cells must be 1 to %d!\n", HOTSET_MAX_CELLS);
+                            return -1;
+                        }
+
+                        --*argv;
+                        break;
+
+                    case 'M': case 'm':
+                        model_file_follows = 1;
+                        break;
+
+                    case 'N': case 'n':
+                        hidden_neurons = strtol (++*argv, argv, 10);
+
+                        if (hidden_neurons < 0 || hidden_neurons > MODEL_MAX_HIDDEN) {
+                            fprintf (stderr, "\nhidden neurons must be 0 to %d!\n", MODEL_MAX_HIDDEN);
+                            return -1;
+                        }
+
+                        --*argv;
+                        break;
+
+                    case 'P': case 'p':
+                        profile_file_follows = 1;
+                        break;
+
+                    case 'S': case 's':
+                        hotset_file_follows = 1;
+                        break;
+
+                    case 'R': case 'r':
+                        forest_trees = strtol (++*argv, argv, 10);
+
+                        if (forest_trees < 1 || forest_trees > 1024) {
+                            fprintf (stderr, "\nboosting rounds must be 1 to 1024!\n");
+                            return -1;
+                        }
+
+                        --*argv;
+                        break;
+
                     default:
                         fprintf (stderr, "\nillegal option: %c !\n", **argv);
                         return 1;
                 }
+        else if (model_file_follows) {
+            model_filename = *argv;
+            model_file_follows = 0;
+        }
+        else if (forest_file_follows) {
+            forest_filename = *argv;
+            forest_file_follows = 0;
+        }
+        else if (profile_file_follows) {
+            profile_filename = *argv;
+            profile_file_follows = 0;
+        }
+        else if (hotset_file_follows) {
+            hotset_filename = *argv;
+            hotset_file_follows = 0;
+        }
         else if (!filenames [0]) {
             filenames [0] = malloc (strlen (*argv) + 10);
             strcpy (filenames [0], *argv);
@@ -105,6 +213,11 @@ int main (int argc, char **argv)
         return 0;
     }
 
+    if (hotset_filename && !profile_filename) {
+        fprintf (stderr, "\na pruned tensor (-s) needs a profile (-p)!\n");
+        return 1;
+    }
+
     switch (dimensions) {
         case 1:
             array_bins_2 = 1;
@@ -141,12 +254,12 @@ int main (int argc, char **argv)
                 for (int k = 0; k < array_bins_4; ++k) {
                     if (dist1.dist_array [h] [i] [j] [k] && !dist2.dist_array [h] [i] [j] [k]) {
                         unique_hits1 += dist1.dist_array [h] [i] [j] [k];
-                        tensor [h] [i] [j] [k] = +99;
+                        TENSOR_CELL (tensor, h, i, j, k) = +99;
                         unique_slots1++;
                     }
                     else if (!dist1.dist_array [h] [i] [j] [k] && dist2.dist_array [h] [i] [j] [k]) {
                         unique_hits2 += dist2.dist_array [h] [i] [j] [k];
-                        tensor [h] [i] [j] [k] = -99;
+                        TENSOR_CELL (tensor, h, i, j, k) = -99;
                         unique_slots2++;
                     }
                     else if (dist1.dist_array [h] [i] [j] [k] && dist2.dist_array [h] [i] [j] [k]) {
@@ -173,7 +286,7 @@ int main (int argc, char **argv)
 
                         common_hits1 += dist1.dist_array [h] [i] [j] [k];
                         common_hits2 += dist2.dist_array [h] [i] [j] [k];
-                        tensor [h] [i] [j] [k] = (int) floor (file1_weight * 99 + file2_weight * -99 + 0.5);
+                        TENSOR_CELL (tensor, h, i, j, k) = (int) floor (file1_weight * 99 + file2_weight * -99 + 0.5);
                         common_slots++;
                     }
                 }
@@ -205,7 +318,7 @@ int main (int argc, char **argv)
 
                         total_slots++;
 
-                        if (tensor [h] [i] [j] [k])
+                        if (TENSOR_CELL (tensor, h, i, j, k))
                             used_slots++;
                         else {
                             int border_hits = 0, values_sum = 0;
@@ -216,8 +329,8 @@ int main (int argc, char **argv)
                                         for (int dk = -1; dk <= 1; dk++)
                                             if (h + dh >= 0 && h + dh < array_bins_1 && i + di >= 0 && i + di < array_bins_2 &&
                                                 j + dj >= 0 && j + dj < array_bins_3 && k + dk >= 0 && k + dk < array_bins_4)
-                                                    if (tensor [h + dh] [i + di] [j + dj] [k + dk]) {
-                                                        values_sum += tensor [h + dh] [i + di] [j + dj] [k + dk];
+                                                    if (TENSOR_CELL (tensor, h + dh, i + di, j + dj, k + dk)) {
+                                                        values_sum += TENSOR_CELL (tensor, h + dh, i + di, j + dj, k + dk);
                                                         border_hits++;
                                                     }
                             if (border_hits) {
@@ -225,7 +338,7 @@ int main (int argc, char **argv)
                                     fprintf (stderr, "first slot filled is tensor [%d] [%d] [%d] [%d], sum = %d, hits = %d\n",
                                         h, i, j, k, values_sum, border_hits);
 
-                                new_tensor [h] [i] [j] [k] = (int) floor ((double) values_sum / border_hits + 0.5);
+                                TENSOR_CELL (new_tensor, h, i, j, k) = (int) floor ((double) values_sum / border_hits + 0.5);
                                 total_border_hits += border_hits;
                                 border_slots++;
                             }
@@ -257,19 +370,22 @@ int main (int argc, char **argv)
         for (int i = 0; i < ARRAY_BINS_2; ++i)
             for (int j = 0; j < ARRAY_BINS_3; ++j)
                 for (int k = 0; k < ARRAY_BINS_4; ++k)
-                    tensor [h] [i] [j] [k] = tensor
-                        [h * (h < array_bins_1)]
-                        [i * (i < array_bins_2)]
-                        [j * (j < array_bins_3)]
-                        [k * (k < array_bins_4)];
+                    TENSOR_CELL (tensor, h, i, j, k) = TENSOR_CELL (tensor,
+                        h * (h < array_bins_1),
+                        i * (i < array_bins_2),
+                        j * (j < array_bins_3),
+                        k * (k < array_bins_4));
 
     display_2D_tensor (tensor);
 
     if (filenames [2])
         write_tensor_file (tensor, filenames [2]);
 
+    if (hotset_filename)
+        use_hotset = write_hotset (tensor, profile_filename, hotset_filename);
+
     for (int i = 0; i < 2; ++i) {
-        int window_count = 0, file1_hits = 0, file2_hits = 0;
+        int window_count = 0, file1_hits = 0, file2_hits = 0, pruned_hits1 = 0, pruned_hits2 = 0;
         struct analysis_result result;
 
         files [i] = fopen (filenames [i], "rb");
@@ -287,6 +403,15 @@ int main (int argc, char **argv)
                     file1_hits += alternate + 1;
                 else if (tensor_value < 0)
                     file2_hits += alternate + 1;
+
+                if (use_hotset) {
+                    int pruned_value = hotset_lookup (&hotset, &result, NULL);
+
+                    if (pruned_value > 0)
+                        pruned_hits1 += alternate + 1;
+                    else if (pruned_value < 0)
+                        pruned_hits2 += alternate + 1;
+                }
             }
 
             window_count++;
@@ -296,12 +421,137 @@ int main (int argc, char **argv)
             file1_hits, file1_hits * 100.0 / window_count, file2_hits, file2_hits * 100.0 / window_count,
             window_count - file1_hits - file2_hits, (window_count - file1_hits - file2_hits) * 100.0 / window_count);
 
+        if (use_hotset)
+            fprintf (stderr, "   pruned tensor: file1 hits = %d (%.1f%%), file2 hits = %d (%.1f%%), ??? = %d (%.1f%%)\n",
+                pruned_hits1, pruned_hits1 * 100.0 / window_count, pruned_hits2, pruned_hits2 * 100.0 / window_count,
+                window_count - pruned_hits1 - pruned_hits2, (window_count - pruned_hits1 - pruned_hits2) * 100.0 / window_count);
+
         fclose (files [i]);
     }
 
+    if (model_filename || forest_filename) {
+        struct analysis_result *results [2];
+        int counts [2];
+
+        for (int i = 0; i < 2; ++i)
+            if (!(results [i] = load_analysis_results (filenames [i], counts + i)))
+                exit (1);
+
+        if (forest_filename)
+            fit_forest (results, counts, forest_filename);
+
+        if (model_filename)
+            write_model (results, counts, model_filename);
+
+        for (int i = 0; i < 2; ++i)
+            free (results [i]);
+    }
+
     return 0;
 }
 
+static void write_model (struct analysis_result *results [2], int counts [2], char *model_filename)
+{
+    SkipperModel model;
+    FILE *model_file;
+
+    train_model (&model, results, counts);
+    compare_model (&model, results, counts);
+
+    if (!(model_file = fopen (model_filename, "wb"))) {
+        fprintf (stderr, "error: can't open \"%s\" for writing!\n", model_filename);
+        exit (1);
+    }
+
+    int model_bytes = model_write (&model, model_file);
+    fclose (model_file);
+
+    if (!model_bytes) {
+        fprintf (stderr, "error: can't write \"%s\"!\n", model_filename);
+        exit (1);
+    }
+
+    fprintf (stderr, "model with %d hidden neurons stored in %d bytes (tensor is %d bytes)\n",
+        model.num_hidden, model_bytes, (int) sizeof (tensor_array));
+}
+
+/* Build the pruned tensor from the tensor and the profile, report how much of the profile it
+ * covers with hot cells and how well it agrees with the full tensor over the profiled windows
+ * (only the coarse tensor can disagree), and write it. Returns TRUE if it was written.
+ */
+
+static int write_hotset (tensor_array tensor, char *profile_filename, char *hotset_filename)
+{
+    uint32_t *hits = malloc (TENSOR_CELLS * sizeof (uint32_t));
+    FILE *profile_file = fopen (profile_filename, "rb"), *hotset_file;
+    double windows = 0, hot_windows = 0, same_sign = 0, same_value = 0;
+    int cells_hit = 0, kept, hotset_bytes;
+
+    if (!profile_file) {
+        fprintf (stderr, "error: can't open \"%s\" for reading!\n", profile_filename);
+        free (hits);
+        return 0;
+    }
+
+    if (!hits || !hotset_read_profile (hits, profile_file) || (kept = hotset_build (&hotset, tensor, hits, hot_cells)) < 0) {
+        fprintf (stderr, "error: can't build pruned tensor from \"%s\"!\n", profile_filename);
+        fclose (profile_file);
+        free (hits);
+        return 0;
+    }
+
+    fclose (profile_file);
+
+    for (int h = 0; h < ARRAY_BINS_1; ++h)
+        for (int i = 0; i < ARRAY_BINS_2; ++i)
+            for (int j = 0; j < ARRAY_BINS_3; ++j)
+                for (int k = 0; k < ARRAY_BINS_4; ++k) {
+                    int cell = ((h * ARRAY_BINS_2 + i) * ARRAY_BINS_3 + j) * ARRAY_BINS_4 + k;
+
+                    if (hits [cell]) {
+                        struct analysis_result result = { h, i << 1, j << 4, k << 4 };
+                        int tensor_value = TENSOR_CELL (tensor, h, i, j, k), hot;
+                        int pruned_value = hotset_lookup (&hotset, &result, &hot);
+
+                        windows += hits [cell];
+                        hot_windows += hot ? hits [cell] : 0;
+                        same_sign += (tensor_value > 0) == (pruned_value > 0) && (tensor_value < 0) == (pruned_value < 0) ? hits [cell] : 0;
+                        same_value += tensor_value == pruned_value ? hits [cell] : 0;
+                        cells_hit++;
+                    }
+                }
+
+    free (hits);
+
+    if (!windows) {
+        fprintf (stderr, "error: profile \"%s\" is empty!\n", profile_filename);
+        return 0;
+    }
+
+    if (!(hotset_file = fopen (hotset_filename, "wb"))) {
+        fprintf (stderr, "error: can't open \"%s\" for writing!\n", hotset_filename);
+        return 0;
+    }
+
+    hotset_bytes = hotset_write (&hotset, hotset_file);
+    fclose (hotset_file);
+
+    if (!hotset_bytes) {
+        fprintf (stderr, "error: can't write \"%s\"!\n", hotset_filename);
+        return 0;
+    }
+
+    fprintf (stderr, "profile: %.0f windows hit %d of %d cells (%.2f%%)\n", windows, cells_hit, TENSOR_CELLS, cells_hit * 100.0 / TENSOR_CELLS);
+    fprintf (stderr, "pruned tensor: %d hot cells cover %.1f%% of the profiled windows, the rest from a coarse tensor\n",
+        kept, hot_windows * 100.0 / windows);
+    fprintf (stderr, "pruned tensor: same sign as tensor on %.2f%% of profiled windows, same value on %.2f%%\n",
+        same_sign * 100.0 / windows, same_value * 100.0 / windows);
+    fprintf (stderr, "pruned tensor stored in %d bytes, lookups touch %d bytes (tensor is %d bytes)\n\n",
+        hotset_bytes, (int) (sizeof (hotset.coarse) + (sizeof (uint32_t) << hotset.slot_bits)), (int) sizeof (tensor_array));
+
+    return 1;
+}
+
 static void display_2D_tensor (tensor_array tensor)
 {
     char string [256] = "";
@@ -321,7 +571,7 @@ static void display_2D_tensor (tensor_array tensor)
         string [0] = 0;
 
         for (int i = 0; i < array_bins_2; ++i)
-            sprintf (string + strlen (string), " %3d", tensor [h] [i] [array_bins_3/2] [array_bins_4/2]);
+            sprintf (string + strlen (string), " %3d", TENSOR_CELL (tensor, h, i, array_bins_3/2, array_bins_4/2));
 
         fprintf (stderr, "%2d dB:  %s\n", h, string);
     }
@@ -382,11 +632,57 @@ static void write_buff (int value, void *ctx)
     stream->buffer [stream->index++] = value;
 }
 
-static void write_tensor_file (tensor_array tensor, char *filename)
+// Write the tensor data as a chunked LZW container (after the header has been written). We try
+// every maxbits setting and keep the smallest, just like the monolithic case.
+
+// Compress the tensor into a chunked container (with the best maxbits) and write it after the
+// header. Returns non-zero on failure.
+
+static int write_chunked_tensor (tensor_array tensor, uint32_t checksum, FILE *tensor_file)
+{
+    unsigned char *best_output = NULL;
+    uint32_t best_size = 0;
+    int best_maxbits = 0;
+
+    for (int maxbits = 9; maxbits <= 16; ++maxbits) {
+        unsigned char *output;
+        uint32_t output_size;
+
+        if (lzw_chunked_compress ((unsigned char *) tensor, sizeof (tensor_array), &output, &output_size, chunk_kbytes * 1024, maxbits, 8)) {
+            fprintf (stderr, "lzw_chunked_compress() returned error!\n");
+            free (best_output);
+            return 1;
+        }
+
+        if (!best_output || output_size < best_size) {
+            free (best_output);
+            best_output = output;
+            best_size = output_size;
+            best_maxbits = maxbits;
+        }
+        else
+            free (output);
+    }
+
+    fprintf (stderr, "tensor checksum = %d, stored with maxbits %d in %d bytes of %d KB chunks (ratio = %.1f%%)\n",
+        checksum, best_maxbits, best_size, chunk_kbytes, best_size * 100.0 / sizeof (tensor_array));
+
+    if (fwrite (best_output, best_size, 1, tensor_file) != 1) {
+        fprintf (stderr, "error: can't write tensor file!\n");
+        free (best_output);
+        return 1;
+    }
+
+    free (best_output);
+    return 0;
+}
+
+static void write_tensor_file (tensor_array memory_tensor, char *filename)
 {
     unsigned char dimensions [4] = { ARRAY_BINS_1, ARRAY_BINS_2, ARRAY_BINS_3, ARRAY_BINS_4 };
     int best_maxbits, smallest_output = sizeof (tensor_array) + 1;
     FILE *tensor_file = fopen (filename, "wb");
+    static tensor_array tensor;     // files are always row-major (see skipper.h)
     struct tensor_header header;
     streamer reader, writer;
 
@@ -395,6 +691,14 @@ static void write_tensor_file (tensor_array tensor, char *filename)
         return;
     }
 
+    memcpy (tensor, memory_tensor, sizeof (tensor));
+
+    if (!tensor_convert_layout (tensor, 0)) {
+        fprintf (stderr, "error: out of memory converting tensor layout!\n");
+        fclose (tensor_file);
+        return;
+    }
+
     memset (&header, 0, sizeof (header));
     memset (&reader, 0, sizeof (reader));
     memset (&writer, 0, sizeof (writer));
@@ -403,10 +707,23 @@ static void write_tensor_file (tensor_array tensor, char *filename)
         header.checksum += ((unsigned char *) tensor) [i];
 
     memcpy (header.dimensions, dimensions, sizeof (dimensions));
-    header.version = TENSOR_VERSION;
+    header.version = chunk_kbytes ? TENSOR_VERSION_CHUNKED : TENSOR_VERSION;
 
     fwrite (&header, sizeof (header), 1, tensor_file);
 
+    // don't leave a file with just the header behind if the chunks can't be written
+
+    if (chunk_kbytes) {
+        int res = write_chunked_tensor (tensor, header.checksum, tensor_file);
+
+        fclose (tensor_file);
+
+        if (res)
+            remove (filename);
+
+        return;
+    }
+
     reader.buffer = (unsigned char *) tensor;
     reader.size = sizeof (tensor_array);
 
@@ -440,3 +757,627 @@ static void write_tensor_file (tensor_array tensor, char *filename)
     fclose (tensor_file);
     free (writer.buffer);
 }
+
+static struct analysis_result *load_analysis_results (const char *filename, int *count)
+{
+    struct analysis_result *results = NULL;
+    FILE *file = fopen (filename, "rb");
+    int alloced = 0;
+
+    *count = 0;
+
+    if (!file) {
+        fprintf (stderr, "can't open file \"%s\" for reading!\n", filename);
+        return NULL;
+    }
+
+    while (1) {
+        if (*count == alloced && !(results = realloc (results, (alloced += 65536) * sizeof (*results)))) {
+            fprintf (stderr, "out of memory reading \"%s\"!\n", filename);
+            fclose (file);
+            return NULL;
+        }
+
+        if (!fread (results + *count, sizeof (*results), 1, file))
+            break;
+
+        ++*count;
+    }
+
+    fclose (file);
+    return results;
+}
+
+// Build the model input for a window, using the earlier windows of the same file as the history
+// (repeating the first window at the start, just as skipper does at the start of a stream).
+
+static void build_window_input (unsigned char *input, const struct analysis_result *results, int index)
+{
+    const struct analysis_result *frames [MODEL_FRAMES];
+
+    for (int f = 0; f < MODEL_FRAMES; ++f) {
+        int window = index - f * MODEL_HISTORY_STEP;
+        frames [f] = results + (window < 0 ? 0 : window);
+    }
+
+    model_build_input (input, frames);
+}
+
+#define TRAIN_EPOCHS    20
+#define TRAIN_BATCH     64
+#define TRAIN_RATE      0.003
+
+/* Train the classifier in floating-point on standardized inputs (minimizing the logistic loss with
+ * the two files weighted equally, using minibatch Adam) and then fold the standardization into the
+ * weights and quantize. The weights of each hidden neuron get their own scale, and the hidden
+ * activations are scaled so that the largest one seen in training maps to 127. As with the tensor,
+ * -a trains on the odd windows and leaves the even windows for testing.
+ */
+
+static void train_model (SkipperModel *model, struct analysis_result *results [2], int counts [2])
+{
+    int num_hidden = hidden_neurons, outputs_base = num_hidden * (MODEL_INPUTS + 1);
+    int num_params = outputs_base + (num_hidden ? num_hidden : MODEL_INPUTS) + 1;
+    int num_samples = 0, class_counts [2] = { 0, 0 };
+    double *params = calloc (num_params, sizeof (double)), *grads = calloc (num_params, sizeof (double));
+    double *adam_m = calloc (num_params, sizeof (double)), *adam_v = calloc (num_params, sizeof (double));
+    double mean [MODEL_INPUTS] = { 0 }, stdev [MODEL_INPUTS] = { 0 }, hidden_max [MODEL_MAX_HIDDEN] = { 0 };
+    double beta1_power = 1.0, beta2_power = 1.0;
+    unsigned char *inputs, *labels;
+    uint32_t random = 0x31415926;
+    int *order;
+
+    for (int c = 0; c < 2; ++c)
+        num_samples += counts [c];
+
+    inputs = malloc ((size_t) num_samples * MODEL_INPUTS);
+    labels = malloc (num_samples);
+    order = malloc (num_samples * sizeof (int));
+
+    if (!params || !grads || !adam_m || !adam_v || !inputs || !labels || !order) {
+        fprintf (stderr, "out of memory training model!\n");
+        exit (1);
+    }
+
+    // gather the training windows (labels: 1 = file1, 0 = file2) and the input statistics
+
+    num_samples = 0;
+
+    for (int c = 0; c < 2; ++c)
+        for (int w = 0; w < counts [c]; ++w)
+            if (!alternate || (w & 1)) {
+                unsigned char *input = inputs + (size_t) num_samples * MODEL_INPUTS;
+
+                build_window_input (input, results [c], w);
+
+                for (int i = 0; i < MODEL_INPUTS; ++i) {
+                    mean [i] += input [i];
+                    stdev [i] += input [i] * input [i];
+                }
+
+                labels [num_samples] = !c;
+                order [num_samples] = num_samples;
+                num_samples++;
+                class_counts [c]++;
+            }
+
+    if (!class_counts [0] || !class_counts [1]) {
+        fprintf (stderr, "not enough windows to train model!\n");
+        exit (1);
+    }
+
+    for (int i = 0; i < MODEL_INPUTS; ++i) {
+        mean [i] /= num_samples;
+        stdev [i] = sqrt (stdev [i] / num_samples - mean [i] * mean [i]);
+
+        if (stdev [i] < 1e-6)
+            stdev [i] = 1.0;
+    }
+
+    for (int p = 0; p < num_params; ++p) {
+        random = ((random << 4) - random) ^ 1;
+        params [p] = ((int32_t) random / 2147483648.0) * (num_hidden ? sqrt (6.0 / (MODEL_INPUTS + num_hidden)) : 0.1);
+    }
+
+    fprintf (stderr, "training model with %d hidden neurons on %d windows...\n", num_hidden, num_samples);
+
+    for (int epoch = 0; epoch < TRAIN_EPOCHS; ++epoch) {
+        double loss_sum = 0.0;
+
+        for (int i = num_samples - 1; i > 0; --i) {
+            int j, temp = order [i];
+
+            random = ((random << 4) - random) ^ 1;
+            j = (random >> 8) % (i + 1);
+            order [i] = order [j];
+            order [j] = temp;
+        }
+
+        for (int start = 0; start < num_samples; start += TRAIN_BATCH) {
+            int end = start + TRAIN_BATCH < num_samples ? start + TRAIN_BATCH : num_samples;
+
+            memset (grads, 0, num_params * sizeof (double));
+
+            for (int s = start; s < end; ++s) {
+                const unsigned char *input = inputs + (size_t) order [s] * MODEL_INPUTS;
+                int label = labels [order [s]];
+                double weight = num_samples * 0.5 / class_counts [!label];
+                double x [MODEL_INPUTS], z [MODEL_MAX_HIDDEN], h [MODEL_MAX_HIDDEN], output, prob, delta;
+
+                for (int i = 0; i < MODEL_INPUTS; ++i)
+                    x [i] = (input [i] - mean [i]) / stdev [i];
+
+                output = params [num_params - 1];
+
+                if (num_hidden) {
+                    for (int n = 0; n < num_hidden; ++n) {
+                        z [n] = params [num_hidden * MODEL_INPUTS + n];
+
+                        for (int i = 0; i < MODEL_INPUTS; ++i)
+                            z [n] += params [n * MODEL_INPUTS + i] * x [i];
+
+                        h [n] = z [n] > 0.0 ? z [n] : 0.0;
+                        output += params [outputs_base + n] * h [n];
+                    }
+                }
+                else
+                    for (int i = 0; i < MODEL_INPUTS; ++i)
+                        output += params [outputs_base + i] * x [i];
+
+                prob = 1.0 / (1.0 + exp (-output));
+                loss_sum -= weight * log (label ? prob + 1e-12 : 1.0 - prob + 1e-12);
+                delta = (prob - label) * weight;
+                grads [num_params - 1] += delta;
+
+                if (num_hidden) {
+                    for (int n = 0; n < num_hidden; ++n) {
+                        double hidden_delta = z [n] > 0.0 ? delta * params [outputs_base + n] : 0.0;
+
+                        grads [outputs_base + n] += delta * h [n];
+                        grads [num_hidden * MODEL_INPUTS + n] += hidden_delta;
+
+                        for (int i = 0; i < MODEL_INPUTS; ++i)
+                            grads [n * MODEL_INPUTS + i] += hidden_delta * x [i];
+                    }
+                }
+                else
+                    for (int i = 0; i < MODEL_INPUTS; ++i)
+                        grads [outputs_base + i] += delta * x [i];
+            }
+
+            beta1_power *= 0.9;
+            beta2_power *= 0.999;
+
+            for (int p = 0; p < num_params; ++p) {
+                double grad = grads [p] / (end - start);
+
+                adam_m [p] = 0.9 * adam_m [p] + 0.1 * grad;
+                adam_v [p] = 0.999 * adam_v [p] + 0.001 * grad * grad;
+                params [p] -= TRAIN_RATE * (adam_m [p] / (1.0 - beta1_power)) / (sqrt (adam_v [p] / (1.0 - beta2_power)) + 1e-8);
+            }
+        }
+
+        if (epoch == 0 || epoch == TRAIN_EPOCHS - 1 || !((epoch + 1) % 5))
+            fprintf (stderr, "epoch %d: mean loss = %.4f\n", epoch + 1, loss_sum / num_samples);
+    }
+
+    // fold the standardization into the first layer so it works directly on the 7-bit inputs
+
+    int layer_inputs = num_hidden ? num_hidden : MODEL_INPUTS;
+    double *layer_weights = num_hidden ? params : params + outputs_base;
+    double *layer_biases = num_hidden ? params + num_hidden * MODEL_INPUTS : params + num_params - 1;
+    double output_weights [MODEL_INPUTS], max_weight = 0.0;
+
+    for (int n = 0; n < (num_hidden ? num_hidden : 1); ++n)
+        for (int i = 0; i < MODEL_INPUTS; ++i) {
+            layer_weights [n * MODEL_INPUTS + i] /= stdev [i];
+            layer_biases [n] -= layer_weights [n * MODEL_INPUTS + i] * mean [i];
+        }
+
+    memset (model, 0, sizeof (*model));
+    model->num_hidden = num_hidden;
+
+    if (num_hidden) {
+        for (int s = 0; s < num_samples; ++s) {
+            const unsigned char *input = inputs + (size_t) s * MODEL_INPUTS;
+
+            for (int n = 0; n < num_hidden; ++n) {
+                double z = layer_biases [n];
+
+                for (int i = 0; i < MODEL_INPUTS; ++i)
+                    z += layer_weights [n * MODEL_INPUTS + i] * input [i];
+
+                if (z > hidden_max [n])
+                    hidden_max [n] = z;
+            }
+        }
+
+        for (int n = 0; n < num_hidden; ++n) {
+            double row_max = 0.0, row_scale;
+
+            for (int i = 0; i < MODEL_INPUTS; ++i)
+                if (fabs (layer_weights [n * MODEL_INPUTS + i]) > row_max)
+                    row_max = fabs (layer_weights [n * MODEL_INPUTS + i]);
+
+            row_scale = row_max > 0.0 ? 127.0 / row_max : 1.0;
+
+            if (hidden_max [n] <= 0.0)
+                hidden_max [n] = 1.0;       // a dead neuron, which will always output zero
+
+            for (int i = 0; i < MODEL_INPUTS; ++i)
+                model->hidden_weights [n] [i] = (int) floor (layer_weights [n * MODEL_INPUTS + i] * row_scale + 0.5);
+
+            model->hidden_scale [n] = 127.0 / (hidden_max [n] * row_scale);
+            model->hidden_bias [n] = layer_biases [n] * 127.0 / hidden_max [n];
+            output_weights [n] = params [outputs_base + n] * hidden_max [n] / 127.0;
+        }
+    }
+    else
+        memcpy (output_weights, layer_weights, sizeof (output_weights));
+
+    for (int i = 0; i < layer_inputs; ++i)
+        if (fabs (output_weights [i]) > max_weight)
+            max_weight = fabs (output_weights [i]);
+
+    double output_scale = max_weight > 0.0 ? 127.0 / max_weight : 1.0;
+
+    for (int i = 0; i < layer_inputs; ++i)
+        model->output_weights [i] = (int) floor (output_weights [i] * output_scale + 0.5);
+
+    model->output_scale = 1.0 / output_scale;
+    model->output_bias = params [num_params - 1];
+
+    free (params); free (grads); free (adam_m); free (adam_v);
+    free (inputs); free (labels); free (order);
+}
+
+// Evaluate the quantized model and the tensor on the same windows (the test windows if -a) and
+// display them side by side, along with the model evaluation time.
+
+static void compare_model (const SkipperModel *model, struct analysis_result *results [2], int counts [2])
+{
+    int total_windows = 0, agreements = 0;
+    unsigned char input [MODEL_INPUTS] __attribute__ ((aligned (16)));
+    volatile int sink = 0;
+
+    fprintf (stderr, "\n             windows    tensor hits    model hits   (%s kernel)\n", model_kernel_name ());
+
+    for (int c = 0; c < 2; ++c) {
+        int window_count = 0, tensor_hits = 0, model_hits = 0;
+
+        for (int w = 0; w < counts [c]; ++w) {
+            int tensor_value, model_value;
+
+            if (alternate && (w & 1))
+                continue;
+
+            build_window_input (input, results [c], w);
+            tensor_value = *analysis_result_to_tensor_pointer (results [c] + w, tensor);
+            model_value = model_evaluate (model, input);
+
+            if (c ? tensor_value < 0 : tensor_value > 0)
+                tensor_hits++;
+
+            if (c ? model_value < 0 : model_value > 0)
+                model_hits++;
+
+            if ((model_value > 0) == (tensor_value > 0) && (model_value < 0) == (tensor_value < 0))
+                agreements++;
+
+            window_count++;
+        }
+
+        fprintf (stderr, "file%d:   %10d   %6d (%.1f%%)  %6d (%.1f%%)\n", c + 1, window_count,
+            tensor_hits, tensor_hits * 100.0 / window_count, model_hits, model_hits * 100.0 / window_count);
+
+        total_windows += window_count;
+    }
+
+    fprintf (stderr, "model and tensor agree on %d of %d windows (%.1f%%)\n", agreements, total_windows, agreements * 100.0 / total_windows);
+
+    // time just the model evaluation (with the inputs prepared in advance) over all the windows
+
+    unsigned char *inputs = malloc ((size_t) total_windows * MODEL_INPUTS);
+    int num_inputs = 0;
+
+    if (inputs) {
+        for (int c = 0; c < 2; ++c)
+            for (int w = 0; w < counts [c]; ++w)
+                if (!alternate || !(w & 1))
+                    build_window_input (inputs + (size_t) num_inputs++ * MODEL_INPUTS, results [c], w);
+
+        clock_t start_time = clock ();
+
+        for (int pass = 0; pass < 10; ++pass)
+            for (int i = 0; i < num_inputs; ++i)
+                sink += model_evaluate (model, inputs + (size_t) i * MODEL_INPUTS);
+
+        fprintf (stderr, "model evaluation time = %.1f ns per window\n\n",
+            (double) (clock () - start_time) / CLOCKS_PER_SEC * 1e9 / (num_inputs * 10.0));
+
+        free (inputs);
+    }
+}
+
+#define FOREST_DEPTH    3       // oblivious trees, so 8 leaves each
+#define FOREST_LEAVES   (1 << FOREST_DEPTH)
+#define FOREST_FEATURES 7
+#define FOREST_SCALE    256     // fixed-point scale of the log-odds leaf values
+#define FOREST_RATE     0.3
+#define FOREST_LAMBDA   1.0
+
+static const char *forest_feature_names [FOREST_FEATURES] = {
+    "range_dB", "cycles", "low_third", "mid_third", "high_third", "attack_ratio", "peak_jitter"
+};
+
+typedef struct {
+    unsigned char feature [FOREST_DEPTH], threshold [FOREST_DEPTH];
+    int leaf [FOREST_LEAVES];
+} oblivious_tree;
+
+static void result_features (const struct analysis_result *result, unsigned char *features)
+{
+    features [0] = result->range_dB;
+    features [1] = result->cycles;
+    features [2] = result->low_third;
+    features [3] = result->mid_third;
+    features [4] = result->high_third;
+    features [5] = result->attack_ratio;
+    features [6] = result->peak_jitter;
+}
+
+static int tree_leaf (const oblivious_tree *tree, const unsigned char *features)
+{
+    int leaf = 0;
+
+    for (int d = 0; d < FOREST_DEPTH; ++d)
+        leaf |= (features [tree->feature [d]] > tree->threshold [d]) << d;
+
+    return leaf;
+}
+
+// Return non-zero if a shallower level of the tree already tests the feature against the threshold
+// (testing it again can't separate anything, it would only waste the level).
+
+static int split_used (const oblivious_tree *tree, int depth, int feature, int threshold)
+{
+    for (int d = 0; d < depth; ++d)
+        if (tree->feature [d] == feature && tree->threshold [d] == threshold)
+            return 1;
+
+    return 0;
+}
+
+static int forest_score (int margin)
+{
+    return (int) floor (99.0 * tanh (margin / (FOREST_SCALE * 2.0)) + 0.5);
+}
+
+/* Fit a gradient boosted ensemble of oblivious decision trees (every node at the same depth uses
+ * the same test) on the seven analysis features, minimizing the logistic loss with the two files
+ * weighted equally. Each level is chosen greedily (Newton boosting gain) using 256-bin histograms
+ * of the byte features. Oblivious trees map directly to branch-free code: each test contributes a
+ * bit of the leaf index, and the leaf value is selected with comparison masks instead of a table
+ * lookup, so the generated classifier has no data-dependent branches or memory accesses.
+ */
+
+static void fit_forest (struct analysis_result *results [2], int counts [2], char *filename)
+{
+    int num_samples = 0, class_counts [2] = { 0, 0 }, test_windows = 0, test_hits = 0, agreements = 0;
+    double *margins, *gradients, *hessians, *weights;
+    static double gradient_hist [FOREST_LEAVES] [FOREST_FEATURES] [256], hessian_hist [FOREST_LEAVES] [FOREST_FEATURES] [256];
+    unsigned char *features, *leaves, *labels;
+    oblivious_tree *trees = calloc (forest_trees, sizeof (oblivious_tree));
+    FILE *file;
+
+    for (int c = 0; c < 2; ++c)
+        num_samples += counts [c];
+
+    features = malloc ((size_t) num_samples * FOREST_FEATURES);
+    leaves = malloc (num_samples);
+    labels = malloc (num_samples);
+    margins = malloc (num_samples * sizeof (double));
+    gradients = malloc (num_samples * sizeof (double));
+    hessians = malloc (num_samples * sizeof (double));
+    weights = malloc (num_samples * sizeof (double));
+
+    if (!trees || !features || !leaves || !labels || !margins || !gradients || !hessians || !weights) {
+        fprintf (stderr, "out of memory fitting forest!\n");
+        exit (1);
+    }
+
+    // gather the training windows (the odd ones with -a), with labels 1 = file1 and 0 = file2
+
+    num_samples = 0;
+
+    for (int c = 0; c < 2; ++c)
+        for (int w = 0; w < counts [c]; ++w)
+            if (!alternate || (w & 1)) {
+                result_features (results [c] + w, features + (size_t) num_samples * FOREST_FEATURES);
+                labels [num_samples++] = !c;
+                class_counts [c]++;
+            }
+
+    if (!class_counts [0] || !class_counts [1]) {
+        fprintf (stderr, "not enough windows to fit forest!\n");
+        exit (1);
+    }
+
+    for (int s = 0; s < num_samples; ++s) {
+        weights [s] = num_samples * 0.5 / class_counts [!labels [s]];
+        margins [s] = 0.0;      // the classes are balanced, so the initial log-odds is zero
+    }
+
+    fprintf (stderr, "fitting %d oblivious trees of depth %d on %d windows...\n", forest_trees, FOREST_DEPTH, num_samples);
+
+    for (int t = 0; t < forest_trees; ++t) {
+        oblivious_tree *tree = trees + t;
+        double loss_sum = 0.0;
+
+        for (int s = 0; s < num_samples; ++s) {
+            double prob = 1.0 / (1.0 + exp (-margins [s]));
+
+            loss_sum -= weights [s] * log (labels [s] ? prob + 1e-12 : 1.0 - prob + 1e-12);
+            gradients [s] = weights [s] * (prob - labels [s]);
+            hessians [s] = weights [s] * prob * (1.0 - prob);
+            leaves [s] = 0;
+        }
+
+        for (int d = 0; d < FOREST_DEPTH; ++d) {
+            double best_gain = -1.0;
+
+            memset (gradient_hist, 0, sizeof (gradient_hist));
+            memset (hessian_hist, 0, sizeof (hessian_hist));
+
+            for (int s = 0; s < num_samples; ++s)
+                for (int f = 0; f < FOREST_FEATURES; ++f) {
+                    int value = features [(size_t) s * FOREST_FEATURES + f];
+
+                    gradient_hist [leaves [s]] [f] [value] += gradients [s];
+                    hessian_hist [leaves [s]] [f] [value] += hessians [s];
+                }
+
+            // every current leaf is split by the same test, so the gain is summed over the leaves
+
+            for (int f = 0; f < FOREST_FEATURES; ++f) {
+                double left_gradient [FOREST_LEAVES] = { 0 }, left_hessian [FOREST_LEAVES] = { 0 };
+                double total_gradient [FOREST_LEAVES] = { 0 }, total_hessian [FOREST_LEAVES] = { 0 };
+
+                for (int l = 0; l < (1 << d); ++l)
+                    for (int v = 0; v < 256; ++v) {
+                        total_gradient [l] += gradient_hist [l] [f] [v];
+                        total_hessian [l] += hessian_hist [l] [f] [v];
+                    }
+
+                for (int threshold = 0; threshold < 255; ++threshold) {
+                    double gain = 0.0;
+
+                    for (int l = 0; l < (1 << d); ++l) {
+                        double right_gradient, right_hessian;
+
+                        left_gradient [l] += gradient_hist [l] [f] [threshold];
+                        left_hessian [l] += hessian_hist [l] [f] [threshold];
+                        right_gradient = total_gradient [l] - left_gradient [l];
+                        right_hessian = total_hessian [l] - left_hessian [l];
+
+                        gain += left_gradient [l] * left_gradient [l] / (left_hessian [l] + FOREST_LAMBDA) +
+                            right_gradient * right_gradient / (right_hessian + FOREST_LAMBDA);
+                    }
+
+                    if (gain > best_gain && !split_used (tree, d, f, threshold)) {
+                        best_gain = gain;
+                        tree->feature [d] = f;
+                        tree->threshold [d] = threshold;
+                    }
+                }
+            }
+
+            for (int s = 0; s < num_samples; ++s)
+                leaves [s] |= (features [(size_t) s * FOREST_FEATURES + tree->feature [d]] > tree->threshold [d]) << d;
+        }
+
+        // Newton step for each leaf, rounded to fixed-point (and the margins updated with the
+        // rounded values so that the training matches what the generated code computes)
+
+        double leaf_gradient [FOREST_LEAVES] = { 0 }, leaf_hessian [FOREST_LEAVES] = { 0 };
+
+        for (int s = 0; s < num_samples; ++s) {
+            leaf_gradient [leaves [s]] += gradients [s];
+            leaf_hessian [leaves [s]] += hessians [s];
+        }
+
+        for (int l = 0; l < FOREST_LEAVES; ++l)
+            tree->leaf [l] = (int) floor (-leaf_gradient [l] / (leaf_hessian [l] + FOREST_LAMBDA) * FOREST_RATE * FOREST_SCALE + 0.5);
+
+        for (int s = 0; s < num_samples; ++s)
+            margins [s] += (double) tree->leaf [leaves [s]] / FOREST_SCALE;
+
+        if (t == 0 || t == forest_trees - 1 || !((t + 1) % 8))
+            fprintf (stderr, "tree %d: mean loss = %.4f\n", t + 1, loss_sum / num_samples);
+    }
+
+    // evaluate on the test windows (all of them without -a) side by side with the tensor
+
+    fprintf (stderr, "\n             windows    tensor hits   forest hits\n");
+
+    for (int c = 0; c < 2; ++c) {
+        int window_count = 0, tensor_hits = 0, forest_hits = 0;
+
+        for (int w = 0; w < counts [c]; ++w) {
+            unsigned char window_features [FOREST_FEATURES];
+            int tensor_value, forest_value, margin = 0;
+
+            if (alternate && (w & 1))
+                continue;
+
+            result_features (results [c] + w, window_features);
+
+            for (int t = 0; t < forest_trees; ++t)
+                margin += trees [t].leaf [tree_leaf (trees + t, window_features)];
+
+            forest_value = forest_score (margin);
+            tensor_value = *analysis_result_to_tensor_pointer (results [c] + w, tensor);
+
+            if (c ? tensor_value < 0 : tensor_value > 0)
+                tensor_hits++;
+
+            if (c ? forest_value < 0 : forest_value > 0)
+                forest_hits++;
+
+            if ((forest_value > 0) == (tensor_value > 0) && (forest_value < 0) == (tensor_value < 0))
+                agreements++;
+
+            window_count++;
+        }
+
+        fprintf (stderr, "file%d:   %10d   %6d (%.1f%%)  %6d (%.1f%%)\n", c + 1, window_count,
+            tensor_hits, tensor_hits * 100.0 / window_count, forest_hits, forest_hits * 100.0 / window_count);
+
+        test_windows += window_count;
+        test_hits += forest_hits;
+    }
+
+    fprintf (stderr, "forest and tensor agree on %d of %d windows (%.1f%%)\n\n", agreements, test_windows, agreements * 100.0 / test_windows);
+
+    if (!(file = fopen (filename, "w"))) {
+        fprintf (stderr, "error: can't open \"%s\" for writing!\n", filename);
+        exit (1);
+    }
+
+    fprintf (file, "// %s: decision-tree ensemble generated by TENSOR-GEN -f (do not edit)\n", filename);
+    fprintf (file, "// %d windows of training data, %.1f%% of test windows correctly classified\n\n",
+        num_samples, test_hits * 100.0 / test_windows);
+    fprintf (file, "#define FOREST_TREES    %d\n", forest_trees);
+    fprintf (file, "#define FOREST_DEPTH    %d\n\n", FOREST_DEPTH);
+    fprintf (file, "static int forest_evaluate (const struct analysis_result *result)\n{\n");
+
+    for (int f = 0; f < FOREST_FEATURES; ++f)
+        fprintf (file, "    const int f%d = result->%s;\n", f, forest_feature_names [f]);
+
+    fprintf (file, "    int margin = 0, leaf;\n");
+
+    for (int t = 0; t < forest_trees; ++t) {
+        fprintf (file, "\n    leaf = ");
+
+        for (int d = 0; d < FOREST_DEPTH; ++d)
+            fprintf (file, d ? " | (f%d > %d) << %d" : "(f%d > %d)", trees [t].feature [d], trees [t].threshold [d], d);
+
+        fprintf (file, ";\n    margin +=");
+
+        for (int l = 0, terms = 0; l < FOREST_LEAVES; ++l)
+            if (trees [t].leaf [l])
+                fprintf (file, "%s(-(leaf == %d) & %d)", terms++ ? "\n        + " : " ", l, trees [t].leaf [l]);
+            else if (l == FOREST_LEAVES - 1 && !terms)
+                fprintf (file, " 0");
+
+        fprintf (file, ";\n");
+    }
+
+    fprintf (file, "\n    return (int) floor (99.0 * tanh (margin / %.1f) + 0.5);\n}\n", FOREST_SCALE * 2.0);
+    fclose (file);
+
+    fprintf (stderr, "wrote %d trees as C code to \"%s\"\n", forest_trees, filename);
+
+    free (trees); free (features); free (leaves); free (labels);
+    free (margins); free (gradients); free (hessians); free (weights);
+}
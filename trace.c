@@ -0,0 +1,211 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// trace.c
+
+#define _POSIX_C_SOURCE 200809L     // for clock_gettime()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef ENABLE_THREADS
+#include <stdatomic.h>
+#endif
+
+#include "trace.h"
+
+/* This records spans (a name, start and end times, a stream id and a queue
+ * depth) for a timeline view of where the time goes and where the threads
+ * wait on each other. Every thread gets its own fixed-size event buffer the
+ * first time it records something (or names itself), so recording a span is
+ * just a few stores with no locks or atomics; the only shared state is the
+ * table of buffers, which is appended to with an atomic increment. When a
+ * buffer fills up further events from that thread are dropped (and counted).
+ * The buffers are only read by trace_write(), which must be called after
+ * all the traced threads are done.
+ *
+ * Names must be literals (or otherwise outlive the trace) because only the
+ * pointers are stored, and they're written to the JSON without escaping.
+ */
+
+#define TRACE_MAX_THREADS   64
+
+typedef struct {
+    const char *name;
+    uint64_t start, end;
+    int64_t depth;
+    int stream;
+} trace_event;
+
+typedef struct {
+    const char *thread_name;
+    trace_event *events;
+    int num_events, max_events;
+    long dropped;
+} trace_buffer;
+
+int trace_enabled;
+
+static trace_buffer *buffers [TRACE_MAX_THREADS];
+static int max_events_per_thread;
+static uint64_t trace_base;
+static trace_buffer untraced;       // for threads beyond TRACE_MAX_THREADS (or out of memory)
+
+#ifdef ENABLE_THREADS
+static atomic_int num_buffers;
+static _Thread_local trace_buffer *thread_buffer;
+#else
+static int num_buffers;
+static trace_buffer *thread_buffer;
+#endif
+
+// Enable tracing with the specified buffer size for each thread. Returns 0 on success.
+
+int trace_init (int max_events)
+{
+    if (max_events < 1)
+        return 1;
+
+    max_events_per_thread = max_events;
+    trace_base = trace_clock ();
+    trace_enabled = 1;
+    return 0;
+}
+
+uint64_t trace_clock (void)
+{
+    struct timespec ts;
+
+#ifdef _WIN32
+    timespec_get (&ts, TIME_UTC);
+#else
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The event buffer is allocated and touched up front so that recording never faults (which also
+// means a thread can call trace_thread_name() at startup to keep this off its time-critical path).
+
+static trace_buffer *get_buffer (void)
+{
+    trace_buffer *buffer;
+    int index;
+
+    if (thread_buffer)
+        return thread_buffer;
+
+    if (!(buffer = calloc (1, sizeof (trace_buffer))) || !(buffer->events = malloc (max_events_per_thread * sizeof (trace_event)))) {
+        free (buffer);
+        return thread_buffer = &untraced;
+    }
+
+    memset (buffer->events, 0, max_events_per_thread * sizeof (trace_event));
+    buffer->max_events = max_events_per_thread;
+
+#ifdef ENABLE_THREADS
+    index = atomic_fetch_add (&num_buffers, 1);
+#else
+    index = num_buffers++;
+#endif
+
+    if (index >= TRACE_MAX_THREADS) {
+        free (buffer->events);
+        free (buffer);
+        return thread_buffer = &untraced;
+    }
+
+    return thread_buffer = buffers [index] = buffer;
+}
+
+void trace_thread_name (const char *name)
+{
+    if (trace_enabled)
+        get_buffer ()->thread_name = name;
+}
+
+void trace_span (const char *name, uint64_t start, int stream, int64_t depth)
+{
+    trace_buffer *buffer = get_buffer ();
+    trace_event *event;
+
+    if (buffer == &untraced)
+        return;
+
+    if (buffer->num_events == buffer->max_events) {
+        buffer->dropped++;
+        return;
+    }
+
+    event = buffer->events + buffer->num_events++;
+    event->name = name;
+    event->start = start;
+    event->end = trace_clock ();
+    event->stream = stream;
+    event->depth = depth;
+}
+
+// Write all the recorded spans as Chrome trace JSON (with times in microseconds from trace_init()
+// and one "tid" per traced thread). Returns 0 on success.
+
+int trace_write (const char *filename)
+{
+    int count = num_buffers < TRACE_MAX_THREADS ? num_buffers : TRACE_MAX_THREADS, first = 1;
+    FILE *file = fopen (filename, "w");
+    long dropped = 0;
+
+    if (!file) {
+        fprintf (stderr, "can't open trace file %s!\n", filename);
+        return 1;
+    }
+
+    fprintf (file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for (int t = 0; t < count; ++t) {
+        trace_buffer *buffer = buffers [t];
+
+        if (!buffer)
+            continue;
+
+        if (buffer->thread_name) {
+            fprintf (file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", t + 1, buffer->thread_name);
+            first = 0;
+        }
+
+        for (int i = 0; i < buffer->num_events; ++i) {
+            trace_event *event = buffer->events + i;
+
+            fprintf (file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"stream\":%d",
+                first ? "" : ",", event->name, t + 1, (int64_t) (event->start - trace_base) / 1000.0,
+                (event->end - event->start) / 1000.0, event->stream);
+
+            if (event->depth >= 0)
+                fprintf (file, ",\"depth\":%lld", (long long) event->depth);
+
+            fprintf (file, "}}");
+            first = 0;
+        }
+
+        dropped += buffer->dropped;
+    }
+
+    fprintf (file, "\n]}\n");
+
+    if (fclose (file)) {
+        fprintf (stderr, "can't write trace file %s!\n", filename);
+        return 1;
+    }
+
+    if (dropped)
+        fprintf (stderr, "warning: %ld trace events dropped (buffers full)\n", dropped);
+
+    return 0;
+}
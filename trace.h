@@ -0,0 +1,42 @@
+////////////////////////////////////////////////////////////////////////////
+//                            **** SKIPPER ****                           //
+//                  Selective Audio Detection and Filter                  //
+//                    Copyright (c) 2024 David Bryant.                    //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// trace.h
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+// Span tracing of the processing stages, written as Chrome trace JSON (which can be opened in
+// chrome://tracing or ui.perfetto.dev). Each span records the stream id and, where it applies,
+// a queue depth (or -1). When tracing isn't enabled, TRACE_START() and TRACE_SPAN() are just a
+// test of a global flag.
+
+extern int trace_enabled;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int trace_init (int max_events_per_thread);
+void trace_thread_name (const char *name);
+uint64_t trace_clock (void);
+void trace_span (const char *name, uint64_t start, int stream, int64_t depth);
+int trace_write (const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define TRACE_START()                       (trace_enabled ? trace_clock () : 0)
+#define TRACE_SPAN(name, start, stream, depth) do {                 \
+    if (trace_enabled) trace_span ((name), (start), (stream), (depth));   \
+} while (0)
+
+#endif /* TRACE_H_ */